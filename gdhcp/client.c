@@ -34,11 +34,12 @@
 #include <sys/time.h>
 #include <resolv.h>
 
-#include <netpacket/packet.h>
+#include <sys/mman.h>
 #include <netinet/if_ether.h>
 #include <net/ethernet.h>
 
 #include <linux/if.h>
+#include <linux/if_packet.h>
 #include <linux/filter.h>
 
 #include <glib.h>
@@ -53,6 +54,14 @@
 #define REQUEST_TIMEOUT 3
 #define REQUEST_RETRIES 5
 
+#define REBOOT_TIMEOUT 1
+#define REBOOT_RETRIES 2
+
+#define ADDRESS_PROBE_MS 50
+
+#define RX_RING_FRAME_SIZE 2048
+#define RX_RING_FRAMES 8
+
 typedef enum _listen_mode {
 	L_NONE,
 	L2,
@@ -63,6 +72,7 @@ typedef enum _listen_mode {
 typedef enum _dhcp_client_state {
 	INIT_SELECTING,
 	REQUESTING,
+	REBOOTING,
 	BOUND,
 	RENEWING,
 	REBINDING,
@@ -95,6 +105,8 @@ struct _GDHCPClient {
 	uint32_t lease_seconds;
 	ListenMode listen_mode;
 	int listener_sockfd;
+	uint8_t *rx_ring;
+	unsigned int rx_frame;
 	uint8_t retry_times;
 	uint8_t ack_retry_times;
 	uint8_t conflicts;
@@ -105,6 +117,8 @@ struct _GDHCPClient {
 	GList *request_list;
 	GHashTable *code_value_hash;
 	GHashTable *send_value_hash;
+	uint8_t *option_block;
+	unsigned int option_block_len;
 	GDHCPClientEventFunc lease_available_cb;
 	gpointer lease_available_data;
 	GDHCPClientEventFunc ipv4ll_available_cb;
@@ -135,14 +149,22 @@ struct _GDHCPClient {
 	gpointer release_data;
 	GDHCPClientEventFunc confirm_cb;
 	gpointer confirm_data;
+	GDHCPClientEventFunc last_address_cb;
+	gpointer last_address_data;
+	GDHCPClientEventFunc last_address_refused_cb;
+	gpointer last_address_refused_data;
+	guint probe_watch;
+	guint probe_timeout;
 	char *last_address;
 	unsigned char *duid;
 	int duid_len;
 	unsigned char *server_duid;
 	int server_duid_len;
 	uint16_t status_code;
+	uint16_t pd_status;
 	uint32_t iaid;
 	uint32_t T1, T2;
+	gboolean ia_timeouts_set;
 	struct in6_addr ia_na;
 	struct in6_addr ia_ta;
 	time_t last_renew;
@@ -150,6 +172,7 @@ struct _GDHCPClient {
 	time_t expire;
 	gboolean retransmit;
 	struct timeval start_time;
+	gint64 phase_time[G_DHCP_CLIENT_PHASE_ACK + 1];
 };
 
 static inline void debug(GDHCPClient *client, const char *format, ...)
@@ -168,6 +191,13 @@ static inline void debug(GDHCPClient *client, const char *format, ...)
 	va_end(ap);
 }
 
+/* Remember when the current attempt first reached the given phase */
+static void mark_phase(GDHCPClient *dhcp_client, GDHCPClientPhase phase)
+{
+	if (dhcp_client->phase_time[phase] == 0)
+		dhcp_client->phase_time[phase] = g_get_monotonic_time();
+}
+
 /* Initialize the packet with the proper defaults */
 static void init_packet(GDHCPClient *dhcp_client, gpointer pkt, char type)
 {
@@ -181,26 +211,32 @@ static void init_packet(GDHCPClient *dhcp_client, gpointer pkt, char type)
 	}
 }
 
-static void add_request_options(GDHCPClient *dhcp_client,
-				struct dhcp_packet *packet)
+/*
+ * The parameter request list and the options to send only change when
+ * the user sets them, so they are encoded once and the encoded block is
+ * copied into every packet.
+ */
+static void add_options(GDHCPClient *dhcp_client, struct dhcp_packet *packet)
 {
-	int len = 0;
-	GList *list;
-	uint8_t code;
-	int end = dhcp_end_option(packet->options);
+	if (dhcp_client->option_block == NULL) {
+		uint8_t block[DHCP_OPTIONS_BUFSIZE];
 
-	for (list = dhcp_client->request_list; list; list = list->next) {
-		code = (uint8_t) GPOINTER_TO_INT(list->data);
-
-		packet->options[end + OPT_DATA + len] = code;
-		len++;
+		dhcp_client->option_block_len = dhcp_encode_options(block,
+					sizeof(block), dhcp_client->request_list,
+					dhcp_client->send_value_hash);
+		dhcp_client->option_block = g_memdup(block,
+					dhcp_client->option_block_len);
 	}
 
-	if (len) {
-		packet->options[end + OPT_CODE] = DHCP_PARAM_REQ;
-		packet->options[end + OPT_LEN] = len;
-		packet->options[end + OPT_DATA + len] = DHCP_END;
-	}
+	dhcp_add_option_block(packet, dhcp_client->option_block,
+					dhcp_client->option_block_len);
+}
+
+static void invalidate_options(GDHCPClient *dhcp_client)
+{
+	g_free(dhcp_client->option_block);
+	dhcp_client->option_block = NULL;
+	dhcp_client->option_block_len = 0;
 }
 
 struct hash_params {
@@ -383,21 +419,6 @@ static void add_dhcpv6_request_options(GDHCPClient *dhcp_client,
 	}
 }
 
-static void add_binary_option(gpointer key, gpointer value, gpointer user_data)
-{
-	uint8_t *option = value;
-	struct dhcp_packet *packet = user_data;
-
-	dhcp_add_binary_option(packet, option);
-}
-
-static void add_send_options(GDHCPClient *dhcp_client,
-				struct dhcp_packet *packet)
-{
-	g_hash_table_foreach(dhcp_client->send_value_hash,
-				add_binary_option, packet);
-}
-
 /*
  * Return an RFC 951- and 2131-complaint BOOTP 'secs' value that
  * represents the number of seconds elapsed from the start of
@@ -412,9 +433,12 @@ static uint16_t dhcp_attempt_secs(GDHCPClient *dhcp_client)
 static int send_discover(GDHCPClient *dhcp_client, uint32_t requested)
 {
 	struct dhcp_packet packet;
+	uint8_t rapid_commit[] = { DHCP_RAPID_COMMIT, 0 };
 
 	debug(dhcp_client, "sending DHCP discover request");
 
+	mark_phase(dhcp_client, G_DHCP_CLIENT_PHASE_DISCOVER);
+
 	init_packet(dhcp_client, &packet, DHCPDISCOVER);
 
 	packet.xid = dhcp_client->xid;
@@ -427,9 +451,10 @@ static int send_discover(GDHCPClient *dhcp_client, uint32_t requested)
 	 * some buggy DHCP servers to NOT send bigger packets */
 	dhcp_add_option_uint16(&packet, DHCP_MAX_SIZE, 576);
 
-	add_request_options(dhcp_client, &packet);
+	/* RFC 4039, let the server answer with an ACK right away */
+	dhcp_add_binary_option(&packet, rapid_commit);
 
-	add_send_options(dhcp_client, &packet);
+	add_options(dhcp_client, &packet);
 
 	return dhcp_send_raw_packet(&packet, INADDR_ANY, CLIENT_PORT,
 					INADDR_BROADCAST, SERVER_PORT,
@@ -442,6 +467,8 @@ static int send_select(GDHCPClient *dhcp_client)
 
 	debug(dhcp_client, "sending DHCP select request");
 
+	mark_phase(dhcp_client, G_DHCP_CLIENT_PHASE_REQUEST);
+
 	init_packet(dhcp_client, &packet, DHCPREQUEST);
 
 	packet.xid = dhcp_client->xid;
@@ -452,9 +479,34 @@ static int send_select(GDHCPClient *dhcp_client)
 	dhcp_add_option_uint32(&packet, DHCP_SERVER_ID,
 						dhcp_client->server_ip);
 
-	add_request_options(dhcp_client, &packet);
+	add_options(dhcp_client, &packet);
+
+	return dhcp_send_raw_packet(&packet, INADDR_ANY, CLIENT_PORT,
+					INADDR_BROADCAST, SERVER_PORT,
+					MAC_BCAST_ADDR, dhcp_client->ifindex);
+}
+
+/*
+ * INIT-REBOOT, RFC 2131 section 4.3.2: ask for the cached lease without
+ * a server identifier and without ciaddr.
+ */
+static int send_reboot(GDHCPClient *dhcp_client)
+{
+	struct dhcp_packet packet;
+
+	debug(dhcp_client, "sending DHCP reboot request");
 
-	add_send_options(dhcp_client, &packet);
+	mark_phase(dhcp_client, G_DHCP_CLIENT_PHASE_REQUEST);
+
+	init_packet(dhcp_client, &packet, DHCPREQUEST);
+
+	packet.xid = dhcp_client->xid;
+	packet.secs = dhcp_attempt_secs(dhcp_client);
+
+	dhcp_add_option_uint32(&packet, DHCP_REQUESTED_IP,
+						dhcp_client->requested_ip);
+
+	add_options(dhcp_client, &packet);
 
 	return dhcp_send_raw_packet(&packet, INADDR_ANY, CLIENT_PORT,
 					INADDR_BROADCAST, SERVER_PORT,
@@ -471,9 +523,7 @@ static int send_renew(GDHCPClient *dhcp_client)
 	packet.xid = dhcp_client->xid;
 	packet.ciaddr = htonl(dhcp_client->requested_ip);
 
-	add_request_options(dhcp_client, &packet);
-
-	add_send_options(dhcp_client, &packet);
+	add_options(dhcp_client, &packet);
 
 	return dhcp_send_kernel_packet(&packet,
 		dhcp_client->requested_ip, CLIENT_PORT,
@@ -490,9 +540,7 @@ static int send_rebound(GDHCPClient *dhcp_client)
 	packet.xid = dhcp_client->xid;
 	packet.ciaddr = htonl(dhcp_client->requested_ip);
 
-	add_request_options(dhcp_client, &packet);
-
-	add_send_options(dhcp_client, &packet);
+	add_options(dhcp_client, &packet);
 
 	return dhcp_send_raw_packet(&packet, INADDR_ANY, CLIENT_PORT,
 					INADDR_BROADCAST, SERVER_PORT,
@@ -1105,65 +1153,117 @@ error:
 
 #define SERVER_AND_CLIENT_PORTS  ((67 << 16) + 68)
 
-static int dhcp_l2_socket(int ifindex)
-{
-	int fd;
-	struct sockaddr_ll sock;
+/* Offset of a DHCP field from the start of the UDP header */
+#define UDP_DHCP_OFFSET(field) \
+	(sizeof(struct udphdr) + offsetof(struct dhcp_packet, field))
 
+static int dhcp_l2_filter(int fd, uint32_t xid, const uint8_t *mac)
+{
 	/*
 	 * Comment:
 	 *
 	 *	I've selected not to see LL header, so BPF doesn't see it, too.
-	 *	The filter may also pass non-IP and non-ARP packets, but we do
-	 *	a more complete check when receiving the message in userspace.
+	 *	Everything the filter passes is checked again when receiving
+	 *	the message in userspace.
 	 *
-	 * and filter shamelessly stolen from:
+	 * Based on the filter from:
 	 *
 	 *	http://www.flamewarmaster.de/software/dhcpclient/
 	 *
-	 * There are a few other interesting ideas on that page (look under
-	 * "Motivation").  Use of netlink events is most interesting.  Think
-	 * of various network servers listening for events and reconfiguring.
-	 * That would obsolete sending HUP signals and/or make use of restarts.
-	 *
 	 * Copyright: 2006, 2007 Stefan Rompf <sux@loplof.de>.
 	 * License: GPL v2.
 	 *
-	 * TODO: make conditional?
+	 * Besides the ports it also matches our transaction id and
+	 * hardware address, so that on a busy segment the replies meant
+	 * for other hosts never wake us up. BPF loads are big endian,
+	 * the xid is sent as is from host memory.
 	 */
-	static const struct sock_filter filter_instr[] = {
+	struct sock_filter filter_instr[] = {
 		/* check for udp */
 		BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 9),
-		/* L5, L1, is UDP? */
-		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_UDP, 2, 0),
-		/* ugly check for arp on ethernet-like and IPv4 */
-		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 2), /* L1: */
-		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x08000604, 3, 4),/* L3, L4 */
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_UDP, 0, 14),
+		/* no fragments */
+		BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 6),
+		BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1fff, 12, 0),
 		/* skip IP header */
-		BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 0), /* L5: */
+		BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 0),
 		/* check udp source and destination ports */
 		BPF_STMT(BPF_LD|BPF_W|BPF_IND, 0),
-		/* L3, L4 */
-		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, SERVER_AND_CLIENT_PORTS, 0, 1),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, SERVER_AND_CLIENT_PORTS, 0, 9),
+		/* check hlen, xid and chaddr */
+		BPF_STMT(BPF_LD|BPF_B|BPF_IND, UDP_DHCP_OFFSET(hlen)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_ALEN, 0, 7),
+		BPF_STMT(BPF_LD|BPF_W|BPF_IND, UDP_DHCP_OFFSET(xid)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ntohl(xid), 0, 5),
+		BPF_STMT(BPF_LD|BPF_W|BPF_IND, UDP_DHCP_OFFSET(chaddr)),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, get_be32(mac), 0, 3),
+		BPF_STMT(BPF_LD|BPF_H|BPF_IND, UDP_DHCP_OFFSET(chaddr) + 4),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, get_be16(mac + 4), 0, 1),
 		/* returns */
-		BPF_STMT(BPF_RET|BPF_K, 0x0fffffff), /* L3: pass */
-		BPF_STMT(BPF_RET|BPF_K, 0), /* L4: reject */
+		BPF_STMT(BPF_RET|BPF_K, 0x0fffffff), /* pass */
+		BPF_STMT(BPF_RET|BPF_K, 0), /* reject */
 	};
 
-	static const struct sock_fprog filter_prog = {
+	struct sock_fprog filter_prog = {
 		.len = sizeof(filter_instr) / sizeof(filter_instr[0]),
-		/* casting const away: */
-		.filter = (struct sock_filter *) filter_instr,
+		.filter = filter_instr,
 	};
 
+	if (SERVER_PORT != 67 || CLIENT_PORT != 68)
+		/* Use only if standard ports are in use */
+		return 0;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter_prog,
+						sizeof(filter_prog)) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * Map a small PACKET_RX_RING so that replies are checked right where
+ * the kernel put them instead of being copied out with read() first.
+ * Returns NULL if the kernel can't do it, the socket is then read.
+ */
+static uint8_t *dhcp_l2_rx_ring(int fd)
+{
+	struct tpacket_req req;
+	int version = TPACKET_V2;
+	void *ring;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+						sizeof(version)) < 0)
+		return NULL;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = getpagesize();
+	req.tp_frame_size = RX_RING_FRAME_SIZE;
+	req.tp_frame_nr = RX_RING_FRAMES;
+	req.tp_block_nr = RX_RING_FRAMES * RX_RING_FRAME_SIZE /
+							req.tp_block_size;
+
+	if (req.tp_block_nr == 0 || setsockopt(fd, SOL_PACKET,
+				PACKET_RX_RING, &req, sizeof(req)) < 0)
+		return NULL;
+
+	ring = mmap(NULL, RX_RING_FRAMES * RX_RING_FRAME_SIZE,
+				PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED)
+		return NULL;
+
+	return ring;
+}
+
+static int dhcp_l2_socket(int ifindex, uint32_t xid, const uint8_t *mac)
+{
+	int fd;
+	struct sockaddr_ll sock;
+
 	fd = socket(PF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, htons(ETH_P_IP));
 	if (fd < 0)
 		return fd;
 
-	if (SERVER_PORT == 67 && CLIENT_PORT == 68)
-		/* Use only if standard ports are in use */
-		setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter_prog,
-							sizeof(filter_prog));
+	dhcp_l2_filter(fd, xid, mac);
 
 	memset(&sock, 0, sizeof(sock));
 	sock.sll_family = AF_PACKET;
@@ -1198,52 +1298,92 @@ static gboolean sanity_check(struct ip_udp_dhcp_packet *packet, int bytes)
 	return TRUE;
 }
 
-static int dhcp_recv_l2_packet(struct dhcp_packet *dhcp_pkt, int fd)
+/*
+ * Validate the IP/UDP encapsulation of a received frame and copy out
+ * the DHCP message. The headers are modified for checksumming.
+ */
+static int dhcp_parse_l2_packet(struct dhcp_packet *dhcp_pkt,
+			struct ip_udp_dhcp_packet *packet, int bytes)
 {
-	int bytes;
-	struct ip_udp_dhcp_packet packet;
 	uint16_t check;
 
-	memset(&packet, 0, sizeof(packet));
-
-	bytes = read(fd, &packet, sizeof(packet));
-	if (bytes < 0)
-		return -1;
-
-	if (bytes < (int) (sizeof(packet.ip) + sizeof(packet.udp)))
+	if (bytes < (int) (sizeof(packet->ip) + sizeof(packet->udp)))
 		return -1;
 
-	if (bytes < ntohs(packet.ip.tot_len))
-		/* packet is bigger than sizeof(packet), we did partial read */
+	if (bytes < ntohs(packet->ip.tot_len))
+		/* packet is bigger than sizeof(*packet), we did partial read */
 		return -1;
 
 	/* ignore any extra garbage bytes */
-	bytes = ntohs(packet.ip.tot_len);
+	bytes = ntohs(packet->ip.tot_len);
 
-	if (sanity_check(&packet, bytes) == FALSE)
+	if (sanity_check(packet, bytes) == FALSE)
 		return -1;
 
-	check = packet.ip.check;
-	packet.ip.check = 0;
-	if (check != dhcp_checksum(&packet.ip, sizeof(packet.ip)))
+	check = packet->ip.check;
+	packet->ip.check = 0;
+	if (check != dhcp_checksum(&packet->ip, sizeof(packet->ip)))
 		return -1;
 
 	/* verify UDP checksum. IP header has to be modified for this */
-	memset(&packet.ip, 0, offsetof(struct iphdr, protocol));
+	memset(&packet->ip, 0, offsetof(struct iphdr, protocol));
 	/* ip.xx fields which are not memset: protocol, check, saddr, daddr */
-	packet.ip.tot_len = packet.udp.len; /* yes, this is needed */
-	check = packet.udp.check;
-	packet.udp.check = 0;
-	if (check && check != dhcp_checksum(&packet, bytes))
+	packet->ip.tot_len = packet->udp.len; /* yes, this is needed */
+	check = packet->udp.check;
+	packet->udp.check = 0;
+	if (check && check != dhcp_checksum(packet, bytes))
 		return -1;
 
-	memcpy(dhcp_pkt, &packet.data, bytes - (sizeof(packet.ip) +
-							sizeof(packet.udp)));
+	memcpy(dhcp_pkt, &packet->data, bytes - (sizeof(packet->ip) +
+							sizeof(packet->udp)));
 
 	if (dhcp_pkt->cookie != htonl(DHCP_MAGIC))
 		return -1;
 
-	return bytes - (sizeof(packet.ip) + sizeof(packet.udp));
+	return bytes - (sizeof(packet->ip) + sizeof(packet->udp));
+}
+
+static int dhcp_recv_l2_packet(struct dhcp_packet *dhcp_pkt, int fd)
+{
+	int bytes;
+	struct ip_udp_dhcp_packet packet;
+
+	memset(&packet, 0, sizeof(packet));
+
+	bytes = read(fd, &packet, sizeof(packet));
+	if (bytes < 0)
+		return -1;
+
+	return dhcp_parse_l2_packet(dhcp_pkt, &packet, bytes);
+}
+
+static int dhcp_recv_l2_ring(GDHCPClient *dhcp_client,
+					struct dhcp_packet *dhcp_pkt)
+{
+	struct tpacket2_hdr *hdr;
+	int bytes, re;
+
+	hdr = (struct tpacket2_hdr *) (dhcp_client->rx_ring +
+			dhcp_client->rx_frame * RX_RING_FRAME_SIZE);
+
+	if ((hdr->tp_status & TP_STATUS_USER) == 0)
+		return -1;
+
+	__sync_synchronize();
+
+	/* Same limit as the read() path, larger frames get rejected */
+	bytes = MIN(hdr->tp_snaplen, sizeof(struct ip_udp_dhcp_packet));
+
+	re = dhcp_parse_l2_packet(dhcp_pkt, (struct ip_udp_dhcp_packet *)
+				((uint8_t *) hdr + hdr->tp_net), bytes);
+
+	/* Hand the frame back only once we are done with it */
+	__sync_synchronize();
+	hdr->tp_status = TP_STATUS_KERNEL;
+
+	dhcp_client->rx_frame = (dhcp_client->rx_frame + 1) % RX_RING_FRAMES;
+
+	return re;
 }
 
 static void ipv4ll_start(GDHCPClient *dhcp_client)
@@ -1441,11 +1581,19 @@ static int switch_listening_mode(GDHCPClient *dhcp_client,
 		dhcp_client->listener_watch = 0;
 	}
 
+	if (dhcp_client->rx_ring != NULL) {
+		munmap(dhcp_client->rx_ring,
+				RX_RING_FRAMES * RX_RING_FRAME_SIZE);
+		dhcp_client->rx_ring = NULL;
+	}
+
 	if (listen_mode == L_NONE)
 		return 0;
 
 	if (listen_mode == L2)
-		listener_sockfd = dhcp_l2_socket(dhcp_client->ifindex);
+		listener_sockfd = dhcp_l2_socket(dhcp_client->ifindex,
+						dhcp_client->xid,
+						dhcp_client->mac_address);
 	else if (listen_mode == L3) {
 		if (dhcp_client->type == G_DHCP_IPV6)
 			listener_sockfd = dhcp_l3_socket(DHCPV6_CLIENT_PORT,
@@ -1470,6 +1618,11 @@ static int switch_listening_mode(GDHCPClient *dhcp_client,
 		return -EIO;
 	}
 
+	if (listen_mode == L2) {
+		dhcp_client->rx_ring = dhcp_l2_rx_ring(listener_sockfd);
+		dhcp_client->rx_frame = 0;
+	}
+
 	dhcp_client->listen_mode = listen_mode;
 	dhcp_client->listener_sockfd = listener_sockfd;
 	dhcp_client->listener_channel = listener_channel;
@@ -1511,12 +1664,199 @@ static void start_request(GDHCPClient *dhcp_client)
 							NULL);
 }
 
-static uint32_t get_lease(struct dhcp_packet *packet)
+static gboolean discover_timeout(gpointer user_data);
+
+static void start_discover(GDHCPClient *dhcp_client, uint32_t requested)
+{
+	send_discover(dhcp_client, requested);
+
+	dhcp_client->timeout = g_timeout_add_seconds_full(G_PRIORITY_HIGH,
+							DISCOVER_TIMEOUT,
+							discover_timeout,
+							dhcp_client,
+							NULL);
+}
+
+static char *get_ip(uint32_t ip);
+
+static void stop_address_probe(GDHCPClient *dhcp_client)
+{
+	if (dhcp_client->probe_timeout > 0) {
+		g_source_remove(dhcp_client->probe_timeout);
+		dhcp_client->probe_timeout = 0;
+	}
+
+	if (dhcp_client->probe_watch > 0) {
+		g_source_remove(dhcp_client->probe_watch);
+		dhcp_client->probe_watch = 0;
+	}
+}
+
+static gboolean address_probe_event(GIOChannel *channel,
+				GIOCondition condition, gpointer user_data)
+{
+	GDHCPClient *dhcp_client = user_data;
+	struct ether_arp arp;
+	uint32_t ip, any = 0;
+	int bytes;
+
+	if (condition & (G_IO_NVAL | G_IO_ERR | G_IO_HUP))
+		goto stop;
+
+	memset(&arp, 0, sizeof(arp));
+	bytes = read(g_io_channel_unix_get_fd(channel), &arp, sizeof(arp));
+	if (bytes < (int) sizeof(arp))
+		return TRUE;
+
+	/* Packet sockets also see our own probe going out */
+	if (memcmp(arp.arp_sha, dhcp_client->mac_address, ETH_ALEN) == 0)
+		return TRUE;
+
+	/* Either the owner answers or somebody else is probing for it */
+	ip = htonl(dhcp_client->requested_ip);
+	if (memcmp(arp.arp_spa, &ip, sizeof(ip)) != 0 &&
+			(memcmp(arp.arp_spa, &any, sizeof(any)) != 0 ||
+			memcmp(arp.arp_tpa, &ip, sizeof(ip)) != 0))
+		return TRUE;
+
+	debug(dhcp_client, "last address is in use");
+
+stop:
+	dhcp_client->probe_watch = 0;
+	stop_address_probe(dhcp_client);
+
+	return FALSE;
+}
+
+static gboolean address_probe_timeout(gpointer user_data)
+{
+	GDHCPClient *dhcp_client = user_data;
+	uint32_t ip = dhcp_client->requested_ip;
+
+	debug(dhcp_client, "last address is not in use");
+
+	dhcp_client->probe_timeout = 0;
+	stop_address_probe(dhcp_client);
+
+	/* Move the neighbours' ARP entries over to us right away */
+	ipv4ll_send_arp_packet(dhcp_client->mac_address, ip, ip,
+						dhcp_client->ifindex);
+
+	g_free(dhcp_client->assigned_ip);
+	dhcp_client->assigned_ip = get_ip(htonl(ip));
+
+	if (dhcp_client->last_address_cb != NULL)
+		dhcp_client->last_address_cb(dhcp_client,
+					dhcp_client->last_address_data);
+
+	return FALSE;
+}
+
+/*
+ * Check with a single ARP probe that nobody holds the cached address,
+ * so that it can be used while the server has not yet confirmed it.
+ */
+static void start_address_probe(GDHCPClient *dhcp_client)
+{
+	GIOChannel *channel;
+	int fd;
+
+	fd = ipv4ll_arp_socket(dhcp_client->ifindex);
+	if (fd < 0)
+		return;
+
+	channel = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	dhcp_client->probe_watch = g_io_add_watch_full(channel,
+				G_PRIORITY_HIGH,
+				G_IO_IN | G_IO_NVAL | G_IO_ERR | G_IO_HUP,
+				address_probe_event, dhcp_client, NULL);
+	g_io_channel_unref(channel);
+
+	if (ipv4ll_send_arp_packet(dhcp_client->mac_address, 0,
+					dhcp_client->requested_ip,
+					dhcp_client->ifindex) < 0) {
+		stop_address_probe(dhcp_client);
+		return;
+	}
+
+	dhcp_client->probe_timeout = g_timeout_add_full(G_PRIORITY_HIGH,
+							ADDRESS_PROBE_MS,
+							address_probe_timeout,
+							dhcp_client,
+							NULL);
+}
+
+/* The cached lease was refused or nobody answered, start from scratch */
+static void reboot_failed(GDHCPClient *dhcp_client, uint32_t requested)
+{
+	debug(dhcp_client, "reboot failed");
+
+	stop_address_probe(dhcp_client);
+
+	if (dhcp_client->timeout > 0) {
+		g_source_remove(dhcp_client->timeout);
+		dhcp_client->timeout = 0;
+	}
+
+	dhcp_client->retry_times = 0;
+	dhcp_client->requested_ip = 0;
+	dhcp_client->state = INIT_SELECTING;
+
+	start_discover(dhcp_client, requested);
+}
+
+static gboolean reboot_timeout(gpointer user_data)
+{
+	GDHCPClient *dhcp_client = user_data;
+
+	debug(dhcp_client, "reboot timeout (retries %d)",
+					dhcp_client->retry_times);
+
+	dhcp_client->timeout = 0;
+	dhcp_client->retry_times++;
+
+	if (dhcp_client->retry_times == REBOOT_RETRIES) {
+		reboot_failed(dhcp_client, dhcp_client->requested_ip);
+		return FALSE;
+	}
+
+	send_reboot(dhcp_client);
+
+	dhcp_client->timeout = g_timeout_add_seconds_full(G_PRIORITY_HIGH,
+							REBOOT_TIMEOUT,
+							reboot_timeout,
+							dhcp_client,
+							NULL);
+
+	return FALSE;
+}
+
+static void start_reboot(GDHCPClient *dhcp_client, uint32_t requested)
+{
+	debug(dhcp_client, "start reboot");
+
+	dhcp_client->state = REBOOTING;
+	dhcp_client->requested_ip = requested;
+
+	send_reboot(dhcp_client);
+
+	if (dhcp_client->last_address_cb != NULL)
+		start_address_probe(dhcp_client);
+
+	dhcp_client->timeout = g_timeout_add_seconds_full(G_PRIORITY_HIGH,
+							REBOOT_TIMEOUT,
+							reboot_timeout,
+							dhcp_client,
+							NULL);
+}
+
+static uint32_t get_lease(struct dhcp_option_index *options)
 {
 	uint8_t *option;
 	uint32_t lease_seconds;
 
-	option = dhcp_get_option(packet, DHCP_LEASE_TIME);
+	option = dhcp_index_get_option(options, DHCP_LEASE_TIME);
 	if (option == NULL)
 		return 3600;
 
@@ -1786,6 +2126,34 @@ static GList *add_prefix(GDHCPClient *dhcp_client, GList *list,
 	return g_list_prepend(list, ia_prefix);
 }
 
+/*
+ * A reply can carry several IAs (IA_NA and IA_PD from the same exchange)
+ * that are renewed together, so keep the earliest T1, T2 and expiry
+ * time of all the IAs in the reply. Zero T1/T2 means that the server
+ * left the choice to us and does not override a given value.
+ */
+static void set_ia_timeouts(GDHCPClient *dhcp_client, uint32_t T1,
+				uint32_t T2, uint32_t valid)
+{
+	time_t expire = time(NULL) + valid;
+
+	if (dhcp_client->ia_timeouts_set == TRUE) {
+		if (T1 == 0 || (dhcp_client->T1 != 0 && dhcp_client->T1 < T1))
+			T1 = dhcp_client->T1;
+
+		if (T2 == 0 || (dhcp_client->T2 != 0 && dhcp_client->T2 < T2))
+			T2 = dhcp_client->T2;
+
+		if (dhcp_client->expire < expire)
+			expire = dhcp_client->expire;
+	}
+
+	dhcp_client->T1 = T1;
+	dhcp_client->T2 = T2;
+	dhcp_client->expire = expire;
+	dhcp_client->ia_timeouts_set = TRUE;
+}
+
 static GList *get_addresses(GDHCPClient *dhcp_client,
 				int code, int len,
 				unsigned char *value,
@@ -1881,7 +2249,7 @@ static GList *get_addresses(GDHCPClient *dhcp_client,
 				/* RFC 3633, ch 10 */
 				list = add_prefix(dhcp_client, list, &addr,
 						prefixlen, preferred, valid);
-				if (shortest_valid > valid)
+				if (prefix_count == 0 || shortest_valid > valid)
 					shortest_valid = valid;
 				prefix_count++;
 			}
@@ -1900,9 +2268,6 @@ static GList *get_addresses(GDHCPClient *dhcp_client,
 			/* RFC 3315, 22.6 */
 			return NULL;
 
-		dhcp_client->T1 = T1;
-		dhcp_client->T2 = T2;
-
 		inet_ntop(AF_INET6, &addr, addr_str, INET6_ADDRSTRLEN);
 		debug(dhcp_client, "address count %d addr %s T1 %u T2 %u",
 			addr_count, addr_str, T1, T2);
@@ -1916,7 +2281,7 @@ static GList *get_addresses(GDHCPClient *dhcp_client,
 			memcpy(&dhcp_client->ia_ta, &addr,
 						sizeof(struct in6_addr));
 
-		g_dhcpv6_client_set_expire(dhcp_client, valid);
+		set_ia_timeouts(dhcp_client, T1, T2, valid);
 	}
 
 	if (prefix_count > 0 && list != NULL) {
@@ -1928,10 +2293,7 @@ static GList *get_addresses(GDHCPClient *dhcp_client,
 		debug(dhcp_client, "prefix count %d T1 %u T2 %u",
 			prefix_count, T1, T2);
 
-		dhcp_client->T1 = T1;
-		dhcp_client->T2 = T2;
-
-		g_dhcpv6_client_set_expire(dhcp_client, shortest_valid);
+		set_ia_timeouts(dhcp_client, T1, T2, shortest_valid);
 	}
 
 	if (status != NULL && *status != 0)
@@ -2029,6 +2391,21 @@ static void get_dhcpv6_request(GDHCPClient *dhcp_client,
 	uint8_t *option;
 	uint16_t code;
 	uint16_t option_len;
+	uint16_t *ia_status;
+	gboolean has_address_ia;
+
+	/*
+	 * When the IA_PD rides along with an address IA the prefix
+	 * status is kept apart so that a missing prefix does not fail
+	 * the address binding.
+	 */
+	has_address_ia = g_list_find(dhcp_client->request_list,
+				GINT_TO_POINTER(G_DHCPV6_IA_NA)) != NULL ||
+			g_list_find(dhcp_client->request_list,
+				GINT_TO_POINTER(G_DHCPV6_IA_TA)) != NULL;
+
+	dhcp_client->pd_status = 0;
+	dhcp_client->ia_timeouts_set = FALSE;
 
 	for (list = dhcp_client->request_list; list; list = list->next) {
 		code = (uint16_t) GPOINTER_TO_INT(list->data);
@@ -2041,8 +2418,13 @@ static void get_dhcpv6_request(GDHCPClient *dhcp_client,
 			continue;
 		}
 
+		if (code == G_DHCPV6_IA_PD && has_address_ia == TRUE)
+			ia_status = &dhcp_client->pd_status;
+		else
+			ia_status = status;
+
 		value_list = get_dhcpv6_option_value_list(dhcp_client, code,
-						option_len, option, status);
+						option_len, option, ia_status);
 
 		debug(dhcp_client, "code %d %p len %d list %p", code, option,
 			option_len, value_list);
@@ -2056,7 +2438,8 @@ static void get_dhcpv6_request(GDHCPClient *dhcp_client,
 	}
 }
 
-static void get_request(GDHCPClient *dhcp_client, struct dhcp_packet *packet)
+static void get_request(GDHCPClient *dhcp_client,
+				struct dhcp_option_index *options)
 {
 	GDHCPOptionType type;
 	GList *list, *value_list;
@@ -2067,7 +2450,7 @@ static void get_request(GDHCPClient *dhcp_client, struct dhcp_packet *packet)
 	for (list = dhcp_client->request_list; list; list = list->next) {
 		code = (uint8_t) GPOINTER_TO_INT(list->data);
 
-		option = dhcp_get_option(packet, code);
+		option = dhcp_index_get_option(options, code);
 		if (option == NULL) {
 			g_hash_table_remove(dhcp_client->code_value_hash,
 						GINT_TO_POINTER((int) code));
@@ -2099,6 +2482,7 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 {
 	GDHCPClient *dhcp_client = user_data;
 	struct dhcp_packet packet;
+	struct dhcp_option_index options;
 	struct dhcpv6_packet *packet6 = NULL;
 	uint8_t *message_type = NULL, *client_id = NULL, *option,
 		*server_id = NULL;
@@ -2122,7 +2506,9 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 
 	dhcp_client->status_code = 0;
 
-	if (dhcp_client->listen_mode == L2)
+	if (dhcp_client->listen_mode == L2 && dhcp_client->rx_ring != NULL)
+		re = dhcp_recv_l2_ring(dhcp_client, &packet);
+	else if (dhcp_client->listen_mode == L2)
 		re = dhcp_recv_l2_packet(&packet,
 					dhcp_client->listener_sockfd);
 	else if (dhcp_client->listen_mode == L3) {
@@ -2187,7 +2573,10 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 			dhcp_client->status_code = status;
 		}
 	} else {
-		message_type = dhcp_get_option(&packet, DHCP_MESSAGE_TYPE);
+		dhcp_index_options(&packet, &options);
+
+		message_type = dhcp_index_get_option(&options,
+							DHCP_MESSAGE_TYPE);
 		if (message_type == NULL)
 			return TRUE;
 	}
@@ -2201,35 +2590,58 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 
 	switch (dhcp_client->state) {
 	case INIT_SELECTING:
-		if (*message_type != DHCPOFFER)
-			return TRUE;
+		if (*message_type == DHCPOFFER) {
+			mark_phase(dhcp_client, G_DHCP_CLIENT_PHASE_OFFER);
 
-		g_source_remove(dhcp_client->timeout);
-		dhcp_client->timeout = 0;
-		dhcp_client->retry_times = 0;
+			g_source_remove(dhcp_client->timeout);
+			dhcp_client->timeout = 0;
+			dhcp_client->retry_times = 0;
 
-		option = dhcp_get_option(&packet, DHCP_SERVER_ID);
-		dhcp_client->server_ip = get_be32(option);
-		dhcp_client->requested_ip = ntohl(packet.yiaddr);
+			option = dhcp_index_get_option(&options,
+							DHCP_SERVER_ID);
+			dhcp_client->server_ip = get_be32(option);
+			dhcp_client->requested_ip = ntohl(packet.yiaddr);
 
-		dhcp_client->state = REQUESTING;
+			dhcp_client->state = REQUESTING;
 
-		start_request(dhcp_client);
+			start_request(dhcp_client);
 
-		return TRUE;
+			return TRUE;
+		}
+
+		/* RFC 4039, the server committed the lease on DISCOVER */
+		if (*message_type != DHCPACK || dhcp_index_get_option(&options,
+						DHCP_RAPID_COMMIT) == NULL)
+			return TRUE;
+
+		debug(dhcp_client, "rapid commit");
+
+		dhcp_client->requested_ip = ntohl(packet.yiaddr);
+
+		/* fall through */
 	case REQUESTING:
+	case REBOOTING:
 	case RENEWING:
 	case REBINDING:
 		if (*message_type == DHCPACK) {
+			mark_phase(dhcp_client, G_DHCP_CLIENT_PHASE_ACK);
+
+			stop_address_probe(dhcp_client);
+
 			dhcp_client->retry_times = 0;
 
 			if (dhcp_client->timeout > 0)
 				g_source_remove(dhcp_client->timeout);
 			dhcp_client->timeout = 0;
 
-			dhcp_client->lease_seconds = get_lease(&packet);
+			option = dhcp_index_get_option(&options,
+							DHCP_SERVER_ID);
+			if (option != NULL)
+				dhcp_client->server_ip = get_be32(option);
+
+			dhcp_client->lease_seconds = get_lease(&options);
 
-			get_request(dhcp_client, &packet);
+			get_request(dhcp_client, &options);
 
 			switch_listening_mode(dhcp_client, L_NONE);
 
@@ -2242,6 +2654,18 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 					dhcp_client->lease_available_data);
 
 			start_bound(dhcp_client);
+		} else if (*message_type == DHCPNAK &&
+					dhcp_client->state == REBOOTING) {
+			/* The cached address is not valid on this network */
+			g_free(dhcp_client->last_address);
+			dhcp_client->last_address = NULL;
+
+			reboot_failed(dhcp_client, 0);
+
+			/* Stop using it even if it was configured already */
+			if (dhcp_client->last_address_refused_cb != NULL)
+				dhcp_client->last_address_refused_cb(dhcp_client,
+					dhcp_client->last_address_refused_data);
 		} else if (*message_type == DHCPNAK) {
 			dhcp_client->retry_times = 0;
 
@@ -2587,7 +3011,8 @@ int g_dhcp_client_start(GDHCPClient *dhcp_client, const char *last_address)
 		return 0;
 	}
 
-	if (dhcp_client->retry_times == DISCOVER_RETRIES) {
+	if (dhcp_client->type == G_DHCP_IPV4LL ||
+			dhcp_client->retry_times == DISCOVER_RETRIES) {
 		ipv4ll_start(dhcp_client);
 		return 0;
 	}
@@ -2596,13 +3021,23 @@ int g_dhcp_client_start(GDHCPClient *dhcp_client, const char *last_address)
 		g_free(dhcp_client->assigned_ip);
 		dhcp_client->assigned_ip = NULL;
 
+		dhcp_client->xid = rand();
+		dhcp_client->start = time(NULL);
+
+		/* The L2 filter matches the xid, a restart needs a new one */
+		if (dhcp_client->listen_mode == L2)
+			dhcp_l2_filter(dhcp_client->listener_sockfd,
+						dhcp_client->xid,
+						dhcp_client->mac_address);
+
 		dhcp_client->state = INIT_SELECTING;
 		re = switch_listening_mode(dhcp_client, L2);
 		if (re != 0)
 			return re;
 
-		dhcp_client->xid = rand();
-		dhcp_client->start = time(NULL);
+		memset(dhcp_client->phase_time, 0,
+					sizeof(dhcp_client->phase_time));
+		mark_phase(dhcp_client, G_DHCP_CLIENT_PHASE_START);
 	}
 
 	if (last_address == NULL) {
@@ -2612,17 +3047,21 @@ int g_dhcp_client_start(GDHCPClient *dhcp_client, const char *last_address)
 		if (addr == 0xFFFFFFFF) {
 			addr = 0;
 		} else {
+			addr = ntohl(addr);
+
 			g_free(dhcp_client->last_address);
 			dhcp_client->last_address = g_strdup(last_address);
 		}
 	}
-	send_discover(dhcp_client, addr);
 
-	dhcp_client->timeout = g_timeout_add_seconds_full(G_PRIORITY_HIGH,
-							DISCOVER_TIMEOUT,
-							discover_timeout,
-							dhcp_client,
-							NULL);
+	/* With a cached lease, first try to simply confirm it */
+	if (dhcp_client->retry_times == 0 && addr != 0) {
+		start_reboot(dhcp_client, addr);
+		return 0;
+	}
+
+	start_discover(dhcp_client, addr);
+
 	return 0;
 }
 
@@ -2630,6 +3069,8 @@ void g_dhcp_client_stop(GDHCPClient *dhcp_client)
 {
 	switch_listening_mode(dhcp_client, L_NONE);
 
+	stop_address_probe(dhcp_client);
+
 	if (dhcp_client->timeout > 0) {
 		g_source_remove(dhcp_client->timeout);
 		dhcp_client->timeout = 0;
@@ -2739,6 +3180,18 @@ void g_dhcp_client_register_event(GDHCPClient *dhcp_client,
 		dhcp_client->confirm_cb = func;
 		dhcp_client->confirm_data = data;
 		return;
+	case G_DHCP_CLIENT_EVENT_LAST_ADDRESS_AVAILABLE:
+		if (dhcp_client->type != G_DHCP_IPV4)
+			return;
+		dhcp_client->last_address_cb = func;
+		dhcp_client->last_address_data = data;
+		return;
+	case G_DHCP_CLIENT_EVENT_LAST_ADDRESS_REFUSED:
+		if (dhcp_client->type != G_DHCP_IPV4)
+			return;
+		dhcp_client->last_address_refused_cb = func;
+		dhcp_client->last_address_refused_data = data;
+		return;
 	}
 }
 
@@ -2747,6 +3200,30 @@ int g_dhcp_client_get_index(GDHCPClient *dhcp_client)
 	return dhcp_client->ifindex;
 }
 
+/*
+ * Milliseconds from g_dhcp_client_start() until the current attempt
+ * reached the given phase, or -1 if it has not got there yet.
+ */
+int g_dhcp_client_get_phase_time(GDHCPClient *dhcp_client,
+						GDHCPClientPhase phase)
+{
+	gint64 start = dhcp_client->phase_time[G_DHCP_CLIENT_PHASE_START];
+
+	if (phase > G_DHCP_CLIENT_PHASE_ACK)
+		return -EINVAL;
+
+	if (start == 0 || dhcp_client->phase_time[phase] == 0)
+		return -1;
+
+	return (dhcp_client->phase_time[phase] - start) / 1000;
+}
+
+/* Only the full lease time while the lease callback is running */
+uint32_t g_dhcp_client_get_lease_time(GDHCPClient *dhcp_client)
+{
+	return dhcp_client->lease_seconds;
+}
+
 char *g_dhcp_client_get_address(GDHCPClient *dhcp_client)
 {
 	return g_strdup(dhcp_client->assigned_ip);
@@ -2771,6 +3248,7 @@ char *g_dhcp_client_get_netmask(GDHCPClient *dhcp_client)
 			return g_strdup(option->data);
 	case INIT_SELECTING:
 	case REQUESTING:
+	case REBOOTING:
 	case RELEASED:
 	case IPV4LL_PROBE:
 	case IPV4LL_ANNOUNCE:
@@ -2790,10 +3268,12 @@ GDHCPClientError g_dhcp_client_set_request(GDHCPClient *dhcp_client,
 						unsigned int option_code)
 {
 	if (g_list_find(dhcp_client->request_list,
-			GINT_TO_POINTER((int) option_code)) == NULL)
+			GINT_TO_POINTER((int) option_code)) == NULL) {
 		dhcp_client->request_list = g_list_prepend(
 					dhcp_client->request_list,
 					(GINT_TO_POINTER((int) option_code)));
+		invalidate_options(dhcp_client);
+	}
 
 	return G_DHCP_CLIENT_ERROR_NONE;
 }
@@ -2802,11 +3282,15 @@ void g_dhcp_client_clear_requests(GDHCPClient *dhcp_client)
 {
 	g_list_free(dhcp_client->request_list);
 	dhcp_client->request_list = NULL;
+
+	invalidate_options(dhcp_client);
 }
 
 void g_dhcp_client_clear_values(GDHCPClient *dhcp_client)
 {
 	g_hash_table_remove_all(dhcp_client->send_value_hash);
+
+	invalidate_options(dhcp_client);
 }
 
 static uint8_t *alloc_dhcp_option(int code, const uint8_t *data, unsigned size)
@@ -2853,6 +3337,8 @@ GDHCPClientError g_dhcp_client_set_id(GDHCPClient *dhcp_client)
 	g_hash_table_insert(dhcp_client->send_value_hash,
 		GINT_TO_POINTER((int) option_code), data_option);
 
+	invalidate_options(dhcp_client);
+
 	return G_DHCP_CLIENT_ERROR_NONE;
 }
 
@@ -2870,6 +3356,8 @@ GDHCPClientError g_dhcp_client_set_send(GDHCPClient *dhcp_client,
 
 		g_hash_table_insert(dhcp_client->send_value_hash,
 			GINT_TO_POINTER((int) option_code), binary_option);
+
+		invalidate_options(dhcp_client);
 	}
 
 	return G_DHCP_CLIENT_ERROR_NONE;
@@ -2910,7 +3398,9 @@ void g_dhcpv6_client_set_send(GDHCPClient *dhcp_client,
 			g_hash_table_insert(dhcp_client->send_value_hash,
 					GINT_TO_POINTER((int) option_code),
 					binary_option);
-	}
+	} else
+		g_hash_table_remove(dhcp_client->send_value_hash,
+					GINT_TO_POINTER((int) option_code));
 }
 
 void g_dhcpv6_client_reset_renew(GDHCPClient *dhcp_client)
@@ -2945,6 +3435,14 @@ uint16_t g_dhcpv6_client_get_status(GDHCPClient *dhcp_client)
 	return dhcp_client->status_code;
 }
 
+uint16_t g_dhcpv6_client_get_pd_status(GDHCPClient *dhcp_client)
+{
+	if (dhcp_client == NULL || dhcp_client->type != G_DHCP_IPV6)
+		return 0;
+
+	return dhcp_client->pd_status;
+}
+
 GDHCPClient *g_dhcp_client_ref(GDHCPClient *dhcp_client)
 {
 	if (dhcp_client == NULL)
@@ -2977,6 +3475,8 @@ void g_dhcp_client_unref(GDHCPClient *dhcp_client)
 	g_hash_table_destroy(dhcp_client->code_value_hash);
 	g_hash_table_destroy(dhcp_client->send_value_hash);
 
+	g_free(dhcp_client->option_block);
+
 	g_free(dhcp_client);
 }
 
@@ -130,6 +130,101 @@ uint8_t *dhcp_get_option(struct dhcp_packet *packet, int code)
 	return NULL;
 }
 
+static void index_option(struct dhcp_option_index *index, uint8_t *option)
+{
+	uint8_t code = option[OPT_CODE];
+	uint8_t *prev = index->option[code], *buf;
+	unsigned int prev_len, len;
+
+	if (prev == NULL) {
+		index->option[code] = option + OPT_DATA;
+		return;
+	}
+
+	/* RFC 3396, the instances of a split option are concatenated */
+	prev_len = prev[OPT_LEN - OPT_DATA];
+	len = prev_len + option[OPT_LEN];
+	if (len > 255)
+		len = 255;
+
+	if (index->concat_len + OPT_DATA + len > sizeof(index->concat))
+		return;
+
+	buf = index->concat + index->concat_len;
+	buf[OPT_CODE] = code;
+	buf[OPT_LEN] = len;
+	memcpy(buf + OPT_DATA, prev, prev_len);
+	memcpy(buf + OPT_DATA + prev_len, option + OPT_DATA, len - prev_len);
+
+	index->concat_len += OPT_DATA + len;
+	index->option[code] = buf + OPT_DATA;
+}
+
+/*
+ * Walk the options (and the file and sname fields if they are overloaded)
+ * once and remember where each option is, so that looking up all the
+ * requested options of a reply does not walk the packet again for each.
+ */
+void dhcp_index_options(struct dhcp_packet *packet,
+			struct dhcp_option_index *index)
+{
+	int len, rem;
+	uint8_t *optionptr;
+	uint8_t overload = 0;
+
+	memset(index->option, 0, sizeof(index->option));
+	index->concat_len = 0;
+
+	optionptr = packet->options;
+	rem = sizeof(packet->options);
+
+	while (rem > 0) {
+		if (optionptr[OPT_CODE] == DHCP_PADDING) {
+			rem--;
+			optionptr++;
+
+			continue;
+		}
+
+		if (optionptr[OPT_CODE] == DHCP_END) {
+			if (overload & FILE_FIELD) {
+				overload &= ~FILE_FIELD;
+
+				optionptr = packet->file;
+				rem = sizeof(packet->file);
+
+				continue;
+			} else if (overload & SNAME_FIELD) {
+				overload &= ~SNAME_FIELD;
+
+				optionptr = packet->sname;
+				rem = sizeof(packet->sname);
+
+				continue;
+			}
+
+			break;
+		}
+
+		if (rem < OPT_DATA)
+			/* Bad packet, malformed option field */
+			break;
+
+		len = OPT_DATA + optionptr[OPT_LEN];
+
+		rem -= len;
+		if (rem < 0)
+			break;
+
+		if (optionptr[OPT_CODE] == DHCP_OPTION_OVERLOAD)
+			overload |= optionptr[OPT_DATA];
+
+		index_option(index, optionptr);
+
+		optionptr += len;
+	}
+}
+
 int dhcp_end_option(uint8_t *optionptr)
 {
 	int i = 0;
@@ -223,6 +318,82 @@ uint8_t *dhcpv6_get_sub_option(unsigned char *option, uint16_t max_len,
 	return &option[4];
 }
 
+struct option_block {
+	uint8_t *buf;
+	unsigned int size;
+	unsigned int len;
+};
+
+static void encode_option(gpointer key, gpointer value, gpointer user_data)
+{
+	uint8_t *option = value;
+	struct option_block *block = user_data;
+	unsigned int len = OPT_DATA + option[OPT_LEN];
+
+	if (block->len + len > block->size)
+		return;
+
+	memcpy(block->buf + block->len, option, len);
+	block->len += len;
+}
+
+/*
+ * Encode the parameter request list for the codes in request_list
+ * followed by the binary options in send_values into buf. Returns the
+ * length of the encoded options, without an end option.
+ */
+unsigned int dhcp_encode_options(uint8_t *buf, unsigned int size,
+				GList *request_list, GHashTable *send_values)
+{
+	struct option_block block = { .buf = buf, .size = size, .len = 0 };
+	unsigned int len = 0;
+	GList *list;
+
+	for (list = request_list; list; list = list->next) {
+		if (len == 255 || OPT_DATA + len == size)
+			break;
+
+		buf[OPT_DATA + len] = (uint8_t) GPOINTER_TO_INT(list->data);
+		len++;
+	}
+
+	if (len > 0) {
+		buf[OPT_CODE] = DHCP_PARAM_REQ;
+		buf[OPT_LEN] = len;
+		block.len = OPT_DATA + len;
+	}
+
+	if (send_values != NULL)
+		g_hash_table_foreach(send_values, encode_option, &block);
+
+	return block.len;
+}
+
+/*
+ * Append a block of encoded options. If the block does not fit as a
+ * whole the options that still fit are added one at a time.
+ */
+void dhcp_add_option_block(struct dhcp_packet *packet, uint8_t *block,
+				unsigned int len)
+{
+	uint8_t *optionptr = packet->options;
+	unsigned int end, pos;
+
+	if (len == 0)
+		return;
+
+	end = dhcp_end_option(optionptr);
+
+	if (end + len + 1 < DHCP_OPTIONS_BUFSIZE) {
+		memcpy(optionptr + end, block, len);
+		optionptr[end + len] = DHCP_END;
+		return;
+	}
+
+	for (pos = 0; pos < len; pos += OPT_DATA + block[pos + OPT_LEN])
+		dhcp_add_binary_option(packet, block + pos);
+}
+
 /*
  * Add an option (supplied in binary form) to the options.
  * Option format: [code][len][data1][data2]..[dataLEN]
@@ -431,19 +602,33 @@ int dhcpv6_recv_l3_packet(struct dhcpv6_packet **packet, unsigned char *buf,
 	return n;
 }
 
-/* TODO: Use glib checksum */
 uint16_t dhcp_checksum(void *addr, int count)
 {
 	/*
 	 * Compute Internet Checksum for "count" bytes
 	 * beginning at location "addr".
+	 *
+	 * The ones' complement sum is the same whichever way the 16-bit
+	 * words are grouped (RFC 1071), so add them up 32 bits at a time
+	 * into a 64-bit accumulator and fold the carries in at the end.
 	 */
-	int32_t sum = 0;
-	uint16_t *source = (uint16_t *) addr;
+	const uint8_t *source = addr;
+	uint64_t sum = 0;
+	uint32_t word;
+	uint16_t half;
 
-	while (count > 1)  {
+	while (count >= 4) {
 		/*  This is the inner loop */
-		sum += *source++;
+		memcpy(&word, source, sizeof(word));
+		sum += word;
+		source += 4;
+		count -= 4;
+	}
+
+	if (count >= 2) {
+		memcpy(&half, source, sizeof(half));
+		sum += half;
+		source += 2;
 		count -= 2;
 	}
 
@@ -452,10 +637,11 @@ uint16_t dhcp_checksum(void *addr, int count)
 		/* Make sure that the left-over byte is added correctly both
 		 * with little and big endian hosts */
 		uint16_t tmp = 0;
-		*(uint8_t *) &tmp = *(uint8_t *) source;
+		*(uint8_t *) &tmp = *source;
 		sum += tmp;
 	}
-	/*  Fold 32-bit sum to 16 bits */
+
+	/*  Fold 64-bit sum to 16 bits */
 	while (sum >> 16)
 		sum = (sum & 0xffff) + (sum >> 16);
 
@@ -106,6 +106,7 @@ struct dhcpv6_packet {
 #define DHCP_MAX_SIZE		0x39
 #define DHCP_VENDOR		0x3c
 #define DHCP_CLIENT_ID		0x3d
+#define DHCP_RAPID_COMMIT	0x50
 #define DHCP_END		0xff
 
 #define OPT_CODE		0
@@ -161,6 +162,24 @@ typedef struct dhcp_option {
 	uint8_t code;
 } DHCPOption;
 
+/*
+ * Options of a received packet indexed by code in a single pass. A slot
+ * points to the option data with the length in the byte before it, the
+ * same as dhcp_get_option() returns. Options that are split into several
+ * instances (RFC 3396) are concatenated into the scratch buffer.
+ */
+struct dhcp_option_index {
+	uint8_t *option[256];
+	uint8_t concat[512];
+	unsigned int concat_len;
+};
+
+static inline uint8_t *dhcp_index_get_option(struct dhcp_option_index *index,
+						uint8_t code)
+{
+	return index->option[code];
+}
+
 /* Length of the option types in binary form */
 static const uint8_t dhcp_option_lengths[] = {
 	[OPTION_IP]	= 4,
@@ -171,12 +190,18 @@ static const uint8_t dhcp_option_lengths[] = {
 };
 
 uint8_t *dhcp_get_option(struct dhcp_packet *packet, int code);
+void dhcp_index_options(struct dhcp_packet *packet,
+			struct dhcp_option_index *index);
 uint8_t *dhcpv6_get_option(struct dhcpv6_packet *packet, uint16_t pkt_len,
 			int code, uint16_t *option_len, int *option_count);
 uint8_t *dhcpv6_get_sub_option(unsigned char *option, uint16_t max_len,
 			uint16_t *code, uint16_t *option_len);
 int dhcp_end_option(uint8_t *optionptr);
 void dhcp_add_binary_option(struct dhcp_packet *packet, uint8_t *addopt);
+unsigned int dhcp_encode_options(uint8_t *buf, unsigned int size,
+				GList *request_list, GHashTable *send_values);
+void dhcp_add_option_block(struct dhcp_packet *packet, uint8_t *block,
+				unsigned int len);
 void dhcpv6_add_binary_option(struct dhcpv6_packet *packet, uint16_t max_len,
 				uint16_t *pkt_len, uint8_t *addopt);
 void dhcp_add_option_uint8(struct dhcp_packet *packet,
@@ -61,8 +61,18 @@ typedef enum {
 	G_DHCP_CLIENT_EVENT_REBIND,
 	G_DHCP_CLIENT_EVENT_RELEASE,
 	G_DHCP_CLIENT_EVENT_CONFIRM,
+	G_DHCP_CLIENT_EVENT_LAST_ADDRESS_AVAILABLE,
+	G_DHCP_CLIENT_EVENT_LAST_ADDRESS_REFUSED,
 } GDHCPClientEvent;
 
+typedef enum {
+	G_DHCP_CLIENT_PHASE_START,
+	G_DHCP_CLIENT_PHASE_DISCOVER,
+	G_DHCP_CLIENT_PHASE_OFFER,
+	G_DHCP_CLIENT_PHASE_REQUEST,
+	G_DHCP_CLIENT_PHASE_ACK,
+} GDHCPClientPhase;
+
 typedef enum {
 	G_DHCP_IPV4,
 	G_DHCP_IPV6,
@@ -153,6 +163,9 @@ char *g_dhcp_client_get_netmask(GDHCPClient *client);
 GList *g_dhcp_client_get_option(GDHCPClient *client,
 						unsigned char option_code);
 int g_dhcp_client_get_index(GDHCPClient *client);
+int g_dhcp_client_get_phase_time(GDHCPClient *client,
+						GDHCPClientPhase phase);
+uint32_t g_dhcp_client_get_lease_time(GDHCPClient *client);
 
 void g_dhcp_client_set_debug(GDHCPClient *client,
 				GDHCPDebugFunc func, gpointer user_data);
@@ -166,6 +179,7 @@ GSList *g_dhcpv6_copy_prefixes(GSList *prefixes);
 void g_dhcpv6_client_set_send(GDHCPClient *dhcp_client, uint16_t option_code,
 			uint8_t *option_value, uint16_t option_len);
 uint16_t g_dhcpv6_client_get_status(GDHCPClient *dhcp_client);
+uint16_t g_dhcpv6_client_get_pd_status(GDHCPClient *dhcp_client);
 int g_dhcpv6_client_set_oro(GDHCPClient *dhcp_client, int args, ...);
 void g_dhcpv6_client_create_iaid(GDHCPClient *dhcp_client, int index,
 				unsigned char *iaid);
@@ -220,6 +234,8 @@ void g_dhcp_server_set_lease_time(GDHCPServer *dhcp_server,
 						unsigned int lease_time);
 void g_dhcp_server_set_save_lease(GDHCPServer *dhcp_server,
 				GDHCPSaveLeaseFunc func, gpointer user_data);
+int g_dhcp_server_set_lease_file(GDHCPServer *dhcp_server,
+						const char *pathname);
 #ifdef __cplusplus
 }
 #endif
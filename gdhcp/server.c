@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
 
@@ -48,6 +49,14 @@
 /* 5 minutes  */
 #define OFFER_TIME (5*60)
 
+/* Pending lease journal records are written out once a second */
+#define JOURNAL_FLUSH_SEC 1
+
+/* Rewrite the journal once it holds this many records... */
+#define JOURNAL_COMPACT_MIN 256
+/* ...and more than this many records per live lease */
+#define JOURNAL_COMPACT_RATIO 4
+
 struct _GDHCPServer {
 	int ref_count;
 	GDHCPType type;
@@ -61,20 +70,32 @@ struct _GDHCPServer {
 	int listener_sockfd;
 	guint listener_watch;
 	GIOChannel *listener_channel;
-	GList *lease_list;
+	GPtrArray *lease_heap; /* Min-heap ordered by expire time */
 	GHashTable *nip_lease_hash;
+	GHashTable *mac_lease_hash;
+	unsigned long *nip_map; /* One bit per address in the pool */
+	uint32_t nip_count;
+	uint32_t nip_cursor;
 	GHashTable *option_hash; /* Options send to client */
 	GDHCPSaveLeaseFunc save_lease_func;
 	GDHCPDebugFunc debug_func;
 	gpointer debug_data;
+	char *lease_file;
+	int journal_fd;
+	GString *journal_pending;
+	guint journal_timeout;
+	unsigned int journal_records;
 };
 
 struct dhcp_lease {
 	time_t expire;
 	uint32_t lease_nip;
 	uint8_t lease_mac[ETH_ALEN];
+	guint heap_index;
 };
 
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+
 static inline void debug(GDHCPServer *server, const char *format, ...)
 {
 	char str[256];
@@ -91,28 +112,152 @@ static inline void debug(GDHCPServer *server, const char *format, ...)
 	va_end(ap);
 }
 
-static struct dhcp_lease *find_lease_by_mac(GDHCPServer *dhcp_server,
-						const uint8_t *mac)
+static guint mac_hash(gconstpointer key)
+{
+	const uint8_t *mac = key;
+
+	return ((guint) mac[2] << 24 | mac[3] << 16 | mac[4] << 8 | mac[5]) ^
+						(mac[0] << 8 | mac[1]);
+}
+
+static gboolean mac_equal(gconstpointer a, gconstpointer b)
+{
+	return memcmp(a, b, ETH_ALEN) == 0;
+}
+
+#define LEASE_AT(heap, i) ((struct dhcp_lease *) g_ptr_array_index(heap, i))
+
+static void heap_set(GPtrArray *heap, guint i, struct dhcp_lease *lease)
+{
+	heap->pdata[i] = lease;
+	lease->heap_index = i;
+}
+
+static void heap_sift_up(GPtrArray *heap, guint i)
 {
-	GList *list;
+	struct dhcp_lease *lease = LEASE_AT(heap, i);
 
-	for (list = dhcp_server->lease_list; list; list = list->next) {
-		struct dhcp_lease *lease = list->data;
+	while (i > 0) {
+		guint parent = (i - 1) / 2;
 
-		if (memcmp(lease->lease_mac, mac, ETH_ALEN) == 0)
-			return lease;
+		if (LEASE_AT(heap, parent)->expire <= lease->expire)
+			break;
+
+		heap_set(heap, i, LEASE_AT(heap, parent));
+		i = parent;
 	}
 
-	return NULL;
+	heap_set(heap, i, lease);
 }
 
-static void remove_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
+static void heap_sift_down(GPtrArray *heap, guint i)
+{
+	struct dhcp_lease *lease = LEASE_AT(heap, i);
+
+	while (TRUE) {
+		guint child = 2 * i + 1;
+
+		if (child >= heap->len)
+			break;
+
+		if (child + 1 < heap->len && LEASE_AT(heap, child + 1)->expire <
+					LEASE_AT(heap, child)->expire)
+			child++;
+
+		if (lease->expire <= LEASE_AT(heap, child)->expire)
+			break;
+
+		heap_set(heap, i, LEASE_AT(heap, child));
+		i = child;
+	}
+
+	heap_set(heap, i, lease);
+}
+
+static void heap_insert(GPtrArray *heap, struct dhcp_lease *lease)
+{
+	g_ptr_array_add(heap, lease);
+	heap_sift_up(heap, heap->len - 1);
+}
+
+static void heap_remove(GPtrArray *heap, struct dhcp_lease *lease)
+{
+	guint i = lease->heap_index;
+	struct dhcp_lease *last;
+
+	last = g_ptr_array_remove_index(heap, heap->len - 1);
+	if (last == lease)
+		return;
+
+	heap_set(heap, i, last);
+	heap_sift_down(heap, i);
+	heap_sift_up(heap, last->heap_index);
+}
+
+/* Network and broadcast addresses of a /24 are never handed out */
+static inline gboolean is_reserved_nip(uint32_t nip)
+{
+	return (nip & 0xff) == 0 || (nip & 0xff) == 0xff;
+}
+
+static inline gboolean nip_in_pool(GDHCPServer *dhcp_server, uint32_t nip)
+{
+	return dhcp_server->nip_map != NULL && nip >= dhcp_server->start_ip &&
+					nip <= dhcp_server->end_ip;
+}
+
+static void nip_map_set(GDHCPServer *dhcp_server, uint32_t nip)
+{
+	uint32_t bit;
+
+	if (nip_in_pool(dhcp_server, nip) == FALSE)
+		return;
+
+	bit = nip - dhcp_server->start_ip;
+	dhcp_server->nip_map[bit / BITS_PER_LONG] |=
+					1UL << (bit % BITS_PER_LONG);
+}
+
+static void nip_map_clear(GDHCPServer *dhcp_server, uint32_t nip)
+{
+	uint32_t bit;
+
+	if (nip_in_pool(dhcp_server, nip) == FALSE)
+		return;
+
+	if (is_reserved_nip(nip) == TRUE)
+		return;
+
+	bit = nip - dhcp_server->start_ip;
+	dhcp_server->nip_map[bit / BITS_PER_LONG] &=
+					~(1UL << (bit % BITS_PER_LONG));
+}
+
+static struct dhcp_lease *find_lease_by_mac(GDHCPServer *dhcp_server,
+						const uint8_t *mac)
+{
+	return g_hash_table_lookup(dhcp_server->mac_lease_hash, mac);
+}
+
+/* Take the lease out of every index without freeing it */
+static void unlink_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
 {
-	dhcp_server->lease_list =
-			g_list_remove(dhcp_server->lease_list, lease);
+	heap_remove(dhcp_server->lease_heap, lease);
 
 	g_hash_table_remove(dhcp_server->nip_lease_hash,
 				GINT_TO_POINTER((int) lease->lease_nip));
+
+	if (g_hash_table_lookup(dhcp_server->mac_lease_hash,
+					lease->lease_mac) == lease)
+		g_hash_table_remove(dhcp_server->mac_lease_hash,
+						lease->lease_mac);
+
+	nip_map_clear(dhcp_server, lease->lease_nip);
+}
+
+static void remove_lease(GDHCPServer *dhcp_server, struct dhcp_lease *lease)
+{
+	unlink_lease(dhcp_server, lease);
 	g_free(lease);
 }
 
@@ -144,11 +289,7 @@ static int get_lease(GDHCPServer *dhcp_server, uint32_t yiaddr,
 	debug(dhcp_server, "lease_mac %p lease_nip %p", lease_mac, lease_nip);
 
 	if (lease_nip != NULL) {
-		dhcp_server->lease_list =
-				g_list_remove(dhcp_server->lease_list,
-								lease_nip);
-		g_hash_table_remove(dhcp_server->nip_lease_hash,
-				GINT_TO_POINTER((int) ntohl(yiaddr)));
+		unlink_lease(dhcp_server, lease_nip);
 
 		if (lease_mac == NULL)
 			*lease = lease_nip;
@@ -162,11 +303,7 @@ static int get_lease(GDHCPServer *dhcp_server, uint32_t yiaddr,
 	}
 
 	if (lease_mac != NULL) {
-		dhcp_server->lease_list =
-				g_list_remove(dhcp_server->lease_list,
-								lease_mac);
-		g_hash_table_remove(dhcp_server->nip_lease_hash,
-				GINT_TO_POINTER((int) lease_mac->lease_nip));
+		unlink_lease(dhcp_server, lease_mac);
 		*lease = lease_mac;
 
 		return 0;
@@ -179,14 +316,6 @@ static int get_lease(GDHCPServer *dhcp_server, uint32_t yiaddr,
 	return 0;
 }
 
-static gint compare_expire(gconstpointer a, gconstpointer b)
-{
-	const struct dhcp_lease *lease1 = a;
-	const struct dhcp_lease *lease2 = b;
-
-	return lease2->expire - lease1->expire;
-}
-
 static struct dhcp_lease *add_lease(GDHCPServer *dhcp_server, uint32_t expire,
 					const uint8_t *chaddr, uint32_t yiaddr)
 {
@@ -207,11 +336,14 @@ static struct dhcp_lease *add_lease(GDHCPServer *dhcp_server, uint32_t expire,
 	else
 		lease->expire = expire;
 
-	dhcp_server->lease_list = g_list_insert_sorted(dhcp_server->lease_list,
-							lease, compare_expire);
+	heap_insert(dhcp_server->lease_heap, lease);
 
 	g_hash_table_insert(dhcp_server->nip_lease_hash,
 				GINT_TO_POINTER((int) lease->lease_nip), lease);
+	g_hash_table_insert(dhcp_server->mac_lease_hash,
+						lease->lease_mac, lease);
+
+	nip_map_set(dhcp_server, lease->lease_nip);
 
 	return lease;
 }
@@ -238,38 +370,72 @@ static gboolean is_expired_lease(struct dhcp_lease *lease)
 	return FALSE;
 }
 
+/*
+ * Find the next clear bit in the pool bitmap at or after the cursor,
+ * wrapping around once. Returns nip_count if every address is taken.
+ */
+static uint32_t nip_map_next_free(GDHCPServer *dhcp_server, uint32_t from)
+{
+	uint32_t words = (dhcp_server->nip_count + BITS_PER_LONG - 1) /
+							BITS_PER_LONG;
+	uint32_t word = from / BITS_PER_LONG, n;
+	unsigned long free_bits;
+
+	free_bits = ~dhcp_server->nip_map[word] &
+				(~0UL << (from % BITS_PER_LONG));
+
+	for (n = 0; n <= words; n++) {
+		if (free_bits != 0) {
+			uint32_t bit = word * BITS_PER_LONG +
+						__builtin_ctzl(free_bits);
+
+			if (bit < dhcp_server->nip_count)
+				return bit;
+		}
+
+		if (++word == words)
+			word = 0;
+
+		free_bits = ~dhcp_server->nip_map[word];
+	}
+
+	return dhcp_server->nip_count;
+}
+
 static uint32_t find_free_or_expired_nip(GDHCPServer *dhcp_server,
 					const uint8_t *safe_mac)
 {
-	uint32_t ip_addr;
+	uint32_t bit, first = dhcp_server->nip_count;
 	struct dhcp_lease *lease;
-	GList *list;
-	ip_addr = dhcp_server->start_ip;
-	for (; ip_addr <= dhcp_server->end_ip; ip_addr++) {
-		/* e.g. 192.168.55.0 */
-		if ((ip_addr & 0xff) == 0)
-			continue;
 
-		/* e.g. 192.168.55.255 */
-		if ((ip_addr & 0xff) == 0xff)
-			continue;
+	bit = dhcp_server->nip_cursor;
 
-		lease = find_lease_by_nip(dhcp_server, ip_addr);
-		if (lease != NULL)
-			continue;
+	while (dhcp_server->nip_map != NULL) {
+		uint32_t ip_addr;
+
+		bit = nip_map_next_free(dhcp_server, bit);
+		if (bit == dhcp_server->nip_count || bit == first)
+			break;
+
+		if (first == dhcp_server->nip_count)
+			first = bit;
 
-		if (arp_check(htonl(ip_addr), safe_mac) == TRUE)
+		ip_addr = dhcp_server->start_ip + bit;
+
+		if (++bit == dhcp_server->nip_count)
+			bit = 0;
+
+		if (arp_check(htonl(ip_addr), safe_mac) == TRUE) {
+			dhcp_server->nip_cursor = bit;
 			return ip_addr;
+		}
 	}
 
-	/* The last lease is the oldest one */
-	list = g_list_last(dhcp_server->lease_list);
-	if (list == NULL)
+	/* The top of the heap is the oldest lease */
+	if (dhcp_server->lease_heap->len == 0)
 		return 0;
 
-	lease = list->data;
-	if (lease == NULL)
-		return 0;
+	lease = LEASE_AT(dhcp_server->lease_heap, 0);
 
 	 if (is_expired_lease(lease) == FALSE)
 		return 0;
@@ -283,31 +449,32 @@ static uint32_t find_free_or_expired_nip(GDHCPServer *dhcp_server,
 static void lease_set_expire(GDHCPServer *dhcp_server,
 			struct dhcp_lease *lease, uint32_t expire)
 {
-	dhcp_server->lease_list = g_list_remove(dhcp_server->lease_list, lease);
-
 	lease->expire = expire;
 
-	dhcp_server->lease_list = g_list_insert_sorted(dhcp_server->lease_list,
-							lease, compare_expire);
+	heap_sift_down(dhcp_server->lease_heap, lease->heap_index);
+	heap_sift_up(dhcp_server->lease_heap, lease->heap_index);
 }
 
 static void destroy_lease_table(GDHCPServer *dhcp_server)
 {
-	GList *list;
+	guint i;
 
 	g_hash_table_destroy(dhcp_server->nip_lease_hash);
+	g_hash_table_destroy(dhcp_server->mac_lease_hash);
 
 	dhcp_server->nip_lease_hash = NULL;
+	dhcp_server->mac_lease_hash = NULL;
 
-	for (list = dhcp_server->lease_list; list; list = list->next) {
-		struct dhcp_lease *lease = list->data;
+	for (i = 0; i < dhcp_server->lease_heap->len; i++)
+		g_free(LEASE_AT(dhcp_server->lease_heap, i));
 
-		g_free(lease);
-	}
+	g_ptr_array_free(dhcp_server->lease_heap, TRUE);
 
-	g_list_free(dhcp_server->lease_list);
+	dhcp_server->lease_heap = NULL;
 
-	dhcp_server->lease_list = NULL;
+	g_free(dhcp_server->nip_map);
+
+	dhcp_server->nip_map = NULL;
 }
 static uint32_t get_interface_address(int index)
 {
@@ -381,6 +548,9 @@ GDHCPServer *g_dhcp_server_new(GDHCPType type,
 
 	dhcp_server->nip_lease_hash = g_hash_table_new_full(g_direct_hash,
 						g_direct_equal, NULL, NULL);
+	dhcp_server->mac_lease_hash = g_hash_table_new_full(mac_hash,
+						mac_equal, NULL, NULL);
+	dhcp_server->lease_heap = g_ptr_array_new();
 	dhcp_server->option_hash = g_hash_table_new_full(g_direct_hash,
 						g_direct_equal, NULL, NULL);
 
@@ -400,6 +570,7 @@ GDHCPServer *g_dhcp_server_new(GDHCPType type,
 	dhcp_server->save_lease_func = NULL;
 	dhcp_server->debug_func = NULL;
 	dhcp_server->debug_data = NULL;
+	dhcp_server->journal_fd = -1;
 
 	*error = G_DHCP_SERVER_ERROR_NONE;
 
@@ -532,6 +703,9 @@ static void send_packet_to_client(GDHCPServer *dhcp_server,
 		dhcp_server->ifindex);
 }
 
+static void send_ACK(GDHCPServer *dhcp_server,
+		struct dhcp_packet *client_packet, uint32_t dest);
+
 static void send_offer(GDHCPServer *dhcp_server,
 			struct dhcp_packet *client_packet,
 				struct dhcp_lease *lease,
@@ -557,6 +731,12 @@ static void send_offer(GDHCPServer *dhcp_server,
 		return;
 	}
 
+	/* RFC 4039, commit the lease without the OFFER/REQUEST round */
+	if (dhcp_get_option(client_packet, DHCP_RAPID_COMMIT) != NULL) {
+		send_ACK(dhcp_server, client_packet, ntohl(packet.yiaddr));
+		return;
+	}
+
 	lease = add_lease(dhcp_server, OFFER_TIME,
 				packet.chaddr, packet.yiaddr);
 	if (lease == NULL) {
@@ -577,22 +757,253 @@ static void send_offer(GDHCPServer *dhcp_server,
 
 static void save_lease(GDHCPServer *dhcp_server)
 {
-	GList *list;
+	guint i;
 
 	if (dhcp_server->save_lease_func == NULL)
 		return;
 
-	for (list = dhcp_server->lease_list; list; list = list->next) {
-		struct dhcp_lease *lease = list->data;
+	for (i = 0; i < dhcp_server->lease_heap->len; i++) {
+		struct dhcp_lease *lease = g_ptr_array_index(
+						dhcp_server->lease_heap, i);
 		dhcp_server->save_lease_func(lease->lease_mac,
 					lease->lease_nip, lease->expire);
 	}
 }
 
+/*
+ * The lease journal is a text file with one "<mac> <ip> <expire>" line
+ * per lease change. Replaying it in order through add_lease() rebuilds
+ * the table; a record that has already expired drops the lease of that
+ * MAC. Once stale records dominate, the file is rewritten with just the
+ * live leases.
+ */
+
+static void journal_format(GString *str, const uint8_t *mac,
+					uint32_t nip, time_t expire)
+{
+	struct in_addr addr;
+
+	addr.s_addr = htonl(nip);
+
+	g_string_append_printf(str,
+			"%02x:%02x:%02x:%02x:%02x:%02x %s %lld\n",
+			mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+			inet_ntoa(addr), (long long) expire);
+}
+
+static gboolean journal_parse(const char *line, uint8_t *mac,
+					uint32_t *nip, time_t *expire)
+{
+	unsigned int m[ETH_ALEN];
+	char ip[16];
+	struct in_addr addr;
+	long long value;
+	int i;
+
+	if (sscanf(line, "%x:%x:%x:%x:%x:%x %15s %lld", &m[0], &m[1],
+				&m[2], &m[3], &m[4], &m[5], ip, &value) != 8)
+		return FALSE;
+
+	if (inet_aton(ip, &addr) == 0)
+		return FALSE;
+
+	for (i = 0; i < ETH_ALEN; i++) {
+		if (m[i] > 0xff)
+			return FALSE;
+
+		mac[i] = m[i];
+	}
+
+	*nip = ntohl(addr.s_addr);
+	*expire = value;
+
+	return TRUE;
+}
+
+static int journal_open(GDHCPServer *dhcp_server)
+{
+	int fd;
+
+	fd = open(dhcp_server->lease_file,
+			O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -errno;
+
+	if (dhcp_server->journal_fd >= 0)
+		close(dhcp_server->journal_fd);
+
+	dhcp_server->journal_fd = fd;
+
+	return 0;
+}
+
+/* Replace the journal with a snapshot of the live leases */
+static int journal_compact(GDHCPServer *dhcp_server)
+{
+	GPtrArray *heap = dhcp_server->lease_heap;
+	GString *str;
+	time_t now;
+	unsigned int records = 0;
+	GError *error = NULL;
+	guint i;
+	int err;
+
+	str = g_string_sized_new(heap->len * 48);
+	now = time(NULL);
+
+	for (i = 0; i < heap->len; i++) {
+		struct dhcp_lease *lease = LEASE_AT(heap, i);
+
+		if (lease->expire <= now)
+			continue;
+
+		journal_format(str, lease->lease_mac, lease->lease_nip,
+							lease->expire);
+		records++;
+	}
+
+	/* Written to a temporary file and renamed over the journal */
+	if (g_file_set_contents(dhcp_server->lease_file, str->str, str->len,
+						&error) == FALSE) {
+		debug(dhcp_server, "Cannot write %s: %s",
+				dhcp_server->lease_file, error->message);
+		g_error_free(error);
+		err = -EIO;
+		goto done;
+	}
+
+	err = journal_open(dhcp_server);
+	if (err == 0) {
+		dhcp_server->journal_records = records;
+		debug(dhcp_server, "Lease journal compacted to %u records",
+								records);
+	}
+
+done:
+	g_string_free(str, TRUE);
+
+	return err;
+}
+
+static void journal_flush(GDHCPServer *dhcp_server)
+{
+	GString *pending = dhcp_server->journal_pending;
+	ssize_t len;
+
+	if (pending == NULL || pending->len == 0)
+		return;
+
+	if (dhcp_server->journal_fd < 0 && journal_open(dhcp_server) < 0)
+		return;
+
+	len = write(dhcp_server->journal_fd, pending->str, pending->len);
+	if (len < 0) {
+		debug(dhcp_server, "Lease journal write failed: %s",
+							strerror(errno));
+		return;
+	}
+
+	g_string_erase(pending, 0, len);
+
+	if (dhcp_server->journal_records < JOURNAL_COMPACT_MIN)
+		return;
+
+	if (dhcp_server->journal_records <= JOURNAL_COMPACT_RATIO *
+					dhcp_server->lease_heap->len)
+		return;
+
+	if (pending->len == 0)
+		journal_compact(dhcp_server);
+}
+
+static gboolean journal_timeout(gpointer user_data)
+{
+	GDHCPServer *dhcp_server = user_data;
+
+	dhcp_server->journal_timeout = 0;
+
+	journal_flush(dhcp_server);
+
+	return FALSE;
+}
+
+static void journal_append(GDHCPServer *dhcp_server, const uint8_t *mac,
+					uint32_t nip, time_t expire)
+{
+	if (dhcp_server->lease_file == NULL)
+		return;
+
+	if (dhcp_server->journal_pending == NULL)
+		dhcp_server->journal_pending = g_string_new(NULL);
+
+	journal_format(dhcp_server->journal_pending, mac, nip, expire);
+	dhcp_server->journal_records++;
+
+	if (dhcp_server->journal_timeout > 0)
+		return;
+
+	dhcp_server->journal_timeout =
+		g_timeout_add_seconds(JOURNAL_FLUSH_SEC,
+					journal_timeout, dhcp_server);
+}
+
+static void journal_load(GDHCPServer *dhcp_server)
+{
+	char *content, *line, *next;
+	unsigned int records = 0, loaded;
+	time_t now;
+
+	if (g_file_get_contents(dhcp_server->lease_file, &content,
+							NULL, NULL) == FALSE)
+		return;
+
+	now = time(NULL);
+
+	for (line = content; *line != '\0'; line = next) {
+		struct dhcp_lease *lease;
+		uint8_t mac[ETH_ALEN];
+		uint32_t nip;
+		time_t expire;
+
+		next = strchr(line, '\n');
+		if (next == NULL)
+			/* Torn write at the end of the file */
+			break;
+
+		*next++ = '\0';
+
+		if (journal_parse(line, mac, &nip, &expire) == FALSE)
+			continue;
+
+		records++;
+
+		if (expire > now && nip_in_pool(dhcp_server, nip) == TRUE) {
+			add_lease(dhcp_server, expire, mac, htonl(nip));
+			continue;
+		}
+
+		lease = find_lease_by_mac(dhcp_server, mac);
+		if (lease != NULL)
+			remove_lease(dhcp_server, lease);
+	}
+
+	g_free(content);
+
+	loaded = dhcp_server->lease_heap->len;
+	dhcp_server->journal_records = records;
+
+	debug(dhcp_server, "Loaded %u leases from %u journal records",
+							loaded, records);
+
+	if (records > loaded)
+		journal_compact(dhcp_server);
+}
+
 static void send_ACK(GDHCPServer *dhcp_server,
 		struct dhcp_packet *client_packet, uint32_t dest)
 {
 	struct dhcp_packet packet;
+	struct dhcp_lease *lease;
 	uint32_t lease_time_sec;
 	struct in_addr addr;
 
@@ -603,6 +1014,12 @@ static void send_ACK(GDHCPServer *dhcp_server,
 
 	dhcp_add_option_uint32(&packet, DHCP_LEASE_TIME, lease_time_sec);
 
+	if (dhcp_get_option(client_packet, DHCP_RAPID_COMMIT) != NULL) {
+		uint8_t rapid_commit[] = { DHCP_RAPID_COMMIT, 0 };
+
+		dhcp_add_binary_option(&packet, rapid_commit);
+	}
+
 	add_server_options(dhcp_server, &packet);
 
 	addr.s_addr = htonl(dest);
@@ -611,7 +1028,10 @@ static void send_ACK(GDHCPServer *dhcp_server,
 
 	send_packet_to_client(dhcp_server, &packet);
 
-	add_lease(dhcp_server, 0, packet.chaddr, packet.yiaddr);
+	lease = add_lease(dhcp_server, 0, packet.chaddr, packet.yiaddr);
+	if (lease != NULL)
+		journal_append(dhcp_server, lease->lease_mac,
+					lease->lease_nip, lease->expire);
 }
 
 static void send_NAK(GDHCPServer *dhcp_server,
@@ -716,8 +1136,11 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 			if (lease == NULL)
 				break;
 
-			if (requested_nip == lease->lease_nip)
+			if (requested_nip == lease->lease_nip) {
+				journal_append(dhcp_server, lease->lease_mac,
+							lease->lease_nip, 0);
 				remove_lease(dhcp_server, lease);
+			}
 
 		break;
 		case DHCPRELEASE:
@@ -729,9 +1152,12 @@ static gboolean listener_event(GIOChannel *channel, GIOCondition condition,
 			if (lease == NULL)
 				break;
 
-			if (packet.ciaddr == lease->lease_nip)
+			if (packet.ciaddr == lease->lease_nip) {
 				lease_set_expire(dhcp_server, lease,
 								time(NULL));
+				journal_append(dhcp_server, lease->lease_mac,
+						lease->lease_nip, lease->expire);
+			}
 		break;
 		case DHCPINFORM:
 			debug(dhcp_server, "Received INFORM");
@@ -751,6 +1177,10 @@ int g_dhcp_server_start(GDHCPServer *dhcp_server)
 	if (dhcp_server->started == TRUE)
 		return 0;
 
+	if (dhcp_server->lease_file != NULL &&
+				dhcp_server->lease_heap->len == 0)
+		journal_load(dhcp_server);
+
 	listener_sockfd = dhcp_l3_socket(SERVER_PORT,
 					dhcp_server->interface, AF_INET);
 	if (listener_sockfd < 0)
@@ -805,6 +1235,21 @@ int g_dhcp_server_set_option(GDHCPServer *dhcp_server,
 	return 0;
 }
 
+int g_dhcp_server_set_lease_file(GDHCPServer *dhcp_server,
+						const char *pathname)
+{
+	if (dhcp_server == NULL)
+		return -EINVAL;
+
+	if (dhcp_server->started == TRUE)
+		return -EBUSY;
+
+	g_free(dhcp_server->lease_file);
+	dhcp_server->lease_file = g_strdup(pathname);
+
+	return 0;
+}
+
 void g_dhcp_server_set_save_lease(GDHCPServer *dhcp_server,
 				GDHCPSaveLeaseFunc func, gpointer user_data)
 {
@@ -829,6 +1274,18 @@ void g_dhcp_server_stop(GDHCPServer *dhcp_server)
 	/* Save leases, before stop; load them before start */
 	save_lease(dhcp_server);
 
+	if (dhcp_server->journal_timeout > 0) {
+		g_source_remove(dhcp_server->journal_timeout);
+		dhcp_server->journal_timeout = 0;
+	}
+
+	journal_flush(dhcp_server);
+
+	if (dhcp_server->journal_fd >= 0) {
+		close(dhcp_server->journal_fd);
+		dhcp_server->journal_fd = -1;
+	}
+
 	if (dhcp_server->listener_watch > 0) {
 		g_source_remove(dhcp_server->listener_watch);
 		dhcp_server->listener_watch = 0;
@@ -853,25 +1310,66 @@ void g_dhcp_server_unref(GDHCPServer *dhcp_server)
 
 	destroy_lease_table(dhcp_server);
 
+	if (dhcp_server->journal_pending != NULL)
+		g_string_free(dhcp_server->journal_pending, TRUE);
+
+	g_free(dhcp_server->lease_file);
 	g_free(dhcp_server->interface);
 
 	g_free(dhcp_server);
 }
 
+static void rebuild_nip_map(GDHCPServer *dhcp_server)
+{
+	GPtrArray *heap = dhcp_server->lease_heap;
+	uint32_t ip_addr, count;
+	guint i;
+
+	g_free(dhcp_server->nip_map);
+
+	count = dhcp_server->end_ip - dhcp_server->start_ip + 1;
+
+	dhcp_server->nip_count = count;
+	dhcp_server->nip_cursor = 0;
+	dhcp_server->nip_map = g_new0(unsigned long,
+				(count + BITS_PER_LONG - 1) / BITS_PER_LONG);
+
+	/* e.g. 192.168.55.0 and 192.168.55.255 stay permanently taken */
+	for (ip_addr = dhcp_server->start_ip; ; ip_addr++) {
+		if (is_reserved_nip(ip_addr) == TRUE)
+			nip_map_set(dhcp_server, ip_addr);
+
+		if (ip_addr == dhcp_server->end_ip)
+			break;
+	}
+
+	for (i = 0; i < heap->len; i++)
+		nip_map_set(dhcp_server, LEASE_AT(heap, i)->lease_nip);
+}
+
 int g_dhcp_server_set_ip_range(GDHCPServer *dhcp_server,
 		const char *start_ip, const char *end_ip)
 {
 	struct in_addr _host_addr;
+	uint32_t start, end;
 
 	if (inet_aton(start_ip, &_host_addr) == 0)
 		return -ENXIO;
 
-	dhcp_server->start_ip = ntohl(_host_addr.s_addr);
+	start = ntohl(_host_addr.s_addr);
 
 	if (inet_aton(end_ip, &_host_addr) == 0)
 		return -ENXIO;
 
-	dhcp_server->end_ip = ntohl(_host_addr.s_addr);
+	end = ntohl(_host_addr.s_addr);
+
+	if (end < start)
+		return -EINVAL;
+
+	dhcp_server->start_ip = start;
+	dhcp_server->end_ip = end;
+
+	rebuild_nip_map(dhcp_server);
 
 	return 0;
 }
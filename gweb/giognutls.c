@@ -27,6 +27,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdarg.h>
+#include <string.h>
+#include <arpa/inet.h>
 
 #include <gnutls/gnutls.h>
 
@@ -41,10 +44,14 @@ typedef struct _GIOGnuTLSWatch GIOGnuTLSWatch;
 struct _GIOGnuTLSChannel {
 	GIOChannel channel;
 	gint fd;
-	gnutls_certificate_credentials_t cred;
 	gnutls_session_t session;
 	gboolean established;
 	gboolean again;
+	char *hostname;
+	char *session_id;
+	gint64 handshake_start;
+	GIOGnuTLSDebugFunc debug_func;
+	gpointer debug_data;
 };
 
 struct _GIOGnuTLSWatch {
@@ -56,10 +63,95 @@ struct _GIOGnuTLSWatch {
 
 static volatile int global_init_done = 0;
 
+/*
+ * The credentials and the resumption data of the last session with
+ * each server, keyed by host and port, are shared by all channels of
+ * the process.
+ */
+static gnutls_certificate_credentials_t global_cred;
+static GHashTable *session_cache;
+
+static void free_session_data(gpointer data)
+{
+	gnutls_datum_t *datum = data;
+
+	gnutls_free(datum->data);
+	g_free(datum);
+}
+
 static inline void g_io_gnutls_global_init(void)
 {
-	if (__sync_bool_compare_and_swap(&global_init_done, 0, 1) == TRUE)
-		gnutls_global_init();
+	if (__sync_bool_compare_and_swap(&global_init_done, 0, 1) == FALSE)
+		return;
+
+	gnutls_global_init();
+
+	gnutls_certificate_allocate_credentials(&global_cred);
+
+	session_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, free_session_data);
+}
+
+#define debug(gnutls_channel, format, arg...)				\
+	_debug(gnutls_channel, __FILE__, __func__, format, ## arg)
+
+static void _debug(GIOGnuTLSChannel *gnutls_channel, const char *file,
+				const char *caller, const char *format, ...)
+{
+	char str[256];
+	va_list ap;
+	int len;
+
+	if (gnutls_channel->debug_func == NULL)
+		return;
+
+	va_start(ap, format);
+
+	if ((len = snprintf(str, sizeof(str), "%s:%s() channel %p ",
+					file, caller, gnutls_channel)) > 0) {
+		if (vsnprintf(str + len, sizeof(str) - len, format, ap) > 0)
+			gnutls_channel->debug_func(str,
+						gnutls_channel->debug_data);
+	}
+
+	va_end(ap);
+}
+
+static void store_session_data(GIOGnuTLSChannel *gnutls_channel)
+{
+	gnutls_datum_t *datum;
+
+	if (gnutls_channel->session_id == NULL)
+		return;
+
+	datum = g_try_new0(gnutls_datum_t, 1);
+	if (datum == NULL)
+		return;
+
+	if (gnutls_session_get_data2(gnutls_channel->session, datum) < 0 ||
+							datum->size == 0) {
+		g_free(datum);
+		return;
+	}
+
+	g_hash_table_replace(session_cache,
+				g_strdup(gnutls_channel->session_id), datum);
+}
+
+static void load_session_data(GIOGnuTLSChannel *gnutls_channel)
+{
+	gnutls_datum_t *datum;
+
+	if (gnutls_channel->session_id == NULL)
+		return;
+
+	datum = g_hash_table_lookup(session_cache, gnutls_channel->session_id);
+	if (datum == NULL)
+		return;
+
+	if (gnutls_session_set_data(gnutls_channel->session,
+					datum->data, datum->size) < 0)
+		g_hash_table_remove(session_cache, gnutls_channel->session_id);
 }
 
 static GIOStatus check_handshake(GIOChannel *channel, GError **err)
@@ -72,6 +164,9 @@ static GIOStatus check_handshake(GIOChannel *channel, GError **err)
 	if (gnutls_channel->established == TRUE)
 		return G_IO_STATUS_NORMAL;
 
+	if (gnutls_channel->handshake_start == 0)
+		gnutls_channel->handshake_start = g_get_monotonic_time();
+
 again:
 	result = gnutls_handshake(gnutls_channel->session);
 
@@ -88,6 +183,14 @@ again:
 	}
 
 	if (result < 0) {
+		debug(gnutls_channel, "handshake with %s failed: %s",
+					gnutls_channel->hostname,
+					gnutls_strerror(result));
+
+		if (gnutls_channel->session_id != NULL)
+			g_hash_table_remove(session_cache,
+						gnutls_channel->session_id);
+
 		g_set_error(err, G_IO_CHANNEL_ERROR,
 				G_IO_CHANNEL_ERROR_FAILED, "Handshake failed");
 		return G_IO_STATUS_ERROR;
@@ -95,6 +198,17 @@ again:
 
 	gnutls_channel->established = TRUE;
 
+	debug(gnutls_channel, "handshake with %s done in %lld usec%s",
+			gnutls_channel->hostname,
+			(long long) (g_get_monotonic_time() -
+					gnutls_channel->handshake_start),
+			gnutls_session_is_resumed(gnutls_channel->session) ?
+							" (resumed)" : "");
+
+	gnutls_channel->handshake_start = 0;
+
+	store_session_data(gnutls_channel);
+
 	DBG("handshake done");
 
 	return G_IO_STATUS_NORMAL;
@@ -215,8 +329,12 @@ static GIOStatus g_io_gnutls_close(GIOChannel *channel, GError **err)
 
 	DBG("channel %p", channel);
 
-	if (gnutls_channel->established == TRUE)
+	if (gnutls_channel->established == TRUE) {
+		/* TLS 1.3 tickets only arrive after the handshake */
+		store_session_data(gnutls_channel);
+
 		gnutls_bye(gnutls_channel->session, GNUTLS_SHUT_RDWR);
+	}
 
 	if (close(gnutls_channel->fd) < 0) {
 		g_set_error_literal(err, G_IO_CHANNEL_ERROR,
@@ -235,8 +353,8 @@ static void g_io_gnutls_free(GIOChannel *channel)
 
 	gnutls_deinit(gnutls_channel->session);
 
-	gnutls_certificate_free_credentials(gnutls_channel->cred);
-
+	g_free(gnutls_channel->hostname);
+	g_free(gnutls_channel->session_id);
 	g_free(gnutls_channel);
 }
 
@@ -413,7 +531,18 @@ gboolean g_io_channel_supports_tls(void)
 	return TRUE;
 }
 
-GIOChannel *g_io_channel_gnutls_new(int fd)
+static gboolean is_address(const char *hostname)
+{
+	struct in6_addr addr;
+
+	if (inet_pton(AF_INET, hostname, &addr) == 1)
+		return TRUE;
+
+	return inet_pton(AF_INET6, hostname, &addr) == 1;
+}
+
+GIOChannel *g_io_channel_gnutls_new(int fd, const char *hostname,
+							guint16 port)
 {
 	GIOGnuTLSChannel *gnutls_channel;
 	GIOChannel *channel;
@@ -429,6 +558,13 @@ GIOChannel *g_io_channel_gnutls_new(int fd)
 	channel->funcs = &gnutls_channel_funcs;
 
 	gnutls_channel->fd = fd;
+	gnutls_channel->established = FALSE;
+	gnutls_channel->again = FALSE;
+	gnutls_channel->hostname = g_strdup(hostname);
+	gnutls_channel->session_id = NULL;
+	gnutls_channel->handshake_start = 0;
+	gnutls_channel->debug_func = NULL;
+	gnutls_channel->debug_data = NULL;
 
 	channel->is_seekable = FALSE;
 	channel->is_readable = TRUE;
@@ -440,6 +576,7 @@ GIOChannel *g_io_channel_gnutls_new(int fd)
 
         err = gnutls_init(&gnutls_channel->session, GNUTLS_CLIENT);
 	if (err < 0) {
+		g_free(gnutls_channel->hostname);
 		g_free(gnutls_channel);
 		return NULL;
 	}
@@ -459,11 +596,32 @@ GIOChannel *g_io_channel_gnutls_new(int fd)
 		"NORMAL:-VERS-TLS-ALL:+VERS-TLS1.0:+VERS-SSL3.0:%COMPAT", NULL);
 #endif
 
-	gnutls_certificate_allocate_credentials(&gnutls_channel->cred);
 	gnutls_credentials_set(gnutls_channel->session,
-				GNUTLS_CRD_CERTIFICATE, gnutls_channel->cred);
+				GNUTLS_CRD_CERTIFICATE, global_cred);
+
+	if (hostname != NULL && is_address(hostname) == FALSE)
+		gnutls_server_name_set(gnutls_channel->session,
+				GNUTLS_NAME_DNS, hostname, strlen(hostname));
+
+	if (hostname != NULL)
+		gnutls_channel->session_id = g_strdup_printf("%s:%u",
+							hostname, port);
+
+	load_session_data(gnutls_channel);
 
 	DBG("channel %p", channel);
 
 	return channel;
 }
+
+void g_io_channel_gnutls_set_debug(GIOChannel *channel,
+				GIOGnuTLSDebugFunc func, gpointer user_data)
+{
+	GIOGnuTLSChannel *gnutls_channel = (GIOGnuTLSChannel *) channel;
+
+	if (channel == NULL)
+		return;
+
+	gnutls_channel->debug_func = func;
+	gnutls_channel->debug_data = user_data;
+}
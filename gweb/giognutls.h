@@ -23,4 +23,10 @@
 
 gboolean g_io_channel_supports_tls(void);
 
-GIOChannel *g_io_channel_gnutls_new(int fd);
+typedef void (*GIOGnuTLSDebugFunc)(const char *str, gpointer user_data);
+
+GIOChannel *g_io_channel_gnutls_new(int fd, const char *hostname,
+							guint16 port);
+
+void g_io_channel_gnutls_set_debug(GIOChannel *channel,
+				GIOGnuTLSDebugFunc func, gpointer user_data);
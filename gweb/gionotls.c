@@ -30,7 +30,13 @@ gboolean g_io_channel_supports_tls(void)
 	return FALSE;
 }
 
-GIOChannel *g_io_channel_gnutls_new(int fd)
+GIOChannel *g_io_channel_gnutls_new(int fd, const char *hostname,
+							guint16 port)
 {
 	return NULL;
 }
+
+void g_io_channel_gnutls_set_debug(GIOChannel *channel,
+				GIOGnuTLSDebugFunc func, gpointer user_data)
+{
+}
@@ -44,14 +44,25 @@
 #include "gweb.h"
 
 #define DEFAULT_BUFFER_SIZE  2048
+#define BODY_BUFFER_SIZE     16384
+#define MAX_HEADER_SIZE      65536
+#define DEFAULT_IDLE_TIMEOUT  15
+#define CONNECT_ATTEMPT_DELAY 250
 
 #define SESSION_FLAG_USE_TLS	(1 << 0)
 
 enum chunk_state {
 	CHUNK_SIZE,
+	CHUNK_EXT,
 	CHUNK_R_BODY,
 	CHUNK_N_BODY,
 	CHUNK_DATA,
+	CHUNK_TRAILER,
+};
+
+struct web_header {
+	const char *name;
+	char *value;
 };
 
 struct _GWebResult {
@@ -59,18 +70,20 @@ struct _GWebResult {
 	const guint8 *buffer;
 	gsize length;
 	gboolean use_chunk;
-	gchar *last_key;
-	GHashTable *headers;
+	struct web_header *headers;
+	unsigned int header_count;
+	GSList *joined_values;
 };
 
 struct web_session {
 	GWeb *web;
+	guint id;
+	char *key;
 
 	char *address;
 	char *host;
 	uint16_t port;
 	unsigned long flags;
-	struct addrinfo *addr;
 
 	char *content_type;
 
@@ -81,19 +94,41 @@ struct web_session {
 	guint resolv_action;
 	char *request;
 
+	GSList *candidates;
+	GSList *attempts;
+	guint attempt_timeout;
+	unsigned int attempt_count;
+	int first_family;
+	gint64 connect_start;
+	gboolean use_route;
+
 	guint8 *receive_buffer;
 	gsize receive_space;
+	gsize receive_len;
+	gsize scan_offset;
+	gsize header_len;
 	GString *send_buffer;
-	GString *current_header;
 	gboolean header_done;
 	gboolean body_done;
 	gboolean more_data;
 	gboolean request_started;
+	gboolean queued;
+	gboolean reused;
+	gboolean keep_alive;
+	gboolean response_done;
+	gboolean in_callback;
+	gboolean cancelled;
+	guint idle_timeout;
+
+	gboolean use_length;
+	gsize content_left;
 
 	enum chunk_state chunck_state;
 	gsize chunk_size;
 	gsize chunk_left;
 	gsize total_len;
+	gboolean chunk_digits;
+	gsize trailer_len;
 
 	GWebResult result;
 
@@ -106,6 +141,25 @@ struct web_session {
 	gpointer user_data;
 };
 
+struct web_attempt {
+	struct web_session *session;
+	char *address;
+	int family;
+	unsigned int number;
+	int sk;
+	GIOChannel *channel;
+	guint watch;
+};
+
+struct web_conn {
+	GWeb *web;
+	char *key;
+	char *address;
+	GIOChannel *channel;
+	guint watch;
+	guint timeout;
+};
+
 struct _GWeb {
 	int ref_count;
 
@@ -115,6 +169,7 @@ struct _GWeb {
 
 	int index;
 	GList *session_list;
+	GList *conn_list;
 
 	GResolv *resolv;
 	char *proxy;
@@ -152,6 +207,37 @@ static void _debug(GWeb *web, const char *file, const char *caller,
 	va_end(ap);
 }
 
+static void free_attempt(gpointer data)
+{
+	struct web_attempt *attempt = data;
+
+	if (attempt->watch > 0)
+		g_source_remove(attempt->watch);
+
+	if (attempt->channel != NULL)
+		g_io_channel_unref(attempt->channel);
+
+	if (attempt->sk >= 0)
+		close(attempt->sk);
+
+	g_free(attempt->address);
+	g_free(attempt);
+}
+
+static void stop_attempts(struct web_session *session)
+{
+	if (session->attempt_timeout > 0) {
+		g_source_remove(session->attempt_timeout);
+		session->attempt_timeout = 0;
+	}
+
+	g_slist_free_full(session->attempts, free_attempt);
+	session->attempts = NULL;
+
+	g_slist_free_full(session->candidates, g_free);
+	session->candidates = NULL;
+}
+
 static void free_session(struct web_session *session)
 {
 	GWeb *web;
@@ -165,6 +251,8 @@ static void free_session(struct web_session *session)
 	if (session->resolv_action > 0)
 		g_resolv_cancel_lookup(web->resolv, session->resolv_action);
 
+	stop_attempts(session);
+
 	if (session->transport_watch > 0)
 		g_source_remove(session->transport_watch);
 
@@ -174,26 +262,20 @@ static void free_session(struct web_session *session)
 	if (session->transport_channel != NULL)
 		g_io_channel_unref(session->transport_channel);
 
-	g_free(session->result.last_key);
-
-	if (session->result.headers != NULL)
-		g_hash_table_destroy(session->result.headers);
+	g_free(session->result.headers);
+	g_slist_free_full(session->result.joined_values, g_free);
 
 	if (session->send_buffer != NULL)
 		g_string_free(session->send_buffer, TRUE);
 
-	if (session->current_header != NULL)
-		g_string_free(session->current_header, TRUE);
-
 	g_free(session->receive_buffer);
 
 	g_free(session->content_type);
 
 	g_free(session->host);
 	g_free(session->address);
-	if (session->addr != NULL)
-		freeaddrinfo(session->addr);
 
+	g_free(session->key);
 	g_free(session);
 }
 
@@ -209,6 +291,37 @@ static void flush_sessions(GWeb *web)
 	web->session_list = NULL;
 }
 
+static void free_conn(struct web_conn *conn)
+{
+	if (conn == NULL)
+		return;
+
+	if (conn->timeout > 0)
+		g_source_remove(conn->timeout);
+
+	if (conn->watch > 0)
+		g_source_remove(conn->watch);
+
+	if (conn->channel != NULL)
+		g_io_channel_unref(conn->channel);
+
+	g_free(conn->address);
+	g_free(conn->key);
+	g_free(conn);
+}
+
+static void flush_conns(GWeb *web)
+{
+	GList *list;
+
+	for (list = g_list_first(web->conn_list);
+					list; list = g_list_next(list))
+		free_conn(list->data);
+
+	g_list_free(web->conn_list);
+	web->conn_list = NULL;
+}
+
 GWeb *g_web_new(int index)
 {
 	GWeb *web;
@@ -261,6 +374,7 @@ void g_web_unref(GWeb *web)
 		return;
 
 	flush_sessions(web);
+	flush_conns(web);
 
 	g_resolv_unref(web->resolv);
 
@@ -449,14 +563,16 @@ static inline void call_result_func(struct web_session *session, guint16 status)
 	if (status != 0)
 		session->result.status = status;
 
+	session->in_callback = TRUE;
 	session->result_func(&session->result, session->user_data);
-
+	session->in_callback = FALSE;
 }
 
-static inline void call_route_func(struct web_session *session)
+static inline void call_route_func(struct web_session *session,
+					const char *address, int family)
 {
 	if (session->route_func != NULL)
-		session->route_func(session->address, session->addr->ai_family,
+		session->route_func(address, family,
 				session->web->index, session->user_data);
 }
 
@@ -658,47 +774,55 @@ static gboolean send_data(GIOChannel *channel, GIOCondition cond,
 	return TRUE;
 }
 
+static void session_done(struct web_session *session, guint16 status);
+static int retry_session(struct web_session *session);
+
 static int decode_chunked(struct web_session *session,
 					const guint8 *buf, gsize len)
 {
 	const guint8 *ptr = buf;
-	gsize counter;
+	const guint8 *pos;
+	gsize count;
+	int value;
 
 	while (len > 0) {
-		guint8 *pos;
-		gsize count;
-		char *str;
-
 		switch (session->chunck_state) {
 		case CHUNK_SIZE:
-			pos = memchr(ptr, '\n', len);
-			if (pos == NULL) {
-				g_string_append_len(session->current_header,
-						(gchar *) ptr, len);
-				return 0;
+			value = g_ascii_xdigit_value(*ptr);
+			if (value < 0) {
+				if (session->chunk_digits == FALSE)
+					return -EILSEQ;
+
+				session->chunck_state = CHUNK_EXT;
+				break;
 			}
 
-			count = pos - ptr;
-			if (count < 1 || ptr[count - 1] != '\r')
+			if (session->chunk_size > G_MAXSIZE >> 4)
 				return -EILSEQ;
 
-			g_string_append_len(session->current_header,
-						(gchar *) ptr, count);
+			session->chunk_size = (session->chunk_size << 4) | value;
+			session->chunk_digits = TRUE;
+			ptr++;
+			len--;
+			break;
+		case CHUNK_EXT:
+			/* chunk extensions are skipped up to the line end */
+			pos = memchr(ptr, '\n', len);
+			if (pos == NULL)
+				return 0;
 
-			len -= count + 1;
+			len -= pos - ptr + 1;
 			ptr = pos + 1;
 
-			str = session->current_header->str;
-
-			counter = strtoul(str, NULL, 16);
-			if ((counter == 0 && errno == EINVAL) ||
-						counter == ULONG_MAX)
-				return -EILSEQ;
-
-			session->chunk_size = counter;
-			session->chunk_left = counter;
+			session->chunk_left = session->chunk_size;
+			session->chunk_digits = FALSE;
 
-			session->chunck_state = CHUNK_DATA;
+			if (session->chunk_size == 0) {
+				debug(session->web, "Download Done in chunk");
+				session->trailer_len = 0;
+				session->chunck_state = CHUNK_TRAILER;
+			} else
+				session->chunck_state = CHUNK_DATA;
 			break;
 		case CHUNK_R_BODY:
 			if (*ptr != '\r')
@@ -712,41 +836,52 @@ static int decode_chunked(struct web_session *session,
 				return -EILSEQ;
 			ptr++;
 			len--;
+			session->chunk_size = 0;
 			session->chunck_state = CHUNK_SIZE;
 			break;
 		case CHUNK_DATA:
-			if (session->chunk_size == 0) {
-				debug(session->web, "Download Done in chunk");
-				g_string_truncate(session->current_header, 0);
-				return 0;
-			}
+			count = MIN(session->chunk_left, len);
 
-			if (session->chunk_left <= len) {
-				session->result.buffer = ptr;
-				session->result.length = session->chunk_left;
-				call_result_func(session, 0);
+			session->result.buffer = ptr;
+			session->result.length = count;
+			call_result_func(session, 0);
 
-				len -= session->chunk_left;
-				ptr += session->chunk_left;
+			len -= count;
+			ptr += count;
 
-				session->total_len += session->chunk_left;
-				session->chunk_left = 0;
+			session->total_len += count;
+			session->chunk_left -= count;
 
-				g_string_truncate(session->current_header, 0);
+			if (session->chunk_left == 0)
 				session->chunck_state = CHUNK_R_BODY;
+			break;
+		case CHUNK_TRAILER:
+			pos = memchr(ptr, '\n', len);
+			count = (pos != NULL ? pos : ptr + len) - ptr;
+
+			/* a carriage return alone keeps the line empty */
+			session->trailer_len += count;
+			if (count > 0 && ptr[count - 1] == '\r')
+				session->trailer_len--;
+
+			if (pos == NULL)
+				return 0;
+
+			len -= count + 1;
+			ptr = pos + 1;
+
+			if (session->trailer_len > 0) {
+				session->trailer_len = 0;
 				break;
 			}
-			/* more data */
-			session->result.buffer = ptr;
-			session->result.length = len;
-			call_result_func(session, 0);
 
-			session->chunk_left -= len;
-			session->total_len += len;
+			session->response_done = TRUE;
 
-			len -= len;
-			ptr += len;
-			break;
+			/* anything after the last chunk breaks the framing */
+			if (len > 0)
+				session->keep_alive = FALSE;
+
+			return 0;
 		}
 	}
 
@@ -761,6 +896,17 @@ static int handle_body(struct web_session *session,
 	debug(session->web, "[body] length %zu", len);
 
 	if (session->result.use_chunk == FALSE) {
+		if (session->use_length == TRUE) {
+			if (len > session->content_left) {
+				session->keep_alive = FALSE;
+				len = session->content_left;
+			}
+
+			session->content_left -= len;
+			if (session->content_left == 0)
+				session->response_done = TRUE;
+		}
+
 		if (len > 0) {
 			session->result.buffer = buf;
 			session->result.length = len;
@@ -770,207 +916,359 @@ static int handle_body(struct web_session *session,
 	}
 
 	err = decode_chunked(session, buf, len);
-	if (err < 0) {
+	if (err < 0)
 		debug(session->web, "Error in chunk decode %d", err);
 
-		session->result.buffer = NULL;
-		session->result.length = 0;
-		call_result_func(session, 400);
-	}
-
 	return err;
 }
 
-static void handle_multi_line(struct web_session *session)
+static const char *find_header(GWebResult *result, const char *name)
 {
-	gsize count;
-	char *str;
-	gchar *value;
+	struct web_header *match = NULL;
+	GString *joined = NULL;
+	unsigned int i;
 
-	str = session->current_header->str;
+	for (i = 0; i < result->header_count; i++) {
+		struct web_header *header = &result->headers[i];
 
-	if (str[0] != ' ' && str[0] != '\t')
-		return;
+		if (header->name == NULL ||
+				g_ascii_strcasecmp(header->name, name) != 0)
+			continue;
 
-	while (str[0] == ' ' || str[0] == '\t')
-		str++;
+		if (match == NULL) {
+			match = header;
+			continue;
+		}
 
-	count = str - session->current_header->str;
-	if (count > 0) {
-		g_string_erase(session->current_header, 0, count);
-		g_string_insert_c(session->current_header, 0, ' ');
-	}
+		/* repeated fields are joined the first time they are asked for */
+		if (joined == NULL)
+			joined = g_string_new(match->value);
 
-	value = g_hash_table_lookup(session->result.headers,
-					session->result.last_key);
-	if (value != NULL) {
-		g_string_insert(session->current_header, 0, value);
+		g_string_append(joined, "; ");
+		g_string_append(joined, header->value);
 
-		str = session->current_header->str;
+		header->name = NULL;
+	}
+
+	if (match == NULL)
+		return NULL;
 
-		g_hash_table_replace(session->result.headers,
-					g_strdup(session->result.last_key),
-					g_strdup(str));
+	if (joined != NULL) {
+		match->value = g_string_free(joined, FALSE);
+		result->joined_values = g_slist_prepend(result->joined_values,
+								match->value);
 	}
+
+	return match->value;
 }
 
-static void add_header_field(struct web_session *session)
+static gboolean find_header_end(struct web_session *session)
 {
-	gsize count;
+	guint8 *buf = session->receive_buffer;
 	guint8 *pos;
-	char *str;
-	gchar *value;
-	gchar *key;
 
-	str = session->current_header->str;
+	while (session->scan_offset < session->receive_len) {
+		gsize start = session->scan_offset;
+		gsize count;
+
+		pos = memchr(buf + start, '\n', session->receive_len - start);
+		if (pos == NULL)
+			return FALSE;
+
+		count = pos - (buf + start);
+		session->scan_offset = start + count + 1;
+
+		if (count == 0 || (count == 1 && buf[start] == '\r')) {
+			session->header_len = session->scan_offset;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/*
+ * The header block is split in place: line ends and the colon after a
+ * field name are overwritten with terminators and only the positions
+ * of names and values are recorded.
+ */
+static int parse_header(struct web_session *session)
+{
+	char *ptr = (char *) session->receive_buffer;
+	char *end = ptr + session->header_len;
+	struct web_header *header = NULL;
+	char *value_end = NULL;
+	unsigned int lines = 0;
+	char *pos;
+
+	for (pos = ptr; pos < end; pos++) {
+		pos = memchr(pos, '\n', end - pos);
+		if (pos == NULL)
+			break;
+		lines++;
+	}
+
+	session->result.headers = g_try_new0(struct web_header, lines);
+	if (session->result.headers == NULL)
+		return -ENOMEM;
+
+	while (ptr < end) {
+		char *line = ptr;
+		char *eol;
+
+		eol = memchr(ptr, '\n', end - ptr);
+		ptr = eol + 1;
+
+		*eol = '\0';
+		if (eol > line && eol[-1] == '\r')
+			*(--eol) = '\0';
+
+		if (eol == line)
+			break;
+
+		debug(session->web, "[header] %s", line);
+
+		if (session->result.status == 0) {
+			unsigned int major, minor, code;
+
+			if (sscanf(line, "HTTP/%u.%u %u",
+					&major, &minor, &code) == 3) {
+				session->result.status = code;
+				session->keep_alive = major > 1 ||
+						(major == 1 && minor > 0);
+				continue;
+			}
+		}
+
+		/* a folded line continues the previous value */
+		if (line[0] == ' ' || line[0] == '\t') {
+			if (header == NULL)
+				continue;
 
-	pos = memchr(str, ':', session->current_header->len);
-	if (pos != NULL) {
-		*pos = '\0';
-		pos++;
+			while (*line == ' ' || *line == '\t')
+				line++;
 
-		key = g_strdup(str);
+			*value_end = ' ';
+			memmove(value_end + 1, line, eol - line + 1);
+			value_end += eol - line + 1;
+			continue;
+		}
+
+		pos = memchr(line, ':', eol - line);
+		if (pos == NULL) {
+			header = NULL;
+			continue;
+		}
 
-		/* remove preceding white spaces */
-		while (*pos == ' ')
+		*pos++ = '\0';
+
+		while (*pos == ' ' || *pos == '\t')
 			pos++;
 
-		count = (char *) pos - str;
+		header = &session->result.headers[session->result.header_count++];
+		header->name = line;
+		header->value = pos;
+		value_end = eol;
+	}
+
+	return 0;
+}
+
+static gboolean header_has_token(const char *value, const char *token)
+{
+	gchar **tokens;
+	gboolean found = FALSE;
+	int i;
 
-		g_string_erase(session->current_header, 0, count);
+	if (value == NULL)
+		return FALSE;
 
-		value = g_hash_table_lookup(session->result.headers, key);
-		if (value != NULL) {
-			g_string_insert_c(session->current_header, 0, ' ');
-			g_string_insert_c(session->current_header, 0, ';');
+	tokens = g_strsplit(value, ",", 0);
 
-			g_string_insert(session->current_header, 0, value);
+	for (i = 0; tokens[i] != NULL; i++) {
+		if (g_ascii_strcasecmp(g_strstrip(tokens[i]), token) == 0) {
+			found = TRUE;
+			break;
 		}
+	}
+
+	g_strfreev(tokens);
+
+	return found;
+}
+
+static void prepare_body(struct web_session *session)
+{
+	const char *version = session->web->http_version;
+	guint16 status = session->result.status;
+	const char *val;
+
+	if (status == 204 || status == 304) {
+		session->use_length = TRUE;
+		session->content_left = 0;
+	} else {
+		val = find_header(&session->result, "Transfer-Encoding");
+		if (val != NULL && g_strrstr(val, "chunked") != NULL) {
+			session->result.use_chunk = TRUE;
 
-		str = session->current_header->str;
-		g_hash_table_replace(session->result.headers, key,
-							g_strdup(str));
+			session->chunck_state = CHUNK_SIZE;
+			session->chunk_size = 0;
+			session->chunk_digits = FALSE;
+			session->chunk_left = 0;
+			session->total_len = 0;
+		} else {
+			val = find_header(&session->result, "Content-Length");
+			if (val != NULL) {
+				session->use_length = TRUE;
+				session->content_left =
+					g_ascii_strtoull(val, NULL, 10);
+			}
+		}
+	}
 
-		g_free(session->result.last_key);
-		session->result.last_key = g_strdup(key);
+	/*
+	 * The connection can only be handed to the next request when
+	 * both sides speak HTTP/1.1, nobody asked for it to be closed and
+	 * the end of the body is known without waiting for the close.
+	 */
+	if (session->web->close_connection == TRUE ||
+			(version != NULL && g_strcmp0(version, "1.1") != 0) ||
+			(session->result.use_chunk == FALSE &&
+					session->use_length == FALSE))
+		session->keep_alive = FALSE;
+
+	val = find_header(&session->result, "Connection");
+	if (header_has_token(val, "close") == TRUE)
+		session->keep_alive = FALSE;
+
+	val = find_header(&session->result, "Keep-Alive");
+	if (val != NULL) {
+		val = strstr(val, "timeout=");
+		if (val != NULL)
+			session->idle_timeout = strtoul(val + 8, NULL, 10);
 	}
+
+	debug(session->web, "keep alive %d", session->keep_alive);
+}
+
+static int grow_receive_buffer(struct web_session *session, gsize size)
+{
+	guint8 *buffer;
+
+	buffer = g_try_realloc(session->receive_buffer, size);
+	if (buffer == NULL)
+		return -ENOMEM;
+
+	session->receive_buffer = buffer;
+	session->receive_space = size;
+
+	return 0;
 }
 
 static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 							gpointer user_data)
 {
 	struct web_session *session = user_data;
-	guint8 *ptr = session->receive_buffer;
-	gsize bytes_read;
+	GWeb *web = session->web;
+	gboolean ret = FALSE;
+	gsize offset, bytes_read;
 	GIOStatus status;
+	guint8 *ptr;
+
+	/* the result callback may drop the last reference */
+	g_web_ref(web);
 
 	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
 		session->transport_watch = 0;
-		session->result.buffer = NULL;
-		session->result.length = 0;
-		call_result_func(session, 400);
-		return FALSE;
+		if (retry_session(session) < 0)
+			session_done(session, 400);
+		goto out;
+	}
+
+	/*
+	 * The header is collected at the start of the buffer and the
+	 * body is read behind it, so the header fields stay valid.
+	 */
+	if (session->header_done == TRUE)
+		offset = session->header_len;
+	else {
+		offset = session->receive_len;
+
+		if (session->receive_space - offset < DEFAULT_BUFFER_SIZE / 2) {
+			if (session->receive_space >= MAX_HEADER_SIZE)
+				goto error;
+
+			if (grow_receive_buffer(session,
+					session->receive_space * 2) < 0)
+				goto error;
+		}
 	}
 
-	status = g_io_channel_read_chars(channel,
-				(gchar *) session->receive_buffer,
-				session->receive_space - 1, &bytes_read, NULL);
+	ptr = session->receive_buffer + offset;
+
+	status = g_io_channel_read_chars(channel, (gchar *) ptr,
+				session->receive_space - offset - 1,
+				&bytes_read, NULL);
 
 	debug(session->web, "bytes read %zu", bytes_read);
 
 	if (status != G_IO_STATUS_NORMAL && status != G_IO_STATUS_AGAIN) {
 		session->transport_watch = 0;
-		session->result.buffer = NULL;
-		session->result.length = 0;
-		call_result_func(session, 0);
-		return FALSE;
+		if (retry_session(session) < 0)
+			session_done(session, 0);
+		goto out;
 	}
 
-	session->receive_buffer[bytes_read] = '\0';
+	ptr[bytes_read] = '\0';
 
 	if (session->header_done == TRUE) {
-		if (handle_body(session, session->receive_buffer,
-							bytes_read) < 0) {
-			session->transport_watch = 0;
-			return FALSE;
-		}
-		return TRUE;
+		if (handle_body(session, ptr, bytes_read) < 0)
+			goto error;
+		goto done;
 	}
 
-	while (bytes_read > 0) {
-		guint8 *pos;
-		gsize count;
-		char *str;
-
-		pos = memchr(ptr, '\n', bytes_read);
-		if (pos == NULL) {
-			g_string_append_len(session->current_header,
-						(gchar *) ptr, bytes_read);
-			return TRUE;
-		}
-
-		*pos = '\0';
-		count = strlen((char *) ptr);
-		if (count > 0 && ptr[count - 1] == '\r') {
-			ptr[--count] = '\0';
-			bytes_read--;
-		}
-
-		g_string_append_len(session->current_header,
-						(gchar *) ptr, count);
-
-		bytes_read -= count + 1;
-		if (bytes_read > 0)
-			ptr = pos + 1;
-		else
-			ptr = NULL;
+	session->receive_len += bytes_read;
 
-		if (session->current_header->len == 0) {
-			char *val;
+	if (find_header_end(session) == FALSE) {
+		ret = TRUE;
+		goto out;
+	}
 
-			session->header_done = TRUE;
+	if (session->receive_space - session->header_len <
+						BODY_BUFFER_SIZE &&
+			grow_receive_buffer(session, session->header_len +
+						BODY_BUFFER_SIZE) < 0)
+		goto error;
 
-			val = g_hash_table_lookup(session->result.headers,
-							"Transfer-Encoding");
-			if (val != NULL) {
-				val = g_strrstr(val, "chunked");
-				if (val != NULL) {
-					session->result.use_chunk = TRUE;
-
-					session->chunck_state = CHUNK_SIZE;
-					session->chunk_left = 0;
-					session->total_len = 0;
-				}
-			}
+	if (parse_header(session) < 0)
+		goto error;
 
-			if (handle_body(session, ptr, bytes_read) < 0) {
-				session->transport_watch = 0;
-				return FALSE;
-			}
-			break;
-		}
+	session->header_done = TRUE;
 
-		str = session->current_header->str;
+	prepare_body(session);
 
-		if (session->result.status == 0) {
-			unsigned int code;
+	if (handle_body(session, session->receive_buffer + session->header_len,
+			session->receive_len - session->header_len) < 0)
+		goto error;
 
-			if (sscanf(str, "HTTP/%*s %u %*s", &code) == 1)
-				session->result.status = code;
-		}
+done:
+	if (session->response_done == FALSE && session->cancelled == FALSE) {
+		ret = TRUE;
+		goto out;
+	}
 
-		debug(session->web, "[header] %s", str);
+	session->transport_watch = 0;
+	session_done(session, 0);
+	goto out;
 
-		/* handle multi-line header */
-		if (str[0] == ' ' || str[0] == '\t')
-			handle_multi_line(session);
-		else
-			add_header_field(session);
+error:
+	session->transport_watch = 0;
+	session_done(session, 400);
 
-		g_string_truncate(session->current_header, 0);
-	}
+out:
+	g_web_unref(web);
 
-	return TRUE;
+	return ret;
 }
 
 static int bind_to_address(int sk, const char *interface, int family)
@@ -1024,28 +1322,31 @@ static inline int bind_socket(int sk, int index, int family)
 	return err;
 }
 
-static int connect_session_transport(struct web_session *session)
+static void add_session_watches(struct web_session *session)
 {
-	GIOFlags flags;
-	int sk;
+	session->transport_watch = g_io_add_watch(session->transport_channel,
+				G_IO_IN | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
+						received_data, session);
 
-	sk = socket(session->addr->ai_family, SOCK_STREAM | SOCK_CLOEXEC,
-			IPPROTO_TCP);
-	if (sk < 0)
-		return -EIO;
+	session->send_watch = g_io_add_watch(session->transport_channel,
+				G_IO_OUT | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
+						send_data, session);
+}
 
-	if (session->web->index > 0) {
-		if (bind_socket(sk, session->web->index,
-					session->addr->ai_family) < 0) {
-			debug(session->web, "bind() %s", strerror(errno));
-			close(sk);
-			return -EIO;
-		}
-	}
+static int setup_session_channel(struct web_session *session, int sk)
+{
+	GIOFlags flags;
 
 	if (session->flags & SESSION_FLAG_USE_TLS) {
 		debug(session->web, "using TLS encryption");
-		session->transport_channel = g_io_channel_gnutls_new(sk);
+		session->transport_channel = g_io_channel_gnutls_new(sk,
+						session->host, session->port);
+		if (session->transport_channel != NULL &&
+					session->web->debug_func != NULL)
+			g_io_channel_gnutls_set_debug(
+						session->transport_channel,
+						session->web->debug_func,
+						session->web->debug_data);
 	} else {
 		debug(session->web, "no encryption");
 		session->transport_channel = g_io_channel_unix_new(sk);
@@ -1066,43 +1367,481 @@ static int connect_session_transport(struct web_session *session)
 
 	g_io_channel_set_close_on_unref(session->transport_channel, TRUE);
 
-	if (connect(sk, session->addr->ai_addr,
-			session->addr->ai_addrlen) < 0) {
-		if (errno != EINPROGRESS) {
-			debug(session->web, "connect() %s", strerror(errno));
-			close(sk);
-			return -EIO;
-		}
-	}
-
-	session->transport_watch = g_io_add_watch(session->transport_channel,
-				G_IO_IN | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
-						received_data, session);
-
-	session->send_watch = g_io_add_watch(session->transport_channel,
-				G_IO_OUT | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
-						send_data, session);
+	add_session_watches(session);
 
 	return 0;
 }
 
-static int create_transport(struct web_session *session)
+static const char *family_name(int family)
 {
-	int err;
+	return family == AF_INET6 ? "IPv6" : "IPv4";
+}
 
-	err = connect_session_transport(session);
-	if (err < 0)
-		return err;
+static int next_attempt(struct web_session *session);
 
-	debug(session->web, "creating session %s:%u",
-					session->address, session->port);
+static gboolean attempt_event(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct web_attempt *attempt = user_data;
+	struct web_session *session = attempt->session;
+	socklen_t len = sizeof(int);
+	int err = 0, sk;
 
-	return 0;
-}
+	attempt->watch = 0;
+	session->attempts = g_slist_remove(session->attempts, attempt);
 
-static int parse_url(struct web_session *session,
-				const char *url, const char *proxy)
-{
+	if (getsockopt(attempt->sk, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+	else if (err == 0 && (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)))
+		err = EIO;
+
+	if (err != 0) {
+		debug(session->web, "connect() %s attempt %u: %s",
+				attempt->address, attempt->number,
+				strerror(err));
+		free_attempt(attempt);
+
+		/* A failed attempt does not wait for the delay to expire */
+		if (next_attempt(session) < 0)
+			session_done(session, 400);
+
+		return FALSE;
+	}
+
+	debug(session->web, "connected to %s (%s) with attempt %u of %u "
+			"after %lld ms", attempt->address,
+			family_name(attempt->family), attempt->number,
+			session->attempt_count,
+			(long long) (g_get_monotonic_time() -
+					session->connect_start) / 1000);
+
+	if (attempt->family != session->first_family)
+		debug(session->web, "%s lost the race against %s",
+					family_name(session->first_family),
+					family_name(attempt->family));
+
+	sk = attempt->sk;
+	attempt->sk = -1;
+
+	g_free(session->address);
+	session->address = attempt->address;
+	attempt->address = NULL;
+
+	free_attempt(attempt);
+	stop_attempts(session);
+	session->use_route = FALSE;
+
+	if (setup_session_channel(session, sk) < 0)
+		session_done(session, 409);
+
+	return FALSE;
+}
+
+static int start_attempt(struct web_session *session, const char *address)
+{
+	struct web_attempt *attempt;
+	struct addrinfo hints, *addr;
+	char port[6];
+	int sk;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_flags = AI_NUMERICHOST;
+	hints.ai_family = session->web->family;
+
+	snprintf(port, sizeof(port), "%u", session->port);
+	if (getaddrinfo(address, port, &hints, &addr) != 0 || addr == NULL)
+		return -EINVAL;
+
+	if (session->use_route == TRUE)
+		call_route_func(session, address, addr->ai_family);
+
+	sk = socket(addr->ai_family, SOCK_STREAM | SOCK_CLOEXEC |
+						SOCK_NONBLOCK, IPPROTO_TCP);
+	if (sk < 0) {
+		freeaddrinfo(addr);
+		return -EIO;
+	}
+
+	if (session->web->index > 0) {
+		if (bind_socket(sk, session->web->index,
+						addr->ai_family) < 0) {
+			debug(session->web, "bind() %s", strerror(errno));
+			freeaddrinfo(addr);
+			close(sk);
+			return -EIO;
+		}
+	}
+
+	if (connect(sk, addr->ai_addr, addr->ai_addrlen) < 0) {
+		if (errno != EINPROGRESS) {
+			debug(session->web, "connect() %s: %s", address,
+							strerror(errno));
+			freeaddrinfo(addr);
+			close(sk);
+			return -EIO;
+		}
+	}
+
+	attempt = g_try_new0(struct web_attempt, 1);
+	if (attempt == NULL) {
+		freeaddrinfo(addr);
+		close(sk);
+		return -ENOMEM;
+	}
+
+	if (session->attempt_count == 0)
+		session->first_family = addr->ai_family;
+
+	attempt->session = session;
+	attempt->address = g_strdup(address);
+	attempt->family = addr->ai_family;
+	attempt->number = ++session->attempt_count;
+	attempt->sk = sk;
+
+	freeaddrinfo(addr);
+
+	attempt->channel = g_io_channel_unix_new(sk);
+	attempt->watch = g_io_add_watch(attempt->channel,
+				G_IO_OUT | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
+						attempt_event, attempt);
+
+	session->attempts = g_slist_append(session->attempts, attempt);
+
+	debug(session->web, "connecting to %s port %u, attempt %u",
+				address, session->port, attempt->number);
+
+	return 0;
+}
+
+static gboolean attempt_delay(gpointer user_data)
+{
+	struct web_session *session = user_data;
+
+	session->attempt_timeout = 0;
+
+	next_attempt(session);
+
+	return FALSE;
+}
+
+/*
+ * Start a connection attempt to the next candidate address. While
+ * attempts are outstanding, another one is started every
+ * CONNECT_ATTEMPT_DELAY milliseconds, or right away if one fails.
+ * The first connection to be established wins (RFC 8305).
+ */
+static int next_attempt(struct web_session *session)
+{
+	if (session->attempt_timeout > 0) {
+		g_source_remove(session->attempt_timeout);
+		session->attempt_timeout = 0;
+	}
+
+	while (session->candidates != NULL) {
+		char *address = session->candidates->data;
+		int err;
+
+		session->candidates = g_slist_delete_link(session->candidates,
+							session->candidates);
+
+		err = start_attempt(session, address);
+		g_free(address);
+		if (err < 0)
+			continue;
+
+		if (session->candidates != NULL)
+			session->attempt_timeout =
+				g_timeout_add(CONNECT_ATTEMPT_DELAY,
+						attempt_delay, session);
+
+		return 0;
+	}
+
+	if (session->attempts == NULL)
+		return -EIO;
+
+	return 0;
+}
+
+static int create_transport(struct web_session *session)
+{
+	if (session->candidates == NULL)
+		session->candidates = g_slist_append(NULL,
+					g_strdup(session->address));
+
+	debug(session->web, "creating session %s:%u",
+					session->host, session->port);
+
+	session->attempt_count = 0;
+	session->connect_start = g_get_monotonic_time();
+
+	return next_attempt(session);
+}
+
+/*
+ * A pooled connection may have been closed by the server just as it
+ * was picked up. Requests without a body can safely be sent again on
+ * a fresh connection as long as nothing of the response has arrived.
+ */
+static int retry_session(struct web_session *session)
+{
+	if (session->reused == FALSE || session->content_type != NULL)
+		return -EINVAL;
+
+	if (session->result.status != 0 || session->receive_len > 0)
+		return -EINVAL;
+
+	debug(session->web, "connection %s closed, reconnecting",
+							session->key);
+
+	session->reused = FALSE;
+
+	if (session->send_watch > 0) {
+		g_source_remove(session->send_watch);
+		session->send_watch = 0;
+	}
+
+	g_io_channel_unref(session->transport_channel);
+	session->transport_channel = NULL;
+
+	g_string_truncate(session->send_buffer, 0);
+	session->request_started = FALSE;
+	session->body_done = FALSE;
+
+	return create_transport(session);
+}
+
+static void remove_conn(struct web_conn *conn)
+{
+	GWeb *web = conn->web;
+
+	web->conn_list = g_list_remove(web->conn_list, conn);
+	free_conn(conn);
+}
+
+static gboolean conn_event(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct web_conn *conn = user_data;
+
+	debug(conn->web, "idle connection %s closed", conn->key);
+
+	conn->watch = 0;
+	remove_conn(conn);
+
+	return FALSE;
+}
+
+static gboolean conn_timeout(gpointer user_data)
+{
+	struct web_conn *conn = user_data;
+
+	debug(conn->web, "idle connection %s expired", conn->key);
+
+	conn->timeout = 0;
+	remove_conn(conn);
+
+	return FALSE;
+}
+
+static gboolean request_sent(struct web_session *session)
+{
+	if (session->body_done == TRUE)
+		return TRUE;
+
+	if (session->request_started == FALSE || session->more_data == TRUE)
+		return FALSE;
+
+	return session->send_buffer->len == 0 && session->fd == -1;
+}
+
+static void pool_session_transport(struct web_session *session)
+{
+	GWeb *web = session->web;
+	struct web_conn *conn;
+	guint timeout;
+
+	conn = g_try_new0(struct web_conn, 1);
+	if (conn == NULL)
+		return;
+
+	if (session->transport_watch > 0) {
+		g_source_remove(session->transport_watch);
+		session->transport_watch = 0;
+	}
+
+	if (session->send_watch > 0) {
+		g_source_remove(session->send_watch);
+		session->send_watch = 0;
+	}
+
+	conn->web = web;
+	conn->key = g_strdup(session->key);
+	conn->address = g_strdup(session->address);
+	conn->channel = session->transport_channel;
+	session->transport_channel = NULL;
+
+	timeout = DEFAULT_IDLE_TIMEOUT;
+	if (session->idle_timeout > 0 && session->idle_timeout < timeout)
+		timeout = session->idle_timeout;
+
+	/* any data or hangup on an idle connection ends it */
+	conn->watch = g_io_add_watch(conn->channel,
+				G_IO_IN | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
+							conn_event, conn);
+	conn->timeout = g_timeout_add_seconds(timeout, conn_timeout, conn);
+
+	web->conn_list = g_list_append(web->conn_list, conn);
+
+	debug(web, "keeping connection %s for %u seconds", conn->key, timeout);
+}
+
+static struct web_conn *take_conn(GWeb *web, const char *key)
+{
+	GList *list;
+
+	for (list = web->conn_list; list; list = list->next) {
+		struct web_conn *conn = list->data;
+
+		if (g_strcmp0(conn->key, key) != 0)
+			continue;
+
+		web->conn_list = g_list_delete_link(web->conn_list, list);
+
+		if (conn->timeout > 0) {
+			g_source_remove(conn->timeout);
+			conn->timeout = 0;
+		}
+
+		if (conn->watch > 0) {
+			g_source_remove(conn->watch);
+			conn->watch = 0;
+		}
+
+		return conn;
+	}
+
+	return NULL;
+}
+
+static struct web_session *find_session(GWeb *web, const char *key,
+							gboolean queued)
+{
+	GList *list;
+
+	for (list = web->session_list; list; list = list->next) {
+		struct web_session *session = list->data;
+
+		if (session->queued == queued &&
+				g_strcmp0(session->key, key) == 0)
+			return session;
+	}
+
+	return NULL;
+}
+
+static void resolv_result(GResolvResultStatus status,
+					char **results, gpointer user_data);
+
+static int start_session(struct web_session *session)
+{
+	GWeb *web = session->web;
+	struct web_conn *conn;
+
+	session->queued = FALSE;
+
+	conn = take_conn(web, session->key);
+	if (conn != NULL) {
+		debug(web, "reusing connection %s", conn->key);
+
+		g_free(session->address);
+		session->address = conn->address;
+		conn->address = NULL;
+
+		session->transport_channel = conn->channel;
+		conn->channel = NULL;
+
+		free_conn(conn);
+
+		session->reused = TRUE;
+		add_session_watches(session);
+
+		return 0;
+	}
+
+	if (session->address == NULL && inet_aton(session->host, NULL) == 0) {
+		session->resolv_action = g_resolv_lookup_hostname(web->resolv,
+					session->host, resolv_result, session);
+		if (session->resolv_action == 0)
+			return -EIO;
+
+		return 0;
+	}
+
+	if (session->address == NULL)
+		session->address = g_strdup(session->host);
+
+	return create_transport(session);
+}
+
+static void start_queued_session(GWeb *web, const char *key)
+{
+	struct web_session *session;
+
+	session = find_session(web, key, TRUE);
+	if (session == NULL)
+		return;
+
+	debug(web, "starting queued request %s", session->request);
+
+	if (start_session(session) < 0)
+		session_done(session, 409);
+}
+
+static void remove_session(struct web_session *session)
+{
+	GWeb *web = session->web;
+	gboolean queued = session->queued;
+	char *key;
+
+	key = session->key;
+	session->key = NULL;
+
+	web->session_list = g_list_remove(web->session_list, session);
+	free_session(session);
+
+	if (queued == FALSE)
+		start_queued_session(web, key);
+
+	g_free(key);
+}
+
+/*
+ * Report the end of a request and release its session. When the
+ * response left the connection in a known state it is kept around
+ * for the next request to the same host.
+ */
+static void session_done(struct web_session *session, guint16 status)
+{
+	GWeb *web = g_web_ref(session->web);
+
+	session->result.buffer = NULL;
+	session->result.length = 0;
+	call_result_func(session, status);
+
+	if (session->keep_alive == TRUE && session->response_done == TRUE &&
+				request_sent(session) == TRUE &&
+				session->transport_channel != NULL)
+		pool_session_transport(session);
+
+	remove_session(session);
+
+	g_web_unref(web);
+}
+
+static int parse_url(struct web_session *session,
+				const char *url, const char *proxy)
+{
 	char *scheme, *host, *port, *path;
 
 	scheme = g_strdup(url);
@@ -1197,43 +1936,59 @@ static int parse_url(struct web_session *session,
 	return 0;
 }
 
-static void resolv_result(GResolvResultStatus status,
-					char **results, gpointer user_data)
+/*
+ * Alternate between address families, starting with the one the
+ * resolver sorted first, so that a broken IPv6 (or IPv4) path only
+ * costs a single attempt delay before the other family gets a go.
+ */
+static GSList *interleave_addresses(char **results)
 {
-	struct web_session *session = user_data;
-	struct addrinfo hints;
-	char *port;
-	int ret;
+	GSList *first = NULL, *second = NULL, *list = NULL;
+	gboolean first_ipv6 = strchr(results[0], ':') != NULL;
+	int i;
 
-	if (results == NULL || results[0] == NULL) {
-		call_result_func(session, 404);
-		return;
+	for (i = 0; results[i] != NULL; i++) {
+		if ((strchr(results[i], ':') != NULL) == first_ipv6)
+			first = g_slist_prepend(first, g_strdup(results[i]));
+		else
+			second = g_slist_prepend(second, g_strdup(results[i]));
 	}
 
-	debug(session->web, "address %s", results[0]);
+	first = g_slist_reverse(first);
+	second = g_slist_reverse(second);
 
-	memset(&hints, 0, sizeof(struct addrinfo));
-	hints.ai_flags = AI_NUMERICHOST;
-	hints.ai_family = session->web->family;
+	while (first != NULL || second != NULL) {
+		if (first != NULL) {
+			list = g_slist_prepend(list, first->data);
+			first = g_slist_delete_link(first, first);
+		}
 
-	if (session->addr != NULL) {
-		freeaddrinfo(session->addr);
-		session->addr = NULL;
+		if (second != NULL) {
+			list = g_slist_prepend(list, second->data);
+			second = g_slist_delete_link(second, second);
+		}
 	}
 
-	port = g_strdup_printf("%u", session->port);
-	ret = getaddrinfo(results[0], port, &hints, &session->addr);
-	g_free(port);
-	if (ret != 0 || session->addr == NULL) {
-		call_result_func(session, 400);
+	return g_slist_reverse(list);
+}
+
+static void resolv_result(GResolvResultStatus status,
+					char **results, gpointer user_data)
+{
+	struct web_session *session = user_data;
+
+	session->resolv_action = 0;
+
+	if (results == NULL || results[0] == NULL) {
+		session_done(session, 404);
 		return;
 	}
 
-	session->address = g_strdup(results[0]);
-	call_route_func(session);
+	session->candidates = interleave_addresses(results);
+	session->use_route = TRUE;
 
 	if (create_transport(session) < 0) {
-		call_result_func(session, 409);
+		session_done(session, 409);
 		return;
 	}
 }
@@ -1287,61 +2042,31 @@ static guint do_request(GWeb *web, const char *url,
 		return 0;
 	}
 
-	session->result.headers = g_hash_table_new_full(g_str_hash, g_str_equal,
-							g_free, g_free);
-	if (session->result.headers == NULL) {
-		free_session(session);
-		return 0;
-	}
-
 	session->receive_space = DEFAULT_BUFFER_SIZE;
 	session->send_buffer = g_string_sized_new(0);
-	session->current_header = g_string_sized_new(0);
 	session->header_done = FALSE;
 	session->body_done = FALSE;
 
-	if (session->address == NULL && inet_aton(session->host, NULL) == 0) {
-		session->resolv_action = g_resolv_lookup_hostname(web->resolv,
-					session->host, resolv_result, session);
-		if (session->resolv_action == 0) {
-			free_session(session);
-			return 0;
-		}
-	} else {
-		struct addrinfo hints;
-		char *port;
-		int ret;
-
-		if (session->address == NULL)
-			session->address = g_strdup(session->host);
-
-		memset(&hints, 0, sizeof(struct addrinfo));
-		hints.ai_flags = AI_NUMERICHOST;
-		hints.ai_family = session->web->family;
-
-		if (session->addr != NULL) {
-			freeaddrinfo(session->addr);
-			session->addr = NULL;
-		}
-
-		port = g_strdup_printf("%u", session->port);
-		ret = getaddrinfo(session->address, port, &hints,
-							&session->addr);
-		g_free(port);
-		if (ret != 0 || session->addr == NULL) {
-			free_session(session);
-			return 0;
-		}
-
-		if (create_transport(session) < 0) {
-			free_session(session);
-			return 0;
-		}
+	session->key = g_strdup_printf("%s:%u%s",
+			session->address ? session->address : session->host,
+			session->port,
+			session->flags & SESSION_FLAG_USE_TLS ? "/tls" : "");
+
+	/* requests to the same host wait for its connection to be free */
+	if (web->close_connection == FALSE &&
+			find_session(web, session->key, FALSE) != NULL) {
+		debug(web, "queueing request for %s", session->key);
+		session->queued = TRUE;
+	} else if (start_session(session) < 0) {
+		free_session(session);
+		return 0;
 	}
 
+	session->id = web->next_query_id++;
+
 	web->session_list = g_list_append(web->session_list, session);
 
-	return web->next_query_id++;
+	return session->id;
 }
 
 guint g_web_request_get(GWeb *web, const char *url, GWebResultFunc func,
@@ -1382,9 +2107,36 @@ guint g_web_request_post_file(GWeb *web, const char *url,
 
 gboolean g_web_cancel_request(GWeb *web, guint id)
 {
+	struct web_session *session = NULL;
+	GList *list;
+
 	if (web == NULL)
 		return FALSE;
 
+	for (list = web->session_list; list; list = list->next) {
+		struct web_session *tmp = list->data;
+
+		if (tmp->id == id) {
+			session = tmp;
+			break;
+		}
+	}
+
+	if (session == NULL)
+		return FALSE;
+
+	debug(web, "cancel request %u", id);
+
+	/* finished by the caller once the result callback returns */
+	if (session->in_callback == TRUE) {
+		session->result_func = NULL;
+		session->keep_alive = FALSE;
+		session->cancelled = TRUE;
+		return TRUE;
+	}
+
+	remove_session(session);
+
 	return TRUE;
 }
 
@@ -1422,7 +2174,7 @@ gboolean g_web_result_get_header(GWebResult *result,
 	if (value == NULL)
 		return FALSE;
 
-	*value = g_hash_table_lookup(result->headers, header);
+	*value = find_header(result, header);
 
 	if (*value == NULL)
 		return FALSE;
@@ -1559,12 +2311,10 @@ void g_web_parser_feed_data(GWebParser *parser,
 				parser->token_len = strlen(parser->end_token);
 				parser->token_pos = 0;
 			} else {
-				char *str;
-				str = g_string_free(parser->content, FALSE);
-				parser->content = g_string_sized_new(0);
 				if (parser->func)
-					parser->func(str, parser->user_data);
-				g_free(str);
+					parser->func(parser->content->str,
+							parser->user_data);
+				g_string_truncate(parser->content, 0);
 
 				parser->intoken = FALSE;
 				parser->token_str = parser->begin_token;
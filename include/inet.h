@@ -75,6 +75,24 @@ int connman_inet_clear_ipv6_gateway_address(int index, const char *gateway);
 int connman_inet_set_ipv6_gateway_interface(int index);
 int connman_inet_clear_ipv6_gateway_interface(int index);
 
+/*
+ * IPv4 routes use netmask (NULL for a host route), IPv6 routes
+ * prefix_len. The outcome of each route is stored in error.
+ */
+struct connman_inet_route {
+	int family;
+	const char *host;
+	const char *gateway;
+	const char *netmask;
+	unsigned char prefix_len;
+	int error;
+};
+
+int connman_inet_add_routes(int index, struct connman_inet_route *routes,
+							unsigned int count);
+int connman_inet_del_routes(int index, struct connman_inet_route *routes,
+							unsigned int count);
+
 int connman_inet_add_to_bridge(int index, const char *bridge);
 int connman_inet_remove_from_bridge(int index, const char *bridge);
 
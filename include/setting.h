@@ -22,6 +22,8 @@
 #ifndef __CONNMAN_SETTING_H
 #define __CONNMAN_SETTING_H
 
+#include <stdint.h>
+
 #include <connman/types.h>
 
 #ifdef __cplusplus
@@ -31,6 +33,8 @@ extern "C" {
 connman_bool_t connman_setting_get_bool(const char *key);
 char **connman_setting_get_string_list(const char *key);
 unsigned int *connman_setting_get_uint_list(const char *key);
+unsigned int connman_setting_get_uint(const char *key);
+uint64_t connman_setting_get_uint64(const char *key);
 
 unsigned int connman_timeout_input_request(void);
 unsigned int connman_timeout_browser_launch(void);
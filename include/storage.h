@@ -22,14 +22,27 @@
 #ifndef __CONNMAN_STORAGE_H
 #define __CONNMAN_STORAGE_H
 
+#include <time.h>
+
 #include <glib.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct connman_storage_service_info {
+	gboolean favorite;
+	gboolean autoconnect;
+	gboolean hidden;
+	gboolean provisioned;
+	time_t modified;
+	const char *security;
+};
+
 gchar **connman_storage_get_services();
 GKeyFile *connman_storage_load_service(const char *service_id);
+int connman_storage_get_service_info(const char *service_id,
+				struct connman_storage_service_info *info);
 
 #ifdef __cplusplus
 }
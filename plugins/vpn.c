@@ -1353,8 +1353,11 @@ static connman_bool_t check_host(char **hosts, char *host)
 	return FALSE;
 }
 
-static void set_route(struct connection_data *data, struct vpn_route *route)
+static void set_route(struct connection_data *data, struct vpn_route *route,
+							GArray *routes)
 {
+	struct connman_inet_route entry;
+
 	/*
 	 * If the VPN administrator/user has given a route to
 	 * VPN server, then we must discard that because the
@@ -1366,26 +1369,29 @@ static void set_route(struct connection_data *data, struct vpn_route *route)
 		return;
 	}
 
-	if (route->family == AF_INET6) {
-		unsigned char prefix_len = atoi(route->netmask);
+	memset(&entry, 0, sizeof(entry));
+	entry.family = route->family;
+	entry.host = route->network;
+	entry.gateway = route->gateway;
 
-		connman_inet_add_ipv6_network_route(data->index,
-							route->network,
-							route->gateway,
-							prefix_len);
-	} else {
-		connman_inet_add_network_route(data->index, route->network,
-						route->gateway,
-						route->netmask);
-	}
+	if (route->family == AF_INET6)
+		entry.prefix_len = atoi(route->netmask);
+	else
+		entry.netmask = route->netmask;
+
+	g_array_append_val(routes, entry);
 }
 
 static int set_routes(struct connman_provider *provider,
 				enum connman_provider_route_type type)
 {
 	struct connection_data *data;
+	struct connman_inet_route *entry;
 	GHashTableIter iter;
 	gpointer value, key;
+	GArray *routes;
+	unsigned int i;
+	int err;
 
 	DBG("provider %p", provider);
 
@@ -1393,12 +1399,14 @@ static int set_routes(struct connman_provider *provider,
 	if (data == NULL)
 		return -EINVAL;
 
+	routes = g_array_new(FALSE, FALSE, sizeof(struct connman_inet_route));
+
 	if (type == CONNMAN_PROVIDER_ROUTE_ALL ||
 					type == CONNMAN_PROVIDER_ROUTE_USER) {
 		g_hash_table_iter_init(&iter, data->user_routes);
 
 		while (g_hash_table_iter_next(&iter, &key, &value) == TRUE)
-			set_route(data, value);
+			set_route(data, value, routes);
 	}
 
 	if (type == CONNMAN_PROVIDER_ROUTE_ALL ||
@@ -1406,10 +1414,24 @@ static int set_routes(struct connman_provider *provider,
 		g_hash_table_iter_init(&iter, data->server_routes);
 
 		while (g_hash_table_iter_next(&iter, &key, &value) == TRUE)
-			set_route(data, value);
+			set_route(data, value, routes);
 	}
 
-	return 0;
+	err = connman_inet_add_routes(data->index,
+			(struct connman_inet_route *) routes->data,
+			routes->len);
+
+	for (i = 0; err == 0 && i < routes->len; i++) {
+		entry = &g_array_index(routes, struct connman_inet_route, i);
+		if (entry->error < 0)
+			connman_warn("VPN route to %s via %s failed: %s",
+					entry->host, entry->gateway,
+					strerror(-entry->error));
+	}
+
+	g_array_free(routes, TRUE);
+
+	return err;
 }
 
 static connman_bool_t check_routes(struct connman_provider *provider)
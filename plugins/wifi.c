@@ -390,6 +390,7 @@ static int add_scan_param(gchar *hex_ssid, char *raw_ssid, int ssid_len,
 
 static int get_hidden_connections(GSupplicantScanParams *scan_data)
 {
+	struct connman_storage_service_info info;
 	struct connman_config_entry **entries;
 	GKeyFile *keyfile;
 	gchar **services;
@@ -403,6 +404,12 @@ static int get_hidden_connections(GSupplicantScanParams *scan_data)
 		if (strncmp(services[i], "wifi_", 5) != 0)
 			continue;
 
+		if (connman_storage_get_service_info(services[i],
+							&info) == 0 &&
+				(info.hidden == FALSE ||
+					info.favorite == FALSE))
+			continue;
+
 		keyfile = connman_storage_load_service(services[i]);
 		if (keyfile == NULL)
 			continue;
@@ -875,21 +882,20 @@ static int wifi_disable(struct connman_device *device)
 }
 
 struct last_connected {
-	GTimeVal modified;
-	gchar *ssid;
-	int freq;
+	time_t modified;
+	gchar *service_id;
 };
 
 static gint sort_entry(gconstpointer a, gconstpointer b, gpointer user_data)
 {
-	GTimeVal *aval = (GTimeVal *)a;
-	GTimeVal *bval = (GTimeVal *)b;
+	const struct last_connected *aval = a;
+	const struct last_connected *bval = b;
 
 	/* Note that the sort order is descending */
-	if (aval->tv_sec < bval->tv_sec)
+	if (aval->modified < bval->modified)
 		return 1;
 
-	if (aval->tv_sec > bval->tv_sec)
+	if (aval->modified > bval->modified)
 		return -1;
 
 	return 0;
@@ -899,20 +905,24 @@ static void free_entry(gpointer data)
 {
 	struct last_connected *entry = data;
 
-	g_free(entry->ssid);
+	g_free(entry->service_id);
 	g_free(entry);
 }
 
+/*
+ * The candidates are ranked by the modification time kept in the
+ * services index, so that only the settings of the services which
+ * actually end up in the scan list need to be loaded.
+ */
 static int get_latest_connections(int max_ssids,
 				GSupplicantScanParams *scan_data)
 {
+	struct connman_storage_service_info info;
 	GSequenceIter *iter;
 	GSequence *latest_list;
 	struct last_connected *entry;
 	GKeyFile *keyfile;
-	GTimeVal modified;
 	gchar **services;
-	gchar *str;
 	char *ssid;
 	int i, freq;
 	int num_ssids = 0;
@@ -926,80 +936,58 @@ static int get_latest_connections(int max_ssids,
 		if (strncmp(services[i], "wifi_", 5) != 0)
 			continue;
 
-		keyfile = connman_storage_load_service(services[i]);
-		if (keyfile == NULL)
+		if (connman_storage_get_service_info(services[i], &info) < 0)
 			continue;
 
-		str = g_key_file_get_string(keyfile,
-					services[i], "Favorite", NULL);
-		if (str == NULL || g_strcmp0(str, "true")) {
-			if (str)
-				g_free(str);
-			g_key_file_free(keyfile);
+		if (info.favorite == FALSE || info.autoconnect == FALSE)
 			continue;
-		}
-		g_free(str);
 
-		str = g_key_file_get_string(keyfile,
-					services[i], "AutoConnect", NULL);
-		if (str == NULL || g_strcmp0(str, "true")) {
-			if (str)
-				g_free(str);
-			g_key_file_free(keyfile);
-			continue;
+		entry = g_try_new(struct last_connected, 1);
+		if (entry == NULL) {
+			g_sequence_free(latest_list);
+			g_strfreev(services);
+			return -ENOMEM;
 		}
-		g_free(str);
 
-		str = g_key_file_get_string(keyfile,
-					services[i], "Modified", NULL);
-		if (str != NULL) {
-			g_time_val_from_iso8601(str, &modified);
-			g_free(str);
-		}
+		entry->service_id = g_strdup(services[i]);
+		entry->modified = info.modified;
 
-		ssid = g_key_file_get_string(keyfile,
-					services[i], "SSID", NULL);
+		g_sequence_insert_sorted(latest_list, entry, sort_entry, NULL);
+	}
 
-		freq = g_key_file_get_integer(keyfile, services[i],
-					"Frequency", NULL);
-		if (freq) {
-			entry = g_try_new(struct last_connected, 1);
-			if (entry == NULL) {
-				g_sequence_free(latest_list);
-				g_key_file_free(keyfile);
-				g_free(ssid);
-				return -ENOMEM;
-			}
+	g_strfreev(services);
 
-			entry->ssid = ssid;
-			entry->modified = modified;
-			entry->freq = freq;
+	iter = g_sequence_get_begin_iter(latest_list);
 
-			g_sequence_insert_sorted(latest_list, entry,
-						sort_entry, NULL);
-			num_ssids++;
-		} else
-			g_free(ssid);
+	while (num_ssids < max_ssids &&
+			g_sequence_iter_is_end(iter) == FALSE) {
+		entry = g_sequence_get(iter);
+		iter = g_sequence_iter_next(iter);
 
-		g_key_file_free(keyfile);
-	}
+		keyfile = connman_storage_load_service(entry->service_id);
+		if (keyfile == NULL)
+			continue;
 
-	g_strfreev(services);
+		ssid = g_key_file_get_string(keyfile,
+					entry->service_id, "SSID", NULL);
 
-	num_ssids = num_ssids > max_ssids ? max_ssids : num_ssids;
+		freq = g_key_file_get_integer(keyfile, entry->service_id,
+					"Frequency", NULL);
 
-	iter = g_sequence_get_begin_iter(latest_list);
+		g_key_file_free(keyfile);
 
-	for (i = 0; i < num_ssids; i++) {
-		entry = g_sequence_get(iter);
+		if (ssid == NULL || freq == 0) {
+			g_free(ssid);
+			continue;
+		}
 
-		DBG("ssid %s freq %d modified %lu", entry->ssid, entry->freq,
-						entry->modified.tv_sec);
+		DBG("ssid %s freq %d modified %lu", ssid, freq,
+						(unsigned long) entry->modified);
 
-		add_scan_param(entry->ssid, NULL, 0, 0, scan_data,
-						max_ssids, entry->ssid);
+		add_scan_param(ssid, NULL, 0, 0, scan_data, max_ssids, ssid);
 
-		iter = g_sequence_iter_next(iter);
+		g_free(ssid);
+		num_ssids++;
 	}
 
 	g_sequence_free(latest_list);
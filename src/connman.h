@@ -134,6 +134,9 @@ void __connman_task_cleanup(void);
 
 #include <connman/inet.h>
 
+int __connman_inet_init(void);
+void __connman_inet_cleanup(void);
+
 char **__connman_inet_get_running_interfaces(void);
 int __connman_inet_modify_address(int cmd, int flags, int index, int family,
 				const char *address,
@@ -169,6 +172,12 @@ typedef void (*connman_inet_addr_cb_t) (const char *src_address, int index,
 					void *user_data);
 int __connman_inet_get_route(const char *dst_address,
 			connman_inet_addr_cb_t callback, void *user_data);
+int __connman_inet_add_host_routes(int index,
+				struct connman_inet_route *routes,
+				unsigned int count);
+int __connman_inet_del_host_routes(int index,
+				struct connman_inet_route *routes,
+				unsigned int count);
 
 struct __connman_inet_rtnl_handle {
 	int			fd;
@@ -238,6 +247,8 @@ void __connman_storage_save_provider(GKeyFile *keyfile, const char *identifier);
 gboolean __connman_storage_remove_provider(const char *identifier);
 char **__connman_storage_get_providers(void);
 gboolean __connman_storage_remove_service(const char *service_id);
+int __connman_storage_init(void);
+void __connman_storage_cleanup(void);
 
 int __connman_detect_init(void);
 void __connman_detect_cleanup(void);
@@ -379,6 +390,12 @@ const char *__connman_ipconfig_get_proxy_autoconfig(struct connman_ipconfig *ipc
 void __connman_ipconfig_set_dhcp_address(struct connman_ipconfig *ipconfig,
 					const char *address);
 char *__connman_ipconfig_get_dhcp_address(struct connman_ipconfig *ipconfig);
+void __connman_ipconfig_set_dhcp_lease(struct connman_ipconfig *ipconfig,
+					unsigned char prefixlen,
+					const char *gateway, time_t expiry);
+const char *__connman_ipconfig_get_dhcp_lease(struct connman_ipconfig *ipconfig,
+					unsigned char *prefixlen,
+					const char **gateway);
 void __connman_ipconfig_set_dhcpv6_prefixes(struct connman_ipconfig *ipconfig,
 					char **prefixes);
 char **__connman_ipconfig_get_dhcpv6_prefixes(struct connman_ipconfig *ipconfig);
@@ -841,6 +858,20 @@ int __connman_iptables_insert(const char *table_name,
 int __connman_iptables_delete(const char *table_name,
 			const char *chain,
 			const char *rule_spec);
+int __connman_iptables_check_template(const char *table_name,
+					const char *rule_template);
+int __connman_iptables_append_template(const char *table_name,
+					const char *chain,
+					const char *rule_template,
+					char **params);
+int __connman_iptables_insert_template(const char *table_name,
+					const char *chain,
+					const char *rule_template,
+					char **params);
+int __connman_iptables_delete_template(const char *table_name,
+					const char *chain,
+					const char *rule_template,
+					char **params);
 
 typedef void (*connman_iptables_iterate_chains_cb_t) (const char *chain_name,
 							void *user_data);
@@ -851,6 +882,8 @@ int __connman_iptables_iterate_chains(const char *table_name,
 int __connman_iptables_init(void);
 void __connman_iptables_cleanup(void);
 int __connman_iptables_commit(const char *table_name);
+void __connman_iptables_begin(void);
+int __connman_iptables_end(void);
 
 int __connman_dnsproxy_init(void);
 void __connman_dnsproxy_cleanup(void);
@@ -916,12 +949,22 @@ struct firewall_context;
 
 struct firewall_context *__connman_firewall_create(void);
 void __connman_firewall_destroy(struct firewall_context *ctx);
-int __connman_firewall_add_rule(struct firewall_context *ctx,
-				const char *table,
-				const char *chain,
-				const char *rule_fmt, ...);
-int __connman_firewall_enable(struct firewall_context *ctx);
-int __connman_firewall_disable(struct firewall_context *ctx);
+void __connman_firewall_begin(void);
+int __connman_firewall_end(void);
+int __connman_firewall_enable_nat(struct firewall_context *ctx,
+				const char *address, unsigned char prefixlen,
+				const char *interface);
+int __connman_firewall_disable_nat(struct firewall_context *ctx);
+int __connman_firewall_enable_connmark(struct firewall_context *ctx);
+int __connman_firewall_disable_connmark(struct firewall_context *ctx);
+int __connman_firewall_enable_marking(struct firewall_context *ctx,
+					enum connman_session_id_type id_type,
+					const char *id, uint32_t mark);
+int __connman_firewall_disable_marking(struct firewall_context *ctx);
+int __connman_firewall_enable_accounting(struct firewall_context *ctx,
+					uint32_t mark, const char *input,
+					const char *output);
+int __connman_firewall_disable_accounting(struct firewall_context *ctx);
 
 int __connman_firewall_init(void);
 void __connman_firewall_cleanup(void);
@@ -955,6 +998,7 @@ int __connman_nfacct_enable(struct nfacct_context *ctx,
 int __connman_nfacct_disable(struct nfacct_context *ctx,
 				connman_nfacct_disable_cb_t cb,
 				void *user_data);
+int __connman_nfacct_update_stats(void);
 
 
 int __connman_nfacct_init(void);
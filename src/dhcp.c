@@ -45,6 +45,10 @@ struct connman_dhcp {
 	char *pac;
 
 	GDHCPClient *dhcp_client;
+
+	/* fast connect, address in use before the server acknowledged it */
+	GDHCPClient *ipv4ll_client;
+	connman_bool_t provisional;
 };
 
 static GHashTable *network_table;
@@ -110,11 +114,13 @@ static void dhcp_invalidate(struct connman_dhcp *dhcp, connman_bool_t callback)
 		}
 	}
 
-	__connman_ipconfig_set_dhcp_address(ipconfig,
+	if (dhcp->provisional == FALSE)
+		__connman_ipconfig_set_dhcp_address(ipconfig,
 				__connman_ipconfig_get_local(ipconfig));
 	DBG("last address %s", __connman_ipconfig_get_dhcp_address(ipconfig));
 
 	__connman_ipconfig_address_remove(ipconfig);
+	dhcp->provisional = FALSE;
 
 	__connman_ipconfig_set_local(ipconfig, NULL);
 	__connman_ipconfig_set_broadcast(ipconfig, NULL);
@@ -134,6 +140,169 @@ static void dhcp_valid(struct connman_dhcp *dhcp)
 		dhcp->callback(dhcp->network, TRUE, NULL);
 }
 
+static void ipv4ll_release(struct connman_dhcp *dhcp)
+{
+	if (dhcp->ipv4ll_client == NULL)
+		return;
+
+	g_dhcp_client_stop(dhcp->ipv4ll_client);
+	g_dhcp_client_unref(dhcp->ipv4ll_client);
+
+	dhcp->ipv4ll_client = NULL;
+}
+
+/*
+ * Fast connect: configure an address that the DHCP server has not
+ * confirmed (yet) unless some other source already won the race.
+ */
+static void provisional_address(struct connman_dhcp *dhcp,
+				const char *address, unsigned char prefixlen,
+				const char *gateway)
+{
+	struct connman_service *service;
+	struct connman_ipconfig *ipconfig;
+
+	service = connman_service_lookup_from_network(dhcp->network);
+	if (service == NULL)
+		return;
+
+	ipconfig = __connman_service_get_ip4config(service);
+	if (ipconfig == NULL)
+		return;
+
+	if (__connman_ipconfig_get_local(ipconfig) != NULL)
+		return;
+
+	connman_info("Using provisional address %s/%u", address, prefixlen);
+
+	dhcp->provisional = TRUE;
+
+	__connman_ipconfig_set_method(ipconfig, CONNMAN_IPCONFIG_METHOD_DHCP);
+	__connman_ipconfig_set_local(ipconfig, address);
+	__connman_ipconfig_set_prefixlen(ipconfig, prefixlen);
+	__connman_ipconfig_set_gateway(ipconfig, gateway);
+
+	dhcp_valid(dhcp);
+}
+
+/*
+ * Undo what a provisional address set up, the gateway goes first so
+ * that no default route is left pointing at the removed address.
+ */
+static void provisional_lost(struct connman_dhcp *dhcp,
+				struct connman_ipconfig *ipconfig)
+{
+	__connman_ipconfig_gateway_remove(ipconfig);
+	__connman_ipconfig_address_remove(ipconfig);
+
+	__connman_ipconfig_set_local(ipconfig, NULL);
+	__connman_ipconfig_set_prefixlen(ipconfig, 0);
+	__connman_ipconfig_set_gateway(ipconfig, NULL);
+	dhcp->provisional = FALSE;
+
+	if (dhcp->callback != NULL)
+		dhcp->callback(dhcp->network, FALSE, NULL);
+}
+
+static void last_address_cb(GDHCPClient *dhcp_client, gpointer user_data)
+{
+	struct connman_dhcp *dhcp = user_data;
+	struct connman_service *service;
+	struct connman_ipconfig *ipconfig;
+	const char *address, *gateway;
+	unsigned char prefixlen;
+
+	DBG("Last address available");
+
+	service = connman_service_lookup_from_network(dhcp->network);
+	if (service == NULL)
+		return;
+
+	ipconfig = __connman_service_get_ip4config(service);
+
+	address = __connman_ipconfig_get_dhcp_lease(ipconfig, &prefixlen,
+								&gateway);
+	if (address == NULL)
+		return;
+
+	provisional_address(dhcp, address, prefixlen, gateway);
+}
+
+static void last_address_refused_cb(GDHCPClient *dhcp_client,
+							gpointer user_data)
+{
+	struct connman_dhcp *dhcp = user_data;
+	struct connman_service *service;
+	struct connman_ipconfig *ipconfig;
+	char *address;
+
+	DBG("Last address refused");
+
+	service = connman_service_lookup_from_network(dhcp->network);
+	if (service == NULL)
+		return;
+
+	ipconfig = __connman_service_get_ip4config(service);
+	if (ipconfig == NULL)
+		return;
+
+	address = g_strdup(__connman_ipconfig_get_dhcp_address(ipconfig));
+
+	/* Forget the refused lease so it is not offered again next time */
+	__connman_ipconfig_set_dhcp_address(ipconfig, NULL);
+	__connman_service_save(service);
+
+	if (dhcp->provisional == TRUE && g_strcmp0(address,
+				__connman_ipconfig_get_local(ipconfig)) == 0) {
+		connman_info("Provisional address %s refused", address);
+
+		provisional_lost(dhcp, ipconfig);
+	}
+
+	g_free(address);
+}
+
+static void fast_ipv4ll_available_cb(GDHCPClient *dhcp_client,
+							gpointer user_data)
+{
+	struct connman_dhcp *dhcp = user_data;
+	char *address, *netmask;
+
+	DBG("IPV4LL available");
+
+	address = g_dhcp_client_get_address(dhcp_client);
+	netmask = g_dhcp_client_get_netmask(dhcp_client);
+
+	provisional_address(dhcp, address,
+			__connman_ipaddress_netmask_prefix_len(netmask), NULL);
+
+	g_free(address);
+	g_free(netmask);
+}
+
+static void fast_ipv4ll_lost_cb(GDHCPClient *dhcp_client, gpointer user_data)
+{
+	struct connman_dhcp *dhcp = user_data;
+	struct connman_service *service;
+	struct connman_ipconfig *ipconfig;
+	char *address;
+
+	DBG("IPV4LL lost");
+
+	service = connman_service_lookup_from_network(dhcp->network);
+	if (service == NULL)
+		return;
+
+	ipconfig = __connman_service_get_ip4config(service);
+	address = g_dhcp_client_get_address(dhcp_client);
+
+	if (dhcp->provisional == TRUE && g_strcmp0(address,
+				__connman_ipconfig_get_local(ipconfig)) == 0)
+		provisional_lost(dhcp, ipconfig);
+
+	g_free(address);
+}
+
 static void no_lease_cb(GDHCPClient *dhcp_client, gpointer user_data)
 {
 	struct connman_dhcp *dhcp = user_data;
@@ -230,9 +399,23 @@ static void lease_available_cb(GDHCPClient *dhcp_client, gpointer user_data)
 	prefixlen = __connman_ipaddress_netmask_prefix_len(netmask);
 	if (prefixlen == 255)
 		connman_warn("netmask: %s is invalid", netmask);
+	else
+		__connman_ipconfig_set_dhcp_lease(ipconfig, prefixlen, gateway,
+			time(NULL) + g_dhcp_client_get_lease_time(dhcp_client));
 
 	DBG("c_address %s", c_address);
 
+	ipv4ll_release(dhcp);
+
+	/* The server has the final word over a fast connect address */
+	if (dhcp->provisional == TRUE) {
+		if (g_strcmp0(address, c_address) != 0 ||
+						prefixlen != c_prefixlen)
+			__connman_ipconfig_address_remove(ipconfig);
+
+		dhcp->provisional = FALSE;
+	}
+
 	if (address != NULL && c_address != NULL &&
 					g_strcmp0(address, c_address) != 0)
 		ip_change = TRUE;
@@ -281,6 +464,18 @@ static void lease_available_cb(GDHCPClient *dhcp_client, gpointer user_data)
 
 	__connman_ipconfig_set_method(ipconfig, CONNMAN_IPCONFIG_METHOD_DHCP);
 
+	if (ip_change == TRUE)
+		connman_info("DHCP address %s in %d ms "
+			"(discover %d offer %d request %d)", address,
+			g_dhcp_client_get_phase_time(dhcp_client,
+						G_DHCP_CLIENT_PHASE_ACK),
+			g_dhcp_client_get_phase_time(dhcp_client,
+						G_DHCP_CLIENT_PHASE_DISCOVER),
+			g_dhcp_client_get_phase_time(dhcp_client,
+						G_DHCP_CLIENT_PHASE_OFFER),
+			g_dhcp_client_get_phase_time(dhcp_client,
+						G_DHCP_CLIENT_PHASE_REQUEST));
+
 	if (ip_change == TRUE) {
 		__connman_ipconfig_set_local(ipconfig, address);
 		__connman_ipconfig_set_prefixlen(ipconfig, prefixlen);
@@ -372,6 +567,9 @@ static void ipv4ll_available_cb(GDHCPClient *dhcp_client, gpointer user_data)
 
 	DBG("IPV4LL available");
 
+	if (dhcp->provisional == TRUE)
+		return;
+
 	service = connman_service_lookup_from_network(dhcp->network);
 	if (service == NULL)
 		return;
@@ -401,13 +599,44 @@ static void dhcp_debug(const char *str, void *data)
 	connman_info("%s: %s\n", (const char *) data, str);
 }
 
+static int ipv4ll_request(struct connman_dhcp *dhcp)
+{
+	GDHCPClient *ipv4ll_client;
+	GDHCPClientError error;
+	int index;
+
+	DBG("dhcp %p", dhcp);
+
+	index = connman_network_get_index(dhcp->network);
+
+	ipv4ll_client = g_dhcp_client_new(G_DHCP_IPV4LL, index, &error);
+	if (error != G_DHCP_CLIENT_ERROR_NONE)
+		return -EINVAL;
+
+	if (getenv("CONNMAN_DHCP_DEBUG"))
+		g_dhcp_client_set_debug(ipv4ll_client, dhcp_debug, "IPv4LL");
+
+	g_dhcp_client_register_event(ipv4ll_client,
+			G_DHCP_CLIENT_EVENT_IPV4LL_AVAILABLE,
+					fast_ipv4ll_available_cb, dhcp);
+
+	g_dhcp_client_register_event(ipv4ll_client,
+			G_DHCP_CLIENT_EVENT_IPV4LL_LOST,
+					fast_ipv4ll_lost_cb, dhcp);
+
+	dhcp->ipv4ll_client = ipv4ll_client;
+
+	return g_dhcp_client_start(ipv4ll_client, NULL);
+}
+
 static int dhcp_request(struct connman_dhcp *dhcp)
 {
 	struct connman_service *service;
 	struct connman_ipconfig *ipconfig;
 	GDHCPClient *dhcp_client;
 	GDHCPClientError error;
-	const char *hostname;
+	const char *hostname, *gateway;
+	unsigned char prefixlen;
 	int index;
 
 	DBG("dhcp %p", dhcp);
@@ -452,6 +681,10 @@ static int dhcp_request(struct connman_dhcp *dhcp)
 	g_dhcp_client_register_event(dhcp_client,
 			G_DHCP_CLIENT_EVENT_NO_LEASE, no_lease_cb, dhcp);
 
+	g_dhcp_client_register_event(dhcp_client,
+			G_DHCP_CLIENT_EVENT_LAST_ADDRESS_REFUSED,
+					last_address_refused_cb, dhcp);
+
 	dhcp->dhcp_client = dhcp_client;
 
 	service = connman_service_lookup_from_network(dhcp->network);
@@ -463,6 +696,21 @@ static int dhcp_request(struct connman_dhcp *dhcp)
 	 */
 	__connman_ipconfig_clear_address(ipconfig);
 
+	/*
+	 * Fast connect races a still valid cached lease and IPv4LL
+	 * against the server, whichever is usable first is configured.
+	 */
+	if (connman_setting_get_bool("FastConnect") == TRUE) {
+		if (__connman_ipconfig_get_dhcp_lease(ipconfig, &prefixlen,
+							&gateway) != NULL)
+			g_dhcp_client_register_event(dhcp_client,
+				G_DHCP_CLIENT_EVENT_LAST_ADDRESS_AVAILABLE,
+						last_address_cb, dhcp);
+
+		if (ipv4ll_request(dhcp) < 0)
+			connman_warn("Could not start IPv4LL in parallel");
+	}
+
 	return g_dhcp_client_start(dhcp_client,
 				__connman_ipconfig_get_dhcp_address(ipconfig));
 }
@@ -471,6 +719,8 @@ static int dhcp_release(struct connman_dhcp *dhcp)
 {
 	DBG("dhcp %p", dhcp);
 
+	ipv4ll_release(dhcp);
+
 	if (dhcp->dhcp_client == NULL)
 		return 0;
 
@@ -78,6 +78,10 @@ struct connman_dhcpv6 {
 	int request_count;	/* how many times REQUEST have been sent */
 	gboolean stateless;	/* TRUE if stateless DHCPv6 is used */
 	gboolean started;	/* TRUE if we have DHCPv6 started */
+	dhcp_cb pd_callback;	/* prefix delegation sharing this exchange */
+	GSList *pd_prefixes;	/* prefixes delegated via the shared exchange */
+	gboolean pd_requested;	/* TRUE if the last message carried IA_PD */
+	gboolean pd_pending;	/* TRUE if IA_PD has not been answered yet */
 };
 
 static GHashTable *network_table;
@@ -88,6 +92,8 @@ static int dhcpv6_pd_request(struct connman_dhcpv6 *dhcp);
 static gboolean start_solicitation(gpointer user_data);
 static int dhcpv6_renew(struct connman_dhcpv6 *dhcp);
 static int dhcpv6_rebind(struct connman_dhcpv6 *dhcp);
+static void set_shared_prefixes(GDHCPClient *dhcp_client,
+				struct connman_dhcpv6 *dhcp);
 
 static void clear_timer(struct connman_dhcpv6 *dhcp)
 {
@@ -138,6 +144,9 @@ static void dhcpv6_free(struct connman_dhcpv6 *dhcp)
 	dhcp->started = FALSE;
 
 	g_slist_free_full(dhcp->prefixes, free_prefix);
+
+	g_slist_free_full(dhcp->pd_prefixes, free_prefix);
+	dhcp->pd_prefixes = NULL;
 }
 
 static gboolean compare_string_arrays(char **array_a, char **array_b)
@@ -585,6 +594,26 @@ static int set_addresses(GDHCPClient *dhcp_client,
 	return 0;
 }
 
+/*
+ * If prefix delegation shares this network's exchange, put the IA_PD
+ * into the same message as the address IA so that both bindings are
+ * requested, renewed and rebound together. Otherwise make sure that a
+ * stale IA_PD is not sent anymore.
+ */
+static void request_pd(struct connman_dhcpv6 *dhcp,
+			GDHCPClient *dhcp_client, uint32_t *T1, uint32_t *T2)
+{
+	if (dhcp->pd_callback == NULL) {
+		dhcp->pd_requested = FALSE;
+		g_dhcpv6_client_set_send(dhcp_client, G_DHCPV6_IA_PD,
+					NULL, 0);
+		return;
+	}
+
+	dhcp->pd_requested = TRUE;
+	g_dhcpv6_client_set_pd(dhcp_client, T1, T2, dhcp->pd_prefixes);
+}
+
 static gboolean timeout_request_resend(gpointer user_data)
 {
 	struct connman_dhcpv6 *dhcp = user_data;
@@ -714,8 +743,10 @@ static void re_cb(enum request_type req_type, GDHCPClient *dhcp_client,
 			}
 		}
 
-		if (status == G_DHCPV6_ERROR_SUCCESS)
+		if (status == G_DHCPV6_ERROR_SUCCESS) {
 			set_addresses(dhcp_client, dhcp);
+			set_shared_prefixes(dhcp_client, dhcp);
+		}
 
 		if (dhcp->callback != NULL)
 			dhcp->callback(dhcp->network,
@@ -756,6 +787,7 @@ static int dhcpv6_rebind(struct connman_dhcpv6 *dhcp)
 			connman_network_get_index(dhcp->network),
 			dhcp->use_ta == TRUE ? G_DHCPV6_IA_TA : G_DHCPV6_IA_NA,
 			NULL, NULL, FALSE, NULL);
+	request_pd(dhcp, dhcp_client, NULL, NULL);
 
 	clear_callbacks(dhcp_client);
 
@@ -870,6 +902,7 @@ static int dhcpv6_request(struct connman_dhcpv6 *dhcp,
 			connman_network_get_index(dhcp->network),
 			dhcp->use_ta == TRUE ? G_DHCPV6_IA_TA : G_DHCPV6_IA_NA,
 			&T1, &T2, add_addresses, NULL);
+	request_pd(dhcp, dhcp_client, &T1, &T2);
 
 	clear_callbacks(dhcp_client);
 
@@ -941,6 +974,7 @@ static int dhcpv6_renew(struct connman_dhcpv6 *dhcp)
 			connman_network_get_index(dhcp->network),
 			dhcp->use_ta == TRUE ? G_DHCPV6_IA_TA : G_DHCPV6_IA_NA,
 			&T1, &T2, TRUE, NULL);
+	request_pd(dhcp, dhcp_client, &T1, &T2);
 
 	clear_callbacks(dhcp_client);
 
@@ -1028,7 +1062,16 @@ int __connman_dhcpv6_start_renew(struct connman_network *network,
 
 	dhcp->callback = callback;
 
-	if (T2 != 0xffffffff && T2 > 0 &&
+	if (dhcp->pd_pending == TRUE) {
+		/*
+		 * Prefix delegation was asked for while the addresses
+		 * were being acquired, add the IA_PD to the binding now
+		 * instead of waiting for T1.
+		 */
+		DBG("renew now to get the delegated prefixes");
+
+		dhcp->timeout = g_timeout_add_seconds(0, start_renew, dhcp);
+	} else if (T2 != 0xffffffff && T2 > 0 &&
 			(unsigned)current > (unsigned)last_rebind + T2) {
 		int timeout;
 
@@ -1100,6 +1143,7 @@ int __connman_dhcpv6_start_release(struct connman_network *network,
 			connman_network_get_index(dhcp->network),
 			dhcp->use_ta == TRUE ? G_DHCPV6_IA_TA : G_DHCPV6_IA_NA,
 			NULL, NULL, TRUE, NULL);
+	request_pd(dhcp, dhcp_client, NULL, NULL);
 
 	clear_callbacks(dhcp_client);
 
@@ -1254,9 +1298,13 @@ static void solicitation_cb(GDHCPClient *dhcp_client, gpointer user_data)
 
 	clear_timer(dhcp);
 
-	set_addresses(dhcp_client, dhcp);
-
 	g_dhcpv6_client_clear_retransmit(dhcp_client);
+
+	/*
+	 * The reply binds the addresses and the delegated prefixes in
+	 * one go, so handle it like a reply to a request.
+	 */
+	re_cb(REQ_REQUEST, dhcp_client, dhcp);
 }
 
 static gboolean timeout_solicitation(gpointer user_data)
@@ -1326,6 +1374,7 @@ static int dhcpv6_solicitation(struct connman_dhcpv6 *dhcp)
 	g_dhcpv6_client_set_ia(dhcp_client, index,
 			dhcp->use_ta == TRUE ? G_DHCPV6_IA_TA : G_DHCPV6_IA_NA,
 			NULL, NULL, FALSE, NULL);
+	request_pd(dhcp, dhcp_client, NULL, NULL);
 
 	clear_callbacks(dhcp_client);
 
@@ -1662,44 +1711,141 @@ static GSList *copy_and_convert_prefixes(GList *prefixes)
 	return copy;
 }
 
-static int set_prefixes(GDHCPClient *dhcp_client, struct connman_dhcpv6 *dhcp)
+static int update_prefixes(GDHCPClient *dhcp_client,
+			struct connman_network *network, uint16_t status,
+			GSList **prefixes, dhcp_cb callback)
 {
-	if (dhcp->prefixes != NULL)
-		g_slist_free_full(dhcp->prefixes, free_prefix);
+	if (*prefixes != NULL)
+		g_slist_free_full(*prefixes, free_prefix);
 
-	dhcp->prefixes =
+	*prefixes =
 		copy_and_convert_prefixes(g_dhcp_client_get_option(dhcp_client,
 							G_DHCPV6_IA_PD));
 
-	DBG("Got %d prefix", g_slist_length(dhcp->prefixes));
+	DBG("Got %d prefix", g_slist_length(*prefixes));
 
-	if (dhcp->callback != NULL) {
-		uint16_t status = g_dhcpv6_client_get_status(dhcp_client);
+	if (callback != NULL) {
 		if (status == G_DHCPV6_ERROR_NO_PREFIX)
-			dhcp->callback(dhcp->network, FALSE, NULL);
+			callback(network, FALSE, NULL);
 		else {
 			struct connman_service *service;
 			struct connman_ipconfig *ipconfig;
-			int ifindex = connman_network_get_index(dhcp->network);
+			int ifindex = connman_network_get_index(network);
 
 			service = __connman_service_lookup_from_index(ifindex);
 			if (service != NULL) {
 				ipconfig = __connman_service_get_ip6config(
 								service);
-				save_prefixes(ipconfig, dhcp->prefixes);
+				save_prefixes(ipconfig, *prefixes);
 				__connman_service_save(service);
 			}
 
-			dhcp->callback(dhcp->network, TRUE, dhcp->prefixes);
+			callback(network, TRUE, *prefixes);
 		}
 	} else {
-		g_slist_free_full(dhcp->prefixes, free_prefix);
-		dhcp->prefixes = NULL;
+		g_slist_free_full(*prefixes, free_prefix);
+		*prefixes = NULL;
 	}
 
 	return 0;
 }
 
+static int set_prefixes(GDHCPClient *dhcp_client, struct connman_dhcpv6 *dhcp)
+{
+	return update_prefixes(dhcp_client, dhcp->network,
+				g_dhcpv6_client_get_status(dhcp_client),
+				&dhcp->prefixes, dhcp->callback);
+}
+
+static void stop_shared_pd(struct connman_dhcpv6 *dhcp)
+{
+	DBG("network %p dhcp %p", dhcp->network, dhcp);
+
+	/* The IA_PD is left out of the next renew or rebind */
+	dhcp->pd_callback = NULL;
+	dhcp->pd_pending = FALSE;
+
+	g_slist_free_full(dhcp->pd_prefixes, free_prefix);
+	dhcp->pd_prefixes = NULL;
+}
+
+static void release_pd_cb(GDHCPClient *dhcp_client, gpointer user_data)
+{
+	DBG("");
+}
+
+/*
+ * Give the delegated prefixes back like a stand-alone delegation does
+ * when it stops. Only the IA_PD is put into the Release so the address
+ * binding stays, its renew or rebind is then scheduled again.
+ */
+static void release_shared_pd(struct connman_dhcpv6 *dhcp)
+{
+	GDHCPClient *dhcp_client = dhcp->dhcp_client;
+	uint32_t T1, T2;
+	time_t expired;
+
+	if (dhcp_client == NULL || dhcp->pd_pending == TRUE ||
+						dhcp->pd_prefixes == NULL)
+		return;
+
+	g_dhcpv6_client_get_timeouts(dhcp_client, &T1, &T2, NULL, NULL,
+								&expired);
+	if (time(NULL) > expired)
+		return;
+
+	DBG("network %p dhcp %p client %p", dhcp->network, dhcp,
+								dhcp_client);
+
+	clear_timer(dhcp);
+	g_dhcpv6_client_clear_retransmit(dhcp_client);
+
+	g_dhcp_client_clear_requests(dhcp_client);
+	g_dhcp_client_clear_values(dhcp_client);
+
+	g_dhcp_client_set_request(dhcp_client, G_DHCPV6_CLIENTID);
+	g_dhcp_client_set_request(dhcp_client, G_DHCPV6_SERVERID);
+
+	g_dhcpv6_client_set_pd(dhcp_client, &T1, &T2, dhcp->pd_prefixes);
+
+	clear_callbacks(dhcp_client);
+
+	/* The reply is not waited for, RFC 3315 chapter 18.1.6 */
+	g_dhcp_client_register_event(dhcp_client, G_DHCP_CLIENT_EVENT_RELEASE,
+					release_pd_cb, dhcp);
+
+	g_dhcp_client_start(dhcp_client, NULL);
+
+	__connman_dhcpv6_start_renew(dhcp->network, dhcp->callback);
+}
+
+static void set_shared_prefixes(GDHCPClient *dhcp_client,
+				struct connman_dhcpv6 *dhcp)
+{
+	uint16_t status;
+	dhcp_cb callback;
+
+	if (dhcp->pd_callback == NULL || dhcp->pd_requested == FALSE)
+		return;
+
+	dhcp->pd_pending = FALSE;
+
+	status = g_dhcpv6_client_get_pd_status(dhcp_client);
+	if (status == G_DHCPV6_ERROR_NO_PREFIX) {
+		/*
+		 * Detach like a failed stand-alone delegation does, the
+		 * caller will ask again if it still wants prefixes.
+		 */
+		callback = dhcp->pd_callback;
+		stop_shared_pd(dhcp);
+		callback(dhcp->network, FALSE, NULL);
+		return;
+	}
+
+	update_prefixes(dhcp_client, dhcp->network, status,
+			&dhcp->pd_prefixes, dhcp->pd_callback);
+}
+
 static void re_pd_cb(GDHCPClient *dhcp_client, gpointer user_data)
 {
 	struct connman_dhcpv6 *dhcp = user_data;
@@ -1971,7 +2117,7 @@ static gboolean timeout_pd_renew(gpointer user_data)
 
 	DBG("renew RT timeout %d msec", dhcp->RT);
 
-	dhcp->timeout = g_timeout_add(dhcp->RT, timeout_renew, dhcp);
+	dhcp->timeout = g_timeout_add(dhcp->RT, timeout_pd_renew, dhcp);
 
 	g_dhcpv6_client_set_retransmit(dhcp->dhcp_client);
 
@@ -2003,8 +2149,17 @@ int __connman_dhcpv6_start_pd_renew(struct connman_network *network,
 	time_t last_renew, last_rebind, current, expired;
 
 	dhcp = g_hash_table_lookup(network_pd_table, network);
-	if (dhcp == NULL)
-		return -ENOENT;
+	if (dhcp == NULL) {
+		dhcp = g_hash_table_lookup(network_table, network);
+		if (dhcp == NULL || dhcp->pd_callback == NULL)
+			return -ENOENT;
+
+		/* The prefixes are renewed together with the addresses */
+		DBG("network %p dhcp %p shared", network, dhcp);
+
+		dhcp->pd_callback = callback;
+		return 0;
+	}
 
 	DBG("network %p dhcp %p", network, dhcp);
 
@@ -2060,11 +2215,6 @@ int __connman_dhcpv6_start_pd_renew(struct connman_network *network,
 	return 0;
 }
 
-static void release_pd_cb(GDHCPClient *dhcp_client, gpointer user_data)
-{
-	DBG("");
-}
-
 int __connman_dhcpv6_start_pd_release(struct connman_network *network,
 				dhcp_cb callback)
 {
@@ -2263,6 +2413,56 @@ static gboolean start_pd_solicitation(gpointer user_data)
 	return FALSE;
 }
 
+/*
+ * Prefix delegation for a network that already runs a stateful DHCPv6
+ * exchange joins that exchange instead of starting its own client, so
+ * that one solicit (with rapid commit) and one renew/rebind carry both
+ * the IA_NA and the IA_PD.
+ */
+static int start_shared_pd(struct connman_dhcpv6 *dhcp,
+			struct connman_service *service,
+			GSList *prefixes, dhcp_cb callback)
+{
+	time_t expired;
+
+	if (dhcp->pd_callback != NULL)
+		return -EBUSY;
+
+	dhcp->pd_callback = callback;
+	dhcp->pd_pending = TRUE;
+
+	if (prefixes == NULL) {
+		struct connman_ipconfig *ipconfig;
+		ipconfig = __connman_service_get_ip6config(service);
+
+		dhcp->pd_prefixes = load_prefixes(ipconfig);
+	} else
+		dhcp->pd_prefixes = g_dhcpv6_copy_prefixes(prefixes);
+
+	DBG("network %p dhcp %p client %p", dhcp->network, dhcp,
+						dhcp->dhcp_client);
+
+	/*
+	 * If the solicitation has not been sent yet, it will carry the
+	 * IA_PD. If the addresses are being acquired right now, the IA_PD
+	 * is added by the renew that __connman_dhcpv6_start_renew() starts
+	 * when pd_pending is set.
+	 */
+	if (dhcp->dhcp_client == NULL)
+		return 0;
+
+	g_dhcpv6_client_get_timeouts(dhcp->dhcp_client, NULL, NULL,
+				NULL, NULL, &expired);
+	if (time(NULL) > expired)
+		return 0;
+
+	/* The addresses are bound already, add the IA_PD right away */
+	clear_timer(dhcp);
+	start_renew(dhcp);
+
+	return 0;
+}
+
 int __connman_dhcpv6_start_pd(int index, GSList *prefixes, dhcp_cb callback)
 {
 	struct connman_service *service;
@@ -2282,6 +2482,14 @@ int __connman_dhcpv6_start_pd(int index, GSList *prefixes, dhcp_cb callback)
 	if (network == NULL)
 		return -EINVAL;
 
+	if (network_table != NULL) {
+		dhcp = g_hash_table_lookup(network_table, network);
+		if (dhcp != NULL && dhcp->started == TRUE &&
+						dhcp->stateless == FALSE)
+			return start_shared_pd(dhcp, service, prefixes,
+						callback);
+	}
+
 	if (network_pd_table != NULL) {
 		dhcp = g_hash_table_lookup(network_pd_table, network);
 		if (dhcp != NULL && dhcp->started == TRUE)
@@ -2334,6 +2542,7 @@ void __connman_dhcpv6_stop_pd(int index)
 {
 	struct connman_service *service;
 	struct connman_network *network;
+	struct connman_dhcpv6 *dhcp;
 
 	if (index < 0)
 		return;
@@ -2351,6 +2560,15 @@ void __connman_dhcpv6_stop_pd(int index)
 	if (network == NULL)
 		return;
 
+	if (network_table != NULL) {
+		dhcp = g_hash_table_lookup(network_table, network);
+		if (dhcp != NULL && dhcp->pd_callback != NULL) {
+			release_shared_pd(dhcp);
+			stop_shared_pd(dhcp);
+			return;
+		}
+	}
+
 	__connman_dhcpv6_start_pd_release(network, NULL);
 
 	if (g_hash_table_remove(network_pd_table, network) == TRUE)
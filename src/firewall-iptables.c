@@ -0,0 +1,738 @@
+/*
+ *
+ *  Connection Manager
+ *
+ *  Copyright (C) 2013  BMW Car IT GmbH.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+
+#include <xtables.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+
+#include "connman.h"
+
+#define CHAIN_PREFIX "connman-"
+
+static const char *builtin_chains[] = {
+	[NF_IP_PRE_ROUTING]	= "PREROUTING",
+	[NF_IP_LOCAL_IN]	= "INPUT",
+	[NF_IP_FORWARD]		= "FORWARD",
+	[NF_IP_LOCAL_OUT]	= "OUTPUT",
+	[NF_IP_POST_ROUTING]	= "POSTROUTING",
+};
+
+struct connman_managed_table {
+	char *name;
+	unsigned int chains[NF_INET_NUMHOOKS];
+};
+
+enum firewall_group {
+	FIREWALL_GROUP_NAT,
+	FIREWALL_GROUP_CONNMARK,
+	FIREWALL_GROUP_MARKING,
+	FIREWALL_GROUP_ACCOUNTING,
+};
+
+struct fw_rule {
+	enum firewall_group group;
+	connman_bool_t enabled;
+
+	char *table;
+	char *chain;
+	char *rule_spec;
+
+	/* rule_spec split into a template and its parameters */
+	char *rule_template;
+	char **params;
+};
+
+struct firewall_context {
+	GList *rules;
+};
+
+static GSList *managed_tables;
+
+static int chain_to_index(const char *chain_name)
+{
+	if (!g_strcmp0(builtin_chains[NF_IP_PRE_ROUTING], chain_name))
+		return NF_IP_PRE_ROUTING;
+	if (!g_strcmp0(builtin_chains[NF_IP_LOCAL_IN], chain_name))
+		return NF_IP_LOCAL_IN;
+	if (!g_strcmp0(builtin_chains[NF_IP_FORWARD], chain_name))
+		return NF_IP_FORWARD;
+	if (!g_strcmp0(builtin_chains[NF_IP_LOCAL_OUT], chain_name))
+		return NF_IP_LOCAL_OUT;
+	if (!g_strcmp0(builtin_chains[NF_IP_POST_ROUTING], chain_name))
+		return NF_IP_POST_ROUTING;
+
+	return -1;
+}
+
+static int managed_chain_to_index(const char *chain_name)
+{
+	if (g_str_has_prefix(chain_name, CHAIN_PREFIX) == FALSE)
+		return -1;
+
+	return chain_to_index(chain_name + strlen(CHAIN_PREFIX));
+}
+
+static int insert_managed_chain(const char *table_name, int id)
+{
+	char *rule, *managed_chain;
+	int err;
+
+	managed_chain = g_strdup_printf("%s%s", CHAIN_PREFIX,
+					builtin_chains[id]);
+
+	err = __connman_iptables_new_chain(table_name, managed_chain);
+	if (err < 0)
+		goto out;
+
+	rule = g_strdup_printf("-j %s", managed_chain);
+	err = __connman_iptables_insert(table_name, builtin_chains[id], rule);
+	g_free(rule);
+	if (err < 0) {
+		__connman_iptables_delete_chain(table_name, managed_chain);
+		goto out;
+	}
+
+out:
+	g_free(managed_chain);
+
+	return err;
+}
+
+static int delete_managed_chain(const char *table_name, int id)
+{
+	char *rule, *managed_chain;
+	int err;
+
+	managed_chain = g_strdup_printf("%s%s", CHAIN_PREFIX,
+					builtin_chains[id]);
+
+	rule = g_strdup_printf("-j %s", managed_chain);
+	err = __connman_iptables_delete(table_name, builtin_chains[id], rule);
+	g_free(rule);
+
+	if (err < 0)
+		goto out;
+
+	err =  __connman_iptables_delete_chain(table_name, managed_chain);
+
+out:
+	g_free(managed_chain);
+
+	return err;
+}
+
+static int append_rule(const char *chain, struct fw_rule *rule)
+{
+	if (rule->rule_template != NULL)
+		return __connman_iptables_append_template(rule->table, chain,
+					rule->rule_template, rule->params);
+
+	return __connman_iptables_append(rule->table, chain, rule->rule_spec);
+}
+
+static int delete_rule(const char *chain, struct fw_rule *rule)
+{
+	if (rule->rule_template != NULL)
+		return __connman_iptables_delete_template(rule->table, chain,
+					rule->rule_template, rule->params);
+
+	return __connman_iptables_delete(rule->table, chain, rule->rule_spec);
+}
+
+static int insert_managed_rule(struct fw_rule *rule)
+{
+	const char *table_name = rule->table;
+	const char *chain_name = rule->chain;
+	struct connman_managed_table *mtable = NULL;
+	GSList *list;
+	char *chain;
+	int id, err;
+
+	id = chain_to_index(chain_name);
+	if (id < 0) {
+		/* This chain is not managed */
+		chain = g_strdup(chain_name);
+		goto out;
+	}
+
+	for (list = managed_tables; list != NULL; list = list->next) {
+		mtable = list->data;
+
+		if (g_strcmp0(mtable->name, table_name) == 0)
+			break;
+
+		mtable = NULL;
+	}
+
+	if (mtable == NULL) {
+		mtable = g_new0(struct connman_managed_table, 1);
+		mtable->name = g_strdup(table_name);
+
+		managed_tables = g_slist_prepend(managed_tables, mtable);
+	}
+
+	if (mtable->chains[id] == 0) {
+		DBG("table %s add managed chain for %s",
+			table_name, chain_name);
+
+		err = insert_managed_chain(table_name, id);
+		if (err < 0)
+			return err;
+	}
+
+	mtable->chains[id]++;
+	chain = g_strdup_printf("%s%s", CHAIN_PREFIX, chain_name);
+
+out:
+	err = append_rule(chain, rule);
+
+	g_free(chain);
+
+	return err;
+ }
+
+static int delete_managed_rule(struct fw_rule *rule)
+ {
+	const char *table_name = rule->table;
+	const char *chain_name = rule->chain;
+	struct connman_managed_table *mtable = NULL;
+	GSList *list;
+	int id, err;
+	char *managed_chain;
+
+	id = chain_to_index(chain_name);
+	if (id < 0) {
+		/* This chain is not managed */
+		return delete_rule(chain_name, rule);
+	}
+
+	managed_chain = g_strdup_printf("%s%s", CHAIN_PREFIX, chain_name);
+
+	err = delete_rule(managed_chain, rule);
+
+	for (list = managed_tables; list != NULL; list = list->next) {
+		mtable = list->data;
+
+		if (g_strcmp0(mtable->name, table_name) == 0)
+			break;
+
+		mtable = NULL;
+	}
+
+	if (mtable == NULL) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	mtable->chains[id]--;
+	if (mtable->chains[id] > 0)
+		goto out;
+
+	DBG("table %s remove managed chain for %s",
+			table_name, chain_name);
+
+	err = delete_managed_chain(table_name, id);
+
+ out:
+	g_free(managed_chain);
+
+	return err;
+}
+
+static void cleanup_managed_table(gpointer user_data)
+{
+	struct connman_managed_table *table = user_data;
+
+	g_free(table->name);
+	g_free(table);
+}
+
+static void cleanup_fw_rule(gpointer user_data)
+{
+	struct fw_rule *rule = user_data;
+
+	g_free(rule->rule_spec);
+	g_free(rule->rule_template);
+	g_strfreev(rule->params);
+	g_free(rule->chain);
+	g_free(rule->table);
+	g_free(rule);
+}
+
+struct firewall_context *__connman_firewall_create(void)
+{
+	struct firewall_context *ctx;
+
+	ctx = g_new0(struct firewall_context, 1);
+
+	return ctx;
+}
+
+void __connman_firewall_destroy(struct firewall_context *ctx)
+{
+	g_list_free_full(ctx->rules, cleanup_fw_rule);
+	g_free(ctx);
+}
+
+void __connman_firewall_begin(void)
+{
+	__connman_iptables_begin();
+}
+
+int __connman_firewall_end(void)
+{
+	return __connman_iptables_end();
+}
+
+/*
+ * Turn the rule format into an iptables rule template. Only plain
+ * %d, %u and %s conversions are supported, anything else leaves the
+ * rule without template.
+ */
+static char *parse_rule_fmt(const char *rule_fmt, va_list args,
+							char ***params)
+{
+	GString *str;
+	GPtrArray *values;
+	const char *fmt;
+
+	str = g_string_new(NULL);
+	values = g_ptr_array_new();
+
+	for (fmt = rule_fmt; *fmt != '\0'; fmt++) {
+		if (*fmt != '%') {
+			g_string_append_c(str, *fmt);
+			continue;
+		}
+
+		fmt++;
+
+		switch (*fmt) {
+		case 'd':
+			g_ptr_array_add(values,
+				g_strdup_printf("%d", va_arg(args, int)));
+			break;
+		case 'u':
+			g_ptr_array_add(values,
+				g_strdup_printf("%u",
+					va_arg(args, unsigned int)));
+			break;
+		case 's':
+			g_ptr_array_add(values,
+				g_strdup(va_arg(args, const char *)));
+			break;
+		default:
+			g_ptr_array_add(values, NULL);
+			g_strfreev((char **) g_ptr_array_free(values, FALSE));
+			g_string_free(str, TRUE);
+			return NULL;
+		}
+
+		g_string_append(str, "%s");
+	}
+
+	/* Without parameters the rule spec cache does the job */
+	if (values->len == 0) {
+		g_ptr_array_free(values, TRUE);
+		g_string_free(str, TRUE);
+		return NULL;
+	}
+
+	g_ptr_array_add(values, NULL);
+	*params = (char **) g_ptr_array_free(values, FALSE);
+
+	return g_string_free(str, FALSE);
+}
+
+static void firewall_add_rule(struct firewall_context *ctx,
+				enum firewall_group group,
+				const char *table,
+				const char *chain,
+				const char *rule_fmt, ...)
+{
+	va_list args;
+	char *rule_spec;
+	struct fw_rule *rule;
+
+	rule = g_new0(struct fw_rule, 1);
+
+	va_start(args, rule_fmt);
+
+	rule_spec = g_strdup_vprintf(rule_fmt, args);
+
+	va_end(args);
+
+	va_start(args, rule_fmt);
+
+	rule->rule_template = parse_rule_fmt(rule_fmt, args, &rule->params);
+
+	va_end(args);
+
+	rule->group = group;
+	rule->table = g_strdup(table);
+	rule->chain = g_strdup(chain);
+	rule->rule_spec = rule_spec;
+
+	ctx->rules = g_list_append(ctx->rules, rule);
+}
+
+static int firewall_disable_rules(struct firewall_context *ctx,
+					enum firewall_group group)
+{
+	struct fw_rule *rule;
+	GList *list;
+	int err = 0;
+
+	__connman_iptables_begin();
+
+	for (list = g_list_last(ctx->rules); list != NULL;
+			list = g_list_previous(list)) {
+		rule = list->data;
+
+		if (rule->group != group || rule->enabled == FALSE)
+			continue;
+
+		err = delete_managed_rule(rule);
+		if (err < 0)
+			break;
+
+		rule->enabled = FALSE;
+
+		err = __connman_iptables_commit(rule->table);
+		if (err < 0)
+			break;
+	}
+
+	if (err < 0)
+		__connman_iptables_end();
+	else
+		err = __connman_iptables_end();
+
+	if (err < 0) {
+		connman_error("Cannot remove previously installed "
+			"iptables rules: %s", strerror(-err));
+		return err;
+	}
+
+	return 0;
+}
+
+static int firewall_enable_rules(struct firewall_context *ctx,
+					enum firewall_group group)
+{
+	struct fw_rule *rule;
+	GList *list;
+	int err = 0;
+
+	/*
+	 * All rules of the group are collected in one transaction,
+	 * so every touched table is replaced only once.
+	 */
+	__connman_iptables_begin();
+
+	for (list = g_list_first(ctx->rules); list != NULL;
+			list = g_list_next(list)) {
+		rule = list->data;
+
+		if (rule->group != group || rule->enabled == TRUE)
+			continue;
+
+		DBG("%s %s %s", rule->table, rule->chain, rule->rule_spec);
+
+		err = insert_managed_rule(rule);
+		if (err < 0)
+			break;
+
+		rule->enabled = TRUE;
+
+		err = __connman_iptables_commit(rule->table);
+		if (err < 0)
+			break;
+	}
+
+	if (err < 0)
+		__connman_iptables_end();
+	else
+		err = __connman_iptables_end();
+
+	if (err < 0) {
+		connman_warn("Failed to install iptables rules: %s",
+			strerror(-err));
+
+		firewall_disable_rules(ctx, group);
+
+		return err;
+	}
+
+	return 0;
+}
+
+static void firewall_remove_rules(struct firewall_context *ctx,
+					enum firewall_group group)
+{
+	struct fw_rule *rule;
+	GList *list, *next;
+
+	for (list = ctx->rules; list != NULL; list = next) {
+		next = g_list_next(list);
+		rule = list->data;
+
+		if (rule->group != group)
+			continue;
+
+		ctx->rules = g_list_delete_link(ctx->rules, list);
+		cleanup_fw_rule(rule);
+	}
+}
+
+static int enable_group(struct firewall_context *ctx,
+				enum firewall_group group)
+{
+	int err;
+
+	err = firewall_enable_rules(ctx, group);
+	if (err < 0)
+		firewall_remove_rules(ctx, group);
+
+	return err;
+}
+
+static int disable_group(struct firewall_context *ctx,
+				enum firewall_group group)
+{
+	int err;
+
+	err = firewall_disable_rules(ctx, group);
+	if (err < 0)
+		return err;
+
+	firewall_remove_rules(ctx, group);
+
+	return 0;
+}
+
+int __connman_firewall_enable_nat(struct firewall_context *ctx,
+				const char *address, unsigned char prefixlen,
+				const char *interface)
+{
+	firewall_add_rule(ctx, FIREWALL_GROUP_NAT, "nat", "POSTROUTING",
+				"-s %s/%d -o %s -j MASQUERADE",
+				address, prefixlen, interface);
+
+	return enable_group(ctx, FIREWALL_GROUP_NAT);
+}
+
+int __connman_firewall_disable_nat(struct firewall_context *ctx)
+{
+	return disable_group(ctx, FIREWALL_GROUP_NAT);
+}
+
+int __connman_firewall_enable_connmark(struct firewall_context *ctx)
+{
+	firewall_add_rule(ctx, FIREWALL_GROUP_CONNMARK, "mangle", "INPUT",
+				"-j CONNMARK --restore-mark");
+	firewall_add_rule(ctx, FIREWALL_GROUP_CONNMARK, "mangle",
+				"POSTROUTING", "-j CONNMARK --save-mark");
+
+	return enable_group(ctx, FIREWALL_GROUP_CONNMARK);
+}
+
+int __connman_firewall_disable_connmark(struct firewall_context *ctx)
+{
+	return disable_group(ctx, FIREWALL_GROUP_CONNMARK);
+}
+
+int __connman_firewall_enable_marking(struct firewall_context *ctx,
+					enum connman_session_id_type id_type,
+					const char *id, uint32_t mark)
+{
+	switch (id_type) {
+	case CONNMAN_SESSION_ID_TYPE_UID:
+		firewall_add_rule(ctx, FIREWALL_GROUP_MARKING,
+				"mangle", "OUTPUT",
+				"-m owner --uid-owner %s -j MARK --set-mark %u",
+				id, mark);
+		break;
+	case CONNMAN_SESSION_ID_TYPE_GID:
+		firewall_add_rule(ctx, FIREWALL_GROUP_MARKING,
+				"mangle", "OUTPUT",
+				"-m owner --gid-owner %s -j MARK --set-mark %u",
+				id, mark);
+		break;
+	case CONNMAN_SESSION_ID_TYPE_UNKNOWN:
+	case CONNMAN_SESSION_ID_TYPE_LSM:
+		return -EINVAL;
+	}
+
+	return enable_group(ctx, FIREWALL_GROUP_MARKING);
+}
+
+int __connman_firewall_disable_marking(struct firewall_context *ctx)
+{
+	return disable_group(ctx, FIREWALL_GROUP_MARKING);
+}
+
+/*
+ * Counter names like "session-input-3" end in the session mark. The
+ * fixed prefix goes into the rule format so only the number is a
+ * template parameter and the rule can be patched instead of parsed.
+ */
+static void add_accounting_rule(struct firewall_context *ctx,
+				const char *chain, uint32_t mark,
+				const char *name)
+{
+	const char *num;
+	char *rule_fmt;
+
+	num = name + strlen(name);
+	while (num > name && g_ascii_isdigit(num[-1]) == TRUE)
+		num--;
+
+	if (*num == '\0' || strchr(name, '%') != NULL) {
+		firewall_add_rule(ctx, FIREWALL_GROUP_ACCOUNTING, "filter",
+				chain,
+				"-m mark --mark %u -m nfacct --nfacct-name %s",
+				mark, name);
+		return;
+	}
+
+	rule_fmt = g_strdup_printf("-m mark --mark %%u "
+					"-m nfacct --nfacct-name %.*s%%s",
+					(int) (num - name), name);
+
+	firewall_add_rule(ctx, FIREWALL_GROUP_ACCOUNTING, "filter", chain,
+				rule_fmt, mark, num);
+
+	g_free(rule_fmt);
+}
+
+int __connman_firewall_enable_accounting(struct firewall_context *ctx,
+					uint32_t mark, const char *input,
+					const char *output)
+{
+	add_accounting_rule(ctx, "INPUT", mark, input);
+	add_accounting_rule(ctx, "OUTPUT", mark, output);
+
+	return enable_group(ctx, FIREWALL_GROUP_ACCOUNTING);
+}
+
+int __connman_firewall_disable_accounting(struct firewall_context *ctx)
+{
+	return disable_group(ctx, FIREWALL_GROUP_ACCOUNTING);
+}
+
+static void iterate_chains_cb(const char *chain_name, void *user_data)
+{
+	GSList **chains = user_data;
+	int id;
+
+	id = managed_chain_to_index(chain_name);
+	if (id < 0)
+		return;
+
+	*chains = g_slist_prepend(*chains, GINT_TO_POINTER(id));
+}
+
+static void flush_table(const char *table_name)
+{
+	GSList *chains = NULL, *list;
+	char *rule, *managed_chain;
+	int id, err;
+
+	__connman_iptables_iterate_chains(table_name, iterate_chains_cb,
+						&chains);
+
+	for (list = chains; list != NULL; list = list->next) {
+		id = GPOINTER_TO_INT(list->data);
+
+		managed_chain = g_strdup_printf("%s%s", CHAIN_PREFIX,
+						builtin_chains[id]);
+
+		rule = g_strdup_printf("-j %s", managed_chain);
+		err = __connman_iptables_delete(table_name,
+						builtin_chains[id], rule);
+		if (err < 0) {
+			connman_warn("Failed to delete jump rule '%s': %s",
+				rule, strerror(-err));
+		}
+		g_free(rule);
+
+		err = __connman_iptables_flush_chain(table_name, managed_chain);
+		if (err < 0) {
+			connman_warn("Failed to flush chain '%s': %s",
+				managed_chain, strerror(-err));
+		}
+		err = __connman_iptables_delete_chain(table_name, managed_chain);
+		if (err < 0) {
+			connman_warn("Failed to delete chain '%s': %s",
+				managed_chain, strerror(-err));
+		}
+
+		g_free(managed_chain);
+	}
+
+	err = __connman_iptables_commit(table_name);
+	if (err < 0) {
+		connman_warn("Failed to flush table '%s': %s",
+			table_name, strerror(-err));
+	}
+
+	g_slist_free(chains);
+}
+
+static void flush_all_tables(void)
+{
+	/* Flush the tables ConnMan might have modified */
+
+	__connman_iptables_begin();
+
+	flush_table("filter");
+	flush_table("mangle");
+	flush_table("nat");
+
+	if (__connman_iptables_end() < 0)
+		connman_warn("Failed to flush iptables tables");
+}
+
+int __connman_firewall_init(void)
+{
+	DBG("");
+
+	__connman_iptables_init();
+
+	flush_all_tables();
+
+	return 0;
+}
+
+void __connman_firewall_cleanup(void)
+{
+	DBG("");
+
+	g_slist_free_full(managed_tables, cleanup_managed_table);
+
+	__connman_iptables_cleanup();
+}
@@ -0,0 +1,1531 @@
+/*
+ *
+ *  Connection Manager
+ *
+ *  Copyright (C) 2013  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * nftables backend for the firewall interface.
+ *
+ * All rules live in the table "ip connman". Every change is sent as one
+ * nfnetlink batch, so the kernel applies it atomically and only the
+ * touched rules are added or removed. Rules are deleted again by the
+ * handle the kernel echoes back when they are created. Every rule also
+ * carries the sequence number of the message creating it as comment,
+ * so its handle can be found in a dump of the table if the echo is
+ * lost.
+ *
+ * Session marking does not add rules at all: the OUTPUT route chain
+ * looks up the socket owner in the uid-marks and gid-marks maps, so
+ * a session only adds or removes a map element.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <pwd.h>
+#include <grp.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nf_tables_compat.h>
+#include <linux/netfilter/xt_nfacct.h>
+
+#include "connman.h"
+
+#define CONNMAN_TABLE		"connman"
+
+#define UID_MARKS		"uid-marks"
+#define GID_MARKS		"gid-marks"
+#define UID_MARKS_ID		1
+#define GID_MARKS_ID		2
+
+/* nft data type ids, only used by nft(8) to print the map */
+#define NFT_TYPE_MARK		19
+#define NFT_TYPE_UID		24
+#define NFT_TYPE_GID		25
+
+#define NFT_MSG(type)		((NFNL_SUBSYS_NFTABLES << 8) | (type))
+
+/* nftnl user data type of a rule comment, as shown by nft(8) */
+#define NFT_UDATA_RULE_COMMENT	0
+
+/*
+ * The kernel answers a batch while processing the send() call, so the
+ * replies are normally queued before the first recv(). The timeout
+ * only bounds how long the main loop waits for replies that got lost.
+ */
+#define NFT_REPLY_TIMEOUT	100
+
+enum firewall_group {
+	FIREWALL_GROUP_NAT,
+	FIREWALL_GROUP_CONNMARK,
+	FIREWALL_GROUP_ACCOUNTING,
+};
+
+struct fw_rule {
+	struct firewall_context *ctx;
+	enum firewall_group group;
+	const char *chain;
+	uint64_t handle;
+
+	/* sequence number of the message creating the rule */
+	uint32_t seq;
+};
+
+struct firewall_context {
+	GList *rules;
+
+	/* map element installed by __connman_firewall_enable_marking() */
+	const char *marks;
+	uint32_t owner;
+	uint32_t mark;
+};
+
+struct nft_base_chain {
+	const char *name;
+	const char *type;
+	unsigned int hook;
+	int priority;
+};
+
+static const struct nft_base_chain base_chains[] = {
+	{ "nat-prerouting",	"nat",		NF_INET_PRE_ROUTING,	-100 },
+	{ "nat-postrouting",	"nat",		NF_INET_POST_ROUTING,	100 },
+	{ "mangle-input",	"filter",	NF_INET_LOCAL_IN,	-150 },
+	{ "mangle-postrouting",	"filter",	NF_INET_POST_ROUTING,	-150 },
+	{ "route-output",	"route",	NF_INET_LOCAL_OUT,	-150 },
+	{ "filter-input",	"filter",	NF_INET_LOCAL_IN,	0 },
+	{ "filter-output",	"filter",	NF_INET_LOCAL_OUT,	0 },
+	{ },
+};
+
+struct nft_batch {
+	char *buf;
+	size_t len;
+	size_t size;
+
+	/* offset of the message currently being built */
+	size_t msg;
+
+	uint32_t first_seq;
+	uint32_t last_seq;
+	unsigned int acks;
+
+	/* rules waiting for the handle the kernel echoes back */
+	GSList *pending;
+
+	/* rules deleted by the batch, freed once it is applied */
+	GSList *deleted;
+
+	/* the batch changes the uid-marks or gid-marks map */
+	connman_bool_t marks_changed;
+};
+
+static int nft_fd = -1;
+static uint32_t nft_seq;
+
+/* Batch collecting all changes between __connman_firewall_begin/end */
+static struct nft_batch *transaction;
+static int transaction_level;
+
+/* Active marks per uid and gid, the head is the one in the map */
+static GHashTable *uid_marks;
+static GHashTable *gid_marks;
+
+static struct nft_batch *batch_new(void)
+{
+	struct nft_batch *batch;
+
+	batch = g_new0(struct nft_batch, 1);
+	batch->size = 4096;
+	batch->buf = g_malloc0(batch->size);
+
+	return batch;
+}
+
+static void batch_free(struct nft_batch *batch)
+{
+	g_slist_free(batch->pending);
+	g_slist_free(batch->deleted);
+	g_free(batch->buf);
+	g_free(batch);
+}
+
+static size_t batch_put(struct nft_batch *batch, const void *data,
+								size_t len)
+{
+	size_t offset = batch->len;
+	size_t aligned = NLMSG_ALIGN(len);
+
+	while (batch->len + aligned > batch->size) {
+		batch->size *= 2;
+		batch->buf = g_realloc(batch->buf, batch->size);
+	}
+
+	memset(batch->buf + offset, 0, aligned);
+	if (data != NULL)
+		memcpy(batch->buf + offset, data, len);
+
+	batch->len += aligned;
+
+	return offset;
+}
+
+static uint32_t msg_begin(struct nft_batch *batch, uint16_t type,
+				uint16_t flags, uint8_t family,
+				uint16_t res_id)
+{
+	struct nlmsghdr nlh;
+	struct nfgenmsg nfg;
+
+	memset(&nlh, 0, sizeof(nlh));
+	nlh.nlmsg_type = type;
+	nlh.nlmsg_flags = NLM_F_REQUEST | flags;
+	nlh.nlmsg_seq = ++nft_seq;
+
+	memset(&nfg, 0, sizeof(nfg));
+	nfg.nfgen_family = family;
+	nfg.version = NFNETLINK_V0;
+	nfg.res_id = htons(res_id);
+
+	batch->msg = batch_put(batch, &nlh, sizeof(nlh));
+	batch_put(batch, &nfg, sizeof(nfg));
+
+	if (batch->first_seq == 0)
+		batch->first_seq = nlh.nlmsg_seq;
+	batch->last_seq = nlh.nlmsg_seq;
+
+	if (flags & NLM_F_ACK)
+		batch->acks++;
+
+	return nlh.nlmsg_seq;
+}
+
+static void msg_end(struct nft_batch *batch)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *) (batch->buf + batch->msg);
+
+	nlh->nlmsg_len = batch->len - batch->msg;
+}
+
+static uint32_t nft_msg_begin(struct nft_batch *batch, uint16_t type,
+							uint16_t flags)
+{
+	return msg_begin(batch, NFT_MSG(type), flags | NLM_F_ACK,
+							NFPROTO_IPV4, 0);
+}
+
+static void attr_put(struct nft_batch *batch, uint16_t type,
+				const void *data, size_t len)
+{
+	struct nlattr nla;
+
+	nla.nla_type = type;
+	nla.nla_len = NLA_HDRLEN + len;
+
+	batch_put(batch, &nla, sizeof(nla));
+	batch_put(batch, data, len);
+}
+
+static void attr_put_str(struct nft_batch *batch, uint16_t type,
+							const char *str)
+{
+	attr_put(batch, type, str, strlen(str) + 1);
+}
+
+static void attr_put_u32(struct nft_batch *batch, uint16_t type,
+							uint32_t value)
+{
+	value = htonl(value);
+
+	attr_put(batch, type, &value, sizeof(value));
+}
+
+static void attr_put_u64(struct nft_batch *batch, uint16_t type,
+							uint64_t value)
+{
+	value = htobe64(value);
+
+	attr_put(batch, type, &value, sizeof(value));
+}
+
+static size_t nest_begin(struct nft_batch *batch, uint16_t type)
+{
+	struct nlattr nla;
+
+	nla.nla_type = NLA_F_NESTED | type;
+	nla.nla_len = 0;
+
+	return batch_put(batch, &nla, sizeof(nla));
+}
+
+static void nest_end(struct nft_batch *batch, size_t nest)
+{
+	struct nlattr *nla = (struct nlattr *) (batch->buf + nest);
+
+	nla->nla_len = batch->len - nest;
+}
+
+static void data_put(struct nft_batch *batch, uint16_t type,
+				const void *data, size_t len)
+{
+	size_t nest;
+
+	nest = nest_begin(batch, type);
+	attr_put(batch, NFTA_DATA_VALUE, data, len);
+	nest_end(batch, nest);
+}
+
+/* Expressions, each is one element of NFTA_RULE_EXPRESSIONS */
+
+static size_t expr_begin(struct nft_batch *batch, const char *name,
+							size_t *data)
+{
+	size_t elem;
+
+	elem = nest_begin(batch, NFTA_LIST_ELEM);
+	attr_put_str(batch, NFTA_EXPR_NAME, name);
+	*data = nest_begin(batch, NFTA_EXPR_DATA);
+
+	return elem;
+}
+
+static void expr_end(struct nft_batch *batch, size_t elem, size_t data)
+{
+	nest_end(batch, data);
+	nest_end(batch, elem);
+}
+
+static void expr_meta_load(struct nft_batch *batch, uint32_t key)
+{
+	size_t elem, data;
+
+	elem = expr_begin(batch, "meta", &data);
+	attr_put_u32(batch, NFTA_META_KEY, key);
+	attr_put_u32(batch, NFTA_META_DREG, NFT_REG_1);
+	expr_end(batch, elem, data);
+}
+
+static void expr_meta_set(struct nft_batch *batch, uint32_t key)
+{
+	size_t elem, data;
+
+	elem = expr_begin(batch, "meta", &data);
+	attr_put_u32(batch, NFTA_META_KEY, key);
+	attr_put_u32(batch, NFTA_META_SREG, NFT_REG_1);
+	expr_end(batch, elem, data);
+}
+
+static void expr_ct_load(struct nft_batch *batch, uint32_t key)
+{
+	size_t elem, data;
+
+	elem = expr_begin(batch, "ct", &data);
+	attr_put_u32(batch, NFTA_CT_KEY, key);
+	attr_put_u32(batch, NFTA_CT_DREG, NFT_REG_1);
+	expr_end(batch, elem, data);
+}
+
+static void expr_ct_set(struct nft_batch *batch, uint32_t key)
+{
+	size_t elem, data;
+
+	elem = expr_begin(batch, "ct", &data);
+	attr_put_u32(batch, NFTA_CT_KEY, key);
+	attr_put_u32(batch, NFTA_CT_SREG, NFT_REG_1);
+	expr_end(batch, elem, data);
+}
+
+static void expr_cmp_eq(struct nft_batch *batch, const void *value,
+								size_t len)
+{
+	size_t elem, data;
+
+	elem = expr_begin(batch, "cmp", &data);
+	attr_put_u32(batch, NFTA_CMP_SREG, NFT_REG_1);
+	attr_put_u32(batch, NFTA_CMP_OP, NFT_CMP_EQ);
+	data_put(batch, NFTA_CMP_DATA, value, len);
+	expr_end(batch, elem, data);
+}
+
+static void expr_payload_load(struct nft_batch *batch, uint32_t base,
+					uint32_t offset, uint32_t len)
+{
+	size_t elem, data;
+
+	elem = expr_begin(batch, "payload", &data);
+	attr_put_u32(batch, NFTA_PAYLOAD_DREG, NFT_REG_1);
+	attr_put_u32(batch, NFTA_PAYLOAD_BASE, base);
+	attr_put_u32(batch, NFTA_PAYLOAD_OFFSET, offset);
+	attr_put_u32(batch, NFTA_PAYLOAD_LEN, len);
+	expr_end(batch, elem, data);
+}
+
+static void expr_bitwise_and(struct nft_batch *batch, const void *mask,
+								size_t len)
+{
+	char xor[16];
+	size_t elem, data;
+
+	memset(xor, 0, sizeof(xor));
+
+	elem = expr_begin(batch, "bitwise", &data);
+	attr_put_u32(batch, NFTA_BITWISE_SREG, NFT_REG_1);
+	attr_put_u32(batch, NFTA_BITWISE_DREG, NFT_REG_1);
+	attr_put_u32(batch, NFTA_BITWISE_LEN, len);
+	data_put(batch, NFTA_BITWISE_MASK, mask, len);
+	data_put(batch, NFTA_BITWISE_XOR, xor, len);
+	expr_end(batch, elem, data);
+}
+
+static void expr_lookup_map(struct nft_batch *batch, const char *set,
+							uint32_t set_id)
+{
+	size_t elem, data;
+
+	elem = expr_begin(batch, "lookup", &data);
+	attr_put_str(batch, NFTA_LOOKUP_SET, set);
+	attr_put_u32(batch, NFTA_LOOKUP_SET_ID, set_id);
+	attr_put_u32(batch, NFTA_LOOKUP_SREG, NFT_REG_1);
+	attr_put_u32(batch, NFTA_LOOKUP_DREG, NFT_REG_1);
+	expr_end(batch, elem, data);
+}
+
+static void expr_masq(struct nft_batch *batch)
+{
+	size_t elem, data;
+
+	elem = expr_begin(batch, "masq", &data);
+	expr_end(batch, elem, data);
+}
+
+static void expr_nfacct(struct nft_batch *batch, const char *name)
+{
+	struct xt_nfacct_match_info_v1 info;
+	size_t elem, data;
+
+	memset(&info, 0, sizeof(info));
+	strncpy(info.name, name, sizeof(info.name) - 1);
+
+	/* nftables has no nfacct expression, use the xtables match */
+	elem = expr_begin(batch, "match", &data);
+	attr_put_str(batch, NFTA_MATCH_NAME, "nfacct");
+	attr_put_u32(batch, NFTA_MATCH_REV, 1);
+	attr_put(batch, NFTA_MATCH_INFO, &info, sizeof(info));
+	expr_end(batch, elem, data);
+}
+
+/* Objects of the connman table */
+
+static void batch_begin(struct nft_batch *batch)
+{
+	msg_begin(batch, NFNL_MSG_BATCH_BEGIN, 0, AF_UNSPEC,
+						NFNL_SUBSYS_NFTABLES);
+	msg_end(batch);
+}
+
+static void batch_end(struct nft_batch *batch)
+{
+	msg_begin(batch, NFNL_MSG_BATCH_END, 0, AF_UNSPEC,
+						NFNL_SUBSYS_NFTABLES);
+	msg_end(batch);
+}
+
+static void add_table(struct nft_batch *batch)
+{
+	nft_msg_begin(batch, NFT_MSG_NEWTABLE, NLM_F_CREATE);
+	attr_put_str(batch, NFTA_TABLE_NAME, CONNMAN_TABLE);
+	msg_end(batch);
+}
+
+static void del_table(struct nft_batch *batch)
+{
+	nft_msg_begin(batch, NFT_MSG_DELTABLE, 0);
+	attr_put_str(batch, NFTA_TABLE_NAME, CONNMAN_TABLE);
+	msg_end(batch);
+}
+
+static void add_base_chain(struct nft_batch *batch,
+				const struct nft_base_chain *chain)
+{
+	size_t hook;
+
+	nft_msg_begin(batch, NFT_MSG_NEWCHAIN, NLM_F_CREATE);
+	attr_put_str(batch, NFTA_CHAIN_TABLE, CONNMAN_TABLE);
+	attr_put_str(batch, NFTA_CHAIN_NAME, chain->name);
+
+	hook = nest_begin(batch, NFTA_CHAIN_HOOK);
+	attr_put_u32(batch, NFTA_HOOK_HOOKNUM, chain->hook);
+	attr_put_u32(batch, NFTA_HOOK_PRIORITY, chain->priority);
+	nest_end(batch, hook);
+
+	attr_put_str(batch, NFTA_CHAIN_TYPE, chain->type);
+	msg_end(batch);
+}
+
+static void add_map(struct nft_batch *batch, const char *name,
+				uint32_t id, uint32_t key_type)
+{
+	nft_msg_begin(batch, NFT_MSG_NEWSET, NLM_F_CREATE);
+	attr_put_str(batch, NFTA_SET_TABLE, CONNMAN_TABLE);
+	attr_put_str(batch, NFTA_SET_NAME, name);
+	attr_put_u32(batch, NFTA_SET_FLAGS, NFT_SET_MAP);
+	attr_put_u32(batch, NFTA_SET_KEY_TYPE, key_type);
+	attr_put_u32(batch, NFTA_SET_KEY_LEN, sizeof(uint32_t));
+	attr_put_u32(batch, NFTA_SET_DATA_TYPE, NFT_TYPE_MARK);
+	attr_put_u32(batch, NFTA_SET_DATA_LEN, sizeof(uint32_t));
+	attr_put_u32(batch, NFTA_SET_ID, id);
+	msg_end(batch);
+}
+
+static void map_elem(struct nft_batch *batch, uint16_t type,
+			const char *map, uint32_t key, uint32_t *value)
+{
+	size_t elements, elem;
+
+	nft_msg_begin(batch, type, type == NFT_MSG_NEWSETELEM ?
+							NLM_F_CREATE : 0);
+	attr_put_str(batch, NFTA_SET_ELEM_LIST_TABLE, CONNMAN_TABLE);
+	attr_put_str(batch, NFTA_SET_ELEM_LIST_SET, map);
+
+	elements = nest_begin(batch, NFTA_SET_ELEM_LIST_ELEMENTS);
+	elem = nest_begin(batch, NFTA_LIST_ELEM);
+	data_put(batch, NFTA_SET_ELEM_KEY, &key, sizeof(key));
+	if (value != NULL)
+		data_put(batch, NFTA_SET_ELEM_DATA, value, sizeof(*value));
+	nest_end(batch, elem);
+	nest_end(batch, elements);
+
+	msg_end(batch);
+}
+
+static void rule_put_tag(struct nft_batch *batch, uint32_t seq)
+{
+	char udata[16];
+	int len;
+
+	/* One user data TLV, a nul terminated comment */
+	len = snprintf(udata + 2, sizeof(udata) - 2, "%u", seq) + 1;
+	udata[0] = NFT_UDATA_RULE_COMMENT;
+	udata[1] = len;
+
+	attr_put(batch, NFTA_RULE_USERDATA, udata, len + 2);
+}
+
+static uint32_t rule_get_tag(struct nlattr *nla)
+{
+	char *udata = (char *) nla + NLA_HDRLEN;
+	int len = nla->nla_len - NLA_HDRLEN;
+
+	if (len < 3 || udata[0] != NFT_UDATA_RULE_COMMENT ||
+			udata[1] != len - 2 || udata[len - 1] != '\0')
+		return 0;
+
+	return strtoul(udata + 2, NULL, 10);
+}
+
+static size_t rule_begin(struct nft_batch *batch, const char *chain,
+						struct fw_rule *rule)
+{
+	uint32_t seq;
+
+	seq = nft_msg_begin(batch, NFT_MSG_NEWRULE,
+			NLM_F_CREATE | NLM_F_APPEND | NLM_F_ECHO);
+	attr_put_str(batch, NFTA_RULE_TABLE, CONNMAN_TABLE);
+	attr_put_str(batch, NFTA_RULE_CHAIN, chain);
+
+	if (rule != NULL) {
+		rule_put_tag(batch, seq);
+
+		rule->seq = seq;
+		batch->pending = g_slist_prepend(batch->pending, rule);
+	}
+
+	return nest_begin(batch, NFTA_RULE_EXPRESSIONS);
+}
+
+static void rule_end(struct nft_batch *batch, size_t exprs)
+{
+	nest_end(batch, exprs);
+	msg_end(batch);
+}
+
+static void del_rule(struct nft_batch *batch, struct fw_rule *rule)
+{
+	nft_msg_begin(batch, NFT_MSG_DELRULE, 0);
+	attr_put_str(batch, NFTA_RULE_TABLE, CONNMAN_TABLE);
+	attr_put_str(batch, NFTA_RULE_CHAIN, rule->chain);
+	attr_put_u64(batch, NFTA_RULE_HANDLE, rule->handle);
+	msg_end(batch);
+
+	batch->deleted = g_slist_prepend(batch->deleted, rule);
+}
+
+static void parse_rule(struct nlmsghdr *nlh, struct nlattr **tb)
+{
+	struct nlattr *nla;
+	int len;
+
+	memset(tb, 0, sizeof(struct nlattr *) * (NFTA_RULE_MAX + 1));
+
+	len = nlh->nlmsg_len - NLMSG_SPACE(sizeof(struct nfgenmsg));
+	nla = (struct nlattr *) ((char *) NLMSG_DATA(nlh) +
+				NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+
+	while (len >= (int) sizeof(*nla) && nla->nla_len >= sizeof(*nla) &&
+						nla->nla_len <= len) {
+		if ((nla->nla_type & NLA_TYPE_MASK) <= NFTA_RULE_MAX)
+			tb[nla->nla_type & NLA_TYPE_MASK] = nla;
+
+		len -= NLA_ALIGN(nla->nla_len);
+		nla = (struct nlattr *) ((char *) nla +
+					NLA_ALIGN(nla->nla_len));
+	}
+}
+
+static uint64_t rule_get_handle(struct nlattr *nla)
+{
+	uint64_t handle;
+
+	if (nla->nla_len < NLA_HDRLEN + sizeof(handle))
+		return 0;
+
+	memcpy(&handle, (char *) nla + NLA_HDRLEN, sizeof(handle));
+
+	return be64toh(handle);
+}
+
+static void set_rule_handle(struct nft_batch *batch, struct nlmsghdr *nlh)
+{
+	struct nlattr *tb[NFTA_RULE_MAX + 1];
+	struct fw_rule *rule;
+	GSList *list;
+
+	parse_rule(nlh, tb);
+	if (tb[NFTA_RULE_HANDLE] == NULL)
+		return;
+
+	for (list = batch->pending; list != NULL; list = list->next) {
+		rule = list->data;
+
+		if (rule->seq == nlh->nlmsg_seq) {
+			rule->handle = rule_get_handle(tb[NFTA_RULE_HANDLE]);
+			return;
+		}
+	}
+}
+
+static connman_bool_t handles_missing(struct nft_batch *batch)
+{
+	GSList *list;
+
+	for (list = batch->pending; list != NULL; list = list->next) {
+		struct fw_rule *rule = list->data;
+
+		if (rule->handle == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Wait for the next answer, but never beyond the deadline, so that a
+ * lost answer stalls the main loop only briefly.
+ */
+static ssize_t nft_recv(char *buf, size_t size, gint64 deadline)
+{
+	struct pollfd pfd;
+	ssize_t len;
+	int timeout;
+
+	for (;;) {
+		len = recv(nft_fd, buf, size, MSG_DONTWAIT);
+		if (len >= 0)
+			return len;
+
+		if (errno == EINTR)
+			continue;
+
+		if (errno != EAGAIN)
+			return -errno;
+
+		timeout = (deadline - g_get_monotonic_time()) / 1000;
+		if (timeout <= 0)
+			return -ETIMEDOUT;
+
+		pfd.fd = nft_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+			return -errno;
+	}
+}
+
+/*
+ * Send the batch and wait until the kernel has answered every message
+ * and echoed the handle of every new rule. The kernel applies all
+ * messages of the batch or none, the first error is returned. If an
+ * answer is missing, e.g. because the receive queue overflowed, the
+ * outcome is unknown and -ETIMEDOUT is returned.
+ */
+static int batch_commit(struct nft_batch *batch)
+{
+	char buf[8192];
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *nle;
+	unsigned int acks;
+	gint64 deadline;
+	ssize_t len;
+	int err = 0;
+
+	if (nft_fd < 0)
+		return -EOPNOTSUPP;
+
+	if (send(nft_fd, batch->buf, batch->len, 0) < 0)
+		return -errno;
+
+	deadline = g_get_monotonic_time() + NFT_REPLY_TIMEOUT * 1000;
+
+	for (acks = 0; acks < batch->acks ||
+			(err == 0 && handles_missing(batch) == TRUE); ) {
+		len = nft_recv(buf, sizeof(buf), deadline);
+		if (len < 0) {
+			/* Any refused message means the batch was refused */
+			if (err < 0)
+				return err;
+
+			return -ETIMEDOUT;
+		}
+
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, len);
+					nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq < batch->first_seq ||
+					nlh->nlmsg_seq > batch->last_seq)
+				continue;
+
+			if (nlh->nlmsg_type == NFT_MSG(NFT_MSG_NEWRULE)) {
+				set_rule_handle(batch, nlh);
+				continue;
+			}
+
+			if (nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			nle = NLMSG_DATA(nlh);
+			if (nle->error < 0 && err == 0)
+				err = nle->error;
+
+			/* The batch was refused as a whole */
+			if (nlh->nlmsg_seq == batch->first_seq)
+				return err;
+
+			acks++;
+		}
+	}
+
+	return err;
+}
+
+static connman_bool_t is_connman_table(struct nlattr *nla)
+{
+	if (nla == NULL)
+		return FALSE;
+
+	return strncmp((char *) nla + NLA_HDRLEN, CONNMAN_TABLE,
+				nla->nla_len - NLA_HDRLEN) == 0;
+}
+
+/*
+ * The answers to a batch are missing. Look for its rules in a dump of
+ * the table: new rules by their tag, which also recovers their handle,
+ * deleted rules by their handle. Returns 0 if the batch was applied.
+ */
+static int batch_resync(struct nft_batch *batch)
+{
+	struct nlattr *tb[NFTA_RULE_MAX + 1];
+	struct nft_batch *dump;
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *nle;
+	struct fw_rule *rule;
+	char buf[8192];
+	GSList *list;
+	unsigned int added = 0, kept = 0;
+	connman_bool_t done = FALSE;
+	uint64_t handle;
+	uint32_t tag;
+	gint64 deadline;
+	ssize_t len;
+	int err = 0;
+
+	for (list = batch->pending; list != NULL; list = list->next) {
+		rule = list->data;
+		rule->handle = 0;
+	}
+
+	dump = batch_new();
+	msg_begin(dump, NFT_MSG(NFT_MSG_GETRULE), NLM_F_DUMP,
+							NFPROTO_IPV4, 0);
+	attr_put_str(dump, NFTA_RULE_TABLE, CONNMAN_TABLE);
+	msg_end(dump);
+
+	if (send(nft_fd, dump->buf, dump->len, 0) < 0) {
+		err = -errno;
+		goto out;
+	}
+
+	deadline = g_get_monotonic_time() + NFT_REPLY_TIMEOUT * 1000;
+
+	while (done == FALSE) {
+		len = nft_recv(buf, sizeof(buf), deadline);
+		if (len < 0) {
+			err = len;
+			goto out;
+		}
+
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, len);
+					nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != dump->first_seq)
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = TRUE;
+				break;
+			}
+
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				nle = NLMSG_DATA(nlh);
+				err = nle->error;
+				goto out;
+			}
+
+			if (nlh->nlmsg_type != NFT_MSG(NFT_MSG_NEWRULE))
+				continue;
+
+			parse_rule(nlh, tb);
+			if (is_connman_table(tb[NFTA_RULE_TABLE]) == FALSE ||
+					tb[NFTA_RULE_HANDLE] == NULL)
+				continue;
+
+			handle = rule_get_handle(tb[NFTA_RULE_HANDLE]);
+
+			tag = 0;
+			if (tb[NFTA_RULE_USERDATA] != NULL)
+				tag = rule_get_tag(tb[NFTA_RULE_USERDATA]);
+
+			for (list = batch->pending; list != NULL && tag != 0;
+							list = list->next) {
+				rule = list->data;
+
+				if (rule->seq == tag) {
+					rule->handle = handle;
+					added++;
+				}
+			}
+
+			for (list = batch->deleted; list != NULL;
+							list = list->next) {
+				rule = list->data;
+
+				if (rule->handle == handle)
+					kept++;
+			}
+		}
+	}
+
+	DBG("added %u kept %u", added, kept);
+
+	/* Without any rules the batch cannot be told apart */
+	if (batch->pending != NULL)
+		err = added > 0 ? 0 : -ETIMEDOUT;
+	else if (batch->deleted != NULL)
+		err = kept == 0 ? 0 : -ETIMEDOUT;
+	else
+		err = -ETIMEDOUT;
+
+out:
+	batch_free(dump);
+
+	return err;
+}
+
+static void free_rule(struct fw_rule *rule)
+{
+	rule->ctx->rules = g_list_remove(rule->ctx->rules, rule);
+	g_free(rule);
+}
+
+static void sync_marks(void);
+
+/*
+ * Bring the firewall contexts in line with what the kernel did with
+ * the batch. New rules are dropped again if the batch was refused,
+ * deleted rules are only forgotten once the kernel removed them, so
+ * that deleting them can be tried again.
+ */
+static int batch_apply(struct nft_batch *batch, int err)
+{
+	struct fw_rule *rule;
+	GSList *list;
+
+	if (err == -ETIMEDOUT) {
+		connman_warn("nftables did not answer, reading back rules");
+
+		err = batch_resync(batch);
+		if (err < 0 && err != -ETIMEDOUT)
+			connman_error("Cannot read back nftables rules: %s",
+							strerror(-err));
+	}
+
+	for (list = batch->pending; list != NULL; list = list->next) {
+		rule = list->data;
+
+		if (err < 0 || rule->handle == 0)
+			free_rule(rule);
+	}
+
+	if (err == 0)
+		g_slist_foreach(batch->deleted, (GFunc) free_rule, NULL);
+
+	if (err < 0 && batch->marks_changed == TRUE)
+		sync_marks();
+
+	return err;
+}
+
+/*
+ * Outside of a transaction every change gets its own batch. Inside of
+ * one all changes are collected in the transaction batch.
+ */
+static struct nft_batch *batch_open(void)
+{
+	struct nft_batch *batch;
+
+	if (transaction != NULL)
+		return transaction;
+
+	batch = batch_new();
+	batch_begin(batch);
+
+	return batch;
+}
+
+static int batch_finish(struct nft_batch *batch)
+{
+	int err = 0;
+
+	batch_end(batch);
+
+	if (batch->acks > 0)
+		err = batch_commit(batch);
+
+	err = batch_apply(batch, err);
+	batch_free(batch);
+
+	return err;
+}
+
+static int batch_close(struct nft_batch *batch)
+{
+	if (batch == transaction)
+		return 0;
+
+	return batch_finish(batch);
+}
+
+/* Rules */
+
+static struct fw_rule *rule_new(struct firewall_context *ctx,
+				enum firewall_group group, const char *chain)
+{
+	struct fw_rule *rule;
+
+	rule = g_new0(struct fw_rule, 1);
+	rule->ctx = ctx;
+	rule->group = group;
+	rule->chain = chain;
+
+	ctx->rules = g_list_append(ctx->rules, rule);
+
+	return rule;
+}
+
+static int enable_rules(struct nft_batch *batch)
+{
+	int err;
+
+	err = batch_close(batch);
+	if (err < 0)
+		connman_warn("Failed to install nftables rules: %s",
+							strerror(-err));
+
+	return err;
+}
+
+static int disable_rules(struct firewall_context *ctx,
+				enum firewall_group group)
+{
+	struct nft_batch *batch;
+	struct fw_rule *rule;
+	GList *list;
+	int err;
+
+	/*
+	 * Rules created earlier in the open transaction have no
+	 * handle yet and cannot be addressed before it is committed.
+	 */
+	for (list = ctx->rules; list != NULL; list = list->next) {
+		rule = list->data;
+
+		if (rule->group == group && rule->handle == 0)
+			return -EINPROGRESS;
+	}
+
+	batch = batch_open();
+
+	for (list = ctx->rules; list != NULL; list = list->next) {
+		rule = list->data;
+
+		if (rule->group == group)
+			del_rule(batch, rule);
+	}
+
+	err = batch_close(batch);
+	if (err < 0) {
+		connman_error("Cannot remove previously installed "
+			"nftables rules: %s", strerror(-err));
+		return err;
+	}
+
+	return 0;
+}
+
+struct firewall_context *__connman_firewall_create(void)
+{
+	struct firewall_context *ctx;
+
+	ctx = g_new0(struct firewall_context, 1);
+
+	return ctx;
+}
+
+void __connman_firewall_destroy(struct firewall_context *ctx)
+{
+	GList *list;
+
+	/* Forget the rules in a transaction still to be committed */
+	for (list = ctx->rules; transaction != NULL && list != NULL;
+						list = list->next) {
+		transaction->pending = g_slist_remove(transaction->pending,
+								list->data);
+		transaction->deleted = g_slist_remove(transaction->deleted,
+								list->data);
+	}
+
+	g_list_free_full(ctx->rules, g_free);
+	g_free(ctx);
+}
+
+void __connman_firewall_begin(void)
+{
+	DBG("level %d", transaction_level);
+
+	if (transaction_level++ > 0)
+		return;
+
+	transaction = batch_new();
+	batch_begin(transaction);
+}
+
+int __connman_firewall_end(void)
+{
+	struct nft_batch *batch;
+
+	DBG("level %d", transaction_level);
+
+	if (transaction_level == 0)
+		return -EINVAL;
+
+	if (--transaction_level > 0)
+		return 0;
+
+	batch = transaction;
+	transaction = NULL;
+
+	return batch_finish(batch);
+}
+
+int __connman_firewall_enable_nat(struct firewall_context *ctx,
+				const char *address, unsigned char prefixlen,
+				const char *interface)
+{
+	struct nft_batch *batch;
+	struct fw_rule *rule;
+	char ifname[IFNAMSIZ];
+	struct in_addr addr;
+	uint32_t mask;
+	size_t exprs;
+
+	if (inet_pton(AF_INET, address, &addr) != 1 || prefixlen > 32)
+		return -EINVAL;
+
+	mask = prefixlen == 0 ? 0 : htonl(~0U << (32 - prefixlen));
+	addr.s_addr &= mask;
+
+	memset(ifname, 0, sizeof(ifname));
+	strncpy(ifname, interface, sizeof(ifname) - 1);
+
+	DBG("%s/%d %s", address, prefixlen, interface);
+
+	batch = batch_open();
+
+	/* ip saddr address/prefixlen oifname interface masquerade */
+	rule = rule_new(ctx, FIREWALL_GROUP_NAT, "nat-postrouting");
+	exprs = rule_begin(batch, rule->chain, rule);
+	expr_payload_load(batch, NFT_PAYLOAD_NETWORK_HEADER,
+				offsetof(struct iphdr, saddr),
+				sizeof(addr.s_addr));
+	expr_bitwise_and(batch, &mask, sizeof(mask));
+	expr_cmp_eq(batch, &addr.s_addr, sizeof(addr.s_addr));
+	expr_meta_load(batch, NFT_META_OIFNAME);
+	expr_cmp_eq(batch, ifname, sizeof(ifname));
+	expr_masq(batch);
+	rule_end(batch, exprs);
+
+	return enable_rules(batch);
+}
+
+int __connman_firewall_disable_nat(struct firewall_context *ctx)
+{
+	return disable_rules(ctx, FIREWALL_GROUP_NAT);
+}
+
+int __connman_firewall_enable_connmark(struct firewall_context *ctx)
+{
+	struct nft_batch *batch;
+	struct fw_rule *rule;
+	size_t exprs;
+
+	batch = batch_open();
+
+	/* meta mark set ct mark */
+	rule = rule_new(ctx, FIREWALL_GROUP_CONNMARK, "mangle-input");
+	exprs = rule_begin(batch, rule->chain, rule);
+	expr_ct_load(batch, NFT_CT_MARK);
+	expr_meta_set(batch, NFT_META_MARK);
+	rule_end(batch, exprs);
+
+	/* ct mark set meta mark */
+	rule = rule_new(ctx, FIREWALL_GROUP_CONNMARK, "mangle-postrouting");
+	exprs = rule_begin(batch, rule->chain, rule);
+	expr_meta_load(batch, NFT_META_MARK);
+	expr_ct_set(batch, NFT_CT_MARK);
+	rule_end(batch, exprs);
+
+	return enable_rules(batch);
+}
+
+int __connman_firewall_disable_connmark(struct firewall_context *ctx)
+{
+	return disable_rules(ctx, FIREWALL_GROUP_CONNMARK);
+}
+
+static int resolve_owner(enum connman_session_id_type id_type,
+				const char *id, uint32_t *owner)
+{
+	struct passwd *pwd;
+	struct group *grp;
+	char *end;
+
+	*owner = strtoul(id, &end, 10);
+	if (*id != '\0' && *end == '\0')
+		return 0;
+
+	switch (id_type) {
+	case CONNMAN_SESSION_ID_TYPE_UID:
+		pwd = getpwnam(id);
+		if (pwd == NULL)
+			return -ENOENT;
+
+		*owner = pwd->pw_uid;
+		return 0;
+	case CONNMAN_SESSION_ID_TYPE_GID:
+		grp = getgrnam(id);
+		if (grp == NULL)
+			return -ENOENT;
+
+		*owner = grp->gr_gid;
+		return 0;
+	case CONNMAN_SESSION_ID_TYPE_UNKNOWN:
+	case CONNMAN_SESSION_ID_TYPE_LSM:
+		break;
+	}
+
+	return -EINVAL;
+}
+
+static GHashTable *owner_marks(const char *map)
+{
+	if (g_strcmp0(map, UID_MARKS) == 0)
+		return uid_marks;
+
+	return gid_marks;
+}
+
+int __connman_firewall_enable_marking(struct firewall_context *ctx,
+					enum connman_session_id_type id_type,
+					const char *id, uint32_t mark)
+{
+	struct nft_batch *batch;
+	GHashTable *hash;
+	const char *map;
+	GSList *marks;
+	uint32_t owner;
+	int err;
+
+	switch (id_type) {
+	case CONNMAN_SESSION_ID_TYPE_UID:
+		map = UID_MARKS;
+		break;
+	case CONNMAN_SESSION_ID_TYPE_GID:
+		map = GID_MARKS;
+		break;
+	case CONNMAN_SESSION_ID_TYPE_UNKNOWN:
+	case CONNMAN_SESSION_ID_TYPE_LSM:
+	default:
+		return -EINVAL;
+	}
+
+	err = resolve_owner(id_type, id, &owner);
+	if (err < 0)
+		return err;
+
+	DBG("%s %u mark %u", map, owner, mark);
+
+	hash = owner_marks(map);
+	marks = g_hash_table_lookup(hash, GUINT_TO_POINTER(owner));
+
+	/*
+	 * The same owner might be used by several sessions. As with
+	 * the MARK rules of iptables the latest session wins.
+	 */
+	batch = batch_open();
+	if (marks != NULL)
+		map_elem(batch, NFT_MSG_DELSETELEM, map, owner, NULL);
+	map_elem(batch, NFT_MSG_NEWSETELEM, map, owner, &mark);
+	batch->marks_changed = TRUE;
+
+	err = batch_close(batch);
+	if (err < 0) {
+		connman_warn("Failed to install nftables mark: %s",
+							strerror(-err));
+		return err;
+	}
+
+	marks = g_slist_prepend(marks, GUINT_TO_POINTER(mark));
+	g_hash_table_replace(hash, GUINT_TO_POINTER(owner), marks);
+
+	ctx->marks = map;
+	ctx->owner = owner;
+	ctx->mark = mark;
+
+	return 0;
+}
+
+int __connman_firewall_disable_marking(struct firewall_context *ctx)
+{
+	struct nft_batch *batch;
+	GHashTable *hash;
+	GSList *marks;
+	uint32_t mark;
+	int err;
+
+	if (ctx->marks == NULL)
+		return 0;
+
+	hash = owner_marks(ctx->marks);
+	marks = g_hash_table_lookup(hash, GUINT_TO_POINTER(ctx->owner));
+	if (marks == NULL)
+		return -ENOENT;
+
+	/* Only the head of the list is installed in the map */
+	if (GPOINTER_TO_UINT(marks->data) == ctx->mark) {
+		batch = batch_open();
+		map_elem(batch, NFT_MSG_DELSETELEM, ctx->marks,
+							ctx->owner, NULL);
+		if (marks->next != NULL) {
+			mark = GPOINTER_TO_UINT(marks->next->data);
+			map_elem(batch, NFT_MSG_NEWSETELEM, ctx->marks,
+							ctx->owner, &mark);
+		}
+		batch->marks_changed = TRUE;
+
+		err = batch_close(batch);
+		if (err < 0) {
+			connman_error("Cannot remove previously installed "
+				"nftables mark: %s", strerror(-err));
+			return err;
+		}
+	}
+
+	marks = g_slist_remove(marks, GUINT_TO_POINTER(ctx->mark));
+	if (marks == NULL)
+		g_hash_table_remove(hash, GUINT_TO_POINTER(ctx->owner));
+	else
+		g_hash_table_replace(hash, GUINT_TO_POINTER(ctx->owner),
+									marks);
+
+	ctx->marks = NULL;
+
+	return 0;
+}
+
+static void sync_map(struct nft_batch *batch, const char *map,
+							GHashTable *hash)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	uint32_t mark;
+
+	/* Without any elements the whole map is flushed */
+	nft_msg_begin(batch, NFT_MSG_DELSETELEM, 0);
+	attr_put_str(batch, NFTA_SET_ELEM_LIST_TABLE, CONNMAN_TABLE);
+	attr_put_str(batch, NFTA_SET_ELEM_LIST_SET, map);
+	msg_end(batch);
+
+	g_hash_table_iter_init(&iter, hash);
+	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+		GSList *marks = value;
+
+		mark = GPOINTER_TO_UINT(marks->data);
+		map_elem(batch, NFT_MSG_NEWSETELEM, map,
+					GPOINTER_TO_UINT(key), &mark);
+	}
+}
+
+/*
+ * A refused transaction leaves the maps unchanged, while the marks
+ * of its sessions have already been recorded. Reload both maps.
+ */
+static void sync_marks(void)
+{
+	struct nft_batch *batch;
+	int err;
+
+	if (nft_fd < 0)
+		return;
+
+	batch = batch_new();
+	batch_begin(batch);
+	sync_map(batch, UID_MARKS, uid_marks);
+	sync_map(batch, GID_MARKS, gid_marks);
+	batch_end(batch);
+
+	err = batch_commit(batch);
+	batch_free(batch);
+
+	if (err < 0)
+		connman_error("Cannot restore nftables marks: %s",
+							strerror(-err));
+}
+
+static void add_accounting_rule(struct firewall_context *ctx,
+				struct nft_batch *batch, const char *chain,
+				uint32_t mark, const char *name)
+{
+	struct fw_rule *rule;
+	size_t exprs;
+
+	/* meta mark mark nfacct name */
+	rule = rule_new(ctx, FIREWALL_GROUP_ACCOUNTING, chain);
+	exprs = rule_begin(batch, rule->chain, rule);
+	expr_meta_load(batch, NFT_META_MARK);
+	expr_cmp_eq(batch, &mark, sizeof(mark));
+	expr_nfacct(batch, name);
+	rule_end(batch, exprs);
+}
+
+int __connman_firewall_enable_accounting(struct firewall_context *ctx,
+					uint32_t mark, const char *input,
+					const char *output)
+{
+	struct nft_batch *batch;
+
+	batch = batch_open();
+
+	add_accounting_rule(ctx, batch, "filter-input", mark, input);
+	add_accounting_rule(ctx, batch, "filter-output", mark, output);
+
+	return enable_rules(batch);
+}
+
+int __connman_firewall_disable_accounting(struct firewall_context *ctx)
+{
+	return disable_rules(ctx, FIREWALL_GROUP_ACCOUNTING);
+}
+
+static void add_marking_rule(struct nft_batch *batch, uint32_t key,
+				const char *map, uint32_t map_id)
+{
+	size_t exprs;
+
+	/* meta mark set meta skuid map @uid-marks */
+	exprs = rule_begin(batch, "route-output", NULL);
+	expr_meta_load(batch, key);
+	expr_lookup_map(batch, map, map_id);
+	expr_meta_set(batch, NFT_META_MARK);
+	rule_end(batch, exprs);
+}
+
+static int flush_table(void)
+{
+	struct nft_batch *batch;
+	int err;
+
+	/* Remove whatever a previous instance left behind */
+	batch = batch_new();
+	batch_begin(batch);
+	del_table(batch);
+	batch_end(batch);
+
+	err = batch_commit(batch);
+	batch_free(batch);
+
+	if (err < 0 && err != -ENOENT)
+		return err;
+
+	return 0;
+}
+
+static int setup_table(void)
+{
+	struct nft_batch *batch;
+	int i, err;
+
+	batch = batch_new();
+	batch_begin(batch);
+
+	add_table(batch);
+
+	for (i = 0; base_chains[i].name != NULL; i++)
+		add_base_chain(batch, &base_chains[i]);
+
+	add_map(batch, UID_MARKS, UID_MARKS_ID, NFT_TYPE_UID);
+	add_map(batch, GID_MARKS, GID_MARKS_ID, NFT_TYPE_GID);
+
+	add_marking_rule(batch, NFT_META_SKUID, UID_MARKS, UID_MARKS_ID);
+	add_marking_rule(batch, NFT_META_SKGID, GID_MARKS, GID_MARKS_ID);
+
+	batch_end(batch);
+
+	err = batch_commit(batch);
+	batch_free(batch);
+
+	return err;
+}
+
+static void free_marks(gpointer key, gpointer value, gpointer user_data)
+{
+	g_slist_free(value);
+}
+
+int __connman_firewall_init(void)
+{
+	struct sockaddr_nl addr;
+	int err;
+
+	DBG("");
+
+	uid_marks = g_hash_table_new(g_direct_hash, g_direct_equal);
+	gid_marks = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	nft_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+						NETLINK_NETFILTER);
+	if (nft_fd < 0) {
+		err = -errno;
+		goto err;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	if (bind(nft_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		err = -errno;
+		goto err;
+	}
+
+	err = flush_table();
+	if (err < 0)
+		goto err;
+
+	err = setup_table();
+	if (err < 0)
+		goto err;
+
+	return 0;
+
+err:
+	connman_error("nftables support not available: %s", strerror(-err));
+
+	if (nft_fd >= 0) {
+		close(nft_fd);
+		nft_fd = -1;
+	}
+
+	return err;
+}
+
+void __connman_firewall_cleanup(void)
+{
+	DBG("");
+
+	if (transaction != NULL) {
+		batch_free(transaction);
+		transaction = NULL;
+		transaction_level = 0;
+	}
+
+	if (nft_fd >= 0) {
+		flush_table();
+
+		close(nft_fd);
+		nft_fd = -1;
+	}
+
+	g_hash_table_foreach(uid_marks, free_marks, NULL);
+	g_hash_table_destroy(uid_marks);
+
+	g_hash_table_foreach(gid_marks, free_marks, NULL);
+	g_hash_table_destroy(gid_marks);
+}
@@ -43,6 +43,8 @@
 #include <net/if_arp.h>
 #include <netinet/icmp6.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include <linux/if_tun.h>
 #include <ctype.h>
 #include <ifaddrs.h>
@@ -81,6 +83,423 @@ static inline int index2tid(int index)
 	return index;
 }
 
+#ifndef SOL_NETLINK
+#define SOL_NETLINK		270
+#endif
+
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK		10
+#endif
+
+/*
+ * Requests sent in one go. Each ACK takes up roughly 1k of socket
+ * buffer, so this stays well below the default receive buffer.
+ */
+#define RTNL_BATCH_MAX		64
+#define RTNL_REPLY_TIMEOUT	1000	/* ms */
+
+/*
+ * The synchronous helpers below share one netlink and one ioctl socket
+ * instead of creating a socket for every call. Each netlink request gets
+ * its own sequence number and asks for an ACK, which lets several
+ * requests go out with one sendmsg() and the answers be matched up
+ * afterwards.
+ */
+struct rtnl_request {
+	struct nlmsghdr *hdr;
+	__connman_inet_rtnl_cb_t callback;
+	void *user_data;
+	int error;
+	connman_bool_t answered;
+};
+
+static int rtnl_sk = -1;
+static __u32 rtnl_seq;
+static int ioctl_sk = -1;
+
+static int rtnl_handle(void)
+{
+	struct sockaddr_nl addr;
+	int sk, err, on = 1;
+
+	if (rtnl_sk >= 0)
+		return rtnl_sk;
+
+	sk = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (sk < 0) {
+		err = -errno;
+		connman_error("Can not open netlink socket: %s",
+							strerror(-err));
+		return err;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		err = -errno;
+		connman_error("Can not bind netlink socket: %s",
+							strerror(-err));
+		close(sk);
+		return err;
+	}
+
+	/* Only the header of a failed request needs to come back */
+	if (setsockopt(sk, SOL_NETLINK, NETLINK_CAP_ACK, &on,
+							sizeof(on)) < 0)
+		DBG("NETLINK_CAP_ACK: %s", strerror(errno));
+
+	rtnl_sk = sk;
+	rtnl_seq = time(NULL);
+
+	DBG("fd %d", rtnl_sk);
+
+	return rtnl_sk;
+}
+
+static int ioctl_handle(void)
+{
+	if (ioctl_sk >= 0)
+		return ioctl_sk;
+
+	ioctl_sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (ioctl_sk < 0)
+		return -errno;
+
+	DBG("fd %d", ioctl_sk);
+
+	return ioctl_sk;
+}
+
+static int rtnl_receive(int sk, struct rtnl_request *requests, int count,
+								__u32 first)
+{
+	unsigned char buf[8192];
+	struct sockaddr_nl addr;
+	socklen_t addr_len = sizeof(addr);
+	struct pollfd pfd;
+	struct nlmsghdr *hdr;
+	ssize_t len;
+	int answered = 0;
+
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = sk;
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, RTNL_REPLY_TIMEOUT) == 0)
+		return -ETIMEDOUT;
+
+	len = recvfrom(sk, buf, sizeof(buf), MSG_DONTWAIT,
+					(struct sockaddr *) &addr, &addr_len);
+	if (len < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+
+		return -errno;
+	}
+
+	if (addr.nl_pid != 0)
+		return 0;
+
+	for (hdr = (struct nlmsghdr *) buf; NLMSG_OK(hdr, (size_t) len);
+					hdr = NLMSG_NEXT(hdr, len)) {
+		struct rtnl_request *req;
+		struct nlmsgerr *err;
+		__u32 pos = hdr->nlmsg_seq - first;
+
+		/* Late answer to a request that has timed out already */
+		if (pos >= (__u32) count)
+			continue;
+
+		req = &requests[pos];
+		if (req->answered == TRUE)
+			continue;
+
+		if (hdr->nlmsg_type != NLMSG_ERROR) {
+			if (req->callback != NULL)
+				req->callback(hdr, req->user_data);
+			continue;
+		}
+
+		err = NLMSG_DATA(hdr);
+		req->error = err->error;
+		req->answered = TRUE;
+		answered++;
+	}
+
+	return answered;
+}
+
+static int rtnl_send_batch(struct rtnl_request *requests, int count)
+{
+	struct iovec iov[RTNL_BATCH_MAX];
+	struct sockaddr_nl addr;
+	struct msghdr msg;
+	__u32 first;
+	int sk, i, err, pending;
+
+	sk = rtnl_handle();
+	if (sk < 0)
+		return sk;
+
+	first = rtnl_seq + 1;
+
+	for (i = 0; i < count; i++) {
+		struct nlmsghdr *hdr = requests[i].hdr;
+
+		hdr->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+		hdr->nlmsg_seq = ++rtnl_seq;
+		hdr->nlmsg_pid = 0;
+
+		requests[i].error = -ETIMEDOUT;
+		requests[i].answered = FALSE;
+
+		iov[i].iov_base = hdr;
+		iov[i].iov_len = hdr->nlmsg_len;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof(addr);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	if (sendmsg(sk, &msg, 0) < 0) {
+		err = -errno;
+		connman_error("Can not talk to rtnetlink: %s", strerror(-err));
+		return err;
+	}
+
+	pending = count;
+
+	while (pending > 0) {
+		err = rtnl_receive(sk, requests, count, first);
+		if (err < 0) {
+			connman_error("No answer to %d of %d rtnetlink requests "
+					"(%s)", pending, count, strerror(-err));
+			return err;
+		}
+
+		pending -= err;
+	}
+
+	DBG("seq %u-%u", first, rtnl_seq);
+
+	return 0;
+}
+
+/*
+ * Sends all requests and waits until each of them has been answered.
+ * The result of every request ends up in its error field, the return
+ * value only reports problems with the socket itself.
+ */
+static int rtnl_transact(struct rtnl_request *requests, int count)
+{
+	int i, err;
+
+	for (i = 0; i < count; i += RTNL_BATCH_MAX) {
+		err = rtnl_send_batch(&requests[i],
+					MIN(count - i, RTNL_BATCH_MAX));
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static int rtnl_request(struct nlmsghdr *hdr)
+{
+	struct rtnl_request req;
+	int err;
+
+	memset(&req, 0, sizeof(req));
+	req.hdr = hdr;
+
+	err = rtnl_transact(&req, 1);
+	if (err < 0)
+		return err;
+
+	return req.error;
+}
+
+int __connman_inet_init(void)
+{
+	int err;
+
+	DBG("");
+
+	err = rtnl_handle();
+	if (err < 0)
+		return err;
+
+	err = ioctl_handle();
+	if (err < 0)
+		return err;
+
+	return 0;
+}
+
+void __connman_inet_cleanup(void)
+{
+	DBG("");
+
+	if (rtnl_sk >= 0) {
+		close(rtnl_sk);
+		rtnl_sk = -1;
+	}
+
+	if (ioctl_sk >= 0) {
+		close(ioctl_sk);
+		ioctl_sk = -1;
+	}
+}
+
+#define RULE_REQUEST_SIZE (NLMSG_ALIGN(sizeof(struct nlmsghdr)) + \
+			NLMSG_ALIGN(sizeof(struct rtmsg)) + \
+			RTA_LENGTH(sizeof(struct in_addr)) + \
+			RTA_LENGTH(sizeof(__u32)))
+
+static int rule_request(struct nlmsghdr *header, size_t size, int cmd,
+					const char *from, int index)
+{
+	struct rtmsg *rtmsg;
+	struct in_addr ipv4_from;
+	int table = index2tid(index);
+
+	memset(header, 0, size);
+
+	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	header->nlmsg_type = cmd;
+	header->nlmsg_flags = NLM_F_REQUEST;
+
+	rtmsg = NLMSG_DATA(header);
+	rtmsg->rtm_family = AF_INET;
+	rtmsg->rtm_protocol = RTPROT_BOOT;
+	rtmsg->rtm_type = RTN_UNICAST;
+
+	if (cmd == RTM_NEWRULE) {
+		header->nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+		rtmsg->rtm_scope = RT_SCOPE_UNIVERSE;
+	} else
+		rtmsg->rtm_scope = RT_SCOPE_NOWHERE;
+
+	if (table < 256)
+		rtmsg->rtm_table = table;
+	else {
+		rtmsg->rtm_table = RT_TABLE_UNSPEC;
+		if (__connman_inet_rtnl_addattr32(header, size,
+						FRA_TABLE, table) < 0)
+			return -E2BIG;
+	}
+
+	rtmsg->rtm_src_len = 32;
+	if (inet_pton(AF_INET, from, &ipv4_from) < 1)
+		return -EINVAL;
+
+	return __connman_inet_rtnl_addattr_l(header, size, FRA_SRC,
+					&ipv4_from, sizeof(ipv4_from));
+}
+
+#define ROUTE_REQUEST_SIZE (NLMSG_ALIGN(sizeof(struct nlmsghdr)) + \
+			NLMSG_ALIGN(sizeof(struct rtmsg)) + \
+			RTA_LENGTH(sizeof(struct in6_addr)) + \
+			RTA_LENGTH(sizeof(struct in6_addr)) + \
+			RTA_LENGTH(sizeof(__u32)) + \
+			RTA_LENGTH(sizeof(__u32)) + \
+			RTA_LENGTH(sizeof(__u32)))
+
+/*
+ * Builds a route request for host/prefix_len through the given
+ * interface. IPv4 routes without a gateway get link scope and IPv6
+ * routes metric 1, like the ones SIOCADDRT creates.
+ */
+static int route_request(struct nlmsghdr *header, size_t size, int cmd,
+				int family, int index, uint32_t table,
+				const char *host, unsigned char prefix_len,
+				const char *gateway)
+{
+	struct rtmsg *rtmsg;
+	unsigned char buf[sizeof(struct in6_addr)];
+	int len, err;
+
+	if (family == AF_INET)
+		len = sizeof(struct in_addr);
+	else if (family == AF_INET6)
+		len = sizeof(struct in6_addr);
+	else
+		return -EINVAL;
+
+	if (prefix_len > len * 8)
+		return -EINVAL;
+
+	memset(header, 0, size);
+
+	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	header->nlmsg_type = cmd;
+	header->nlmsg_flags = NLM_F_REQUEST;
+
+	rtmsg = NLMSG_DATA(header);
+	rtmsg->rtm_family = family;
+	rtmsg->rtm_dst_len = prefix_len;
+
+	if (cmd == RTM_NEWROUTE) {
+		header->nlmsg_flags |= NLM_F_CREATE;
+		rtmsg->rtm_protocol = RTPROT_BOOT;
+		rtmsg->rtm_type = RTN_UNICAST;
+		if (gateway != NULL)
+			rtmsg->rtm_scope = RT_SCOPE_UNIVERSE;
+		else
+			rtmsg->rtm_scope = RT_SCOPE_LINK;
+	} else
+		rtmsg->rtm_scope = RT_SCOPE_NOWHERE;
+
+	if (table < 256)
+		rtmsg->rtm_table = table;
+	else {
+		rtmsg->rtm_table = RT_TABLE_UNSPEC;
+		err = __connman_inet_rtnl_addattr32(header, size,
+							RTA_TABLE, table);
+		if (err < 0)
+			return -E2BIG;
+	}
+
+	if (host != NULL) {
+		if (inet_pton(family, host, buf) < 1)
+			return -EINVAL;
+
+		err = __connman_inet_rtnl_addattr_l(header, size, RTA_DST,
+								buf, len);
+		if (err < 0)
+			return err;
+	}
+
+	if (gateway != NULL) {
+		if (inet_pton(family, gateway, buf) < 1)
+			return -EINVAL;
+
+		err = __connman_inet_rtnl_addattr_l(header, size, RTA_GATEWAY,
+								buf, len);
+		if (err < 0)
+			return err;
+	}
+
+	err = __connman_inet_rtnl_addattr32(header, size, RTA_OIF, index);
+	if (err < 0)
+		return -E2BIG;
+
+	if (family == AF_INET6) {
+		err = __connman_inet_rtnl_addattr32(header, size,
+							RTA_PRIORITY, 1);
+		if (err < 0)
+			return -E2BIG;
+	}
+
+	return 0;
+}
+
 int __connman_inet_modify_address(int cmd, int flags,
 				int index, int family,
 				const char *address,
@@ -93,12 +512,13 @@ int __connman_inet_modify_address(int cmd, int flags,
 			RTA_LENGTH(sizeof(struct in6_addr)) +
 			RTA_LENGTH(sizeof(struct in6_addr))];
 
+	uint8_t rule[RULE_REQUEST_SIZE];
+	struct rtnl_request requests[2];
 	struct nlmsghdr *header;
-	struct sockaddr_nl nl_addr;
 	struct ifaddrmsg *ifaddrmsg;
 	struct in6_addr ipv6_addr;
 	struct in_addr ipv4_addr, ipv4_dest, ipv4_bcast;
-	int sk, err;
+	int count = 0, err;
 
 	DBG("cmd %#x flags %#x index %d family %d address %s peer %s "
 		"prefixlen %hhu broadcast %s", cmd, flags, index, family,
@@ -116,7 +536,6 @@ int __connman_inet_modify_address(int cmd, int flags,
 	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
 	header->nlmsg_type = cmd;
 	header->nlmsg_flags = NLM_F_REQUEST | flags;
-	header->nlmsg_seq = 1;
 
 	ifaddrmsg = NLMSG_DATA(header);
 	ifaddrmsg->ifa_family = family;
@@ -125,12 +544,17 @@ int __connman_inet_modify_address(int cmd, int flags,
 	ifaddrmsg->ifa_scope = RT_SCOPE_UNIVERSE;
 	ifaddrmsg->ifa_index = index;
 
-	if (family == AF_INET) {
+	memset(&requests, 0, sizeof(requests));
 
-		if (header->nlmsg_type == RTM_NEWADDR)
-			connman_inet_add_rule(address, index);
-		else if (header->nlmsg_type == RTM_DELADDR)
-			connman_inet_del_rule(address, index);
+	if (family == AF_INET) {
+		/*
+		 * The source rule goes out in the same batch as the
+		 * address itself.
+		 */
+		if (rule_request((struct nlmsghdr *) rule, sizeof(rule),
+				cmd == RTM_NEWADDR ? RTM_NEWRULE : RTM_DELRULE,
+				address, index) == 0)
+			requests[count++].hdr = (struct nlmsghdr *) rule;
 
 		if (inet_pton(AF_INET, address, &ipv4_addr) < 1)
 			return -1;
@@ -183,21 +607,19 @@ int __connman_inet_modify_address(int cmd, int flags,
 			return err;
 	}
 
-	sk = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
-	if (sk < 0)
-		return -errno;
-
-	memset(&nl_addr, 0, sizeof(nl_addr));
-	nl_addr.nl_family = AF_NETLINK;
+	requests[count++].hdr = header;
 
-	if ((err = sendto(sk, request, header->nlmsg_len, 0,
-			(struct sockaddr *) &nl_addr, sizeof(nl_addr))) < 0)
-		goto done;
+	err = rtnl_transact(requests, count);
+	if (err < 0)
+		return err;
 
-	err = 0;
+	if (count > 1 && requests[0].error < 0)
+		DBG("rule from %s index %d: %s", address, index,
+					strerror(-requests[0].error));
 
-done:
-	close(sk);
+	err = requests[count - 1].error;
+	if (cmd == RTM_DELADDR && err == -EADDRNOTAVAIL)
+		err = 0;
 
 	return err;
 }
@@ -210,7 +632,7 @@ int connman_inet_ifindex(const char *name)
 	if (name == NULL)
 		return -1;
 
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	sk = ioctl_handle();
 	if (sk < 0)
 		return -1;
 
@@ -219,8 +641,6 @@ int connman_inet_ifindex(const char *name)
 
 	err = ioctl(sk, SIOCGIFINDEX, &ifr);
 
-	close(sk);
-
 	if (err < 0)
 		return -1;
 
@@ -235,7 +655,7 @@ char *connman_inet_ifname(int index)
 	if (index < 0)
 		return NULL;
 
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	sk = ioctl_handle();
 	if (sk < 0)
 		return NULL;
 
@@ -244,8 +664,6 @@ char *connman_inet_ifname(int index)
 
 	err = ioctl(sk, SIOCGIFNAME, &ifr);
 
-	close(sk);
-
 	if (err < 0)
 		return NULL;
 
@@ -257,9 +675,9 @@ short int connman_inet_ifflags(int index)
 	struct ifreq ifr;
 	int sk, err;
 
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	sk = ioctl_handle();
 	if (sk < 0)
-		return -errno;
+		return sk;
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_ifindex = index;
@@ -277,8 +695,6 @@ short int connman_inet_ifflags(int index)
 	err = ifr.ifr_flags;
 
 done:
-	close(sk);
-
 	return err;
 }
 
@@ -287,9 +703,9 @@ int connman_inet_ifup(int index)
 	struct ifreq ifr;
 	int sk, err;
 
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	sk = ioctl_handle();
 	if (sk < 0)
-		return -errno;
+		return sk;
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_ifindex = index;
@@ -319,8 +735,6 @@ int connman_inet_ifup(int index)
 	err = 0;
 
 done:
-	close(sk);
-
 	return err;
 }
 
@@ -330,9 +744,9 @@ int connman_inet_ifdown(int index)
 	struct sockaddr_in *addr;
 	int sk, err;
 
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	sk = ioctl_handle();
 	if (sk < 0)
-		return -errno;
+		return sk;
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_ifindex = index;
@@ -367,8 +781,6 @@ int connman_inet_ifdown(int index)
 		err = 0;
 
 done:
-	close(sk);
-
 	return err;
 }
 
@@ -502,118 +914,47 @@ int connman_inet_clear_address(int index, struct connman_ipaddress *ipaddress)
 }
 int connman_inet_add_rule(const char* from, int index)
 {
-	uint8_t request[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
-			NLMSG_ALIGN(sizeof(struct rtmsg)) +
-			RTA_LENGTH(sizeof(struct in_addr))];
-
-	int sk = 0, err = 0;
-	struct nlmsghdr *header;
-	struct sockaddr_nl nl_addr;
-	struct rtmsg *rtmsg;
-	struct in_addr ipv4_from;
+	uint8_t request[RULE_REQUEST_SIZE];
+	int err;
 
 	DBG("add ip rule from %s index %d", from, index);
 
-	memset(&request, 0, sizeof(request));
-
-	header = (struct nlmsghdr *)request;
-	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	header->nlmsg_flags = NLM_F_REQUEST|NLM_F_CREATE|NLM_F_EXCL;;
-	header->nlmsg_type = RTM_NEWRULE;
+	err = rule_request((struct nlmsghdr *) request, sizeof(request),
+						RTM_NEWRULE, from, index);
+	if (err == 0)
+		err = rtnl_request((struct nlmsghdr *) request);
 
-	rtmsg = NLMSG_DATA(header);
-	rtmsg->rtm_family = AF_INET;
-	rtmsg->rtm_protocol = RTPROT_BOOT;
-	rtmsg->rtm_scope = RT_SCOPE_UNIVERSE;
-	rtmsg->rtm_type = RTN_UNICAST;
-
-	rtmsg->rtm_table = index2tid(index);
-
-	rtmsg->rtm_src_len = 32;
-	inet_pton(AF_INET, from, &ipv4_from);
-
-	if ((err = __connman_inet_rtnl_addattr_l(header, sizeof(request), FRA_SRC,
-			      &ipv4_from, sizeof(ipv4_from))) < 0)
-		goto out;
-
-	sk = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
-	if (sk < 0) {
-		err = -1;
-		goto out;
-	}
-
-	memset(&nl_addr, 0, sizeof(nl_addr));
-	nl_addr.nl_family = AF_NETLINK;
-	if ((err = sendto(sk, request, header->nlmsg_len, 0,
-			(struct sockaddr *) &nl_addr, sizeof(nl_addr))) < 0)
-		goto out;
+	if (err == -EEXIST)
+		err = 0;
 
- out:
 	if (err < 0)
-		connman_error("Set IP rule error (%s)", strerror(errno));
-	close(sk);
-	return err;
+		connman_error("Set IP rule error (%s)", strerror(-err));
 
+	return err;
 }
 
 int connman_inet_del_rule(const char* from, int index)
 {
-	uint8_t request[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
-			NLMSG_ALIGN(sizeof(struct rtmsg)) +
-			RTA_LENGTH(sizeof(struct in_addr))];
-
-	int sk = 0 , err = 0;
-	struct nlmsghdr *header;
-	struct sockaddr_nl nl_addr;
-	struct rtmsg *rtmsg;
-	struct in_addr ipv4_from;
+	uint8_t request[RULE_REQUEST_SIZE];
+	int err;
 
 	DBG("del ip rule from %s index %d", from, index);
 
 	if (from == NULL)
 		return 0;
 
-	memset(&request, 0, sizeof(request));
-
-	header = (struct nlmsghdr *)request;
-	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	header->nlmsg_flags = NLM_F_REQUEST;
-	header->nlmsg_type = RTM_DELRULE;
+	err = rule_request((struct nlmsghdr *) request, sizeof(request),
+						RTM_DELRULE, from, index);
+	if (err == 0)
+		err = rtnl_request((struct nlmsghdr *) request);
 
-	rtmsg = NLMSG_DATA(header);
-	rtmsg = NLMSG_DATA(header);
-	rtmsg->rtm_family = AF_INET;
-	rtmsg->rtm_protocol = RTPROT_BOOT;
-	rtmsg->rtm_scope = RT_SCOPE_NOWHERE;
-	rtmsg->rtm_type = RTN_UNICAST;
-
-	rtmsg->rtm_table = index2tid(index);
-
-	rtmsg->rtm_src_len = 32;
-	inet_pton(AF_INET, from, &ipv4_from);
-
-	if ((err = __connman_inet_rtnl_addattr_l(header, sizeof(request), FRA_SRC,
-			      &ipv4_from, sizeof(ipv4_from))) < 0)
-		goto out;
-
-	sk = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
-	if (sk < 0) {
-		err = -1;
-		goto out;
-	}
-
-	memset(&nl_addr, 0, sizeof(nl_addr));
-	nl_addr.nl_family = AF_NETLINK;
-	if ((err = sendto(sk, request, header->nlmsg_len, 0,
-			(struct sockaddr *) &nl_addr, sizeof(nl_addr))) < 0)
-		goto out;
+	if (err == -ENOENT)
+		err = 0;
 
- out:
 	if (err < 0)
-		connman_error("Del IP rule error (%s)",	strerror(errno));
-	close(sk);
-	return err;
+		connman_error("Del IP rule error (%s)", strerror(-err));
 
+	return err;
 }
 
 int connman_inet_add_host_route(int index, const char *host,
@@ -633,68 +974,24 @@ int connman_inet_add_network_route(int index, const char *host,
 					const char *gateway,
 					const char *netmask)
 {
-	struct ifreq ifr;
-	struct rtentry rt;
-	struct sockaddr_in addr;
-	int sk, err = 0;
+	uint8_t request[ROUTE_REQUEST_SIZE];
+	unsigned char prefix_len;
+	int err;
 
 	DBG("index %d host %s gateway %s netmask %s", index,
 		host, gateway, netmask);
 
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0) {
-		err = -errno;
-		goto out;
-	}
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_ifindex = index;
-
-	if (ioctl(sk, SIOCGIFNAME, &ifr) < 0) {
-		err = -errno;
-		close(sk);
-		goto out;
-	}
-
-	DBG("ifname %s", ifr.ifr_name);
-
-	memset(&rt, 0, sizeof(rt));
-	rt.rt_flags = RTF_UP;
-	if (gateway != NULL)
-		rt.rt_flags |= RTF_GATEWAY;
-	if (netmask == NULL)
-		rt.rt_flags |= RTF_HOST;
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = inet_addr(host);
-	memcpy(&rt.rt_dst, &addr, sizeof(rt.rt_dst));
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	if (gateway != NULL)
-		addr.sin_addr.s_addr = inet_addr(gateway);
-	else
-		addr.sin_addr.s_addr = INADDR_ANY;
-	memcpy(&rt.rt_gateway, &addr, sizeof(rt.rt_gateway));
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	if (netmask != NULL)
-		addr.sin_addr.s_addr = inet_addr(netmask);
-	else
-		addr.sin_addr.s_addr = INADDR_ANY;
-	memcpy(&rt.rt_genmask, &addr, sizeof(rt.rt_genmask));
+	prefix_len = __connman_ipaddress_netmask_prefix_len(netmask);
 
-	rt.rt_dev = ifr.ifr_name;
+	err = route_request((struct nlmsghdr *) request, sizeof(request),
+				RTM_NEWROUTE, AF_INET, index, RT_TABLE_MAIN,
+				host, prefix_len, gateway);
+	if (err == 0)
+		err = rtnl_request((struct nlmsghdr *) request);
 
-	if (ioctl(sk, SIOCADDRT, &rt) < 0 && errno != EEXIST)
-		err = -errno;
-
-	close(sk);
+	if (err == -EEXIST)
+		err = 0;
 
-out:
 	if (err < 0)
 		connman_error("Adding host route failed (%s)",
 							strerror(-err));
@@ -706,119 +1003,44 @@ int connman_inet_add_network_route_with_table(int index, const char *host,
 						const char *gateway,
 						unsigned char prefix_len)
 {
-	uint8_t request[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
-			NLMSG_ALIGN(sizeof(struct rtmsg)) +
-			RTA_LENGTH(sizeof(struct in_addr)) +
-			RTA_LENGTH(sizeof(struct in_addr)) +
-			RTA_LENGTH(sizeof(int))];
-
-	int sk, err = 0;
-	struct nlmsghdr *header;
-	struct sockaddr_nl nl_addr;
-	struct rtmsg *rtmsg;
-	struct in_addr ipv4_gw, ipv4_dst;
+	uint8_t request[ROUTE_REQUEST_SIZE];
+	int err;
 
 	DBG("%s/%u via %s table %d interface %d",
 	    host, prefix_len, gateway, index, index);
 
-	memset(&request, 0, sizeof(request));
-
-	header = (struct nlmsghdr *)request;
-	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	header->nlmsg_flags = NLM_F_REQUEST|NLM_F_CREATE;
-	header->nlmsg_type = RTM_NEWROUTE;
-
-	rtmsg = NLMSG_DATA(header);
-	rtmsg->rtm_family = AF_INET;
-	rtmsg->rtm_protocol = RTPROT_BOOT;
-	rtmsg->rtm_scope = RT_SCOPE_UNIVERSE;
-	rtmsg->rtm_type = RTN_UNICAST;
-	rtmsg->rtm_table = index;
-	rtmsg->rtm_dst_len = prefix_len;
-
-	if (gateway != NULL) {
-		inet_pton(AF_INET, gateway, &ipv4_gw);
-		if ((err = __connman_inet_rtnl_addattr_l(header, sizeof(request), RTA_GATEWAY,
-				&ipv4_gw, sizeof(ipv4_gw))) < 0)
-			goto out;
-	}
-
-	if (host != NULL) {
-		inet_pton(AF_INET, host, &ipv4_dst);
-		if ((err = __connman_inet_rtnl_addattr_l(header, sizeof(request), RTA_DST,
-				      &ipv4_dst, sizeof(ipv4_dst))) < 0)
-			goto out;
-
-	}
-
-	if ((err = __connman_inet_rtnl_addattr_l(header, sizeof(request), RTA_OIF,
-			      &index, 4)) < 0)
-		goto out;
-
-	sk = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
-	if (sk < 0) {
-		err = -1;
-		goto out;
-	}
+	err = route_request((struct nlmsghdr *) request, sizeof(request),
+				RTM_NEWROUTE, AF_INET, index, index2tid(index),
+				host, prefix_len, gateway);
+	if (err == 0)
+		err = rtnl_request((struct nlmsghdr *) request);
 
-	memset(&nl_addr, 0, sizeof(nl_addr));
-	nl_addr.nl_family = AF_NETLINK;
-	if ((err = sendto(sk, request, header->nlmsg_len, 0,
-			(struct sockaddr *) &nl_addr, sizeof(nl_addr))) < 0)
-		goto out;
+	if (err == -EEXIST)
+		err = 0;
 
-	err = 0;
-	close(sk);
-out:
 	if (err < 0)
 		connman_error("Set IPv4 host route error (%s)",
-						strerror(errno));
+						strerror(-err));
 
 	return err;
 }
 
 int connman_inet_del_network_route(int index, const char *host)
 {
-	struct ifreq ifr;
-	struct rtentry rt;
-	struct sockaddr_in addr;
-	int sk, err = 0;
+	uint8_t request[ROUTE_REQUEST_SIZE];
+	int err;
 
 	DBG("index %d host %s", index, host);
 
-	sk = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0) {
-		err = -errno;
-		goto out;
-	}
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_ifindex = index;
-
-	if (ioctl(sk, SIOCGIFNAME, &ifr) < 0) {
-		err = -errno;
-		close(sk);
-		goto out;
-	}
-
-	DBG("ifname %s", ifr.ifr_name);
-
-	memset(&rt, 0, sizeof(rt));
-	rt.rt_flags = RTF_UP | RTF_HOST;
-
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = inet_addr(host);
-	memcpy(&rt.rt_dst, &addr, sizeof(rt.rt_dst));
-
-	rt.rt_dev = ifr.ifr_name;
-
-	if (ioctl(sk, SIOCDELRT, &rt) < 0 && errno != ESRCH)
-		err = -errno;
+	err = route_request((struct nlmsghdr *) request, sizeof(request),
+				RTM_DELROUTE, AF_INET, index, RT_TABLE_MAIN,
+				host, 32, NULL);
+	if (err == 0)
+		err = rtnl_request((struct nlmsghdr *) request);
 
-	close(sk);
+	if (err == -ESRCH)
+		err = 0;
 
-out:
 	if (err < 0)
 		connman_error("Deleting host route failed (%s)",
 							strerror(-err));
@@ -829,40 +1051,23 @@ out:
 int connman_inet_del_ipv6_network_route(int index, const char *host,
 						unsigned char prefix_len)
 {
-	struct in6_rtmsg rt;
-	int sk, err = 0;
+	uint8_t request[ROUTE_REQUEST_SIZE];
+	int err;
 
 	DBG("index %d host %s", index, host);
 
 	if (host == NULL)
 		return -EINVAL;
 
-	memset(&rt, 0, sizeof(rt));
-
-	rt.rtmsg_dst_len = prefix_len;
-
-	if (inet_pton(AF_INET6, host, &rt.rtmsg_dst) < 0) {
-		err = -errno;
-		goto out;
-	}
-
-	rt.rtmsg_flags = RTF_UP | RTF_HOST;
-
-	rt.rtmsg_metric = 1;
-	rt.rtmsg_ifindex = index;
-
-	sk = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0) {
-		err = -errno;
-		goto out;
-	}
-
-	if (ioctl(sk, SIOCDELRT, &rt) < 0 && errno != ESRCH)
-		err = -errno;
+	err = route_request((struct nlmsghdr *) request, sizeof(request),
+				RTM_DELROUTE, AF_INET6, index, RT_TABLE_MAIN,
+				host, prefix_len, NULL);
+	if (err == 0)
+		err = rtnl_request((struct nlmsghdr *) request);
 
-	close(sk);
+	if (err == -ESRCH)
+		err = 0;
 
-out:
 	if (err < 0)
 		connman_error("Del IPv6 host route error (%s)",
 						strerror(-err));
@@ -873,69 +1078,23 @@ out:
 int connman_inet_del_network_route_with_table(int index, const char *host,
 						const char *gateway)
 {
-	uint8_t request[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
-			NLMSG_ALIGN(sizeof(struct rtmsg)) +
-			RTA_LENGTH(sizeof(struct in_addr)) +
-			RTA_LENGTH(sizeof(struct in_addr))];
-
-	int err, sk = 0;
-	struct nlmsghdr *header;
-	struct sockaddr_nl nl_addr;
-	struct rtmsg *rtmsg;
-	struct in_addr ipv4_dst, ipv4_gw;
+	uint8_t request[ROUTE_REQUEST_SIZE];
+	int err;
 
 	DBG("interface %d host %s table %d", index, host, index);
 
-	header = (struct nlmsghdr *)request;
-	header->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	header->nlmsg_flags = NLM_F_REQUEST;
-	header->nlmsg_type = RTM_NEWROUTE;
-
-	rtmsg = NLMSG_DATA(header);
-	rtmsg->rtm_dst_len = sizeof(struct in_addr);
-	rtmsg->rtm_family = AF_INET;
-	rtmsg->rtm_scope = RT_SCOPE_NOWHERE;
-	rtmsg->rtm_table = index;
-
-	if (host != NULL) {
-		rtmsg->rtm_dst_len = 32;
-		inet_pton(AF_INET, host, &ipv4_dst);
-		if ((err = __connman_inet_rtnl_addattr_l(header, sizeof(request), RTA_DST,
-				      &ipv4_dst, sizeof(ipv4_dst))) < 0)
-			goto out;
-
-	}
-
-	if (gateway != NULL) {
-		inet_pton(AF_INET, gateway, &ipv4_gw);
-		if ((err = __connman_inet_rtnl_addattr_l(header, sizeof(request), RTA_GATEWAY,
-				&ipv4_gw, sizeof(ipv4_gw))) < 0)
-			goto out;
-	}
-
+	err = route_request((struct nlmsghdr *) request, sizeof(request),
+				RTM_DELROUTE, AF_INET, index, index2tid(index),
+				host, 32, gateway);
+	if (err == 0)
+		err = rtnl_request((struct nlmsghdr *) request);
 
-	if ((err = __connman_inet_rtnl_addattr_l(header, sizeof(request), RTA_OIF,
-			      &index, 4)) < 0)
-		goto out;
-
-	sk = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
-	if (sk < 0) {
-		err = -1;
-		goto out;
-	}
-
-	memset(&nl_addr, 0, sizeof(nl_addr));
-	nl_addr.nl_family = AF_NETLINK;
-	if ((err = sendto(sk, request, header->nlmsg_len, 0,
-			(struct sockaddr *) &nl_addr, sizeof(nl_addr))) < 0)
-		goto out;
+	if (err == -ESRCH)
+		err = 0;
 
- out:
 	if (err < 0)
 		connman_error("Deleting host route failed (%s)",
-							strerror(errno));
-
-	close(sk);
+							strerror(-err));
 
 	return err;
 }
@@ -949,56 +1108,157 @@ int connman_inet_add_ipv6_network_route(int index, const char *host,
 					const char *gateway,
 					unsigned char prefix_len)
 {
-	struct in6_rtmsg rt;
-	int sk, err = 0;
+	uint8_t request[ROUTE_REQUEST_SIZE];
+	int err;
 
 	DBG("index %d host %s gateway %s", index, host, gateway);
 
 	if (host == NULL)
 		return -EINVAL;
 
-	memset(&rt, 0, sizeof(rt));
+	err = route_request((struct nlmsghdr *) request, sizeof(request),
+				RTM_NEWROUTE, AF_INET6, index, RT_TABLE_MAIN,
+				host, prefix_len, gateway);
+	if (err == 0)
+		err = rtnl_request((struct nlmsghdr *) request);
 
-	rt.rtmsg_dst_len = prefix_len;
+	if (err == -EEXIST)
+		err = 0;
 
-	if (inet_pton(AF_INET6, host, &rt.rtmsg_dst) < 0) {
-		err = -errno;
+	if (err < 0)
+		connman_error("Set IPv6 host route error (%s)",
+						strerror(-err));
+
+	return err;
+}
+
+int connman_inet_add_ipv6_host_route(int index, const char *host,
+					const char *gateway)
+{
+	return connman_inet_add_ipv6_network_route(index, host, gateway, 128);
+}
+
+/*
+ * Adds or removes all routes with as few round trips to the kernel as
+ * possible. The IPv4 host routes in the per interface table that
+ * connman_inet_add_host_route() creates are handled when table is set.
+ */
+static int modify_routes(int cmd, int index,
+				struct connman_inet_route *routes,
+				unsigned int count, connman_bool_t table)
+{
+	struct rtnl_request *requests;
+	uint8_t *buffers;
+	unsigned int i, n = 0, failed = 0;
+	int err;
+
+	if (count == 0)
+		return 0;
+
+	requests = g_try_new0(struct rtnl_request, count * 2);
+	buffers = g_try_malloc0(count * 2 * ROUTE_REQUEST_SIZE);
+	if (requests == NULL || buffers == NULL) {
+		err = -ENOMEM;
 		goto out;
 	}
 
-	rt.rtmsg_flags = RTF_UP | RTF_HOST;
+	for (i = 0; i < count; i++) {
+		struct connman_inet_route *route = &routes[i];
+		struct nlmsghdr *header;
+		unsigned char prefix_len;
 
-	if (gateway != NULL) {
-		rt.rtmsg_flags |= RTF_GATEWAY;
-		inet_pton(AF_INET6, gateway, &rt.rtmsg_gateway);
+		if (route->family == AF_INET)
+			prefix_len = __connman_ipaddress_netmask_prefix_len(
+							route->netmask);
+		else
+			prefix_len = route->prefix_len;
+
+		header = (struct nlmsghdr *) &buffers[n * ROUTE_REQUEST_SIZE];
+		route->error = route_request(header, ROUTE_REQUEST_SIZE, cmd,
+					route->family, index, RT_TABLE_MAIN,
+					route->host, prefix_len,
+					cmd == RTM_NEWROUTE ?
+						route->gateway : NULL);
+		if (route->error < 0)
+			continue;
+
+		requests[n].hdr = header;
+		requests[n++].user_data = route;
+
+		if (table == FALSE || route->family != AF_INET)
+			continue;
+
+		header = (struct nlmsghdr *) &buffers[n * ROUTE_REQUEST_SIZE];
+		if (route_request(header, ROUTE_REQUEST_SIZE, cmd, AF_INET,
+					index, index2tid(index), route->host,
+					32, cmd == RTM_NEWROUTE ?
+						route->gateway : NULL) == 0)
+			requests[n++].hdr = header;
 	}
 
-	rt.rtmsg_metric = 1;
-	rt.rtmsg_ifindex = index;
+	err = rtnl_transact(requests, n);
 
-	sk = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (sk < 0) {
-		err = -errno;
-		goto out;
+	for (i = 0; i < n; i++) {
+		struct connman_inet_route *route = requests[i].user_data;
+
+		if (route == NULL)
+			continue;
+
+		if (err < 0) {
+			route->error = err;
+			continue;
+		}
+
+		route->error = requests[i].error;
+
+		if ((cmd == RTM_NEWROUTE && route->error == -EEXIST) ||
+				(cmd == RTM_DELROUTE && route->error == -ESRCH))
+			route->error = 0;
 	}
 
-	if (ioctl(sk, SIOCADDRT, &rt) < 0 && errno != EEXIST)
-		err = -errno;
+	for (i = 0; i < count; i++) {
+		if (routes[i].error == 0)
+			continue;
 
-	close(sk);
+		DBG("%s %s via %s: %s", cmd == RTM_NEWROUTE ? "add" : "del",
+				routes[i].host, routes[i].gateway,
+				strerror(-routes[i].error));
+		failed++;
+	}
+
+	DBG("index %d routes %u failed %u", index, count, failed);
 
 out:
-	if (err < 0)
-		connman_error("Set IPv6 host route error (%s)",
-						strerror(-err));
+	g_free(buffers);
+	g_free(requests);
 
 	return err;
 }
 
-int connman_inet_add_ipv6_host_route(int index, const char *host,
-					const char *gateway)
+int connman_inet_add_routes(int index, struct connman_inet_route *routes,
+							unsigned int count)
 {
-	return connman_inet_add_ipv6_network_route(index, host, gateway, 128);
+	return modify_routes(RTM_NEWROUTE, index, routes, count, FALSE);
+}
+
+int connman_inet_del_routes(int index, struct connman_inet_route *routes,
+							unsigned int count)
+{
+	return modify_routes(RTM_DELROUTE, index, routes, count, FALSE);
+}
+
+int __connman_inet_add_host_routes(int index,
+				struct connman_inet_route *routes,
+				unsigned int count)
+{
+	return modify_routes(RTM_NEWROUTE, index, routes, count, TRUE);
+}
+
+int __connman_inet_del_host_routes(int index,
+				struct connman_inet_route *routes,
+				unsigned int count)
+{
+	return modify_routes(RTM_DELROUTE, index, routes, count, TRUE);
 }
 
 int connman_inet_clear_ipv6_gateway_address(int index, const char *gateway)
@@ -2532,6 +2792,8 @@ static int parse_rtattr(struct rtattr *tb[], int max,
 struct get_route_cb_data {
 	connman_inet_addr_cb_t callback;
 	void *user_data;
+	char *addr;
+	int index;
 };
 
 static void get_route_cb(struct nlmsghdr *answer, void *user_data)
@@ -2539,15 +2801,11 @@ static void get_route_cb(struct nlmsghdr *answer, void *user_data)
 	struct get_route_cb_data *data = user_data;
 	struct rtattr *tb[RTA_MAX+1];
 	struct rtmsg *r = NLMSG_DATA(answer);
-	int len, index = -1;
+	int len;
 	char abuf[256];
-	const char *addr = NULL;
 
 	DBG("answer %p data %p", answer, user_data);
 
-	if (answer == NULL)
-		goto out;
-
 	len = answer->nlmsg_len;
 
 	if (answer->nlmsg_type != RTM_NEWROUTE &&
@@ -2555,112 +2813,109 @@ static void get_route_cb(struct nlmsghdr *answer, void *user_data)
 		connman_error("Not a route: %08x %08x %08x",
 			answer->nlmsg_len, answer->nlmsg_type,
 			answer->nlmsg_flags);
-		goto out;
+		return;
 	}
 
 	len -= NLMSG_LENGTH(sizeof(*r));
 	if (len < 0) {
 		connman_error("BUG: wrong nlmsg len %d", len);
-		goto out;
+		return;
 	}
 
 	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
 
 	if (tb[RTA_OIF] != NULL)
-		index = *(int *)RTA_DATA(tb[RTA_OIF]);
+		data->index = *(int *)RTA_DATA(tb[RTA_OIF]);
+
+	if (tb[RTA_GATEWAY] != NULL &&
+			inet_ntop(r->rtm_family, RTA_DATA(tb[RTA_GATEWAY]),
+					abuf, sizeof(abuf)) != NULL)
+		data->addr = g_strdup(abuf);
 
-	if (tb[RTA_GATEWAY] != NULL)
-		addr = inet_ntop(r->rtm_family,
-				RTA_DATA(tb[RTA_GATEWAY]),
-				abuf, sizeof(abuf));
+	DBG("addr %s index %d user %p", data->addr, data->index,
+							data->user_data);
+}
 
-	DBG("addr %s index %d user %p", addr, index, data->user_data);
+static gboolean get_route_reply(gpointer user_data)
+{
+	struct get_route_cb_data *data = user_data;
 
-out:
-	if (data != NULL && data->callback != NULL)
-		data->callback(addr, index, data->user_data);
+	if (data->callback != NULL)
+		data->callback(data->addr, data->index, data->user_data);
 
+	g_free(data->addr);
 	g_free(data);
 
-	return;
+	return FALSE;
 }
 
 /*
- * Return the interface index that contains route to host.
+ * Return the interface index that contains route to host. The kernel
+ * answers right away, the callback is still called from the main loop.
  */
 int __connman_inet_get_route(const char *dest_address,
 			connman_inet_addr_cb_t callback, void *user_data)
 {
 	struct get_route_cb_data *data;
-	struct addrinfo hints, *rp;
-	struct __connman_inet_rtnl_handle *rth;
-	int err;
+	struct rtnl_request req;
+	struct {
+		struct nlmsghdr n;
+		struct rtmsg rt;
+		char buf[64];
+	} msg;
+	unsigned char buf[sizeof(struct in6_addr)];
+	int family, len, err;
 
 	DBG("dest %s", dest_address);
 
 	if (dest_address == NULL)
 		return -EINVAL;
 
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV | AI_NUMERICHOST;
-
-	err = getaddrinfo(dest_address, NULL, &hints, &rp);
-	if (err)
+	family = connman_inet_check_ipaddress(dest_address);
+	if (family == AF_INET)
+		len = sizeof(struct in_addr);
+	else if (family == AF_INET6)
+		len = sizeof(struct in6_addr);
+	else
 		return -EINVAL;
 
-	rth = g_try_malloc0(sizeof(struct __connman_inet_rtnl_handle));
-	if (rth == NULL) {
-		freeaddrinfo(rp);
-		return -ENOMEM;
-	}
-
-	rth->req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	rth->req.n.nlmsg_flags = NLM_F_REQUEST;
-	rth->req.n.nlmsg_type = RTM_GETROUTE;
-	rth->req.u.r.rt.rtm_family = rp->ai_family;
-	rth->req.u.r.rt.rtm_table = 0;
-	rth->req.u.r.rt.rtm_protocol = 0;
-	rth->req.u.r.rt.rtm_scope = 0;
-	rth->req.u.r.rt.rtm_type = 0;
-	rth->req.u.r.rt.rtm_src_len = 0;
-	rth->req.u.r.rt.rtm_dst_len = rp->ai_addrlen << 3;
-	rth->req.u.r.rt.rtm_tos = 0;
-
-	__connman_inet_rtnl_addattr_l(&rth->req.n, sizeof(rth->req), RTA_DST,
-				&rp->ai_addr, rp->ai_addrlen);
+	if (inet_pton(family, dest_address, buf) < 1)
+		return -EINVAL;
 
-	freeaddrinfo(rp);
+	memset(&msg, 0, sizeof(msg));
+	msg.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	msg.n.nlmsg_flags = NLM_F_REQUEST;
+	msg.n.nlmsg_type = RTM_GETROUTE;
+	msg.rt.rtm_family = family;
+	msg.rt.rtm_dst_len = len * 8;
 
-	err = __connman_inet_rtnl_open(rth);
-	if (err < 0)
-		goto fail;
+	__connman_inet_rtnl_addattr_l(&msg.n, sizeof(msg), RTA_DST, buf, len);
 
-	data = g_try_malloc(sizeof(struct get_route_cb_data));
-	if (data == NULL) {
-		err = -ENOMEM;
-		goto done;
-	}
+	data = g_try_malloc0(sizeof(struct get_route_cb_data));
+	if (data == NULL)
+		return -ENOMEM;
 
 	data->callback = callback;
 	data->user_data = user_data;
+	data->index = -1;
 
-#define GET_ROUTE_TIMEOUT 2
-	err = __connman_inet_rtnl_talk(rth, &rth->req.n, GET_ROUTE_TIMEOUT,
-				get_route_cb, data);
+	memset(&req, 0, sizeof(req));
+	req.hdr = &msg.n;
+	req.callback = get_route_cb;
+	req.user_data = data;
+
+	err = rtnl_transact(&req, 1);
 	if (err < 0) {
 		g_free(data);
-		goto done;
+		return err;
 	}
 
-	return 0;
+	if (req.error < 0)
+		DBG("no route to %s: %s", dest_address, strerror(-req.error));
 
-done:
-	__connman_inet_rtnl_close(rth);
+	g_idle_add(get_route_reply, data);
 
-fail:
-	g_free(rth);
-	return err;
+	return 0;
 }
 
 int connman_inet_check_ipaddress(const char *host)
@@ -2876,7 +3131,6 @@ static int iprule_modify(int cmd, int family, uint32_t table_id,
 			uint32_t fwmark)
 {
 	struct __connman_inet_rtnl_handle rth;
-	int ret;
 
 	memset(&rth, 0, sizeof(rth));
 
@@ -2909,16 +3163,7 @@ static int iprule_modify(int cmd, int family, uint32_t table_id,
 	if (rth.req.u.r.rt.rtm_family == AF_UNSPEC)
 		rth.req.u.r.rt.rtm_family = AF_INET;
 
-	ret = __connman_inet_rtnl_open(&rth);
-	if (ret < 0)
-		goto done;
-
-	ret = __connman_inet_rtnl_send(&rth, &rth.req.n);
-
-done:
-	__connman_inet_rtnl_close(&rth);
-
-	return ret;
+	return rtnl_request(&rth.req.n);
 }
 
 int __connman_inet_add_fwmark_rule(uint32_t table_id, int family, uint32_t fwmark)
@@ -2959,7 +3204,7 @@ static int iproute_default_modify(int cmd, uint32_t table_id, int ifindex,
 	memset(&rth, 0, sizeof(rth));
 
 	rth.req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	rth.req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL;
+	rth.req.n.nlmsg_flags = NLM_F_REQUEST;
 	rth.req.n.nlmsg_type = cmd;
 	rth.req.u.r.rt.rtm_family = family;
 	rth.req.u.r.rt.rtm_table = RT_TABLE_MAIN;
@@ -2968,6 +3213,9 @@ static int iproute_default_modify(int cmd, uint32_t table_id, int ifindex,
 	rth.req.u.r.rt.rtm_scope = RT_SCOPE_UNIVERSE;
 	rth.req.u.r.rt.rtm_type = RTN_UNICAST;
 
+	if (cmd == RTM_NEWROUTE)
+		rth.req.n.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+
 	__connman_inet_rtnl_addattr_l(&rth.req.n, sizeof(rth.req), RTA_GATEWAY,
 								buf, len);
 	if (table_id < 256) {
@@ -2981,16 +3229,7 @@ static int iproute_default_modify(int cmd, uint32_t table_id, int ifindex,
 	__connman_inet_rtnl_addattr32(&rth.req.n, sizeof(rth.req),
 							RTA_OIF, ifindex);
 
-	ret = __connman_inet_rtnl_open(&rth);
-	if (ret < 0)
-		goto done;
-
-	ret = __connman_inet_rtnl_send(&rth, &rth.req.n);
-
-done:
-	__connman_inet_rtnl_close(&rth);
-
-	return ret;
+	return rtnl_request(&rth.req.n);
 }
 
 int __connman_inet_add_default_to_table(uint32_t table_id, int ifindex,
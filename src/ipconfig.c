@@ -57,6 +57,9 @@ struct connman_ipconfig {
 
 	int ipv6_privacy_config;
 	char *last_dhcp_address;
+	unsigned char last_dhcp_prefixlen;
+	char *last_dhcp_gateway;
+	time_t last_dhcp_expiry;
 	char **last_dhcpv6_prefixes;
 };
 
@@ -1248,6 +1251,7 @@ void __connman_ipconfig_unref_debug(struct connman_ipconfig *ipconfig,
 	connman_ipaddress_free(ipconfig->system);
 	connman_ipaddress_free(ipconfig->address);
 	g_free(ipconfig->last_dhcp_address);
+	g_free(ipconfig->last_dhcp_gateway);
 	g_strfreev(ipconfig->last_dhcpv6_prefixes);
 	g_free(ipconfig);
 }
@@ -1486,6 +1490,10 @@ void __connman_ipconfig_set_dhcp_address(struct connman_ipconfig *ipconfig,
 	if (ipconfig == NULL)
 		return;
 
+	/* The cached lease only describes the address it was given for */
+	if (g_strcmp0(ipconfig->last_dhcp_address, address) != 0)
+		__connman_ipconfig_set_dhcp_lease(ipconfig, 0, NULL, 0);
+
 	g_free(ipconfig->last_dhcp_address);
 	ipconfig->last_dhcp_address = g_strdup(address);
 }
@@ -1498,6 +1506,41 @@ char *__connman_ipconfig_get_dhcp_address(struct connman_ipconfig *ipconfig)
 	return ipconfig->last_dhcp_address;
 }
 
+void __connman_ipconfig_set_dhcp_lease(struct connman_ipconfig *ipconfig,
+					unsigned char prefixlen,
+					const char *gateway, time_t expiry)
+{
+	if (ipconfig == NULL)
+		return;
+
+	ipconfig->last_dhcp_prefixlen = prefixlen;
+	ipconfig->last_dhcp_expiry = expiry;
+
+	g_free(ipconfig->last_dhcp_gateway);
+	ipconfig->last_dhcp_gateway = g_strdup(gateway);
+}
+
+/*
+ * Returns the last DHCP address together with the prefix length and
+ * gateway of its lease, or NULL if no lease is cached or it has expired.
+ */
+const char *__connman_ipconfig_get_dhcp_lease(struct connman_ipconfig *ipconfig,
+					unsigned char *prefixlen,
+					const char **gateway)
+{
+	if (ipconfig == NULL || ipconfig->last_dhcp_address == NULL)
+		return NULL;
+
+	if (ipconfig->last_dhcp_prefixlen == 0 ||
+			ipconfig->last_dhcp_expiry <= time(NULL))
+		return NULL;
+
+	*prefixlen = ipconfig->last_dhcp_prefixlen;
+	*gateway = ipconfig->last_dhcp_gateway;
+
+	return ipconfig->last_dhcp_address;
+}
+
 void __connman_ipconfig_set_dhcpv6_prefixes(struct connman_ipconfig *ipconfig,
 					char **prefixes)
 {
@@ -2265,9 +2308,70 @@ int __connman_ipconfig_load(struct connman_ipconfig *ipconfig,
 	}
 	g_free(key);
 
+	key = g_strdup_printf("%sDHCP.LastPrefixlen", prefix);
+	ipconfig->last_dhcp_prefixlen = g_key_file_get_integer(
+				keyfile, identifier, key, NULL);
+	g_free(key);
+
+	key = g_strdup_printf("%sDHCP.LastGateway", prefix);
+	g_free(ipconfig->last_dhcp_gateway);
+	ipconfig->last_dhcp_gateway = g_key_file_get_string(
+				keyfile, identifier, key, NULL);
+	g_free(key);
+
+	key = g_strdup_printf("%sDHCP.LastExpiry", prefix);
+	str = g_key_file_get_string(keyfile, identifier, key, NULL);
+	if (str != NULL) {
+		GTimeVal expiry;
+
+		if (g_time_val_from_iso8601(str, &expiry) == TRUE)
+			ipconfig->last_dhcp_expiry = expiry.tv_sec;
+		g_free(str);
+	}
+	g_free(key);
+
 	return 0;
 }
 
+static void save_dhcp_lease(struct connman_ipconfig *ipconfig,
+		GKeyFile *keyfile, const char *identifier, const char *prefix)
+{
+	connman_bool_t valid;
+	GTimeVal expiry;
+	char *key, *str;
+
+	valid = ipconfig->last_dhcp_prefixlen != 0 &&
+				ipconfig->last_dhcp_expiry > time(NULL);
+
+	key = g_strdup_printf("%sDHCP.LastPrefixlen", prefix);
+	if (valid == TRUE)
+		g_key_file_set_integer(keyfile, identifier, key,
+					ipconfig->last_dhcp_prefixlen);
+	else
+		g_key_file_remove_key(keyfile, identifier, key, NULL);
+	g_free(key);
+
+	key = g_strdup_printf("%sDHCP.LastGateway", prefix);
+	if (valid == TRUE && ipconfig->last_dhcp_gateway != NULL)
+		g_key_file_set_string(keyfile, identifier, key,
+					ipconfig->last_dhcp_gateway);
+	else
+		g_key_file_remove_key(keyfile, identifier, key, NULL);
+	g_free(key);
+
+	key = g_strdup_printf("%sDHCP.LastExpiry", prefix);
+	if (valid == TRUE) {
+		expiry.tv_sec = ipconfig->last_dhcp_expiry;
+		expiry.tv_usec = 0;
+
+		str = g_time_val_to_iso8601(&expiry);
+		g_key_file_set_string(keyfile, identifier, key, str);
+		g_free(str);
+	} else
+		g_key_file_remove_key(keyfile, identifier, key, NULL);
+	g_free(key);
+}
+
 int __connman_ipconfig_save(struct connman_ipconfig *ipconfig,
 		GKeyFile *keyfile, const char *identifier, const char *prefix)
 {
@@ -2325,6 +2429,8 @@ int __connman_ipconfig_save(struct connman_ipconfig *ipconfig,
 		else
 			g_key_file_remove_key(keyfile, identifier, key, NULL);
 		g_free(key);
+
+		save_dhcp_lease(ipconfig, keyfile, identifier, prefix);
 		/* fall through */
 	case CONNMAN_IPCONFIG_METHOD_UNKNOWN:
 	case CONNMAN_IPCONFIG_METHOD_OFF:
@@ -151,10 +151,28 @@ struct error_target {
 	char error[IPT_TABLE_MAXNAMELEN];
 };
 
+struct connman_iptables_chain {
+	char *name;
+	int builtin;
+
+	/* Error target entry, or the first rule of a builtin chain */
+	GList *head;
+	/* RETURN or policy entry closing the chain */
+	GList *end;
+
+	/* Number of rules jumping to this chain */
+	unsigned int references;
+};
+
 struct connman_iptables_entry {
 	int offset;
 	int builtin;
 
+	struct connman_iptables_chain *chain;
+	struct connman_iptables_chain *jump;
+	gboolean fallthrough;
+	guint fingerprint;
+
 	struct ipt_entry *entry;
 };
 
@@ -162,21 +180,35 @@ struct connman_iptables {
 	char *name;
 	int ipt_sock;
 
+	/* Kernel view of the table as of the last read or replace */
 	struct ipt_getinfo *info;
-	struct ipt_get_entries *blob_entries;
+
+	/*
+	 * The entries of the last read or replace live in one block,
+	 * their records in one array. Only entries added since then
+	 * are allocated on their own.
+	 */
+	gpointer arena;
+	struct ipt_entry *arena_entries;
+	unsigned int arena_size;
+	struct connman_iptables_entry *records;
+	unsigned int num_records;
 
 	unsigned int num_entries;
 	unsigned int old_entries;
 	unsigned int size;
 
-	unsigned int underflow[NF_INET_NUMHOOKS];
-	unsigned int hook_entry[NF_INET_NUMHOOKS];
-
 	GList *entries;
+	GHashTable *chains;
+	GHashTable *rules;
+
+	gboolean dirty;
+	gboolean modified;
 };
 
 static GHashTable *table_hash = NULL;
 static gboolean debug_enabled = FALSE;
+static int transaction_level = 0;
 
 typedef int (*iterate_entries_cb_t)(struct ipt_entry *entry, int builtin,
 					unsigned int hook,size_t size,
@@ -286,31 +318,10 @@ static gboolean is_builtin_target(const char *target_name)
 	return FALSE;
 }
 
-static gboolean is_jump(struct connman_iptables_entry *e)
+static gboolean is_standard_target(struct xt_entry_target *target)
 {
-	struct xt_entry_target *target;
-
-	target = ipt_get_target(e->entry);
-
-	if (!g_strcmp0(target->u.user.name, IPT_STANDARD_TARGET)) {
-		struct xt_standard_target *t;
-
-		t = (struct xt_standard_target *)target;
-
-		switch (t->verdict) {
-		case XT_RETURN:
-		case -NF_ACCEPT - 1:
-		case -NF_DROP - 1:
-		case -NF_QUEUE - 1:
-		case -NF_STOP - 1:
-			return false;
-
-		default:
-			return true;
-		}
-	}
-
-	return false;
+	return strncmp(target->u.user.name, IPT_STANDARD_TARGET,
+				sizeof(target->u.user.name)) == 0;
 }
 
 static gboolean is_fallthrough(struct connman_iptables_entry *e)
@@ -345,255 +356,323 @@ static gboolean is_chain(struct connman_iptables *table,
 	return FALSE;
 }
 
-static GList *find_chain_head(struct connman_iptables *table,
-				const char *chain_name)
+static guint hash_bytes(guint hash, const void *data, size_t len)
 {
-	GList *list;
-	struct connman_iptables_entry *head;
-	struct ipt_entry *entry;
+	const unsigned char *p = data;
+
+	while (len-- > 0)
+		hash = (hash << 5) + hash + *p++;
+
+	return hash;
+}
+
+/*
+ * The fingerprint only covers what is_same_rule() compares. Extension
+ * names are hashed up to the terminating NUL since older kernels
+ * leave garbage behind it in entries read back from the kernel.
+ */
+static guint rule_fingerprint(struct connman_iptables_entry *e)
+{
+	struct ipt_entry *entry = e->entry;
+	struct xt_entry_match *match;
 	struct xt_entry_target *target;
-	int builtin;
+	struct xt_standard_target *t;
+	unsigned int offset;
+	guint hash = 5381;
 
-	for (list = table->entries; list; list = list->next) {
-		head = list->data;
-		entry = head->entry;
+	hash = hash_bytes(hash, &entry->ip, sizeof(entry->ip));
 
-		/* Buit-in chain */
-		builtin = head->builtin;
-		if (builtin >= 0 && !g_strcmp0(hooknames[builtin], chain_name))
+	for (offset = sizeof(struct ipt_entry); offset < entry->target_offset;
+			offset += match->u.match_size) {
+		match = (struct xt_entry_match *)((char *)entry + offset);
+		if (match->u.match_size < sizeof(struct xt_entry_match))
 			break;
 
-		/* User defined chain */
-		target = ipt_get_target(entry);
-		if (!g_strcmp0(target->u.user.name, IPT_ERROR_TARGET) &&
-		    !g_strcmp0((char *)target->data, chain_name))
-			break;
+		hash = hash_bytes(hash, match->u.user.name,
+				strnlen(match->u.user.name,
+					sizeof(match->u.user.name)));
+		hash = hash_bytes(hash, match->data, match->u.match_size -
+					sizeof(struct xt_entry_match));
 	}
 
-	return list;
-}
+	target = ipt_get_target(entry);
 
-static GList *find_chain_tail(struct connman_iptables *table,
-				const char *chain_name)
-{
-	struct connman_iptables_entry *tail;
-	GList *chain_head, *list;
+	if (e->jump != NULL)
+		return hash * 33 + g_str_hash(e->jump->name);
 
-	chain_head = find_chain_head(table, chain_name);
-	if (chain_head == NULL)
-		return NULL;
+	if (e->fallthrough == TRUE)
+		return hash;
 
-	/* Then we look for the next chain */
-	for (list = chain_head->next; list; list = list->next) {
-		tail = list->data;
+	if (is_standard_target(target) == TRUE) {
+		t = (struct xt_standard_target *)target;
 
-		if (is_chain(table, tail))
-			return list;
+		return hash_bytes(hash, &t->verdict, sizeof(t->verdict));
 	}
 
-	/* Nothing found, we return the table end */
-	return g_list_last(table->entries);
+	hash = hash_bytes(hash, target->u.user.name,
+				strnlen(target->u.user.name,
+					sizeof(target->u.user.name)));
+
+	if (target->u.target_size > sizeof(struct xt_entry_target))
+		hash = hash_bytes(hash, target->data, target->u.target_size -
+					sizeof(struct xt_entry_target));
+
+	return hash;
 }
 
+static void index_entry(struct connman_iptables *table, GList *node)
+{
+	struct connman_iptables_entry *e = node->data;
+	gpointer key;
+	GSList *nodes;
 
-static void update_offsets(struct connman_iptables *table)
+	e->fingerprint = rule_fingerprint(e);
+	key = GUINT_TO_POINTER(e->fingerprint);
+
+	nodes = g_hash_table_lookup(table->rules, key);
+	g_hash_table_steal(table->rules, key);
+
+	g_hash_table_insert(table->rules, key, g_slist_prepend(nodes, node));
+}
+
+static void unindex_entry(struct connman_iptables *table, GList *node)
 {
-	GList *list, *prev;
-	struct connman_iptables_entry *entry, *prev_entry;
+	struct connman_iptables_entry *e = node->data;
+	gpointer key;
+	GSList *nodes;
 
-	for (list = table->entries; list; list = list->next) {
-		entry = list->data;
+	key = GUINT_TO_POINTER(e->fingerprint);
 
-		if (list == table->entries) {
-			entry->offset = 0;
+	nodes = g_hash_table_lookup(table->rules, key);
+	if (nodes == NULL)
+		return;
 
-			continue;
-		}
+	g_hash_table_steal(table->rules, key);
+
+	nodes = g_slist_remove(nodes, node);
+	if (nodes != NULL)
+		g_hash_table_insert(table->rules, key, nodes);
+}
+
+static GList *find_chain_head(struct connman_iptables *table,
+				const char *chain_name)
+{
+	struct connman_iptables_chain *chain;
 
-		prev = list->prev;
-		prev_entry = prev->data;
+	chain = g_hash_table_lookup(table->chains, chain_name);
+	if (chain == NULL)
+		return NULL;
 
-		entry->offset = prev_entry->offset +
-					prev_entry->entry->next_offset;
-	}
+	return chain->head;
 }
 
-static void update_targets_reference(struct connman_iptables *table,
-				struct connman_iptables_entry *entry_before,
-				struct connman_iptables_entry *modified_entry,
-				gboolean is_removing)
+static struct connman_iptables_chain *find_jump(
+					struct connman_iptables *table,
+					const char *target_name)
 {
-	struct connman_iptables_entry *tmp;
-	struct xt_standard_target *t;
-	GList *list;
-	int offset;
+	struct connman_iptables_chain *chain;
 
-	offset = modified_entry->entry->next_offset;
+	if (is_builtin_target(target_name))
+		return NULL;
 
-	for (list = table->entries; list; list = list->next) {
-		tmp = list->data;
+	chain = g_hash_table_lookup(table->chains, target_name);
+	if (chain == NULL || chain->builtin >= 0)
+		return NULL;
 
-		if (!is_jump(tmp))
-			continue;
+	return chain;
+}
 
-		t = (struct xt_standard_target *)ipt_get_target(tmp->entry);
+/*
+ * Builtin chains have no head entry of their own, the builtin flag
+ * marks their first rule. Whenever it moves, the chain index has to
+ * follow.
+ */
+static void set_builtin(struct connman_iptables *table, GList *node,
+				int builtin)
+{
+	struct connman_iptables_entry *e = node->data;
+	struct connman_iptables_chain *chain;
 
-		if (is_removing == TRUE) {
-			if (t->verdict >= entry_before->offset)
-				t->verdict -= offset;
-		} else {
-			if (t->verdict > entry_before->offset)
-				t->verdict += offset;
-		}
-	}
+	e->builtin = builtin;
+
+	if (builtin < 0)
+		return;
 
-	if (is_fallthrough(modified_entry)) {
-		t = (struct xt_standard_target *) ipt_get_target(modified_entry->entry);
+	chain = g_hash_table_lookup(table->chains, hooknames[builtin]);
+	if (chain != NULL)
+		chain->head = node;
+}
 
-		t->verdict = entry_before->offset +
-			modified_entry->entry->target_offset +
-			ALIGN(sizeof(struct xt_standard_target));
-		t->target.u.target_size =
-			ALIGN(sizeof(struct xt_standard_target));
+/*
+ * Offsets, jump verdicts and the hook positions are only needed in
+ * the blob handed to the kernel, so they are computed in one pass
+ * when it is built instead of on every modification.
+ */
+static void update_offsets(struct connman_iptables *table)
+{
+	struct connman_iptables_entry *entry;
+	GList *list;
+	int offset = 0;
+
+	for (list = table->entries; list; list = list->next) {
+		entry = list->data;
+
+		entry->offset = offset;
+		offset += entry->entry->next_offset;
 	}
 }
 
-static int iptables_add_entry(struct connman_iptables *table,
+static void free_entry(struct connman_iptables *table,
+				struct connman_iptables_entry *e)
+{
+	char *entry = (char *)e->entry;
+	char *arena = (char *)table->arena_entries;
+
+	if (entry < arena || entry >= arena + table->arena_size)
+		g_free(e->entry);
+
+	if (e < table->records || e >= table->records + table->num_records)
+		g_free(e);
+}
+
+static GList *iptables_add_entry(struct connman_iptables *table,
 				struct ipt_entry *entry, GList *before,
-					int builtin)
+				int builtin,
+				struct connman_iptables_chain *chain,
+				struct connman_iptables_chain *jump)
 {
-	struct connman_iptables_entry *e, *entry_before;
+	struct connman_iptables_entry *e;
+	struct xt_standard_target *t;
+	GList *node;
 
 	if (table == NULL)
-		return -1;
+		return NULL;
 
 	e = g_try_malloc0(sizeof(struct connman_iptables_entry));
 	if (e == NULL)
-		return -1;
+		return NULL;
 
 	e->entry = entry;
-	e->builtin = builtin;
+	e->builtin = -1;
+	e->chain = chain;
+	e->jump = jump;
+
+	if (jump != NULL) {
+		jump->references++;
+	} else if (chain != NULL && is_fallthrough(e) == TRUE) {
+		t = (struct xt_standard_target *)ipt_get_target(entry);
+		t->target.u.target_size =
+			ALIGN(sizeof(struct xt_standard_target));
+
+		e->fallthrough = TRUE;
+	}
 
 	table->entries = g_list_insert_before(table->entries, before, e);
 	table->num_entries++;
 	table->size += entry->next_offset;
+	table->modified = TRUE;
 
-	if (before == NULL) {
-		e->offset = table->size - entry->next_offset;
-
-		return 0;
-	}
-
-	entry_before = before->data;
-
-	/*
-	 * We've just appended/insterted a new entry. All references
-	 * should be bumped accordingly.
-	 */
-	update_targets_reference(table, entry_before, e, FALSE);
-
-	update_offsets(table);
-
-	return 0;
-}
-
-static int remove_table_entry(struct connman_iptables *table,
-				struct connman_iptables_entry *entry)
-{
-	int removed = 0;
-
-	table->num_entries--;
-	table->size -= entry->entry->next_offset;
-	removed = entry->entry->next_offset;
+	if (before == NULL)
+		node = g_list_last(table->entries);
+	else
+		node = before->prev;
 
-	table->entries = g_list_remove(table->entries, entry);
+	if (builtin >= 0)
+		set_builtin(table, node, builtin);
 
-	g_free(entry->entry);
-	g_free(entry);
+	index_entry(table, node);
 
-	return removed;
+	return node;
 }
 
-static void delete_update_hooks(struct connman_iptables *table,
-				int builtin, GList *chain_head,
-				int removed)
+static void remove_table_entry(struct connman_iptables *table, GList *node)
 {
-	struct connman_iptables_entry *e;
-	GList *list;
+	struct connman_iptables_entry *entry = node->data;
 
-	e = chain_head->data;
-	e->builtin = builtin;
+	unindex_entry(table, node);
 
-	table->underflow[builtin] -= removed;
+	if (entry->jump != NULL)
+		entry->jump->references--;
 
-	for (list = chain_head->next; list; list = list->next) {
-		e = list->data;
+	table->num_entries--;
+	table->size -= entry->entry->next_offset;
+	table->modified = TRUE;
 
-		if (e->builtin < 0)
-			continue;
+	table->entries = g_list_delete_link(table->entries, node);
 
-		table->hook_entry[e->builtin] -= removed;
-		table->underflow[e->builtin] -= removed;
-	}
+	free_entry(table, entry);
 }
 
 static int iptables_flush_chain(struct connman_iptables *table,
 						const char *name)
 {
-	GList *chain_head, *chain_tail, *list, *next;
+	struct connman_iptables_chain *chain;
 	struct connman_iptables_entry *entry;
-	int builtin, removed = 0;
+	GList *list, *next;
+	int builtin;
 
 	DBG("table %s chain %s", table->name, name);
 
-	chain_head = find_chain_head(table, name);
-	if (chain_head == NULL)
-		return -EINVAL;
-
-	chain_tail = find_chain_tail(table, name);
-	if (chain_tail == NULL)
+	chain = g_hash_table_lookup(table->chains, name);
+	if (chain == NULL)
 		return -EINVAL;
 
-	entry = chain_head->data;
+	entry = chain->head->data;
 	builtin = entry->builtin;
 
 	if (builtin >= 0)
-		list = chain_head;
+		list = chain->head;
 	else
-		list = chain_head->next;
+		list = chain->head->next;
 
-	if (list == chain_tail->prev)
+	if (list == chain->end)
 		return 0;
 
-	while (list != chain_tail->prev) {
-		entry = list->data;
+	while (list != chain->end) {
 		next = g_list_next(list);
 
-		removed += remove_table_entry(table, entry);
+		remove_table_entry(table, list);
 
 		list = next;
 	}
 
 	if (builtin >= 0)
-		delete_update_hooks(table, builtin, chain_tail->prev, removed);
-
-	update_offsets(table);
+		set_builtin(table, chain->end, builtin);
 
 	return 0;
 }
 
+static void free_chain(gpointer user_data)
+{
+	struct connman_iptables_chain *chain = user_data;
+
+	g_free(chain->name);
+	g_free(chain);
+}
+
 static int iptables_add_chain(struct connman_iptables *table,
 				const char *name)
 {
+	struct connman_iptables_chain *chain;
 	GList *last;
 	struct ipt_entry *entry_head;
-	struct ipt_entry *entry_return;
+	struct ipt_entry *entry_return = NULL;
 	struct error_target *error;
 	struct ipt_standard_target *standard;
 	u_int16_t entry_head_size, entry_return_size;
 
 	DBG("table %s chain %s", table->name, name);
 
+	if (g_hash_table_lookup(table->chains, name) != NULL)
+		return -EEXIST;
+
+	chain = g_try_new0(struct connman_iptables_chain, 1);
+	if (chain == NULL)
+		return -ENOMEM;
+
+	chain->name = g_strdup(name);
+	chain->builtin = -1;
+
 	last = g_list_last(table->entries);
 
 	/*
@@ -620,7 +699,9 @@ static int iptables_add_chain(struct connman_iptables *table,
 	error->t.u.user.target_size = ALIGN(sizeof(struct error_target));
 	g_stpcpy(error->error, name);
 
-	if (iptables_add_entry(table, entry_head, last, -1) < 0)
+	chain->head = iptables_add_entry(table, entry_head, last, -1,
+						chain, NULL);
+	if (chain->head == NULL)
 		goto err_head;
 
 	/* tail entry */
@@ -638,15 +719,25 @@ static int iptables_add_chain(struct connman_iptables *table,
 				ALIGN(sizeof(struct ipt_standard_target));
 	standard->verdict = XT_RETURN;
 
-	if (iptables_add_entry(table, entry_return, last, -1) < 0)
+	chain->end = iptables_add_entry(table, entry_return, last, -1,
+						chain, NULL);
+	if (chain->end == NULL)
 		goto err;
 
+	g_hash_table_replace(table->chains, chain->name, chain);
+
 	return 0;
 
 err:
 	g_free(entry_return);
+	remove_table_entry(table, chain->head);
+	free_chain(chain);
+
+	return -ENOMEM;
+
 err_head:
 	g_free(entry_head);
+	free_chain(chain);
 
 	return -ENOMEM;
 }
@@ -654,35 +745,30 @@ err_head:
 static int iptables_delete_chain(struct connman_iptables *table,
 					const char *name)
 {
-	struct connman_iptables_entry *entry;
-	GList *chain_head, *chain_tail;
+	struct connman_iptables_chain *chain;
 
 	DBG("table %s chain %s", table->name, name);
 
-	chain_head = find_chain_head(table, name);
-	if (chain_head == NULL)
+	chain = g_hash_table_lookup(table->chains, name);
+	if (chain == NULL)
 		return -EINVAL;
 
-	entry = chain_head->data;
-
 	/* We cannot remove builtin chain */
-	if (entry->builtin >= 0)
-		return -EINVAL;
-
-	chain_tail = find_chain_tail(table, name);
-	if (chain_tail == NULL)
+	if (chain->builtin >= 0)
 		return -EINVAL;
 
 	/* Chain must be flushed */
-	if (chain_head->next != chain_tail->prev)
+	if (chain->head->next != chain->end)
 		return -EINVAL;
 
-	remove_table_entry(table, entry);
+	/* and must not be referenced anymore */
+	if (chain->references > 0)
+		return -EBUSY;
 
-	entry = chain_tail->prev->data;
-	remove_table_entry(table, entry);
+	remove_table_entry(table, chain->head);
+	remove_table_entry(table, chain->end);
 
-	update_offsets(table);
+	g_hash_table_remove(table->chains, name);
 
 	return 0;
 }
@@ -733,329 +819,230 @@ static struct ipt_entry *new_rule(struct ipt_ip *ip,
 	return new_entry;
 }
 
-static void update_hooks(struct connman_iptables *table, GList *chain_head,
-				struct ipt_entry *entry)
-{
-	GList *list;
-	struct connman_iptables_entry *head, *e;
-	int builtin;
-
-	if (chain_head == NULL)
-		return;
-
-	head = chain_head->data;
-
-	builtin = head->builtin;
-	if (builtin < 0)
-		return;
-
-	table->underflow[builtin] += entry->next_offset;
-
-	for (list = chain_head->next; list; list = list->next) {
-		e = list->data;
-
-		builtin = e->builtin;
-		if (builtin < 0)
-			continue;
-
-		table->hook_entry[builtin] += entry->next_offset;
-		table->underflow[builtin] += entry->next_offset;
-	}
-}
-
-static struct ipt_entry *prepare_rule_inclusion(struct connman_iptables *table,
-				struct ipt_ip *ip, const char *chain_name,
-				const char *target_name,
-				struct xtables_target *xt_t,
-				int *builtin, struct xtables_rule_match *xt_rm,
-				connman_bool_t insert)
+static void prepare_rule_inclusion(struct connman_iptables_chain *chain,
+				int *builtin, connman_bool_t insert)
 {
-	GList *chain_tail, *chain_head;
-	struct ipt_entry *new_entry;
 	struct connman_iptables_entry *head;
 
-	chain_head = find_chain_head(table, chain_name);
-	if (chain_head == NULL)
-		return NULL;
-
-	chain_tail = find_chain_tail(table, chain_name);
-	if (chain_tail == NULL)
-		return NULL;
-
-	new_entry = new_rule(ip, target_name, xt_t, xt_rm);
-	if (new_entry == NULL)
-		return NULL;
-
-	update_hooks(table, chain_head, new_entry);
-
 	/*
 	 * If the chain is builtin, and does not have any rule,
 	 * then the one that we're inserting is becoming the head
 	 * and thus needs the builtin flag.
 	 */
-	head = chain_head->data;
+	head = chain->head->data;
 	if (head->builtin < 0)
 		*builtin = -1;
-	else if (insert == TRUE || chain_head == chain_tail->prev) {
+	else if (insert == TRUE || chain->head == chain->end) {
 		*builtin = head->builtin;
 		head->builtin = -1;
 	}
-
-	return new_entry;
 }
 
+/* On success the table takes ownership of new_entry */
 static int iptables_append_rule(struct connman_iptables *table,
-				struct ipt_ip *ip, const char *chain_name,
-				const char *target_name,
-				struct xtables_target *xt_t,
-				struct xtables_rule_match *xt_rm)
+				const char *chain_name,
+				struct ipt_entry *new_entry,
+				struct connman_iptables_chain *jump)
 {
-	struct ipt_entry *new_entry;
-	int builtin = -1, ret;
-	GList *chain_tail;
+	struct connman_iptables_chain *chain;
+	int builtin = -1;
 
 	DBG("table %s chain %s", table->name, chain_name);
 
-	chain_tail = find_chain_tail(table, chain_name);
-	if (chain_tail == NULL)
+	chain = g_hash_table_lookup(table->chains, chain_name);
+	if (chain == NULL)
 		return -EINVAL;
 
-	new_entry = prepare_rule_inclusion(table, ip, chain_name,
-				target_name, xt_t, &builtin, xt_rm, FALSE);
-	if (new_entry == NULL)
-		return -EINVAL;
+	prepare_rule_inclusion(chain, &builtin, FALSE);
 
-	ret = iptables_add_entry(table, new_entry, chain_tail->prev, builtin);
-	if (ret < 0)
-		g_free(new_entry);
+	if (iptables_add_entry(table, new_entry, chain->end, builtin,
+						chain, jump) == NULL)
+		return -ENOMEM;
 
-	return ret;
+	return 0;
 }
 
 static int iptables_insert_rule(struct connman_iptables *table,
-				struct ipt_ip *ip, const char *chain_name,
-				const char *target_name,
-				struct xtables_target *xt_t,
-				struct xtables_rule_match *xt_rm)
+				const char *chain_name,
+				struct ipt_entry *new_entry,
+				struct connman_iptables_chain *jump)
 {
-	struct ipt_entry *new_entry;
-	int builtin = -1, ret;
-	GList *chain_head;
+	struct connman_iptables_chain *chain;
+	int builtin = -1;
+	GList *before;
 
 	DBG("table %s chain %s", table->name, chain_name);
 
-	chain_head = find_chain_head(table, chain_name);
-	if (chain_head == NULL)
+	chain = g_hash_table_lookup(table->chains, chain_name);
+	if (chain == NULL)
 		return -EINVAL;
 
-	new_entry = prepare_rule_inclusion(table, ip, chain_name,
-				target_name, xt_t, &builtin, xt_rm, TRUE);
-	if (new_entry == NULL)
-		return -EINVAL;
+	prepare_rule_inclusion(chain, &builtin, TRUE);
 
+	before = chain->head;
 	if (builtin == -1)
-		chain_head = chain_head->next;
-
-	ret = iptables_add_entry(table, new_entry, chain_head, builtin);
-	if (ret < 0)
-		g_free(new_entry);
-
-	return ret;
-}
-
-static gboolean is_same_ipt_entry(struct ipt_entry *i_e1,
-					struct ipt_entry *i_e2)
-{
-	if (memcmp(&i_e1->ip, &i_e2->ip, sizeof(struct ipt_ip)) != 0)
-		return FALSE;
-
-	if (i_e1->target_offset != i_e2->target_offset)
-		return FALSE;
+		before = before->next;
 
-	if (i_e1->next_offset != i_e2->next_offset)
-		return FALSE;
+	if (iptables_add_entry(table, new_entry, before, builtin,
+						chain, jump) == NULL)
+		return -ENOMEM;
 
-	return TRUE;
+	return 0;
 }
 
 static gboolean is_same_target(struct xt_entry_target *xt_e_t1,
 					struct xt_entry_target *xt_e_t2)
 {
-	unsigned int i;
-
 	if (xt_e_t1 == NULL || xt_e_t2 == NULL)
 		return FALSE;
 
-	if (g_strcmp0(xt_e_t1->u.user.name, "") == 0 &&
-			g_strcmp0(xt_e_t2->u.user.name, "") == 0) {
-		/* fallthrough */
-		return TRUE;
-	} else if (g_strcmp0(xt_e_t1->u.user.name, IPT_STANDARD_TARGET) == 0) {
+	if (g_strcmp0(xt_e_t1->u.user.name, xt_e_t2->u.user.name) != 0)
+		return FALSE;
+
+	if (is_standard_target(xt_e_t1) == TRUE) {
 		struct xt_standard_target *xt_s_t1;
 		struct xt_standard_target *xt_s_t2;
 
 		xt_s_t1 = (struct xt_standard_target *) xt_e_t1;
 		xt_s_t2 = (struct xt_standard_target *) xt_e_t2;
 
-		if (xt_s_t1->verdict != xt_s_t2->verdict)
-			return FALSE;
-	} else {
-		if (xt_e_t1->u.target_size != xt_e_t2->u.target_size)
-			return FALSE;
+		return xt_s_t1->verdict == xt_s_t2->verdict;
+	}
 
-		if (g_strcmp0(xt_e_t1->u.user.name, xt_e_t2->u.user.name) != 0)
-			return FALSE;
+	if (xt_e_t1->u.target_size != xt_e_t2->u.target_size)
+		return FALSE;
 
-		for (i = 0; i < xt_e_t1->u.target_size -
-				sizeof(struct xt_standard_target); i++) {
-			if ((xt_e_t1->data[i] ^ xt_e_t2->data[i]) != 0)
-				return FALSE;
-		}
-	}
+	if (xt_e_t1->u.target_size < sizeof(struct xt_entry_target))
+		return TRUE;
 
-	return TRUE;
+	return memcmp(xt_e_t1->data, xt_e_t2->data, xt_e_t1->u.target_size -
+				sizeof(struct xt_entry_target)) == 0;
 }
 
 static gboolean is_same_match(struct xt_entry_match *xt_e_m1,
 				struct xt_entry_match *xt_e_m2)
 {
-	unsigned int i;
-
 	if (xt_e_m1 == NULL || xt_e_m2 == NULL)
 		return FALSE;
 
 	if (xt_e_m1->u.match_size != xt_e_m2->u.match_size)
 		return FALSE;
 
+	if (xt_e_m1->u.match_size < sizeof(struct xt_entry_match))
+		return FALSE;
+
 	if (xt_e_m1->u.user.revision != xt_e_m2->u.user.revision)
 		return FALSE;
 
 	if (g_strcmp0(xt_e_m1->u.user.name, xt_e_m2->u.user.name) != 0)
 		return FALSE;
 
-	for (i = 0; i < xt_e_m1->u.match_size - sizeof(struct xt_entry_match);
-			i++) {
-		if ((xt_e_m1->data[i] ^ xt_e_m2->data[i]) != 0)
-			return FALSE;
-	}
-
-	return TRUE;
+	return memcmp(xt_e_m1->data, xt_e_m2->data, xt_e_m1->u.match_size -
+				sizeof(struct xt_entry_match)) == 0;
 }
 
-static GList *find_existing_rule(struct connman_iptables *table,
-				struct ipt_ip *ip, const char *chain_name,
-				const char *target_name,
-				struct xtables_target *xt_t,
-				GList *matches,
-				struct xtables_rule_match *xt_rm)
-{
-	GList *chain_tail, *chain_head, *list;
-	struct xt_entry_target *xt_e_t = NULL;
-	struct xt_entry_match *xt_e_m = NULL;
-	struct connman_iptables_entry *entry;
-	struct ipt_entry *entry_test;
-	int builtin;
+static gboolean is_same_rule(struct connman_iptables_entry *e1,
+				struct connman_iptables_entry *e2)
+{
+	struct ipt_entry *i_e1 = e1->entry, *i_e2 = e2->entry;
+	struct xt_entry_match *xt_e_m1, *xt_e_m2;
+	unsigned int offset;
 
-	chain_head = find_chain_head(table, chain_name);
-	if (chain_head == NULL)
-		return NULL;
+	if (memcmp(&i_e1->ip, &i_e2->ip, sizeof(struct ipt_ip)) != 0)
+		return FALSE;
 
-	chain_tail = find_chain_tail(table, chain_name);
-	if (chain_tail == NULL)
-		return NULL;
+	if (i_e1->target_offset != i_e2->target_offset)
+		return FALSE;
 
-	if (!xt_t && !matches)
-		return NULL;
+	if (i_e1->next_offset != i_e2->next_offset)
+		return FALSE;
 
-	entry_test = new_rule(ip, target_name, xt_t, xt_rm);
-	if (entry_test == NULL)
-		return NULL;
+	for (offset = sizeof(struct ipt_entry); offset < i_e1->target_offset;
+			offset += xt_e_m1->u.match_size) {
+		xt_e_m1 = (struct xt_entry_match *)((char *)i_e1 + offset);
+		xt_e_m2 = (struct xt_entry_match *)((char *)i_e2 + offset);
 
-	if (xt_t != NULL)
-		xt_e_t = ipt_get_target(entry_test);
-	if (matches != NULL)
-		xt_e_m = (struct xt_entry_match *)entry_test->elems;
+		if (is_same_match(xt_e_m1, xt_e_m2) == FALSE)
+			return FALSE;
+	}
 
-	entry = chain_head->data;
-	builtin = entry->builtin;
+	if (e1->jump != e2->jump || e1->fallthrough != e2->fallthrough)
+		return FALSE;
 
-	if (builtin >= 0)
-		list = chain_head;
-	else
-		list = chain_head->next;
+	/* The verdict of those is only known once the blob is built */
+	if (e1->jump != NULL || e1->fallthrough == TRUE)
+		return TRUE;
 
-	for (; list != chain_tail->prev; list = list->next) {
-		struct connman_iptables_entry *tmp;
-		struct ipt_entry *tmp_e;
+	return is_same_target(ipt_get_target(i_e1), ipt_get_target(i_e2));
+}
 
-		tmp = list->data;
-		tmp_e = tmp->entry;
+static GList *find_existing_rule(struct connman_iptables *table,
+				struct connman_iptables_chain *chain,
+				struct ipt_entry *rule,
+				struct connman_iptables_chain *jump)
+{
+	struct connman_iptables_entry test, *entry;
+	GSList *list;
+	GList *node = NULL;
 
-		if (is_same_ipt_entry(entry_test, tmp_e) == FALSE)
-			continue;
+	memset(&test, 0, sizeof(test));
 
-		if (xt_t != NULL) {
-			struct xt_entry_target *tmp_xt_e_t;
+	test.entry = rule;
+	test.jump = jump;
+	if (jump == NULL)
+		test.fallthrough = is_fallthrough(&test);
 
-			tmp_xt_e_t = ipt_get_target(tmp_e);
+	list = g_hash_table_lookup(table->rules,
+				GUINT_TO_POINTER(rule_fingerprint(&test)));
 
-			if (!is_same_target(tmp_xt_e_t, xt_e_t))
-				continue;
-		}
+	for (; list != NULL; list = list->next) {
+		node = list->data;
+		entry = node->data;
 
-		if (matches != NULL) {
-			struct xt_entry_match *tmp_xt_e_m;
+		if (entry->chain != chain)
+			continue;
 
-			tmp_xt_e_m = (struct xt_entry_match *)tmp_e->elems;
+		/* Skip the entries delimiting the chain */
+		if (node == chain->end)
+			continue;
 
-			if (!is_same_match(tmp_xt_e_m, xt_e_m))
-				continue;
-		}
+		if (chain->builtin < 0 && node == chain->head)
+			continue;
 
-		break;
+		if (is_same_rule(entry, &test) == TRUE)
+			break;
 	}
 
-	g_free(entry_test);
-
-	if (list != chain_tail->prev)
-		return list;
+	if (list == NULL)
+		return NULL;
 
-	return NULL;
+	return node;
 }
 
 static int iptables_delete_rule(struct connman_iptables *table,
-				struct ipt_ip *ip, const char *chain_name,
-				const char *target_name,
-				struct xtables_target *xt_t,
-				GList *matches,
-				struct xtables_rule_match *xt_rm)
+				const char *chain_name,
+				struct ipt_entry *rule,
+				struct connman_iptables_chain *jump)
 {
+	struct connman_iptables_chain *chain;
 	struct connman_iptables_entry *entry;
-	GList *chain_head, *chain_tail, *list;
-	int builtin, removed;
-
+	GList *list;
+	int builtin;
 
 	DBG("table %s chain %s", table->name, chain_name);
 
-	removed = 0;
-
-	chain_head = find_chain_head(table, chain_name);
-	if (chain_head == NULL)
-		return -EINVAL;
-
-	chain_tail = find_chain_tail(table, chain_name);
-	if (chain_tail == NULL)
+	chain = g_hash_table_lookup(table->chains, chain_name);
+	if (chain == NULL)
 		return -EINVAL;
 
-	list = find_existing_rule(table, ip, chain_name, target_name,
-							xt_t, matches, xt_rm);
+	list = find_existing_rule(table, chain, rule, jump);
 	if (list == NULL)
 		return -EINVAL;
 
-	entry = chain_head->data;
+	entry = chain->head->data;
 	builtin = entry->builtin;
 
-	if (builtin >= 0 && list == chain_head) {
+	if (builtin >= 0 && list == chain->head) {
 		/*
 		 * We are about to remove the first rule in the
 		 * chain. In this case we need to store the builtin
@@ -1065,28 +1052,10 @@ static int iptables_delete_rule(struct connman_iptables *table,
 		 * always valid. A builtin chain has always a policy
 		 * rule at the end.
 		 */
-		chain_head = chain_head->next;
-
-		entry = chain_head->data;
-		entry->builtin = builtin;
+		set_builtin(table, chain->head->next, builtin);
 	}
 
-	entry = list->data;
-	if (entry == NULL)
-		return -EINVAL;
-
-	/* We have deleted a rule,
-	 * all references should be bumped accordingly */
-	if (list->next != NULL)
-		update_targets_reference(table, list->next->data,
-						list->data, TRUE);
-
-	removed += remove_table_entry(table, entry);
-
-	if (builtin >= 0)
-		delete_update_hooks(table, builtin, chain_head, removed);
-
-	update_offsets(table);
+	remove_table_entry(table, list);
 
 	return 0;
 }
@@ -1094,7 +1063,7 @@ static int iptables_delete_rule(struct connman_iptables *table,
 static int iptables_change_policy(struct connman_iptables *table,
 				const char *chain_name, const char *policy)
 {
-	GList *chain_head, *chain_tail;
+	struct connman_iptables_chain *chain;
 	struct connman_iptables_entry *entry;
 	struct xt_entry_target *target;
 	struct xt_standard_target *t;
@@ -1111,24 +1080,25 @@ static int iptables_change_policy(struct connman_iptables *table,
 		return -EINVAL;
 	}
 
-	chain_head = find_chain_head(table, chain_name);
-	if (chain_head == NULL)
-		return -EINVAL;
-
-	entry = chain_head->data;
-	if (entry->builtin < 0)
+	chain = g_hash_table_lookup(table->chains, chain_name);
+	if (chain == NULL)
 		return -EINVAL;
 
-	chain_tail = find_chain_tail(table, chain_name);
-	if (chain_tail == NULL)
+	if (chain->builtin < 0)
 		return -EINVAL;
 
-	entry = chain_tail->prev->data;
+	entry = chain->end->data;
 	target = ipt_get_target(entry->entry);
 
+	unindex_entry(table, chain->end);
+
 	t = (struct xt_standard_target *)target;
 	t->verdict = verdict;
 
+	index_entry(table, chain->end);
+
+	table->modified = TRUE;
+
 	return 0;
 }
 
@@ -1136,8 +1106,11 @@ static struct ipt_replace *iptables_blob(struct connman_iptables *table)
 {
 	struct ipt_replace *r;
 	GList *list;
-	struct connman_iptables_entry *e;
+	struct connman_iptables_chain *chain;
+	struct connman_iptables_entry *e, *head;
+	struct xt_standard_target *t;
 	unsigned char *entry_index;
+	unsigned int h;
 
 	r = g_try_malloc0(sizeof(struct ipt_replace) + table->size);
 	if (r == NULL)
@@ -1159,14 +1132,46 @@ static struct ipt_replace *iptables_blob(struct connman_iptables *table)
 	r->num_counters = table->old_entries;
 	r->valid_hooks  = table->info->valid_hooks;
 
-	memcpy(r->hook_entry, table->hook_entry, sizeof(table->hook_entry));
-	memcpy(r->underflow, table->underflow, sizeof(table->underflow));
+	update_offsets(table);
+
+	memcpy(r->hook_entry, table->info->hook_entry,
+				sizeof(table->info->hook_entry));
+	memcpy(r->underflow, table->info->underflow,
+				sizeof(table->info->underflow));
+
+	for (h = 0; h < NF_INET_NUMHOOKS; h++) {
+		if ((r->valid_hooks & (1 << h)) == 0)
+			continue;
+
+		chain = g_hash_table_lookup(table->chains, hooknames[h]);
+		if (chain == NULL)
+			continue;
+
+		e = chain->head->data;
+		r->hook_entry[h] = e->offset;
+
+		e = chain->end->data;
+		r->underflow[h] = e->offset;
+	}
 
 	entry_index = (unsigned char *)r->entries;
 	for (list = table->entries; list; list = list->next) {
 		e = list->data;
 
 		memcpy(entry_index, e->entry, e->entry->next_offset);
+
+		if (e->jump != NULL || e->fallthrough == TRUE) {
+			t = (struct xt_standard_target *)ipt_get_target(
+					(struct ipt_entry *)entry_index);
+
+			if (e->jump != NULL) {
+				head = e->jump->head->data;
+				t->verdict = head->offset +
+						head->entry->next_offset;
+			} else
+				t->verdict = e->offset + e->entry->next_offset;
+		}
+
 		entry_index += e->entry->next_offset;
 	}
 
@@ -1344,11 +1349,11 @@ static void dump_table(struct connman_iptables *table)
 		table->info->underflow[NF_IP_LOCAL_OUT],
 		table->info->underflow[NF_IP_POST_ROUTING]);
 
-	iterate_entries(table->blob_entries->entrytable,
+	iterate_entries(table->arena_entries,
 			table->info->valid_hooks,
 			table->info->hook_entry,
 			table->info->underflow,
-			table->blob_entries->size,
+			table->arena_size,
 			print_entry, dump_entry);
 }
 
@@ -1376,14 +1381,15 @@ static void dump_ipt_replace(struct ipt_replace *repl)
 			repl->size, print_entry, dump_entry);
 }
 
-static int iptables_get_entries(struct connman_iptables *table)
+static int iptables_get_entries(struct connman_iptables *table,
+				struct ipt_get_entries *blob_entries)
 {
 	socklen_t entry_size;
 
 	entry_size = sizeof(struct ipt_get_entries) + table->info->size;
 
 	return getsockopt(table->ipt_sock, IPPROTO_IP, IPT_SO_GET_ENTRIES,
-				table->blob_entries, &entry_size);
+				blob_entries, &entry_size);
 }
 
 static int iptables_replace(struct connman_iptables *table,
@@ -1397,15 +1403,98 @@ static int add_entry(struct ipt_entry *entry, int builtin, unsigned int hook,
 			size_t size, unsigned offset, void *user_data)
 {
 	struct connman_iptables *table = user_data;
-	struct ipt_entry *new_entry;
+	struct connman_iptables_entry *e;
 
-	new_entry = g_try_malloc0(entry->next_offset);
-	if (new_entry == NULL)
-		return -ENOMEM;
+	if (table->num_entries == table->num_records)
+		return -EINVAL;
 
-	memcpy(new_entry, entry, entry->next_offset);
+	/* Entries read from the kernel stay in the arena */
+	e = &table->records[table->num_entries];
+	e->entry = entry;
+	e->builtin = builtin;
+
+	table->entries = g_list_prepend(table->entries, e);
+	table->num_entries++;
+	table->size += entry->next_offset;
+
+	return 0;
+}
+
+/*
+ * Build the chain and rule index for the entries read from the
+ * kernel and turn the jump verdicts into chain references.
+ */
+static void build_index(struct connman_iptables *table)
+{
+	struct connman_iptables_chain *chain = NULL;
+	struct connman_iptables_entry *e;
+	struct xt_entry_target *target;
+	struct xt_standard_target *t;
+	GHashTable *starts;
+	GList *list;
+
+	update_offsets(table);
+
+	/* Offset of the first rule of a user chain -> chain */
+	starts = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	/* The last entry is the error target terminating the table */
+	for (list = table->entries; list != NULL && list->next != NULL;
+			list = list->next) {
+		e = list->data;
+
+		if (is_chain(table, e) == TRUE) {
+			if (chain != NULL)
+				chain->end = list->prev;
+
+			chain = g_new0(struct connman_iptables_chain, 1);
+			chain->builtin = e->builtin;
+			chain->head = list;
+
+			if (e->builtin >= 0) {
+				chain->name = g_strdup(hooknames[e->builtin]);
+			} else {
+				target = ipt_get_target(e->entry);
+				chain->name = g_strdup((char *)target->data);
+
+				g_hash_table_insert(starts,
+					GINT_TO_POINTER(e->offset +
+						e->entry->next_offset),
+					chain);
+			}
+
+			g_hash_table_replace(table->chains, chain->name, chain);
+		}
+
+		e->chain = chain;
+	}
+
+	if (chain != NULL && list != NULL)
+		chain->end = list->prev;
+
+	for (list = table->entries; list != NULL; list = list->next) {
+		e = list->data;
+		target = ipt_get_target(e->entry);
+		t = (struct xt_standard_target *)target;
+
+		if (is_standard_target(target) == TRUE && t->verdict >= 0) {
+			if (t->verdict == e->offset + e->entry->next_offset) {
+				e->fallthrough = TRUE;
+			} else {
+				e->jump = g_hash_table_lookup(starts,
+						GINT_TO_POINTER(t->verdict));
+				if (e->jump != NULL)
+					e->jump->references++;
+				else
+					connman_warn("%s: unknown jump to %d",
+						table->info->name, t->verdict);
+			}
+		}
 
-	return iptables_add_entry(table, new_entry, NULL, builtin);
+		index_entry(table, list);
+	}
+
+	g_hash_table_destroy(starts);
 }
 
 static void table_cleanup(struct connman_iptables *table)
@@ -1422,20 +1511,27 @@ static void table_cleanup(struct connman_iptables *table)
 	for (list = table->entries; list; list = list->next) {
 		entry = list->data;
 
-		g_free(entry->entry);
-		g_free(entry);
+		free_entry(table, entry);
 	}
 
 	g_list_free(table->entries);
+
+	if (table->chains != NULL)
+		g_hash_table_destroy(table->chains);
+	if (table->rules != NULL)
+		g_hash_table_destroy(table->rules);
+
 	g_free(table->name);
 	g_free(table->info);
-	g_free(table->blob_entries);
+	g_free(table->records);
+	g_free(table->arena);
 	g_free(table);
 }
 
 static struct connman_iptables *iptables_init(const char *table_name)
 {
 	struct connman_iptables *table = NULL;
+	struct ipt_get_entries *blob_entries;
 	char *module = NULL;
 	socklen_t s;
 
@@ -1474,30 +1570,46 @@ static struct connman_iptables *iptables_init(const char *table_name)
 		goto err;
 	}
 
-	table->blob_entries = g_try_malloc0(sizeof(struct ipt_get_entries) +
+	blob_entries = g_try_malloc0(sizeof(struct ipt_get_entries) +
 						table->info->size);
-	if (table->blob_entries == NULL)
+	if (blob_entries == NULL)
 		goto err;
 
-	g_stpcpy(table->blob_entries->name, table_name);
-	table->blob_entries->size = table->info->size;
+	table->arena = blob_entries;
+	table->arena_entries = blob_entries->entrytable;
+	table->arena_size = table->info->size;
+
+	g_stpcpy(blob_entries->name, table_name);
+	blob_entries->size = table->info->size;
+
+	if (iptables_get_entries(table, blob_entries) < 0)
+		goto err;
 
-	if (iptables_get_entries(table) < 0)
+	table->records = g_try_new0(struct connman_iptables_entry,
+						table->info->num_entries);
+	if (table->records == NULL)
 		goto err;
 
+	table->num_records = table->info->num_entries;
+
 	table->num_entries = 0;
 	table->old_entries = table->info->num_entries;
 	table->size = 0;
 
-	memcpy(table->underflow, table->info->underflow,
-				sizeof(table->info->underflow));
-	memcpy(table->hook_entry, table->info->hook_entry,
-				sizeof(table->info->hook_entry));
+	table->chains = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, free_chain);
+	table->rules = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					NULL, (GDestroyNotify) g_slist_free);
 
-	iterate_entries(table->blob_entries->entrytable,
+	if (iterate_entries(blob_entries->entrytable,
 			table->info->valid_hooks, table->info->hook_entry,
-			table->info->underflow, table->blob_entries->size,
-			add_entry, table);
+			table->info->underflow, blob_entries->size,
+			add_entry, table) < 0)
+		goto err;
+
+	table->entries = g_list_reverse(table->entries);
+
+	build_index(table);
 
 	if (debug_enabled == TRUE)
 		dump_table(table);
@@ -1581,15 +1693,11 @@ static struct xtables_target *prepare_target(struct connman_iptables *table,
 		if (is_builtin == TRUE)
 			target->verdict = target_to_verdict(target_name);
 		else if (is_user_defined == TRUE) {
-			struct connman_iptables_entry *target_rule;
-
-			if (chain_head == NULL) {
-				g_free(xt_t->t);
-				return NULL;
-			}
-
-			target_rule = chain_head->next->data;
-			target->verdict = target_rule->offset;
+			/*
+			 * The rule references the chain, the jump offset
+			 * is filled in by iptables_blob().
+			 */
+			target->verdict = 0;
 		}
 	} else {
 		g_stpcpy(xt_t->t->u.user.name, target_name);
@@ -1709,6 +1817,30 @@ out:
 	return err;
 }
 
+/*
+ * The entry count and size of the table change with every replace,
+ * they are good enough to tell whether someone else touched the table
+ * since connman read or wrote it.
+ */
+static gboolean is_table_current(struct connman_iptables *table)
+{
+	struct ipt_getinfo info;
+	socklen_t s;
+
+	memset(&info, 0, sizeof(info));
+	g_stpcpy(info.name, table->info->name);
+
+	s = sizeof(info);
+	if (getsockopt(table->ipt_sock, IPPROTO_IP, IPT_SO_GET_INFO,
+						&info, &s) < 0)
+		return FALSE;
+
+	return info.num_entries == table->info->num_entries &&
+		info.size == table->info->size &&
+		memcmp(info.hook_entry, table->info->hook_entry,
+				sizeof(info.hook_entry)) == 0;
+}
+
 static struct connman_iptables *get_table(const char *table_name)
 {
 	struct connman_iptables *table;
@@ -1717,8 +1849,16 @@ static struct connman_iptables *get_table(const char *table_name)
 		table_name = "filter";
 
 	table = g_hash_table_lookup(table_hash, table_name);
-	if (table != NULL)
-		return table;
+	if (table != NULL) {
+		/* Pending changes are checked by the kernel on commit */
+		if (table->modified == TRUE || is_table_current(table) == TRUE)
+			return table;
+
+		DBG("%s changed outside of connman, reading it again",
+			table_name);
+
+		g_hash_table_remove(table_hash, table_name);
+	}
 
 	table = iptables_init(table_name);
 	if (table == NULL)
@@ -1735,6 +1875,7 @@ struct parse_context {
 	char **argv;
 	struct ipt_ip *ip;
 	struct xtables_target *xt_t;
+	struct connman_iptables_chain *jump;
 	GList *xt_m;
 	struct xtables_rule_match *xt_rm;
 };
@@ -1988,6 +2129,8 @@ static int parse_rule_spec(struct connman_iptables *table,
 				goto out;
 			}
 
+			ctx->jump = find_jump(table, optarg);
+
 			break;
 		case 1:
 			if (optarg[0] == '!' && optarg[1] == '\0') {
@@ -2160,55 +2303,41 @@ int __connman_iptables_change_policy(const char *table_name,
 	return iptables_change_policy(table, chain, policy);
 }
 
-int __connman_iptables_append(const char *table_name,
-				const char *chain,
-				const char *rule_spec)
-{
-	struct connman_iptables *table;
-	struct parse_context *ctx;
-	const char *target_name;
-	int err;
-
-	ctx = g_try_new0(struct parse_context, 1);
-	if (ctx == NULL)
-		return -ENOMEM;
-
-	DBG("-t %s -A %s %s", table_name, chain, rule_spec);
-
-	err = prepare_getopt_args(rule_spec, ctx);
-	if (err < 0)
-		goto out;
+/*
+ * Parsing a rule spec means running getopt and libxtables over it.
+ * ConnMan installs and removes the same rules over and over, so the
+ * resulting entries are cached per table and rule spec.
+ */
+#define RULE_CACHE_SIZE 256
 
-	table = get_table(table_name);
-	if (table == NULL) {
-		err = -EINVAL;
-		goto out;
-	}
+struct compiled_rule {
+	struct ipt_entry *entry;
+	/* user chain the rule jumps to, resolved on each use */
+	char *jump;
+	/* neither match nor target given */
+	gboolean empty;
+};
 
-	err = parse_rule_spec(table, ctx);
-	if (err < 0)
-		goto out;
+static GHashTable *rule_cache = NULL;
 
-	if (ctx->xt_t == NULL)
-		target_name = NULL;
-	else
-		target_name = ctx->xt_t->name;
+static void free_compiled_rule(gpointer user_data)
+{
+	struct compiled_rule *rule = user_data;
 
-	err = iptables_append_rule(table, ctx->ip, chain,
-				target_name, ctx->xt_t, ctx->xt_rm);
-out:
-	cleanup_parse_context(ctx);
-	reset_xtables();
+	if (rule == NULL)
+		return;
 
-	return err;
+	g_free(rule->entry);
+	g_free(rule->jump);
+	g_free(rule);
 }
 
-int __connman_iptables_insert(const char *table_name,
-				const char *chain,
-				const char *rule_spec)
+static int compile_rule(struct connman_iptables *table,
+				const char *rule_spec,
+				struct compiled_rule **compiled)
 {
-	struct connman_iptables *table;
 	struct parse_context *ctx;
+	struct compiled_rule *rule;
 	const char *target_name;
 	int err;
 
@@ -2216,18 +2345,10 @@ int __connman_iptables_insert(const char *table_name,
 	if (ctx == NULL)
 		return -ENOMEM;
 
-	DBG("-t %s -I %s %s", table_name, chain, rule_spec);
-
 	err = prepare_getopt_args(rule_spec, ctx);
 	if (err < 0)
 		goto out;
 
-	table = get_table(table_name);
-	if (table == NULL) {
-		err = -EINVAL;
-		goto out;
-	}
-
 	err = parse_rule_spec(table, ctx);
 	if (err < 0)
 		goto out;
@@ -2237,52 +2358,26 @@ int __connman_iptables_insert(const char *table_name,
 	else
 		target_name = ctx->xt_t->name;
 
-	err = iptables_insert_rule(table, ctx->ip, chain,
-				target_name, ctx->xt_t, ctx->xt_rm);
-out:
-	cleanup_parse_context(ctx);
-	reset_xtables();
-
-	return err;
-}
-
-int __connman_iptables_delete(const char *table_name,
-				const char *chain,
-				const char *rule_spec)
-{
-	struct connman_iptables *table;
-	struct parse_context *ctx;
-	const char *target_name;
-	int err;
-
-	ctx = g_try_new0(struct parse_context, 1);
-	if (ctx == NULL)
-		return -ENOMEM;
-
-	DBG("-t %s -D %s %s", table_name, chain, rule_spec);
-
-	err = prepare_getopt_args(rule_spec, ctx);
-	if (err < 0)
+	rule = g_try_new0(struct compiled_rule, 1);
+	if (rule == NULL) {
+		err = -ENOMEM;
 		goto out;
+	}
 
-	table = get_table(table_name);
-	if (table == NULL) {
-		err = -EINVAL;
+	rule->entry = new_rule(ctx->ip, target_name, ctx->xt_t, ctx->xt_rm);
+	if (rule->entry == NULL) {
+		g_free(rule);
+		err = -ENOMEM;
 		goto out;
 	}
 
-	err = parse_rule_spec(table, ctx);
-	if (err < 0)
-		goto out;
+	if (ctx->jump != NULL)
+		rule->jump = g_strdup(ctx->jump->name);
 
-	if (ctx->xt_t == NULL)
-		target_name = NULL;
-	else
-		target_name = ctx->xt_t->name;
+	rule->empty = ctx->xt_t == NULL && ctx->xt_m == NULL;
+
+	*compiled = rule;
 
-	err = iptables_delete_rule(table, ctx->ip, chain,
-				target_name, ctx->xt_t, ctx->xt_m,
-				ctx->xt_rm);
 out:
 	cleanup_parse_context(ctx);
 	reset_xtables();
@@ -2290,83 +2385,778 @@ out:
 	return err;
 }
 
-int __connman_iptables_commit(const char *table_name)
+static int lookup_rule(struct connman_iptables *table,
+				const char *rule_spec,
+				struct compiled_rule **rule)
 {
-	struct connman_iptables *table;
-	struct ipt_replace *repl;
+	char *key;
 	int err;
 
-	DBG("%s", table_name);
-
-	table = g_hash_table_lookup(table_hash, table_name);
-	if (table == NULL)
-		return -EINVAL;
-
-	repl = iptables_blob(table);
-
-	if (debug_enabled == TRUE)
-		dump_ipt_replace(repl);
+	key = g_strdup_printf("%s %s", table->name, rule_spec);
 
-	err = iptables_replace(table, repl);
+	*rule = g_hash_table_lookup(rule_cache, key);
+	if (*rule != NULL) {
+		g_free(key);
+		return 0;
+	}
 
-	g_free(repl->counters);
-	g_free(repl);
+	err = compile_rule(table, rule_spec, rule);
+	if (err < 0) {
+		g_free(key);
+		return err;
+	}
 
-	if (err < 0)
-	    return err;
+	if (g_hash_table_size(rule_cache) >= RULE_CACHE_SIZE)
+		g_hash_table_remove_all(rule_cache);
 
-	g_hash_table_remove(table_hash, table_name);
+	g_hash_table_replace(rule_cache, key, *rule);
 
 	return 0;
 }
 
-static void remove_table(gpointer user_data)
+static int resolve_jump(struct connman_iptables *table,
+				struct compiled_rule *rule,
+				struct connman_iptables_chain **jump)
 {
-	struct connman_iptables *table = user_data;
+	*jump = NULL;
 
-	table_cleanup(table);
+	if (rule->jump == NULL)
+		return 0;
+
+	/* The chain might have been deleted since the rule was parsed */
+	*jump = find_jump(table, rule->jump);
+	if (*jump == NULL)
+		return -EINVAL;
+
+	return 0;
 }
 
-static int iterate_chains_cb(struct ipt_entry *entry, int builtin,
-				unsigned int hook, size_t size,
-				unsigned int offset, void *user_data)
+static int add_compiled_rule(struct connman_iptables *table,
+				const char *chain,
+				struct compiled_rule *rule,
+				struct ipt_entry *entry,
+				connman_bool_t insert)
 {
-	struct cb_data *cbd = user_data;
-	connman_iptables_iterate_chains_cb_t cb = cbd->cb;
-	struct xt_entry_target *target;
+	struct connman_iptables_chain *jump;
+	struct ipt_entry *new_entry;
+	int err;
 
-	if (offset + entry->next_offset == size)
-		return 0;
+	err = resolve_jump(table, rule, &jump);
+	if (err < 0)
+		return err;
 
-	target = ipt_get_target(entry);
+	new_entry = g_try_malloc(entry->next_offset);
+	if (new_entry == NULL)
+		return -ENOMEM;
 
-	if (!g_strcmp0(target->u.user.name, IPT_ERROR_TARGET))
-		(*cb)((const char*)target->data, cbd->user_data);
-	else if (builtin >= 0)
-		(*cb)(hooknames[builtin], cbd->user_data);
+	memcpy(new_entry, entry, entry->next_offset);
+
+	if (insert == TRUE)
+		err = iptables_insert_rule(table, chain, new_entry, jump);
+	else
+		err = iptables_append_rule(table, chain, new_entry, jump);
+
+	if (err < 0)
+		g_free(new_entry);
+
+	return err;
+}
+
+static int delete_compiled_rule(struct connman_iptables *table,
+				const char *chain,
+				struct compiled_rule *rule,
+				struct ipt_entry *entry)
+{
+	struct connman_iptables_chain *jump;
+	int err;
+
+	if (rule->empty == TRUE)
+		return -EINVAL;
+
+	err = resolve_jump(table, rule, &jump);
+	if (err < 0)
+		return err;
+
+	return iptables_delete_rule(table, chain, entry, jump);
+}
+
+static int add_rule(const char *table_name, const char *chain,
+				const char *rule_spec, connman_bool_t insert)
+{
+	struct connman_iptables *table;
+	struct compiled_rule *rule;
+	int err;
+
+	table = get_table(table_name);
+	if (table == NULL)
+		return -EINVAL;
+
+	err = lookup_rule(table, rule_spec, &rule);
+	if (err < 0)
+		return err;
+
+	return add_compiled_rule(table, chain, rule, rule->entry, insert);
+}
+
+int __connman_iptables_append(const char *table_name,
+				const char *chain,
+				const char *rule_spec)
+{
+	DBG("-t %s -A %s %s", table_name, chain, rule_spec);
+
+	return add_rule(table_name, chain, rule_spec, FALSE);
+}
+
+int __connman_iptables_insert(const char *table_name,
+				const char *chain,
+				const char *rule_spec)
+{
+	DBG("-t %s -I %s %s", table_name, chain, rule_spec);
+
+	return add_rule(table_name, chain, rule_spec, TRUE);
+}
+
+int __connman_iptables_delete(const char *table_name,
+				const char *chain,
+				const char *rule_spec)
+{
+	struct connman_iptables *table;
+	struct compiled_rule *rule;
+	int err;
+
+	DBG("-t %s -D %s %s", table_name, chain, rule_spec);
+
+	table = get_table(table_name);
+	if (table == NULL)
+		return -EINVAL;
+
+	err = lookup_rule(table, rule_spec, &rule);
+	if (err < 0)
+		return err;
+
+	return delete_compiled_rule(table, chain, rule, rule->entry);
+}
+
+/*
+ * Rule templates are rule specs with "%s" placeholders. Each
+ * placeholder is found in the compiled entry once by comparing the
+ * entries parsed with two different sample values. A placeholder is
+ * either stored as a 32 bit integer (e.g. --set-mark), as a pair of
+ * equal 32 bit integers (the min and max of --uid-owner) or as
+ * decimal text inside a string field (e.g. --nfacct-name session-%s).
+ * Instances with decimal parameters are then built by patching a
+ * copy of the sample entry. Everything else falls back to parsing
+ * the expanded rule spec.
+ */
+#define TEMPLATE_SAMPLE_A	"1111111111"
+#define TEMPLATE_SAMPLE_B	"2000000000"
+#define TEMPLATE_SAMPLE_C	"42"
+#define TEMPLATE_SAMPLE_LEN	10
+
+enum template_param_type {
+	TEMPLATE_PARAM_U32,
+	TEMPLATE_PARAM_U32_RANGE,
+	TEMPLATE_PARAM_TEXT,
+};
+
+struct template_param {
+	enum template_param_type type;
+	unsigned int offset;
+	/* text following the parameter inside the string field */
+	unsigned int suffix;
+};
+
+struct rule_template {
+	/* compiled with all parameters set to TEMPLATE_SAMPLE_A */
+	struct compiled_rule *rule;
+	unsigned int num_params;
+	struct template_param *params;
+};
+
+static GHashTable *template_cache = NULL;
+
+static void free_rule_template(gpointer user_data)
+{
+	struct rule_template *tmpl = user_data;
+
+	free_compiled_rule(tmpl->rule);
+	g_free(tmpl->params);
+	g_free(tmpl);
+}
+
+static unsigned int count_placeholders(const char *rule_template)
+{
+	const char *str;
+	unsigned int count = 0;
+
+	for (str = strstr(rule_template, "%s"); str != NULL;
+			str = strstr(str + 2, "%s"))
+		count++;
+
+	return count;
+}
+
+static char *expand_template(const char *rule_template, char **params)
+{
+	GString *str;
+	const char *start, *pos;
+	unsigned int i = 0;
+
+	str = g_string_new(NULL);
+
+	for (start = rule_template; (pos = strstr(start, "%s")) != NULL;
+			start = pos + 2) {
+		g_string_append_len(str, start, pos - start);
+		g_string_append(str, params[i++]);
+	}
+
+	g_string_append(str, start);
+
+	return g_string_free(str, FALSE);
+}
+
+static connman_bool_t is_decimal(const char *value)
+{
+	size_t len;
+
+	len = strlen(value);
+	if (len == 0 || len > TEMPLATE_SAMPLE_LEN)
+		return FALSE;
+
+	if (strspn(value, "0123456789") != len)
+		return FALSE;
+
+	return g_ascii_strtoull(value, NULL, 10) <= G_MAXUINT32;
+}
+
+static void patch_param(struct ipt_entry *entry,
+				struct template_param *param,
+				const char *value)
+{
+	unsigned char *field = (unsigned char *)entry + param->offset;
+	uint32_t number;
+	size_t len;
+
+	if (param->type == TEMPLATE_PARAM_U32) {
+		number = g_ascii_strtoull(value, NULL, 10);
+		memcpy(field, &number, sizeof(number));
+		return;
+	}
+
+	if (param->type == TEMPLATE_PARAM_U32_RANGE) {
+		number = g_ascii_strtoull(value, NULL, 10);
+		memcpy(field, &number, sizeof(number));
+		memcpy(field + sizeof(number), &number, sizeof(number));
+		return;
+	}
+
+	/* The sample is the longest possible value, so it always fits */
+	len = strlen(value);
+	memmove(field + len, field + TEMPLATE_SAMPLE_LEN, param->suffix);
+	memcpy(field, value, len);
+	memset(field + len + param->suffix, 0,
+					TEMPLATE_SAMPLE_LEN - len);
+}
+
+static connman_bool_t is_sample_u32(unsigned char *a, unsigned char *b)
+{
+	uint32_t va, vb;
+
+	memcpy(&va, a, sizeof(va));
+	memcpy(&vb, b, sizeof(vb));
+
+	return va == g_ascii_strtoull(TEMPLATE_SAMPLE_A, NULL, 10) &&
+		vb == g_ascii_strtoull(TEMPLATE_SAMPLE_B, NULL, 10);
+}
+
+static connman_bool_t find_param(struct ipt_entry *ref,
+				struct ipt_entry *other,
+				struct template_param *param)
+{
+	unsigned char *a = (unsigned char *)ref;
+	unsigned char *b = (unsigned char *)other;
+	unsigned char *pa, *pb;
+	unsigned int lo, hi, i;
+
+	if (ref->next_offset != other->next_offset)
+		return FALSE;
+
+	for (lo = 0; lo < ref->next_offset && a[lo] == b[lo]; lo++);
+	if (lo == ref->next_offset)
+		return FALSE;
+
+	for (hi = ref->next_offset - 1; a[hi] == b[hi]; hi--);
+
+	param->offset = lo & ~(sizeof(uint32_t) - 1);
+	pa = a + param->offset;
+	pb = b + param->offset;
+
+	if (hi < param->offset + sizeof(uint32_t)) {
+		if (is_sample_u32(pa, pb) == TRUE) {
+			param->type = TEMPLATE_PARAM_U32;
+			return TRUE;
+		}
+	} else if (hi < param->offset + 2 * sizeof(uint32_t)) {
+		/* A single id is stored as min and max, e.g. --uid-owner */
+		if (is_sample_u32(pa, pb) == TRUE &&
+				is_sample_u32(pa + sizeof(uint32_t),
+					pb + sizeof(uint32_t)) == TRUE) {
+			param->type = TEMPLATE_PARAM_U32_RANGE;
+			return TRUE;
+		}
+	}
+
+	if (hi - lo + 1 != TEMPLATE_SAMPLE_LEN ||
+			memcmp(a + lo, TEMPLATE_SAMPLE_A,
+					TEMPLATE_SAMPLE_LEN) != 0 ||
+			memcmp(b + lo, TEMPLATE_SAMPLE_B,
+					TEMPLATE_SAMPLE_LEN) != 0)
+		return FALSE;
+
+	param->type = TEMPLATE_PARAM_TEXT;
+	param->offset = lo;
+	param->suffix = 0;
+
+	for (i = hi + 1; i < ref->next_offset && a[i] != '\0'; i++)
+		param->suffix++;
+
+	/* The string must be terminated inside the entry */
+	return i < ref->next_offset;
+}
+
+static struct compiled_rule *compile_template(struct connman_iptables *table,
+				const char *rule_template,
+				unsigned int num_params,
+				const char *value, int index,
+				const char *index_value)
+{
+	struct compiled_rule *rule = NULL;
+	char **params, *rule_spec;
+	unsigned int i;
+
+	params = g_new0(char *, num_params + 1);
+	for (i = 0; i < num_params; i++) {
+		if ((int) i == index)
+			params[i] = (char *) index_value;
+		else
+			params[i] = (char *) value;
+	}
+
+	rule_spec = expand_template(rule_template, params);
+	if (compile_rule(table, rule_spec, &rule) < 0)
+		rule = NULL;
+
+	g_free(rule_spec);
+	g_free(params);
+
+	return rule;
+}
+
+static void learn_template(struct connman_iptables *table,
+				const char *rule_template,
+				struct rule_template *tmpl)
+{
+	struct compiled_rule *ref, *other;
+	struct ipt_entry *entry;
+	unsigned int i;
+	gboolean valid = TRUE;
+
+	ref = compile_template(table, rule_template, tmpl->num_params,
+					TEMPLATE_SAMPLE_A, -1, NULL);
+	if (ref == NULL)
+		return;
+
+	tmpl->params = g_new0(struct template_param, tmpl->num_params);
+
+	for (i = 0; i < tmpl->num_params && valid == TRUE; i++) {
+		other = compile_template(table, rule_template,
+					tmpl->num_params, TEMPLATE_SAMPLE_A,
+					i, TEMPLATE_SAMPLE_B);
+		if (other == NULL)
+			valid = FALSE;
+		else if (g_strcmp0(ref->jump, other->jump) != 0)
+			valid = FALSE;
+		else
+			valid = find_param(ref->entry, other->entry,
+							&tmpl->params[i]);
+
+		free_compiled_rule(other);
+	}
+
+	if (valid == TRUE) {
+		/* Patching must give exactly what the parser builds */
+		other = compile_template(table, rule_template,
+					tmpl->num_params, TEMPLATE_SAMPLE_C,
+					-1, NULL);
+
+		entry = g_malloc(ref->entry->next_offset);
+		memcpy(entry, ref->entry, ref->entry->next_offset);
+
+		for (i = 0; i < tmpl->num_params; i++)
+			patch_param(entry, &tmpl->params[i],
+						TEMPLATE_SAMPLE_C);
+
+		if (other == NULL || other->entry->next_offset !=
+					ref->entry->next_offset ||
+				memcmp(entry, other->entry,
+					ref->entry->next_offset) != 0)
+			valid = FALSE;
+
+		g_free(entry);
+		free_compiled_rule(other);
+	}
+
+	DBG("template \"%s\" %s", rule_template,
+				valid == TRUE ? "compiled" : "not patchable");
+
+	if (valid == FALSE) {
+		free_compiled_rule(ref);
+		return;
+	}
+
+	tmpl->rule = ref;
+}
+
+static struct rule_template *lookup_template(struct connman_iptables *table,
+						const char *rule_template)
+{
+	struct rule_template *tmpl;
+	char *key;
+
+	key = g_strdup_printf("%s %s", table->name, rule_template);
+
+	tmpl = g_hash_table_lookup(template_cache, key);
+	if (tmpl != NULL) {
+		g_free(key);
+		return tmpl;
+	}
+
+	tmpl = g_new0(struct rule_template, 1);
+	tmpl->num_params = count_placeholders(rule_template);
+
+	learn_template(table, rule_template, tmpl);
+
+	g_hash_table_replace(template_cache, key, tmpl);
+
+	return tmpl;
+}
+
+/*
+ * Returns a patched copy of the template entry, or NULL if the
+ * rule has to be parsed from its expanded spec instead.
+ */
+static struct ipt_entry *instantiate_template(struct rule_template *tmpl,
+							char **params)
+{
+	struct ipt_entry *entry;
+	unsigned int i;
+
+	if (tmpl->rule == NULL)
+		return NULL;
+
+	for (i = 0; i < tmpl->num_params; i++) {
+		if (is_decimal(params[i]) == FALSE)
+			return NULL;
+	}
+
+	entry = g_try_malloc(tmpl->rule->entry->next_offset);
+	if (entry == NULL)
+		return NULL;
+
+	memcpy(entry, tmpl->rule->entry, tmpl->rule->entry->next_offset);
+
+	for (i = 0; i < tmpl->num_params; i++)
+		patch_param(entry, &tmpl->params[i], params[i]);
+
+	return entry;
+}
+
+enum template_op {
+	TEMPLATE_APPEND,
+	TEMPLATE_INSERT,
+	TEMPLATE_DELETE,
+};
+
+static int template_rule(const char *table_name, const char *chain,
+				const char *rule_template, char **params,
+				enum template_op op)
+{
+	struct connman_iptables *table;
+	struct rule_template *tmpl;
+	struct ipt_entry *entry;
+	char *rule_spec;
+	int err;
+
+	table = get_table(table_name);
+	if (table == NULL)
+		return -EINVAL;
+
+	tmpl = lookup_template(table, rule_template);
+	if (g_strv_length(params) != tmpl->num_params)
+		return -EINVAL;
+
+	entry = instantiate_template(tmpl, params);
+	if (entry == NULL) {
+		rule_spec = expand_template(rule_template, params);
+
+		switch (op) {
+		case TEMPLATE_APPEND:
+			err = __connman_iptables_append(table_name, chain,
+								rule_spec);
+			break;
+		case TEMPLATE_INSERT:
+			err = __connman_iptables_insert(table_name, chain,
+								rule_spec);
+			break;
+		case TEMPLATE_DELETE:
+		default:
+			err = __connman_iptables_delete(table_name, chain,
+								rule_spec);
+			break;
+		}
+
+		g_free(rule_spec);
+
+		return err;
+	}
+
+	if (op == TEMPLATE_DELETE)
+		err = delete_compiled_rule(table, chain, tmpl->rule, entry);
+	else
+		err = add_compiled_rule(table, chain, tmpl->rule, entry,
+						op == TEMPLATE_INSERT);
+
+	g_free(entry);
+
+	return err;
+}
+
+int __connman_iptables_check_template(const char *table_name,
+					const char *rule_template)
+{
+	struct connman_iptables *table;
+	struct rule_template *tmpl;
+
+	table = get_table(table_name);
+	if (table == NULL)
+		return -EINVAL;
+
+	tmpl = lookup_template(table, rule_template);
+	if (tmpl->rule == NULL)
+		return -ENOTSUP;
 
 	return 0;
 }
 
+int __connman_iptables_append_template(const char *table_name,
+					const char *chain,
+					const char *rule_template,
+					char **params)
+{
+	DBG("-t %s -A %s %s", table_name, chain, rule_template);
+
+	return template_rule(table_name, chain, rule_template, params,
+							TEMPLATE_APPEND);
+}
+
+int __connman_iptables_insert_template(const char *table_name,
+					const char *chain,
+					const char *rule_template,
+					char **params)
+{
+	DBG("-t %s -I %s %s", table_name, chain, rule_template);
+
+	return template_rule(table_name, chain, rule_template, params,
+							TEMPLATE_INSERT);
+}
+
+int __connman_iptables_delete_template(const char *table_name,
+					const char *chain,
+					const char *rule_template,
+					char **params)
+{
+	DBG("-t %s -D %s %s", table_name, chain, rule_template);
+
+	return template_rule(table_name, chain, rule_template, params,
+							TEMPLATE_DELETE);
+}
+
+/*
+ * After a successful replace the blob is what the kernel has, so it
+ * becomes the arena of the table. The records are packed again and
+ * the entries allocated since the last replace are released.
+ */
+static void adopt_blob(struct connman_iptables *table,
+				struct ipt_replace *repl)
+{
+	struct connman_iptables_entry *records, *e;
+	GList *list;
+	unsigned int i = 0;
+
+	records = g_new0(struct connman_iptables_entry, repl->num_entries);
+
+	for (list = table->entries; list != NULL; list = list->next, i++) {
+		e = list->data;
+
+		records[i] = *e;
+		records[i].entry = (struct ipt_entry *)
+				((char *)repl->entries + e->offset);
+
+		free_entry(table, e);
+		list->data = &records[i];
+	}
+
+	g_free(table->records);
+	g_free(table->arena);
+
+	table->records = records;
+	table->num_records = repl->num_entries;
+
+	repl->counters = NULL;
+	table->arena = repl;
+	table->arena_entries = repl->entries;
+	table->arena_size = repl->size;
+
+	table->old_entries = repl->num_entries;
+	table->info->num_entries = repl->num_entries;
+	table->info->size = repl->size;
+	memcpy(table->info->hook_entry, repl->hook_entry,
+				sizeof(table->info->hook_entry));
+	memcpy(table->info->underflow, repl->underflow,
+				sizeof(table->info->underflow));
+
+	table->modified = FALSE;
+}
+
+static int commit_table(struct connman_iptables *table)
+{
+	struct ipt_replace *repl;
+	int err;
+
+	DBG("%s", table->name);
+
+	table->dirty = FALSE;
+
+	repl = iptables_blob(table);
+	if (repl == NULL)
+		return -ENOMEM;
+
+	if (debug_enabled == TRUE)
+		dump_ipt_replace(repl);
+
+	err = iptables_replace(table, repl);
+
+	g_free(repl->counters);
+
+	if (err < 0) {
+		g_free(repl);
+
+		/* Nobody knows what the kernel has now, read it again */
+		g_hash_table_remove(table_hash, table->name);
+
+		return err;
+	}
+
+	adopt_blob(table, repl);
+
+	return 0;
+}
+
+int __connman_iptables_commit(const char *table_name)
+{
+	struct connman_iptables *table;
+
+	DBG("%s", table_name);
+
+	table = g_hash_table_lookup(table_hash, table_name);
+	if (table == NULL)
+		return -EINVAL;
+
+	/*
+	 * Inside a transaction the table is only marked. It is
+	 * pushed to the kernel once by __connman_iptables_end().
+	 */
+	if (transaction_level > 0) {
+		table->dirty = TRUE;
+		return 0;
+	}
+
+	return commit_table(table);
+}
+
+void __connman_iptables_begin(void)
+{
+	transaction_level++;
+
+	DBG("level %d", transaction_level);
+}
+
+int __connman_iptables_end(void)
+{
+	struct connman_iptables *table;
+	GHashTableIter iter;
+	gpointer value;
+	GSList *dirty = NULL, *list;
+	int err, ret = 0;
+
+	DBG("level %d", transaction_level);
+
+	if (transaction_level == 0)
+		return -EINVAL;
+
+	transaction_level--;
+	if (transaction_level > 0)
+		return 0;
+
+	g_hash_table_iter_init(&iter, table_hash);
+	while (g_hash_table_iter_next(&iter, NULL, &value) == TRUE) {
+		table = value;
+
+		if (table->dirty == TRUE)
+			dirty = g_slist_prepend(dirty, table);
+	}
+
+	/* commit_table() removes the table from table_hash on failure */
+	for (list = dirty; list != NULL; list = list->next) {
+		table = list->data;
+
+		err = commit_table(table);
+		if (err < 0 && ret == 0)
+			ret = err;
+	}
+
+	g_slist_free(dirty);
+
+	return ret;
+}
+
+static void remove_table(gpointer user_data)
+{
+	struct connman_iptables *table = user_data;
+
+	table_cleanup(table);
+}
+
 int __connman_iptables_iterate_chains(const char *table_name,
 				connman_iptables_iterate_chains_cb_t cb,
 				void *user_data)
 {
-	struct cb_data *cbd = cb_data_new(cb, user_data);
 	struct connman_iptables *table;
+	struct connman_iptables_entry *e;
+	GList *list;
 
 	table = get_table(table_name);
 	if (table == NULL)
 		return -EINVAL;
 
-	iterate_entries(table->blob_entries->entrytable,
-			table->info->valid_hooks,
-			table->info->hook_entry,
-			table->info->underflow,
-			table->blob_entries->size,
-			iterate_chains_cb, cbd);
+	for (list = table->entries; list != NULL; list = list->next) {
+		e = list->data;
 
-	g_free(cbd);
+		if (e->chain == NULL || e->chain->head != list)
+			continue;
+
+		cb(e->chain->name, user_data);
+	}
 
 	return 0;
 }
@@ -2381,6 +3171,11 @@ int __connman_iptables_init(void)
 	table_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
 						NULL, remove_table);
 
+	rule_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, free_compiled_rule);
+	template_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, free_rule_template);
+
 	xtables_init_all(&iptables_globals, NFPROTO_IPV4);
 
 	return 0;
@@ -2390,5 +3185,10 @@ void __connman_iptables_cleanup(void)
 {
 	DBG("");
 
+	if (transaction_level > 0)
+		connman_warn("iptables transaction still open");
+
+	g_hash_table_destroy(template_cache);
+	g_hash_table_destroy(rule_cache);
 	g_hash_table_destroy(table_hash);
 }
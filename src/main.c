@@ -41,6 +41,8 @@
 
 #define DEFAULT_INPUT_REQUEST_TIMEOUT 120 * 1000
 #define DEFAULT_BROWSER_LAUNCH_TIMEOUT 300 * 1000
+#define DEFAULT_SESSION_STATS_INTERVAL 10
+#define DEFAULT_NETLINK_RCVBUF_SIZE 1024 * 1024
 
 #define MAINFILE "main.conf"
 #define CONFIGMAINFILE CONFIGDIR "/" MAINFILE
@@ -72,6 +74,10 @@ static struct {
 	connman_bool_t single_tech;
 	char **tethering_technologies;
 	connman_bool_t persistent_tethering_mode;
+	unsigned int session_stats_interval;
+	uint64_t session_stats_threshold;
+	unsigned int netlink_rcvbuf_size;
+	connman_bool_t fast_connect;
 } connman_settings  = {
 	.bg_scan = TRUE,
 	.pref_timeservers = NULL,
@@ -85,6 +91,10 @@ static struct {
 	.single_tech = FALSE,
 	.tethering_technologies = NULL,
 	.persistent_tethering_mode = FALSE,
+	.session_stats_interval = DEFAULT_SESSION_STATS_INTERVAL,
+	.session_stats_threshold = 0,
+	.netlink_rcvbuf_size = DEFAULT_NETLINK_RCVBUF_SIZE,
+	.fast_connect = FALSE,
 };
 
 #define CONF_BG_SCAN                    "BackgroundScanning"
@@ -99,6 +109,10 @@ static struct {
 #define CONF_SINGLE_TECH                "SingleConnectedTechnology"
 #define CONF_TETHERING_TECHNOLOGIES      "TetheringTechnologies"
 #define CONF_PERSISTENT_TETHERING_MODE  "PersistentTetheringMode"
+#define CONF_SESSION_STATS_INTERVAL     "SessionStatisticsInterval"
+#define CONF_SESSION_STATS_THRESHOLD    "SessionStatisticsThreshold"
+#define CONF_NETLINK_RCVBUF_SIZE        "NetlinkReceiveBufferSize"
+#define CONF_FAST_CONNECT               "FastConnect"
 
 static const char *supported_options[] = {
 	CONF_BG_SCAN,
@@ -113,6 +127,10 @@ static const char *supported_options[] = {
 	CONF_SINGLE_TECH,
 	CONF_TETHERING_TECHNOLOGIES,
 	CONF_PERSISTENT_TETHERING_MODE,
+	CONF_SESSION_STATS_INTERVAL,
+	CONF_SESSION_STATS_THRESHOLD,
+	CONF_NETLINK_RCVBUF_SIZE,
+	CONF_FAST_CONNECT,
 	NULL
 };
 
@@ -236,6 +254,7 @@ static void parse_config(GKeyFile *config)
 	char **tethering;
 	gsize len;
 	int timeout;
+	guint64 interval, threshold, size;
 
 	if (config == NULL) {
 		connman_settings.auto_connect =
@@ -352,6 +371,34 @@ static void parse_config(GKeyFile *config)
 		connman_settings.persistent_tethering_mode = boolean;
 
 	g_clear_error(&error);
+
+	interval = g_key_file_get_uint64(config, "General",
+			CONF_SESSION_STATS_INTERVAL, &error);
+	if (error == NULL && interval <= G_MAXUINT)
+		connman_settings.session_stats_interval = interval;
+
+	g_clear_error(&error);
+
+	threshold = g_key_file_get_uint64(config, "General",
+			CONF_SESSION_STATS_THRESHOLD, &error);
+	if (error == NULL)
+		connman_settings.session_stats_threshold = threshold;
+
+	g_clear_error(&error);
+
+	size = g_key_file_get_uint64(config, "General",
+			CONF_NETLINK_RCVBUF_SIZE, &error);
+	if (error == NULL && size <= G_MAXUINT)
+		connman_settings.netlink_rcvbuf_size = size;
+
+	g_clear_error(&error);
+
+	boolean = g_key_file_get_boolean(config, "General",
+			CONF_FAST_CONNECT, &error);
+	if (error == NULL)
+		connman_settings.fast_connect = boolean;
+
+	g_clear_error(&error);
 }
 
 static int config_init(const char *file)
@@ -526,6 +573,9 @@ connman_bool_t connman_setting_get_bool(const char *key)
 	if (g_str_equal(key, CONF_PERSISTENT_TETHERING_MODE) == TRUE)
 		return connman_settings.persistent_tethering_mode;
 
+	if (g_str_equal(key, CONF_FAST_CONNECT) == TRUE)
+		return connman_settings.fast_connect;
+
 	return FALSE;
 }
 
@@ -557,6 +607,25 @@ unsigned int *connman_setting_get_uint_list(const char *key)
 	return NULL;
 }
 
+unsigned int connman_setting_get_uint(const char *key)
+{
+	if (g_str_equal(key, CONF_SESSION_STATS_INTERVAL) == TRUE)
+		return connman_settings.session_stats_interval;
+
+	if (g_str_equal(key, CONF_NETLINK_RCVBUF_SIZE) == TRUE)
+		return connman_settings.netlink_rcvbuf_size;
+
+	return 0;
+}
+
+uint64_t connman_setting_get_uint64(const char *key)
+{
+	if (g_str_equal(key, CONF_SESSION_STATS_THRESHOLD) == TRUE)
+		return connman_settings.session_stats_threshold;
+
+	return 0;
+}
+
 unsigned int connman_timeout_input_request(void) {
 	return connman_settings.timeout_inputreq;
 }
@@ -642,16 +711,17 @@ int main(int argc, char *argv[])
 		config_init(option_config);
 
 	__connman_inotify_init();
+	__connman_inet_init();
 	__connman_technology_init();
 	__connman_notifier_init();
 	__connman_agent_init();
+	__connman_storage_init();
 	__connman_service_init();
 	__connman_provider_init();
 	__connman_network_init();
 	__connman_device_init(option_device, option_nodevice);
 
 	__connman_ippool_init();
-	__connman_iptables_init();
 	__connman_nfacct_init();
 	__connman_firewall_init();
 	__connman_nat_init();
@@ -716,15 +786,16 @@ int main(int argc, char *argv[])
 	__connman_nat_cleanup();
 	__connman_firewall_cleanup();
 	__connman_nfacct_cleanup();
-	__connman_iptables_cleanup();
 	__connman_ippool_cleanup();
 	__connman_device_cleanup();
 	__connman_network_cleanup();
 	__connman_service_cleanup();
+	__connman_storage_cleanup();
 	__connman_agent_cleanup();
 	__connman_ipconfig_cleanup();
 	__connman_notifier_cleanup();
 	__connman_technology_cleanup();
+	__connman_inet_cleanup();
 	__connman_inotify_cleanup();
 
 	__connman_dbus_cleanup();
@@ -32,10 +32,17 @@
 
 static struct nfacct_info *nfacct;
 
+/* Enabled rules by name, used to dispatch a batched statistics dump */
+static GHashTable *rule_hash;
+static unsigned int stats_dump_id;
+
 struct nfacct_rule {
 	char *name;
 	connman_nfacct_stats_cb_t cb;
 	void *user_data;
+	struct nfacct_context *ctx;
+	uint64_t packets;
+	uint64_t bytes;
 };
 
 struct nfacct_context {
@@ -67,8 +74,34 @@ struct nfacct_context *__connman_nfacct_create_context(void)
 	return ctx;
 }
 
+static void register_rules(struct nfacct_context *ctx)
+{
+	struct nfacct_rule *rule;
+	GList *list;
+
+	for (list = ctx->rules; list != NULL; list = list->next) {
+		rule = list->data;
+
+		g_hash_table_replace(rule_hash, rule->name, rule);
+	}
+}
+
+static void unregister_rules(struct nfacct_context *ctx)
+{
+	struct nfacct_rule *rule;
+	GList *list;
+
+	for (list = ctx->rules; list != NULL; list = list->next) {
+		rule = list->data;
+
+		if (g_hash_table_lookup(rule_hash, rule->name) == rule)
+			g_hash_table_remove(rule_hash, rule->name);
+	}
+}
+
 void __connman_nfacct_destroy_context(struct nfacct_context *ctx)
 {
+	unregister_rules(ctx);
 	g_list_free_full(ctx->rules, cleanup_nfacct_rule);
 	g_free(ctx);
 }
@@ -82,6 +115,7 @@ int __connman_nfacct_add(struct nfacct_context *ctx, const char *name,
 	rule->name = g_strdup(name);
 	rule->cb = cb;
 	rule->user_data = user_data;
+	rule->ctx = ctx;
 
 	ctx->rules = g_list_append(ctx->rules, rule);
 
@@ -159,6 +193,8 @@ static void nfacct_enable_cb(unsigned int error, void *user_data)
 		return;
 	}
 
+	register_rules(ctx);
+
 	cb(0, ctx, user_data);
 }
 
@@ -235,6 +271,8 @@ int __connman_nfacct_disable(struct nfacct_context *ctx,
 
 	DBG("");
 
+	unregister_rules(ctx);
+
 	for (list = ctx->rules; list != NULL; list = list->next) {
 		rule = list->data;
 
@@ -365,6 +403,66 @@ int __connman_nfacct_flush(connman_nfacct_flush_cb_t cb, void *user_data)
 	return -ECOMM;
 }
 
+static void nfacct_stats_cb(unsigned int error, const char *name,
+				uint64_t packets, uint64_t bytes,
+				void *user_data)
+{
+	struct nfacct_rule *rule;
+	uint64_t delta_packets, delta_bytes;
+
+	if (error != 0) {
+		DBG("error %d", error);
+		stats_dump_id = 0;
+		return;
+	}
+
+	if (name == NULL) {
+		/* last call */
+		stats_dump_id = 0;
+		return;
+	}
+
+	rule = g_hash_table_lookup(rule_hash, name);
+	if (rule == NULL)
+		return;
+
+	/*
+	 * The counters are not zeroed by the dump so that other users
+	 * of the accounting objects are not disturbed. If someone else
+	 * did reset them, start over from zero.
+	 */
+	if (packets < rule->packets || bytes < rule->bytes) {
+		rule->packets = 0;
+		rule->bytes = 0;
+	}
+
+	delta_packets = packets - rule->packets;
+	delta_bytes = bytes - rule->bytes;
+
+	rule->packets = packets;
+	rule->bytes = bytes;
+
+	if (delta_packets == 0 && delta_bytes == 0)
+		return;
+
+	rule->cb(rule->ctx, delta_packets, delta_bytes, rule->user_data);
+}
+
+int __connman_nfacct_update_stats(void)
+{
+	if (stats_dump_id > 0)
+		return -EINPROGRESS;
+
+	if (g_hash_table_size(rule_hash) == 0)
+		return 0;
+
+	stats_dump_id = nfacct_dump(nfacct, false, nfacct_stats_cb, NULL);
+	if (stats_dump_id == 0)
+		return -ECOMM;
+
+	return 0;
+}
+
 int __connman_nfacct_init(void)
 {
 	DBG("");
@@ -373,11 +471,16 @@ int __connman_nfacct_init(void)
 	if (nfacct == NULL)
 		return -ENOMEM;
 
+	rule_hash = g_hash_table_new(g_str_hash, g_str_equal);
+
 	return 0;
 }
 
 void __connman_nfacct_cleanup(void)
 {
+	g_hash_table_destroy(rule_hash);
+	rule_hash = NULL;
+
 	nfacct_destroy(nfacct);
 	nfacct = NULL;
 }
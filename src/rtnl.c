@@ -34,6 +34,7 @@
 #include <netinet/icmp6.h>
 #include <net/if_arp.h>
 #include <linux/if.h>
+#include <linux/filter.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <linux/wireless.h>
@@ -69,10 +70,52 @@ struct interface_data {
 	char *ident;
 	enum connman_service_type service_type;
 	enum connman_device_type device_type;
+	unsigned short type;
+	unsigned int flags;
+	unsigned int generation;
+	connman_bool_t ignored;
 };
 
 static GHashTable *interface_list = NULL;
 
+static GIOChannel *channel = NULL;
+
+/*
+ * The addresses and routes handed to ipconfig, so that a dump done
+ * after the kernel dropped events can be compared with what connman
+ * has been told so far.
+ */
+struct address_data {
+	int index;
+	unsigned char family;
+	unsigned char prefixlen;
+	char *label;
+	char *address;
+	unsigned int generation;
+};
+
+struct route_data {
+	int index;
+	unsigned char family;
+	unsigned char scope;
+	char *dst;
+	char *gateway;
+	connman_bool_t default_route;
+	unsigned int generation;
+};
+
+static GHashTable *address_list = NULL;
+static GHashTable *route_list = NULL;
+
+/* Bumped by each resync, entries it does not see again are gone */
+static unsigned int generation = 0;
+
+/* Sequence numbers of the dumps of the resync in progress */
+static connman_bool_t resync_active = FALSE;
+static guint32 resync_link_seq = 0;
+static guint32 resync_addr_seq = 0;
+static guint32 resync_route_seq = 0;
+
 static void free_interface(gpointer data)
 {
 	struct interface_data *interface = data;
@@ -85,6 +128,24 @@ static void free_interface(gpointer data)
 	g_free(interface);
 }
 
+static void free_address(gpointer data)
+{
+	struct address_data *address = data;
+
+	g_free(address->label);
+	g_free(address->address);
+	g_free(address);
+}
+
+static void free_route(gpointer data)
+{
+	struct route_data *route = data;
+
+	g_free(route->dst);
+	g_free(route->gateway);
+	g_free(route);
+}
+
 static connman_bool_t ether_blacklisted(const char *name)
 {
 	if (name == NULL)
@@ -394,6 +455,158 @@ static connman_bool_t extract_link(struct ifinfomsg *msg, int bytes,
 	return TRUE;
 }
 
+/*
+ * Events of the types below are counted as they arrive and when
+ * connman throws them away, to see what the socket filter saves.
+ */
+#define EVENT_TYPES	(RTM_DELROUTE - RTM_BASE + 1)
+
+static unsigned int events_received[EVENT_TYPES];
+static unsigned int events_ignored[EVENT_TYPES];
+
+static void count_event(unsigned int *counters, struct nlmsghdr *hdr)
+{
+	/* Dump replies are not events */
+	if (hdr->nlmsg_flags & NLM_F_MULTI)
+		return;
+
+	if (hdr->nlmsg_type >= RTM_BASE && hdr->nlmsg_type <= RTM_DELROUTE)
+		counters[hdr->nlmsg_type - RTM_BASE]++;
+}
+
+static connman_bool_t is_ignored(int index)
+{
+	struct interface_data *interface;
+
+	interface = g_hash_table_lookup(interface_list,
+					GINT_TO_POINTER(index));
+	if (interface == NULL)
+		return FALSE;
+
+	return interface->ignored;
+}
+
+/*
+ * The socket filter lets the kernel drop the route events connman
+ * ignores: routes that is_route_rtmsg() rejects and routes of
+ * blacklisted interfaces. Link and address events and dump replies
+ * always pass, addresses of blacklisted interfaces still tell the IP
+ * pools which subnets are taken. Routes that slip through, for example
+ * before the filter is updated for a new interface, are still dropped
+ * in the handler.
+ */
+#define FILTER_MAX_IGNORED	64
+#define FILTER_IGNORED		18
+#define FILTER_ACCEPT		0xffffffff
+#define FILTER_DROP		0
+
+#define RTMSG_OFFSET(field) \
+	(NLMSG_HDRLEN + offsetof(struct rtmsg, field))
+
+static void update_filter(void)
+{
+	struct sock_filter code[FILTER_IGNORED + FILTER_MAX_IGNORED + 2];
+	struct sock_fprog fprog;
+	GHashTableIter iter;
+	gpointer key, value;
+	unsigned int n = 0, i, accept, drop;
+	int sk;
+
+	if (channel == NULL)
+		return;
+
+	/*
+	 * Classic BPF loads 16 and 32 bit values in network byte order,
+	 * so host order netlink fields are compared with htons() and
+	 * htonl() of the value.
+	 */
+	g_hash_table_iter_init(&iter, interface_list);
+	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+		struct interface_data *interface = value;
+
+		if (interface->ignored == FALSE)
+			continue;
+
+		/* The rest is dropped by the handler */
+		if (n == FILTER_MAX_IGNORED)
+			break;
+
+		code[FILTER_IGNORED + n] = (struct sock_filter) BPF_JUMP(
+				BPF_JMP | BPF_JEQ | BPF_K,
+				htonl(interface->index), 0, 0);
+		n++;
+	}
+
+	accept = FILTER_IGNORED + n;
+	drop = accept + 1;
+
+#define TO(label, pc) ((label) - (pc) - 1)
+
+	/* Dump replies */
+	code[0] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_ABS,
+				offsetof(struct nlmsghdr, nlmsg_flags));
+	code[1] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K,
+				htons(NLM_F_MULTI), TO(accept, 1), 0);
+
+	code[2] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_ABS,
+				offsetof(struct nlmsghdr, nlmsg_type));
+	code[3] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				htons(RTM_NEWROUTE), TO(5, 3), 0);
+	code[4] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				htons(RTM_DELROUTE), 0, TO(accept, 4));
+
+	/* Routes, see is_route_rtmsg() */
+	code[5] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS,
+				RTMSG_OFFSET(rtm_table));
+	code[6] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				RT_TABLE_MAIN, 0, TO(drop, 6));
+	code[7] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS,
+				RTMSG_OFFSET(rtm_type));
+	code[8] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				RTN_UNICAST, 0, TO(drop, 8));
+	code[9] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS,
+				RTMSG_OFFSET(rtm_protocol));
+	code[10] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				RTPROT_BOOT, TO(12, 10), 0);
+	code[11] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				RTPROT_KERNEL, 0, TO(drop, 11));
+
+	/* Output interface of a route, from its RTA_OIF attribute */
+	code[12] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_IMM,
+				NLMSG_SPACE(sizeof(struct rtmsg)));
+	code[13] = (struct sock_filter) BPF_STMT(BPF_LDX | BPF_IMM, RTA_OIF);
+	code[14] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				SKF_AD_OFF + SKF_AD_NLATTR);
+	code[15] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				0, TO(accept, 15), 0);
+	code[16] = (struct sock_filter) BPF_STMT(BPF_MISC | BPF_TAX, 0);
+	code[17] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_IND,
+				RTA_LENGTH(0));
+
+	/* The following n instructions compare with ignored interfaces */
+	for (i = 0; i < n; i++)
+		code[FILTER_IGNORED + i].jt = TO(drop, FILTER_IGNORED + i);
+
+	code[accept] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K,
+							FILTER_ACCEPT);
+	code[drop] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K,
+							FILTER_DROP);
+
+#undef TO
+
+	fprog.len = drop + 1;
+	fprog.filter = code;
+
+	DBG("%u ignored interfaces", n);
+
+	sk = g_io_channel_unix_get_fd(channel);
+
+	if (setsockopt(sk, SOL_SOCKET, SO_ATTACH_FILTER,
+					&fprog, sizeof(fprog)) < 0)
+		connman_warn("Cannot attach rtnl socket filter: %s",
+							strerror(errno));
+}
+
 static void process_newlink(unsigned short type, int index, unsigned flags,
 			unsigned change, struct ifinfomsg *msg, int bytes)
 {
@@ -454,14 +667,26 @@ static void process_newlink(unsigned short type, int index, unsigned flags,
 		interface->index = index;
 		interface->name = g_strdup(ifname);
 		interface->ident = g_strdup(ident);
+		interface->type = type;
+		interface->flags = flags;
+		interface->generation = generation;
 
 		g_hash_table_insert(interface_list,
 					GINT_TO_POINTER(index), interface);
 
-		if (type == ARPHRD_ETHER)
+		if (type == ARPHRD_ETHER) {
 			read_uevent(interface);
-	} else
+
+			interface->ignored = ether_blacklisted(ifname);
+			if (interface->ignored == TRUE)
+				update_filter();
+		}
+	} else {
+		interface->flags = flags;
+		interface->generation = generation;
+
 		interface = NULL;
+	}
 
 	for (list = rtnl_list; list; list = list->next) {
 		struct connman_rtnl *rtnl = list->data;
@@ -491,24 +716,12 @@ static void process_newlink(unsigned short type, int index, unsigned flags,
 	}
 }
 
-static void process_dellink(unsigned short type, int index, unsigned flags,
-			unsigned change, struct ifinfomsg *msg, int bytes)
+static void notify_dellink(unsigned short type, int index, unsigned flags,
+			unsigned change, struct rtnl_link_stats *stats)
 {
-	struct rtnl_link_stats stats;
-	unsigned char operstate = 0xff;
-	const char *ifname = NULL;
+	connman_bool_t ignored = is_ignored(index);
 	GSList *list;
 
-	memset(&stats, 0, sizeof(stats));
-	if (extract_link(msg, bytes, NULL, &ifname, NULL, &operstate,
-					&stats) == FALSE)
-		return;
-
-	if (operstate != 0xff)
-		connman_info("%s {dellink} index %d operstate %u <%s>",
-						ifname, index, operstate,
-						operstate2str(operstate));
-
 	for (list = rtnl_list; list; list = list->next) {
 		struct connman_rtnl *rtnl = list->data;
 
@@ -520,11 +733,34 @@ static void process_dellink(unsigned short type, int index, unsigned flags,
 	case ARPHRD_ETHER:
 	case ARPHRD_LOOPBACK:
 	case ARPHRD_NONE:
-		__connman_ipconfig_dellink(index, &stats);
+		__connman_ipconfig_dellink(index, stats);
 		break;
 	}
 
 	g_hash_table_remove(interface_list, GINT_TO_POINTER(index));
+
+	if (ignored == TRUE)
+		update_filter();
+}
+
+static void process_dellink(unsigned short type, int index, unsigned flags,
+			unsigned change, struct ifinfomsg *msg, int bytes)
+{
+	struct rtnl_link_stats stats;
+	unsigned char operstate = 0xff;
+	const char *ifname = NULL;
+
+	memset(&stats, 0, sizeof(stats));
+	if (extract_link(msg, bytes, NULL, &ifname, NULL, &operstate,
+					&stats) == FALSE)
+		return;
+
+	if (operstate != 0xff)
+		connman_info("%s {dellink} index %d operstate %u <%s>",
+						ifname, index, operstate,
+						operstate2str(operstate));
+
+	notify_dellink(type, index, flags, change, &stats);
 }
 
 static void extract_ipv4_addr(struct ifaddrmsg *msg, int bytes,
@@ -579,36 +815,66 @@ static void extract_ipv6_addr(struct ifaddrmsg *msg, int bytes,
 	}
 }
 
-static void process_newaddr(unsigned char family, unsigned char prefixlen,
-				int index, struct ifaddrmsg *msg, int bytes)
+/* Returns FALSE for addresses connman does not track */
+static connman_bool_t extract_addr(unsigned char family,
+				struct ifaddrmsg *msg, int bytes,
+				const char **label, char *ip_string)
 {
-	const char *label = NULL;
+	struct in_addr ipv4_addr = { INADDR_ANY };
+	struct in6_addr ipv6_address, ipv6_local;
 	void *src;
-	char ip_string[INET6_ADDRSTRLEN];
 
 	if (family == AF_INET) {
-		struct in_addr ipv4_addr = { INADDR_ANY };
-
-		extract_ipv4_addr(msg, bytes, &label, &ipv4_addr, NULL, NULL);
+		extract_ipv4_addr(msg, bytes, label, &ipv4_addr, NULL, NULL);
 		src = &ipv4_addr;
 	} else if (family == AF_INET6) {
-		struct in6_addr ipv6_address, ipv6_local;
-
 		extract_ipv6_addr(msg, bytes, &ipv6_address, &ipv6_local);
 		if (IN6_IS_ADDR_LINKLOCAL(&ipv6_address))
-			return;
+			return FALSE;
 
 		src = &ipv6_address;
 	} else {
-		return;
+		return FALSE;
 	}
 
 	if (inet_ntop(family, src, ip_string, INET6_ADDRSTRLEN) == NULL)
+		return FALSE;
+
+	return TRUE;
+}
+
+static char *address_key(unsigned char family, unsigned char prefixlen,
+					int index, const char *ip_string)
+{
+	return g_strdup_printf("%d %u %s/%u", index, family, ip_string,
+								prefixlen);
+}
+
+static void process_newaddr(unsigned char family, unsigned char prefixlen,
+				int index, struct ifaddrmsg *msg, int bytes)
+{
+	struct address_data *address;
+	const char *label = NULL;
+	char ip_string[INET6_ADDRSTRLEN];
+
+	if (extract_addr(family, msg, bytes, &label, ip_string) == FALSE)
 		return;
 
 	__connman_ipconfig_newaddr(index, family, label,
 					prefixlen, ip_string);
 
+	address = g_new0(struct address_data, 1);
+	address->index = index;
+	address->family = family;
+	address->prefixlen = prefixlen;
+	address->label = g_strdup(label);
+	address->address = g_strdup(ip_string);
+	address->generation = generation;
+
+	g_hash_table_replace(address_list,
+			address_key(family, prefixlen, index, ip_string),
+			address);
+
 	if (family == AF_INET6) {
 		/*
 		 * Re-create RDNSS configured servers if there are any
@@ -624,31 +890,18 @@ static void process_deladdr(unsigned char family, unsigned char prefixlen,
 				int index, struct ifaddrmsg *msg, int bytes)
 {
 	const char *label = NULL;
-	void *src;
 	char ip_string[INET6_ADDRSTRLEN];
+	char *key;
 
-	if (family == AF_INET) {
-		struct in_addr ipv4_addr = { INADDR_ANY };
-
-		extract_ipv4_addr(msg, bytes, &label, &ipv4_addr, NULL, NULL);
-		src = &ipv4_addr;
-	} else if (family == AF_INET6) {
-		struct in6_addr ipv6_address, ipv6_local;
-
-		extract_ipv6_addr(msg, bytes, &ipv6_address, &ipv6_local);
-		if (IN6_IS_ADDR_LINKLOCAL(&ipv6_address))
-			return;
-
-		src = &ipv6_address;
-	} else {
-		return;
-	}
-
-	if (inet_ntop(family, src, ip_string, INET6_ADDRSTRLEN) == NULL)
+	if (extract_addr(family, msg, bytes, &label, ip_string) == FALSE)
 		return;
 
 	__connman_ipconfig_deladdr(index, family, label,
 					prefixlen, ip_string);
+
+	key = address_key(family, prefixlen, index, ip_string);
+	g_hash_table_remove(address_list, key);
+	g_free(key);
 }
 
 static void extract_ipv4_route(struct rtmsg *msg, int bytes, int *index,
@@ -702,110 +955,101 @@ static void extract_ipv6_route(struct rtmsg *msg, int bytes, int *index,
 	}
 }
 
-static void process_newroute(unsigned char family, unsigned char scope,
-						struct rtmsg *msg, int bytes)
+/* Returns FALSE for routes connman does not track */
+static connman_bool_t extract_route(unsigned char family, unsigned char scope,
+				struct rtmsg *msg, int bytes, int *index,
+				char *dststr, char *gatewaystr,
+				connman_bool_t *default_route)
 {
-	GSList *list;
-	char dststr[INET6_ADDRSTRLEN], gatewaystr[INET6_ADDRSTRLEN];
-	int index = -1;
-
 	if (family == AF_INET) {
 		struct in_addr dst = { INADDR_ANY }, gateway = { INADDR_ANY };
 
-		extract_ipv4_route(msg, bytes, &index, &dst, &gateway);
-
-		inet_ntop(family, &dst, dststr, sizeof(dststr));
-		inet_ntop(family, &gateway, gatewaystr, sizeof(gatewaystr));
+		extract_ipv4_route(msg, bytes, index, &dst, &gateway);
 
-		__connman_ipconfig_newroute(index, family, scope, dststr,
-								gatewaystr);
+		inet_ntop(family, &dst, dststr, INET6_ADDRSTRLEN);
+		inet_ntop(family, &gateway, gatewaystr, INET6_ADDRSTRLEN);
 
 		/* skip host specific routes */
-		if (scope != RT_SCOPE_UNIVERSE &&
-			!(scope == RT_SCOPE_LINK && dst.s_addr == INADDR_ANY))
-			return;
-
-		if (dst.s_addr != INADDR_ANY)
-			return;
-
+		*default_route = (scope == RT_SCOPE_UNIVERSE ||
+						scope == RT_SCOPE_LINK) &&
+					dst.s_addr == INADDR_ANY;
 	} else if (family == AF_INET6) {
 		struct in6_addr dst = IN6ADDR_ANY_INIT,
 				gateway = IN6ADDR_ANY_INIT;
 
-		extract_ipv6_route(msg, bytes, &index, &dst, &gateway);
+		extract_ipv6_route(msg, bytes, index, &dst, &gateway);
 
-		inet_ntop(family, &dst, dststr, sizeof(dststr));
-		inet_ntop(family, &gateway, gatewaystr, sizeof(gatewaystr));
-
-		__connman_ipconfig_newroute(index, family, scope, dststr,
-								gatewaystr);
+		inet_ntop(family, &dst, dststr, INET6_ADDRSTRLEN);
+		inet_ntop(family, &gateway, gatewaystr, INET6_ADDRSTRLEN);
 
 		/* skip host specific routes */
-		if (scope != RT_SCOPE_UNIVERSE &&
-			!(scope == RT_SCOPE_LINK &&
-				IN6_IS_ADDR_UNSPECIFIED(&dst)))
-			return;
-
-		if (!IN6_IS_ADDR_UNSPECIFIED(&dst))
-			return;
+		*default_route = (scope == RT_SCOPE_UNIVERSE ||
+						scope == RT_SCOPE_LINK) &&
+					IN6_IS_ADDR_UNSPECIFIED(&dst);
 	} else
-		return;
+		return FALSE;
 
-	for (list = rtnl_list; list; list = list->next) {
-		struct connman_rtnl *rtnl = list->data;
+	return TRUE;
+}
 
-		if (rtnl->newgateway)
-			rtnl->newgateway(index, gatewaystr);
-	}
+static char *route_key(unsigned char family, unsigned char scope, int index,
+				const char *dststr, const char *gatewaystr)
+{
+	return g_strdup_printf("%d %u %u %s %s", index, family, scope,
+							dststr, gatewaystr);
 }
 
-static void process_delroute(unsigned char family, unsigned char scope,
+static void process_newroute(unsigned char family, unsigned char scope,
 						struct rtmsg *msg, int bytes)
 {
 	GSList *list;
 	char dststr[INET6_ADDRSTRLEN], gatewaystr[INET6_ADDRSTRLEN];
+	struct route_data *route;
+	connman_bool_t default_route;
 	int index = -1;
 
-	if (family == AF_INET) {
-		struct in_addr dst = { INADDR_ANY }, gateway = { INADDR_ANY };
-
-		extract_ipv4_route(msg, bytes, &index, &dst, &gateway);
-
-		inet_ntop(family, &dst, dststr, sizeof(dststr));
-		inet_ntop(family, &gateway, gatewaystr, sizeof(gatewaystr));
+	if (extract_route(family, scope, msg, bytes, &index, dststr,
+					gatewaystr, &default_route) == FALSE)
+		return;
 
-		__connman_ipconfig_delroute(index, family, scope, dststr,
-								gatewaystr);
+	__connman_ipconfig_newroute(index, family, scope, dststr,
+							gatewaystr);
 
-		/* skip host specific routes */
-		if (scope != RT_SCOPE_UNIVERSE &&
-			!(scope == RT_SCOPE_LINK && dst.s_addr == INADDR_ANY))
-			return;
+	route = g_new0(struct route_data, 1);
+	route->index = index;
+	route->family = family;
+	route->scope = scope;
+	route->dst = g_strdup(dststr);
+	route->gateway = g_strdup(gatewaystr);
+	route->default_route = default_route;
+	route->generation = generation;
 
-		if (dst.s_addr != INADDR_ANY)
-			return;
+	g_hash_table_replace(route_list,
+			route_key(family, scope, index, dststr, gatewaystr),
+			route);
 
-	}  else if (family == AF_INET6) {
-		struct in6_addr dst = IN6ADDR_ANY_INIT,
-				gateway = IN6ADDR_ANY_INIT;
+	if (default_route == FALSE)
+		return;
 
-		extract_ipv6_route(msg, bytes, &index, &dst, &gateway);
+	for (list = rtnl_list; list; list = list->next) {
+		struct connman_rtnl *rtnl = list->data;
 
-		inet_ntop(family, &dst, dststr, sizeof(dststr));
-		inet_ntop(family, &gateway, gatewaystr, sizeof(gatewaystr));
+		if (rtnl->newgateway)
+			rtnl->newgateway(index, gatewaystr);
+	}
+}
 
-		__connman_ipconfig_delroute(index, family, scope, dststr,
-						gatewaystr);
+static void notify_delroute(unsigned char family, unsigned char scope,
+				int index, const char *dststr,
+				const char *gatewaystr,
+				connman_bool_t default_route)
+{
+	GSList *list;
 
-		/* skip host specific routes */
-		if (scope != RT_SCOPE_UNIVERSE &&
-			!(scope == RT_SCOPE_LINK &&
-				IN6_IS_ADDR_UNSPECIFIED(&dst)))
-			return;
+	__connman_ipconfig_delroute(index, family, scope, dststr,
+							gatewaystr);
 
-		if (!IN6_IS_ADDR_UNSPECIFIED(&dst))
-			return;
-	} else
+	if (default_route == FALSE)
 		return;
 
 	for (list = rtnl_list; list; list = list->next) {
@@ -816,6 +1060,26 @@ static void process_delroute(unsigned char family, unsigned char scope,
 	}
 }
 
+static void process_delroute(unsigned char family, unsigned char scope,
+						struct rtmsg *msg, int bytes)
+{
+	char dststr[INET6_ADDRSTRLEN], gatewaystr[INET6_ADDRSTRLEN];
+	connman_bool_t default_route;
+	int index = -1;
+	char *key;
+
+	if (extract_route(family, scope, msg, bytes, &index, dststr,
+					gatewaystr, &default_route) == FALSE)
+		return;
+
+	key = route_key(family, scope, index, dststr, gatewaystr);
+	g_hash_table_remove(route_list, key);
+	g_free(key);
+
+	notify_delroute(family, scope, index, dststr, gatewaystr,
+							default_route);
+}
+
 static inline void print_ether(struct rtattr *attr, const char *name)
 {
 	int len = (int) RTA_PAYLOAD(attr);
@@ -941,10 +1205,41 @@ static void rtnl_link(struct nlmsghdr *hdr)
 	}
 }
 
+static connman_bool_t is_resync_reply(struct nlmsghdr *hdr, guint32 seq)
+{
+	return resync_active == TRUE && hdr->nlmsg_seq == seq &&
+				(hdr->nlmsg_flags & NLM_F_MULTI) != 0;
+}
+
+/*
+ * A resync dump reports everything again, only what differs from what
+ * connman already knows is passed on.
+ */
+static connman_bool_t link_unchanged(struct nlmsghdr *hdr)
+{
+	struct ifinfomsg *msg = (struct ifinfomsg *) NLMSG_DATA(hdr);
+	struct interface_data *interface;
+
+	if (is_resync_reply(hdr, resync_link_seq) == FALSE)
+		return FALSE;
+
+	interface = g_hash_table_lookup(interface_list,
+					GINT_TO_POINTER(msg->ifi_index));
+	if (interface == NULL || interface->flags != msg->ifi_flags)
+		return FALSE;
+
+	interface->generation = generation;
+
+	return TRUE;
+}
+
 static void rtnl_newlink(struct nlmsghdr *hdr)
 {
 	struct ifinfomsg *msg = (struct ifinfomsg *) NLMSG_DATA(hdr);
 
+	if (link_unchanged(hdr) == TRUE)
+		return;
+
 	rtnl_link(hdr);
 
 	process_newlink(msg->ifi_type, msg->ifi_index, msg->ifi_flags,
@@ -1003,10 +1298,40 @@ static void rtnl_addr(struct nlmsghdr *hdr)
 	}
 }
 
+static connman_bool_t addr_unchanged(struct nlmsghdr *hdr)
+{
+	struct ifaddrmsg *msg = (struct ifaddrmsg *) NLMSG_DATA(hdr);
+	struct address_data *address;
+	char ip_string[INET6_ADDRSTRLEN];
+	char *key;
+
+	if (is_resync_reply(hdr, resync_addr_seq) == FALSE)
+		return FALSE;
+
+	if (extract_addr(msg->ifa_family, msg, IFA_PAYLOAD(hdr),
+						NULL, ip_string) == FALSE)
+		return FALSE;
+
+	key = address_key(msg->ifa_family, msg->ifa_prefixlen,
+						msg->ifa_index, ip_string);
+	address = g_hash_table_lookup(address_list, key);
+	g_free(key);
+
+	if (address == NULL)
+		return FALSE;
+
+	address->generation = generation;
+
+	return TRUE;
+}
+
 static void rtnl_newaddr(struct nlmsghdr *hdr)
 {
 	struct ifaddrmsg *msg = (struct ifaddrmsg *) NLMSG_DATA(hdr);
 
+	if (addr_unchanged(hdr) == TRUE)
+		return;
+
 	rtnl_addr(hdr);
 
 	process_newaddr(msg->ifa_family, msg->ifa_prefixlen, msg->ifa_index,
@@ -1090,26 +1415,89 @@ static connman_bool_t is_route_rtmsg(struct rtmsg *msg)
 	return TRUE;
 }
 
+static connman_bool_t route_unchanged(struct nlmsghdr *hdr)
+{
+	struct rtmsg *msg = (struct rtmsg *) NLMSG_DATA(hdr);
+	char dststr[INET6_ADDRSTRLEN], gatewaystr[INET6_ADDRSTRLEN];
+	connman_bool_t default_route;
+	struct route_data *route;
+	int index = -1;
+	char *key;
+
+	if (is_resync_reply(hdr, resync_route_seq) == FALSE)
+		return FALSE;
+
+	if (extract_route(msg->rtm_family, msg->rtm_scope, msg,
+				RTM_PAYLOAD(hdr), &index, dststr, gatewaystr,
+				&default_route) == FALSE)
+		return FALSE;
+
+	key = route_key(msg->rtm_family, msg->rtm_scope, index,
+							dststr, gatewaystr);
+	route = g_hash_table_lookup(route_list, key);
+	g_free(key);
+
+	if (route == NULL)
+		return FALSE;
+
+	route->generation = generation;
+
+	return TRUE;
+}
+
+static int route_oif(struct rtmsg *msg, int bytes)
+{
+	struct rtattr *attr;
+
+	for (attr = RTM_RTA(msg); RTA_OK(attr, bytes);
+					attr = RTA_NEXT(attr, bytes)) {
+		if (attr->rta_type == RTA_OIF)
+			return *((int *) RTA_DATA(attr));
+	}
+
+	return -1;
+}
+
+static connman_bool_t ignore_route(struct nlmsghdr *hdr)
+{
+	struct rtmsg *msg = (struct rtmsg *) NLMSG_DATA(hdr);
+
+	if (is_route_rtmsg(msg) == TRUE &&
+			is_ignored(route_oif(msg, RTM_PAYLOAD(hdr))) == FALSE)
+		return FALSE;
+
+	count_event(events_ignored, hdr);
+
+	return TRUE;
+}
+
 static void rtnl_newroute(struct nlmsghdr *hdr)
 {
 	struct rtmsg *msg = (struct rtmsg *) NLMSG_DATA(hdr);
 
+	if (ignore_route(hdr) == TRUE)
+		return;
+
+	if (route_unchanged(hdr) == TRUE)
+		return;
+
 	rtnl_route(hdr);
 
-	if (is_route_rtmsg(msg))
-		process_newroute(msg->rtm_family, msg->rtm_scope,
-						msg, RTM_PAYLOAD(hdr));
+	process_newroute(msg->rtm_family, msg->rtm_scope,
+					msg, RTM_PAYLOAD(hdr));
 }
 
 static void rtnl_delroute(struct nlmsghdr *hdr)
 {
 	struct rtmsg *msg = (struct rtmsg *) NLMSG_DATA(hdr);
 
+	if (ignore_route(hdr) == TRUE)
+		return;
+
 	rtnl_route(hdr);
 
-	if (is_route_rtmsg(msg))
-		process_delroute(msg->rtm_family, msg->rtm_scope,
-						msg, RTM_PAYLOAD(hdr));
+	process_delroute(msg->rtm_family, msg->rtm_scope,
+					msg, RTM_PAYLOAD(hdr));
 }
 
 static void *rtnl_nd_opt_rdnss(struct nd_opt_hdr *opt, guint32 *lifetime,
@@ -1283,7 +1671,30 @@ static const char *type2string(uint16_t type)
 	}
 }
 
-static GIOChannel *channel = NULL;
+static void print_event_counters(void)
+{
+	uint16_t type;
+
+	for (type = RTM_BASE; type <= RTM_DELROUTE; type++) {
+		if (events_received[type - RTM_BASE] == 0)
+			continue;
+
+		DBG("%s received %u ignored %u", type2string(type),
+					events_received[type - RTM_BASE],
+					events_ignored[type - RTM_BASE]);
+	}
+}
+
+/*
+ * A dump reply is sent in chunks of up to 32k, so read with a buffer at
+ * least that large. The socket is drained on each wakeup, but no more
+ * than RTNL_MAX_READS times so an event storm cannot starve the main
+ * loop; whatever is left triggers the next wakeup.
+ */
+#define RTNL_BUFFER_SIZE	(32 * 1024)
+#define RTNL_MAX_READS		64
+
+static unsigned char rtnl_buffer[RTNL_BUFFER_SIZE];
 
 struct rtnl_request {
 	struct nlmsghdr hdr;
@@ -1356,6 +1767,211 @@ static int process_response(guint32 seq)
 	return send_request(req);
 }
 
+static int queue_dump(uint16_t type, unsigned char family, guint32 *seq)
+{
+	struct rtnl_request *req;
+
+	req = g_try_malloc0(RTNL_REQUEST_SIZE);
+	if (req == NULL)
+		return -ENOMEM;
+
+	req->hdr.nlmsg_len = RTNL_REQUEST_SIZE;
+	req->hdr.nlmsg_type = type;
+	req->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req->hdr.nlmsg_pid = 0;
+	req->hdr.nlmsg_seq = request_seq++;
+	req->msg.rtgen_family = family;
+
+	if (seq != NULL)
+		*seq = req->hdr.nlmsg_seq;
+
+	return queue_request(req);
+}
+
+/*
+ * When the socket overflows the kernel drops events, and connman no
+ * longer knows for sure which links, addresses and routes exist. The
+ * resync dumps all of them again. Entries that did not change are
+ * only marked as seen, new or changed ones are processed as if an
+ * event had arrived, and whatever was not seen is removed once the
+ * dump is done.
+ */
+#define RESYNC_DELAY	1
+
+static guint resync_timeout = 0;
+static connman_bool_t resync_again = FALSE;
+
+static void purge_links(void)
+{
+	struct rtnl_link_stats stats;
+	GHashTableIter iter;
+	gpointer key, value;
+	GSList *stale = NULL, *list;
+
+	g_hash_table_iter_init(&iter, interface_list);
+	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+		struct interface_data *interface = value;
+
+		if (interface->generation != generation)
+			stale = g_slist_prepend(stale, interface);
+	}
+
+	memset(&stats, 0, sizeof(stats));
+
+	for (list = stale; list; list = list->next) {
+		struct interface_data *interface = list->data;
+
+		DBG("index %d is gone", interface->index);
+
+		notify_dellink(interface->type, interface->index,
+					interface->flags, 0, &stats);
+	}
+
+	g_slist_free(stale);
+}
+
+static void purge_addresses(void)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GSList *stale = NULL, *list;
+
+	g_hash_table_iter_init(&iter, address_list);
+	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+		struct address_data *address = value;
+
+		if (address->generation != generation)
+			stale = g_slist_prepend(stale, key);
+	}
+
+	for (list = stale; list; list = list->next) {
+		struct address_data *address;
+
+		address = g_hash_table_lookup(address_list, list->data);
+
+		DBG("index %d address %s is gone", address->index,
+							address->address);
+
+		__connman_ipconfig_deladdr(address->index, address->family,
+					address->label, address->prefixlen,
+					address->address);
+
+		g_hash_table_remove(address_list, list->data);
+	}
+
+	g_slist_free(stale);
+}
+
+static void purge_routes(void)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GSList *stale = NULL, *list;
+
+	g_hash_table_iter_init(&iter, route_list);
+	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+		struct route_data *route = value;
+
+		if (route->generation != generation)
+			stale = g_slist_prepend(stale, key);
+	}
+
+	for (list = stale; list; list = list->next) {
+		struct route_data *route;
+
+		route = g_hash_table_lookup(route_list, list->data);
+
+		DBG("index %d route %s via %s is gone", route->index,
+						route->dst, route->gateway);
+
+		notify_delroute(route->family, route->scope, route->index,
+					route->dst, route->gateway,
+					route->default_route);
+
+		g_hash_table_remove(route_list, list->data);
+	}
+
+	g_slist_free(stale);
+}
+
+static void start_resync(void)
+{
+	generation++;
+
+	DBG("generation %u", generation);
+
+	resync_active = TRUE;
+
+	if (queue_dump(RTM_GETLINK, AF_UNSPEC, &resync_link_seq) < 0 ||
+			queue_dump(RTM_GETADDR, AF_UNSPEC,
+						&resync_addr_seq) < 0 ||
+			queue_dump(RTM_GETROUTE, AF_UNSPEC,
+						&resync_route_seq) < 0) {
+		connman_error("Cannot resync rtnl state");
+		resync_active = FALSE;
+	}
+}
+
+static gboolean resync_cb(gpointer user_data)
+{
+	resync_timeout = 0;
+
+	start_resync();
+
+	return FALSE;
+}
+
+static void schedule_resync(void)
+{
+	/* Events lost while dumping are caught by another round */
+	if (resync_active == TRUE) {
+		resync_again = TRUE;
+		return;
+	}
+
+	/* Give an event storm a moment to settle */
+	if (resync_timeout == 0)
+		resync_timeout = g_timeout_add_seconds(RESYNC_DELAY,
+							resync_cb, NULL);
+}
+
+static void resync_dump_done(guint32 seq)
+{
+	if (resync_active == FALSE)
+		return;
+
+	if (seq == resync_link_seq) {
+		purge_links();
+	} else if (seq == resync_addr_seq) {
+		purge_addresses();
+	} else if (seq == resync_route_seq) {
+		purge_routes();
+
+		DBG("resync done");
+
+		resync_active = FALSE;
+
+		if (resync_again == TRUE) {
+			resync_again = FALSE;
+			schedule_resync();
+		}
+	}
+}
+
+static void resync_dump_failed(guint32 seq)
+{
+	if (resync_active == FALSE)
+		return;
+
+	if (seq != resync_link_seq && seq != resync_addr_seq &&
+						seq != resync_route_seq)
+		return;
+
+	/* Nothing is purged from a partial dump, try again later */
+	resync_active = FALSE;
+	schedule_resync();
+}
+
 static void rtnl_message(void *buf, size_t len)
 {
 	DBG("buf %p len %zd", buf, len);
@@ -1373,18 +1989,33 @@ static void rtnl_message(void *buf, size_t len)
 					hdr->nlmsg_flags, hdr->nlmsg_seq,
 					hdr->nlmsg_pid);
 
+		count_event(events_received, hdr);
+
+		/*
+		 * A buffer may hold the end of one dump and the start of
+		 * the next one, so keep going after NLMSG_DONE. The next
+		 * queued request is sent right away by process_response().
+		 */
 		switch (hdr->nlmsg_type) {
 		case NLMSG_NOOP:
+			break;
 		case NLMSG_OVERRUN:
+			schedule_resync();
 			return;
 		case NLMSG_DONE:
+			resync_dump_done(hdr->nlmsg_seq);
 			process_response(hdr->nlmsg_seq);
-			return;
+			break;
 		case NLMSG_ERROR:
 			err = NLMSG_DATA(hdr);
 			DBG("error %d (%s)", -err->error,
 						strerror(-err->error));
-			return;
+			/* A failed dump must not hold up the queue */
+			if (find_request(hdr->nlmsg_seq) != NULL) {
+				resync_dump_failed(hdr->nlmsg_seq);
+				process_response(hdr->nlmsg_seq);
+			}
+			break;
 		case RTM_NEWLINK:
 			rtnl_newlink(hdr);
 			break;
@@ -1416,100 +2047,83 @@ static void rtnl_message(void *buf, size_t len)
 static gboolean netlink_event(GIOChannel *chan,
 				GIOCondition cond, gpointer data)
 {
-	unsigned char buf[4096];
 	struct sockaddr_nl nladdr;
-	socklen_t addr_len = sizeof(nladdr);
+	socklen_t addr_len;
 	ssize_t status;
-	int fd;
+	int fd, i;
 
-	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
+	/*
+	 * An overrun is reported as G_IO_ERR, the ENOBUFS it stands for
+	 * is picked up by recvfrom() below.
+	 */
+	if (cond & (G_IO_NVAL | G_IO_HUP))
 		return FALSE;
 
-	memset(buf, 0, sizeof(buf));
-	memset(&nladdr, 0, sizeof(nladdr));
-
 	fd = g_io_channel_unix_get_fd(chan);
 
-	status = recvfrom(fd, buf, sizeof(buf), 0,
-                       (struct sockaddr *) &nladdr, &addr_len);
-	if (status < 0) {
-		if (errno == EINTR || errno == EAGAIN)
-			return TRUE;
+	for (i = 0; i < RTNL_MAX_READS; i++) {
+		memset(&nladdr, 0, sizeof(nladdr));
+		addr_len = sizeof(nladdr);
 
-		return FALSE;
-	}
+		status = recvfrom(fd, rtnl_buffer, sizeof(rtnl_buffer),
+					MSG_DONTWAIT,
+					(struct sockaddr *) &nladdr, &addr_len);
+		if (status < 0) {
+			if (errno == EINTR)
+				continue;
 
-	if (status == 0)
-		return FALSE;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
 
-	if (nladdr.nl_pid != 0) { /* not sent by kernel, ignore */
-		DBG("Received msg from %u, ignoring it", nladdr.nl_pid);
-		return TRUE;
-	}
+			/*
+			 * The kernel dropped events because the socket
+			 * buffer was full. The socket itself is fine,
+			 * the lost state is recovered by a resync.
+			 */
+			if (errno == ENOBUFS) {
+				connman_warn("rtnl socket overrun, "
+						"events were lost");
+				schedule_resync();
+				continue;
+			}
 
-	rtnl_message(buf, status);
+			return FALSE;
+		}
+
+		if (status == 0)
+			return FALSE;
+
+		if (nladdr.nl_pid != 0) { /* not sent by kernel, ignore */
+			DBG("Received msg from %u, ignoring it",
+							nladdr.nl_pid);
+			continue;
+		}
+
+		rtnl_message(rtnl_buffer, status);
+	}
 
 	return TRUE;
 }
 
 static int send_getlink(void)
 {
-	struct rtnl_request *req;
-
 	DBG("");
 
-	req = g_try_malloc0(RTNL_REQUEST_SIZE);
-	if (req == NULL)
-		return -ENOMEM;
-
-	req->hdr.nlmsg_len = RTNL_REQUEST_SIZE;
-	req->hdr.nlmsg_type = RTM_GETLINK;
-	req->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-	req->hdr.nlmsg_pid = 0;
-	req->hdr.nlmsg_seq = request_seq++;
-	req->msg.rtgen_family = AF_INET;
-
-	return queue_request(req);
+	return queue_dump(RTM_GETLINK, AF_INET, NULL);
 }
 
 static int send_getaddr(void)
 {
-	struct rtnl_request *req;
-
 	DBG("");
 
-	req = g_try_malloc0(RTNL_REQUEST_SIZE);
-	if (req == NULL)
-		return -ENOMEM;
-
-	req->hdr.nlmsg_len = RTNL_REQUEST_SIZE;
-	req->hdr.nlmsg_type = RTM_GETADDR;
-	req->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-	req->hdr.nlmsg_pid = 0;
-	req->hdr.nlmsg_seq = request_seq++;
-	req->msg.rtgen_family = AF_INET;
-
-	return queue_request(req);
+	return queue_dump(RTM_GETADDR, AF_INET, NULL);
 }
 
 static int send_getroute(void)
 {
-	struct rtnl_request *req;
-
 	DBG("");
 
-	req = g_try_malloc0(RTNL_REQUEST_SIZE);
-	if (req == NULL)
-		return -ENOMEM;
-
-	req->hdr.nlmsg_len = RTNL_REQUEST_SIZE;
-	req->hdr.nlmsg_type = RTM_GETROUTE;
-	req->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-	req->hdr.nlmsg_pid = 0;
-	req->hdr.nlmsg_seq = request_seq++;
-	req->msg.rtgen_family = AF_INET;
-
-	return queue_request(req);
+	return queue_dump(RTM_GETROUTE, AF_INET, NULL);
 }
 
 static gboolean update_timeout_cb(gpointer user_data)
@@ -1584,6 +2198,28 @@ int __connman_rtnl_request_update(void)
 	return send_getlink();
 }
 
+static void set_receive_buffer(int sk)
+{
+	unsigned int value;
+	int size;
+
+	value = connman_setting_get_uint("NetlinkReceiveBufferSize");
+	if (value == 0)
+		return;
+
+	/* The socket option takes an int, larger sizes are clamped */
+	size = value > G_MAXINT ? G_MAXINT : value;
+
+	/* SO_RCVBUFFORCE is allowed to go beyond rmem_max */
+	if (setsockopt(sk, SOL_SOCKET, SO_RCVBUFFORCE,
+					&size, sizeof(size)) == 0)
+		return;
+
+	if (setsockopt(sk, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+		connman_warn("Cannot set rtnl receive buffer to %d: %s",
+						size, strerror(errno));
+}
+
 int __connman_rtnl_init(void)
 {
 	struct sockaddr_nl addr;
@@ -1593,11 +2229,17 @@ int __connman_rtnl_init(void)
 
 	interface_list = g_hash_table_new_full(g_direct_hash, g_direct_equal,
 							NULL, free_interface);
+	address_list = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, free_address);
+	route_list = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, free_route);
 
 	sk = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
 	if (sk < 0)
 		return -1;
 
+	set_receive_buffer(sk);
+
 	memset(&addr, 0, sizeof(addr));
 	addr.nl_family = AF_NETLINK;
 	addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE |
@@ -1618,6 +2260,8 @@ int __connman_rtnl_init(void)
 	g_io_add_watch(channel, G_IO_IN | G_IO_NVAL | G_IO_HUP | G_IO_ERR,
 							netlink_event, NULL);
 
+	update_filter();
+
 	return 0;
 }
 
@@ -1636,6 +2280,8 @@ void __connman_rtnl_cleanup(void)
 
 	DBG("");
 
+	print_event_counters();
+
 	for (list = watch_list; list; list = list->next) {
 		struct watch_data *watch = list->data;
 
@@ -1671,5 +2317,12 @@ void __connman_rtnl_cleanup(void)
 
 	channel = NULL;
 
+	if (resync_timeout > 0) {
+		g_source_remove(resync_timeout);
+		resync_timeout = 0;
+	}
+
+	g_hash_table_destroy(route_list);
+	g_hash_table_destroy(address_list);
 	g_hash_table_destroy(interface_list);
 }
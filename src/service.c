@@ -1117,65 +1117,97 @@ void __connman_service_nameserver_clear(struct connman_service *service)
 	update_nameservers(service);
 }
 
-static void add_nameserver_route(int family, int index, char *nameserver,
-				const char *gw)
+static struct connman_inet_route *nameserver_routes(char **nameservers,
+					enum connman_ipconfig_type type,
+					const char *gw, unsigned int *count)
 {
-	switch (family) {
-	case AF_INET:
-		if (connman_inet_compare_subnet(index, nameserver) == TRUE)
-			break;
+	struct connman_inet_route *routes;
+	int i, family;
 
-		if (connman_inet_add_host_route(index, nameserver, gw) < 0)
-			/* For P-t-P link the above route add will fail */
-			connman_inet_add_host_route(index, nameserver, NULL);
-		break;
+	*count = 0;
 
-	case AF_INET6:
-		if (connman_inet_add_ipv6_host_route(index, nameserver,
-								gw) < 0)
-			connman_inet_add_ipv6_host_route(index, nameserver,
-							NULL);
-		break;
+	routes = g_try_new0(struct connman_inet_route,
+					g_strv_length(nameservers));
+	if (routes == NULL)
+		return NULL;
+
+	for (i = 0; nameservers[i] != NULL; i++) {
+		family = connman_inet_check_ipaddress(nameservers[i]);
+
+		switch (family) {
+		case AF_INET:
+			if (type == CONNMAN_IPCONFIG_TYPE_IPV6)
+				continue;
+			break;
+		case AF_INET6:
+			if (type == CONNMAN_IPCONFIG_TYPE_IPV4)
+				continue;
+			routes[*count].prefix_len = 128;
+			break;
+		default:
+			continue;
+		}
+
+		routes[*count].family = family;
+		routes[*count].host = nameservers[i];
+		routes[*count].gateway = gw;
+		(*count)++;
 	}
+
+	return routes;
 }
 
 static void nameserver_add_routes(int index, char **nameservers,
 					const char *gw)
 {
-	int i, family;
+	struct connman_inet_route *routes;
+	unsigned int i, count, n = 0;
 
-	for (i = 0; nameservers[i] != NULL; i++) {
-		family = connman_inet_check_ipaddress(nameservers[i]);
-		if (family < 0)
+	routes = nameserver_routes(nameservers, CONNMAN_IPCONFIG_TYPE_ALL,
+								gw, &count);
+	if (routes == NULL)
+		return;
+
+	for (i = 0; i < count; i++) {
+		if (routes[i].family == AF_INET &&
+				connman_inet_compare_subnet(index,
+						routes[i].host) == TRUE)
 			continue;
 
-		add_nameserver_route(family, index, nameservers[i], gw);
+		routes[n++] = routes[i];
 	}
+
+	if (__connman_inet_add_host_routes(index, routes, n) < 0)
+		goto out;
+
+	/* For P-t-P link the routes via gateway will fail */
+	for (i = 0, count = n, n = 0; i < count; i++) {
+		if (routes[i].error == 0)
+			continue;
+
+		routes[i].gateway = NULL;
+		routes[n++] = routes[i];
+	}
+
+	__connman_inet_add_host_routes(index, routes, n);
+
+out:
+	g_free(routes);
 }
 
 static void nameserver_del_routes(int index, char **nameservers,
 				enum connman_ipconfig_type type)
 {
-	int i, family;
+	struct connman_inet_route *routes;
+	unsigned int count;
 
-	for (i = 0; nameservers[i] != NULL; i++) {
-		family = connman_inet_check_ipaddress(nameservers[i]);
-		if (family < 0)
-			continue;
+	routes = nameserver_routes(nameservers, type, NULL, &count);
+	if (routes == NULL)
+		return;
 
-		switch (family) {
-		case AF_INET:
-			if (type != CONNMAN_IPCONFIG_TYPE_IPV6)
-				connman_inet_del_host_route(index,
-							nameservers[i]);
-			break;
-		case AF_INET6:
-			if (type != CONNMAN_IPCONFIG_TYPE_IPV4)
-				connman_inet_del_ipv6_host_route(index,
-							nameservers[i]);
-			break;
-		}
-	}
+	__connman_inet_del_host_routes(index, routes, count);
+
+	g_free(routes);
 }
 
 void __connman_service_nameserver_add_routes(struct connman_service *service,
@@ -6691,6 +6723,13 @@ static void remove_unprovisioned_services()
 		return;
 
 	for (;services[i] != NULL; i++) {
+		struct connman_storage_service_info info;
+
+		/* Only provisioned services need their keyfile parsed here */
+		if (connman_storage_get_service_info(services[i], &info) == 0 &&
+				info.provisioned == FALSE)
+			continue;
+
 		file = section = NULL;
 		keyfile = configkeyfile = NULL;
 
@@ -25,6 +25,7 @@
 #endif
 
 #include <errno.h>
+#include <inttypes.h>
 
 #include <gdbus.h>
 
@@ -40,6 +41,30 @@ static GSList *policy_list;
 static uint32_t session_mark = 256;
 static struct firewall_context *global_firewall;
 
+/*
+ * Sessions indexed by the service types their allowed bearers can
+ * match, so that a service event only visits the interested sessions.
+ * Sessions allowing any bearer live in the CONNMAN_SERVICE_TYPE_UNKNOWN
+ * slot.
+ */
+#define MAX_SERVICE_TYPES	(CONNMAN_SERVICE_TYPE_GADGET + 1)
+
+static GHashTable *type_sessions[MAX_SERVICE_TYPES];
+
+/*
+ * State changes are sent to the session owner right away. Setting
+ * changes (IP configuration, allowed bearers, connection type) are
+ * collected for SESSION_NOTIFY_DELAY milliseconds and sent as one
+ * Update message.
+ */
+#define SESSION_NOTIFY_DELAY	500
+
+/*
+ * The accounting objects of all sessions are read with one batched
+ * nfacct dump every SessionStatisticsInterval seconds.
+ */
+static guint stats_timeout;
+
 enum connman_session_trigger {
 	CONNMAN_SESSION_TRIGGER_UNKNOWN		= 0,
 	CONNMAN_SESSION_TRIGGER_SETTING		= 1,
@@ -105,6 +130,19 @@ struct connman_session {
 
 	GList *service_list;
 	GHashTable *service_hash;
+
+	guint notify_timeout;
+	connman_bool_t pending_ipv4;
+	connman_bool_t pending_ipv6;
+	uint32_t notify_sent;
+	uint32_t notify_coalesced;
+
+	uint64_t rx_packets;
+	uint64_t rx_bytes;
+	uint64_t tx_packets;
+	uint64_t tx_bytes;
+	uint64_t stats_unpublished;
+	connman_bool_t pending_stats;
 };
 
 static const char *trigger2string(enum connman_session_trigger trigger)
@@ -250,17 +288,7 @@ static int init_firewall(void)
 
 	fw = __connman_firewall_create();
 
-	err = __connman_firewall_add_rule(fw, "mangle", "INPUT",
-					"-j CONNMARK --restore-mark");
-	if (err < 0)
-		goto err;
-
-	err = __connman_firewall_add_rule(fw, "mangle", "POSTROUTING",
-					"-j CONNMARK --save-mark");
-	if (err < 0)
-		goto err;
-
-	err = __connman_firewall_enable(fw);
+	err = __connman_firewall_enable_connmark(fw);
 	if (err < 0)
 		goto err;
 
@@ -279,13 +307,14 @@ static void cleanup_firewall(void)
 	if (global_firewall == NULL)
 		return;
 
-	__connman_firewall_disable(global_firewall);
+	__connman_firewall_disable_connmark(global_firewall);
 	__connman_firewall_destroy(global_firewall);
 }
 
 static int init_firewall_session(struct connman_session *session)
 {
 	struct firewall_context *fw;
+	char *input, *output;
 	int err;
 
 	if (session->policy_config->id_type == CONNMAN_SESSION_ID_TYPE_UNKNOWN)
@@ -297,46 +326,26 @@ static int init_firewall_session(struct connman_session *session)
 	if (fw == NULL)
 		return -ENOMEM;
 
-	switch (session->policy_config->id_type) {
-	case CONNMAN_SESSION_ID_TYPE_UID:
-		err = __connman_firewall_add_rule(fw, "mangle", "OUTPUT",
-				"-m owner --uid-owner %s -j MARK --set-mark %d",
-						session->policy_config->id,
-						session->mark);
-		break;
-	case CONNMAN_SESSION_ID_TYPE_GID:
-		err = __connman_firewall_add_rule(fw, "mangle", "OUTPUT",
-				"-m owner --gid-owner %s -j MARK --set-mark %d",
-						session->policy_config->id,
-						session->mark);
-		break;
-	case CONNMAN_SESSION_ID_TYPE_LSM:
-	default:
-		err = -EINVAL;
-	}
-
+	err = __connman_firewall_enable_marking(fw,
+					session->policy_config->id_type,
+					session->policy_config->id,
+					session->mark);
 	if (err < 0)
 		goto err;
 
 	session->id_type = session->policy_config->id_type;
 
-	err = __connman_firewall_add_rule(fw, "filter", "INPUT",
-		"-m mark --mark %d -m nfacct --nfacct-name session-input-%d",
-		session->mark,
-		session->mark);
-	if (err < 0)
-		goto err;
-
-	err = __connman_firewall_add_rule(fw, "filter", "OUTPUT",
-		"-m mark --mark %d -m nfacct --nfacct-name session-output-%d",
-		session->mark,
-		session->mark);
-	if (err < 0)
-		goto err;
+	input = g_strdup_printf("session-input-%d", session->mark);
+	output = g_strdup_printf("session-output-%d", session->mark);
 
-	err = __connman_firewall_enable(fw);
-	if (err)
+	err = __connman_firewall_enable_accounting(fw, session->mark,
+							input, output);
+	g_free(input);
+	g_free(output);
+	if (err < 0) {
+		__connman_firewall_disable_marking(fw);
 		goto err;
+	}
 
 	session->fw = fw;
 
@@ -353,7 +362,8 @@ static void cleanup_firewall_session(struct connman_session *session)
 	if (session->fw == NULL)
 		return;
 
-	__connman_firewall_disable(session->fw);
+	__connman_firewall_disable_accounting(session->fw);
+	__connman_firewall_disable_marking(session->fw);
 	__connman_firewall_destroy(session->fw);
 
 	session->fw = NULL;
@@ -438,6 +448,16 @@ static void update_routing_table(struct connman_session *session)
 	add_default_route(session);
 }
 
+static void unsubscribe_session(struct connman_session *session)
+{
+	int i;
+
+	for (i = 0; i < MAX_SERVICE_TYPES; i++) {
+		if (type_sessions[i] != NULL)
+			g_hash_table_remove(type_sessions[i], session);
+	}
+}
+
 static void destroy_policy_config(struct connman_session *session)
 {
 	if (session->policy == NULL) {
@@ -456,6 +476,9 @@ static void free_session(struct connman_session *session)
 	if (session->notify_watch > 0)
 		g_dbus_remove_watch(connection, session->notify_watch);
 
+	if (session->notify_timeout > 0)
+		g_source_remove(session->notify_timeout);
+
 	destroy_policy_config(session);
 	g_slist_free(session->info->config.allowed_bearers);
 	g_free(session->owner);
@@ -505,6 +528,8 @@ static void cleanup_session(gpointer user_data)
 
 	DBG("remove %s", session->session_path);
 
+	unsubscribe_session(session);
+
 	cleanup_routing_table(session);
 	cleanup_firewall_session(session);
 
@@ -911,8 +936,47 @@ static void append_notify(DBusMessageIter *dict,
 						&bearer);
 
 		info_last->entry = info->entry;
+	} else if (info->entry != NULL) {
+		if (session->pending_ipv4 == TRUE)
+			connman_dbus_dict_append_dict(dict, "IPv4",
+						append_ipconfig_ipv4,
+						info->entry->service);
+
+		if (session->pending_ipv6 == TRUE)
+			connman_dbus_dict_append_dict(dict, "IPv6",
+						append_ipconfig_ipv6,
+						info->entry->service);
 	}
 
+	session->pending_ipv4 = FALSE;
+	session->pending_ipv6 = FALSE;
+
+	if (session->pending_stats == TRUE) {
+		connman_dbus_dict_append_basic(dict, "RxPackets",
+						DBUS_TYPE_UINT64,
+						&session->rx_packets);
+		connman_dbus_dict_append_basic(dict, "RxBytes",
+						DBUS_TYPE_UINT64,
+						&session->rx_bytes);
+		connman_dbus_dict_append_basic(dict, "TxPackets",
+						DBUS_TYPE_UINT64,
+						&session->tx_packets);
+		connman_dbus_dict_append_basic(dict, "TxBytes",
+						DBUS_TYPE_UINT64,
+						&session->tx_bytes);
+	}
+
+	if (session->append_all == TRUE || session->pending_stats == TRUE) {
+		connman_dbus_dict_append_basic(dict, "NotificationsSent",
+						DBUS_TYPE_UINT32,
+						&session->notify_sent);
+		connman_dbus_dict_append_basic(dict, "NotificationsCoalesced",
+						DBUS_TYPE_UINT32,
+						&session->notify_coalesced);
+	}
+
+	session->pending_stats = FALSE;
+
 	if (session->append_all == TRUE ||
 			info->config.type != info_last->config.type) {
 		const char *type = type2string(info->config.type);
@@ -978,6 +1042,31 @@ static connman_bool_t compute_notifiable_changes(struct connman_session *session
 			info->config.type != info_last->config.type)
 		return TRUE;
 
+	if (info->entry != NULL && (session->pending_ipv4 == TRUE ||
+					session->pending_ipv6 == TRUE))
+		return TRUE;
+
+	if (session->pending_stats == TRUE)
+		return TRUE;
+
+	return FALSE;
+}
+
+static connman_bool_t is_urgent_change(struct connman_session *session)
+{
+	struct session_info *info_last = session->info_last;
+	struct session_info *info = session->info;
+
+	if (session->append_all == TRUE)
+		return TRUE;
+
+	if (info->state != info_last->state)
+		return TRUE;
+
+	if (info->entry != info_last->entry &&
+			info->state >= CONNMAN_SESSION_STATE_CONNECTED)
+		return TRUE;
+
 	return FALSE;
 }
 
@@ -987,11 +1076,19 @@ static gboolean session_notify(gpointer user_data)
 	DBusMessage *msg;
 	DBusMessageIter array, dict;
 
+	if (session->notify_timeout > 0) {
+		g_source_remove(session->notify_timeout);
+		session->notify_timeout = 0;
+	}
+
 	if (compute_notifiable_changes(session) == FALSE)
 		return FALSE;
 
-	DBG("session %p owner %s notify_path %s", session,
-		session->owner, session->notify_path);
+	session->notify_sent++;
+
+	DBG("session %p owner %s notify_path %s sent %u coalesced %u",
+		session, session->owner, session->notify_path,
+		session->notify_sent, session->notify_coalesced);
 
 	msg = dbus_message_new_method_call(session->owner, session->notify_path,
 						CONNMAN_NOTIFICATION_INTERFACE,
@@ -1011,22 +1108,96 @@ static gboolean session_notify(gpointer user_data)
 	return FALSE;
 }
 
+static gboolean session_notify_timeout(gpointer user_data)
+{
+	struct connman_session *session = user_data;
+
+	session->notify_timeout = 0;
+
+	session_notify(session);
+
+	return FALSE;
+}
+
+static void session_schedule_notify(struct connman_session *session)
+{
+	if (is_urgent_change(session) == TRUE) {
+		session_notify(session);
+		return;
+	}
+
+	if (compute_notifiable_changes(session) == FALSE)
+		return;
+
+	if (session->notify_timeout > 0) {
+		session->notify_coalesced++;
+		return;
+	}
+
+	session->notify_timeout = g_timeout_add(SESSION_NOTIFY_DELAY,
+					session_notify_timeout, session);
+}
+
 static void ipconfig_ipv4_changed(struct connman_session *session)
 {
-	struct session_info *info = session->info;
+	session->pending_ipv4 = TRUE;
 
-	connman_dbus_setting_changed_dict(session->owner, session->notify_path,
-						"IPv4", append_ipconfig_ipv4,
-						info->entry->service);
+	session_schedule_notify(session);
 }
 
 static void ipconfig_ipv6_changed(struct connman_session *session)
+{
+	session->pending_ipv6 = TRUE;
+
+	session_schedule_notify(session);
+}
+
+static void subscribe_session(struct connman_session *session)
 {
 	struct session_info *info = session->info;
+	GSList *list;
 
-	connman_dbus_setting_changed_dict(session->owner, session->notify_path,
-						"IPv6", append_ipconfig_ipv6,
-						info->entry->service);
+	unsubscribe_session(session);
+
+	for (list = info->config.allowed_bearers;
+			list != NULL; list = list->next) {
+		enum connman_service_type bearer = GPOINTER_TO_INT(list->data);
+
+		if (bearer >= MAX_SERVICE_TYPES)
+			continue;
+
+		if (bearer == CONNMAN_SERVICE_TYPE_UNKNOWN) {
+			unsubscribe_session(session);
+			g_hash_table_replace(type_sessions[bearer],
+							session, session);
+			return;
+		}
+
+		g_hash_table_replace(type_sessions[bearer], session, session);
+	}
+}
+
+static GSList *matching_sessions(struct connman_service *service)
+{
+	enum connman_service_type type;
+	GHashTableIter iter;
+	gpointer key;
+	GSList *list = NULL;
+
+	g_hash_table_iter_init(&iter,
+			type_sessions[CONNMAN_SERVICE_TYPE_UNKNOWN]);
+	while (g_hash_table_iter_next(&iter, &key, NULL) == TRUE)
+		list = g_slist_prepend(list, key);
+
+	type = connman_service_get_type(service);
+	if (type == CONNMAN_SERVICE_TYPE_UNKNOWN || type >= MAX_SERVICE_TYPES)
+		return list;
+
+	g_hash_table_iter_init(&iter, type_sessions[type]);
+	while (g_hash_table_iter_next(&iter, &key, NULL) == TRUE)
+		list = g_slist_prepend(list, key);
+
+	return list;
 }
 
 static connman_bool_t service_type_match(struct connman_session *session,
@@ -1488,6 +1659,9 @@ static void iterate_service_cb(struct connman_service *service,
 	struct connman_session *session = user_data;
 	struct service_entry *entry;
 
+	if (g_hash_table_lookup(session->service_hash, service) != NULL)
+		return;
+
 	if (service_match(session, service) == FALSE)
 		return;
 
@@ -1495,7 +1669,12 @@ static void iterate_service_cb(struct connman_service *service,
 	if (entry == NULL)
 		return;
 
+	DBG("service %p type %s name %s", entry->service,
+		service2bearer(connman_service_get_type(entry->service)),
+		entry->name);
+
 	g_hash_table_replace(session->service_hash, service, entry);
+	session->service_list = g_list_prepend(session->service_list, entry);
 }
 
 static void destroy_service_entry(gpointer data)
@@ -1517,28 +1696,46 @@ static void destroy_service_entry(gpointer data)
 
 static void populate_service_list(struct connman_session *session)
 {
-	GHashTableIter iter;
-	gpointer key, value;
-
 	session->service_hash =
 		g_hash_table_new_full(g_direct_hash, g_direct_equal,
 					NULL, destroy_service_entry);
 	__connman_service_iterate_services(iterate_service_cb, session);
 
+	session->service_list = g_list_sort_with_data(session->service_list,
+						sort_services, session);
+
+	subscribe_session(session);
+}
+
+static void update_service_list(struct connman_session *session)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	/*
+	 * Only drop the entries which do not match the new allowed
+	 * bearers anymore. If the selected service goes away this
+	 * way, destroy_service_entry() takes care of deselecting it.
+	 */
 	g_hash_table_iter_init(&iter, session->service_hash);
 
 	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
 		struct service_entry *entry = value;
 
-		DBG("service %p type %s name %s", entry->service,
-			service2bearer(connman_service_get_type(entry->service)),
-			entry->name);
-		session->service_list = g_list_prepend(session->service_list,
+		if (service_match(session, entry->service) == TRUE)
+			continue;
+
+		session->service_list = g_list_remove(session->service_list,
 							entry);
+		g_hash_table_iter_remove(&iter);
 	}
 
+	__connman_service_iterate_services(iterate_service_cb, session);
+
 	session->service_list = g_list_sort_with_data(session->service_list,
 						sort_services, session);
+
+	subscribe_session(session);
 }
 
 static void session_changed(struct connman_session *session,
@@ -1546,9 +1743,6 @@ static void session_changed(struct connman_session *session,
 {
 	struct session_info *info = session->info;
 	struct session_info *info_last = session->info_last;
-	struct connman_service *service;
-	struct service_entry *entry = NULL, *entry_last = NULL;
-	GHashTable *service_hash_last;
 
 	/*
 	 * TODO: This only a placeholder for the 'real' algorithm to
@@ -1572,38 +1766,8 @@ static void session_changed(struct connman_session *session,
 		DBG("ignore session changed event");
 		return;
 	case CONNMAN_SESSION_TRIGGER_SETTING:
-		if (info->config.allowed_bearers != info_last->config.allowed_bearers) {
-
-			service_hash_last = session->service_hash;
-			g_list_free(session->service_list);
-			session->service_list = NULL;
-
-			if (info->entry != NULL)
-				service = info->entry->service;
-			else
-				service = NULL;
-
-			populate_service_list(session);
-
-			if (info->entry != NULL) {
-				entry_last = g_hash_table_lookup(
-							service_hash_last,
-							info->entry->service);
-				entry = g_hash_table_lookup(
-							session->service_hash,
-							service);
-			}
-
-			if (entry == NULL && entry_last != NULL) {
-				/*
-				 * The currently selected service is
-				 * not part of this session anymore.
-				 */
-				deselect_and_disconnect(session);
-			}
-
-			g_hash_table_destroy(service_hash_last);
-		}
+		if (info->config.allowed_bearers != info_last->config.allowed_bearers)
+			update_service_list(session);
 
 		if (info->config.type != info_last->config.type) {
 			if (info->state >= CONNMAN_SESSION_STATE_CONNECTED &&
@@ -1661,7 +1825,7 @@ static void session_changed(struct connman_session *session,
 		break;
 	}
 
-	session_notify(session);
+	session_schedule_notify(session);
 }
 
 int connman_session_config_update(struct connman_session *session)
@@ -1678,8 +1842,12 @@ int connman_session_config_update(struct connman_session *session)
 	 */
 
 	if (session->id_type != session->policy_config->id_type) {
+		/* Swap the rules in a single firewall transaction */
+		__connman_firewall_begin();
 		cleanup_firewall_session(session);
 		err = init_firewall_session(session);
+		if (__connman_firewall_end() < 0 && err == 0)
+			err = -EIO;
 		if (err < 0) {
 			connman_session_destroy(session);
 			return err;
@@ -1899,15 +2067,58 @@ static const GDBusMethodTable session_methods[] = {
 	{ },
 };
 
-static void session_nfacct_stats_cb(struct nfacct_context *ctx,
+static void session_stats_changed(struct connman_session *session,
+					uint64_t bytes)
+{
+	uint64_t threshold;
+
+	session->stats_unpublished += bytes;
+
+	threshold = connman_setting_get_uint64("SessionStatisticsThreshold");
+	if (session->stats_unpublished < threshold)
+		return;
+
+	session->stats_unpublished = 0;
+	session->pending_stats = TRUE;
+
+	session_schedule_notify(session);
+}
+
+static void session_nfacct_input_cb(struct nfacct_context *ctx,
 					uint64_t packets, uint64_t bytes,
 					void *user_data)
 {
 	struct connman_session *session = user_data;
 
-	DBG("session %p", session);
+	DBG("session %p packets %" PRIu64 " bytes %" PRIu64,
+					session, packets, bytes);
+
+	session->rx_packets += packets;
+	session->rx_bytes += bytes;
 
-	/* XXX add accounting code here */
+	session_stats_changed(session, bytes);
+}
+
+static void session_nfacct_output_cb(struct nfacct_context *ctx,
+					uint64_t packets, uint64_t bytes,
+					void *user_data)
+{
+	struct connman_session *session = user_data;
+
+	DBG("session %p packets %" PRIu64 " bytes %" PRIu64,
+					session, packets, bytes);
+
+	session->tx_packets += packets;
+	session->tx_bytes += bytes;
+
+	session_stats_changed(session, bytes);
+}
+
+static gboolean session_stats_timeout(gpointer user_data)
+{
+	__connman_nfacct_update_stats();
+
+	return TRUE;
 }
 
 static int session_create_final(struct creation_data *creation_data,
@@ -2046,7 +2257,7 @@ static int session_policy_config_cb(struct connman_session *session,
 
 	input = g_strdup_printf("session-input-%d", session->mark);
 	err = __connman_nfacct_add(session->nfctx, input,
-					session_nfacct_stats_cb,
+					session_nfacct_input_cb,
 					session);
 	g_free(input);
 	if (err < 0)
@@ -2054,7 +2265,7 @@ static int session_policy_config_cb(struct connman_session *session,
 
 	output = g_strdup_printf("session-output-%d", session->mark);
 	err = __connman_nfacct_add(session->nfctx, output,
-					session_nfacct_stats_cb,
+					session_nfacct_output_cb,
 					session);
 	g_free(output);
 	if (err < 0)
@@ -2300,17 +2511,16 @@ void __connman_session_set_mode(connman_bool_t enable)
 static void service_add(struct connman_service *service,
 			const char *name)
 {
-	GHashTableIter iter;
-	gpointer key, value;
+	GSList *sessions, *list;
 	struct connman_session *session;
 	struct service_entry *entry;
 
 	DBG("service %p", service);
 
-	g_hash_table_iter_init(&iter, session_hash);
+	sessions = matching_sessions(service);
 
-	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
-		session = value;
+	for (list = sessions; list != NULL; list = list->next) {
+		session = list->data;
 
 		if (service_match(session, service) == FALSE)
 			continue;
@@ -2327,23 +2537,23 @@ static void service_add(struct connman_service *service,
 
 		session_changed(session, CONNMAN_SESSION_TRIGGER_SERVICE);
 	}
+
+	g_slist_free(sessions);
 }
 
 static void service_remove(struct connman_service *service)
 {
-
-	GHashTableIter iter;
-	gpointer key, value;
+	GSList *sessions, *list;
 	struct connman_session *session;
 	struct session_info *info;
 
 	DBG("service %p", service);
 
-	g_hash_table_iter_init(&iter, session_hash);
+	sessions = matching_sessions(service);
 
-	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+	for (list = sessions; list != NULL; list = list->next) {
 		struct service_entry *entry;
-		session = value;
+		session = list->data;
 		info = session->info;
 
 		entry = g_hash_table_lookup(session->service_hash, service);
@@ -2359,20 +2569,21 @@ static void service_remove(struct connman_service *service)
 			info->entry = NULL;
 		session_changed(session, CONNMAN_SESSION_TRIGGER_SERVICE);
 	}
+
+	g_slist_free(sessions);
 }
 
 static void service_state_changed(struct connman_service *service,
 					enum connman_service_state state)
 {
-	GHashTableIter iter;
-	gpointer key, value;
+	GSList *sessions, *list;
 
 	DBG("service %p state %d", service, state);
 
-	g_hash_table_iter_init(&iter, session_hash);
+	sessions = matching_sessions(service);
 
-	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
-		struct connman_session *session = value;
+	for (list = sessions; list != NULL; list = list->next) {
+		struct connman_session *session = list->data;
 		struct service_entry *entry;
 
 		entry = g_hash_table_lookup(session->service_hash, service);
@@ -2382,13 +2593,14 @@ static void service_state_changed(struct connman_service *service,
 		session_changed(session,
 				CONNMAN_SESSION_TRIGGER_SERVICE);
 	}
+
+	g_slist_free(sessions);
 }
 
 static void ipconfig_changed(struct connman_service *service,
 				struct connman_ipconfig *ipconfig)
 {
-	GHashTableIter iter;
-	gpointer key, value;
+	GSList *sessions, *list;
 	struct connman_session *session;
 	struct session_info *info;
 	enum connman_ipconfig_type type;
@@ -2397,10 +2609,10 @@ static void ipconfig_changed(struct connman_service *service,
 
 	type = __connman_ipconfig_get_config_type(ipconfig);
 
-	g_hash_table_iter_init(&iter, session_hash);
+	sessions = matching_sessions(service);
 
-	while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
-		session = value;
+	for (list = sessions; list != NULL; list = list->next) {
+		session = list->data;
 		info = session->info;
 
 		if (info->state == CONNMAN_SESSION_STATE_DISCONNECTED)
@@ -2413,6 +2625,8 @@ static void ipconfig_changed(struct connman_service *service,
 				ipconfig_ipv6_changed(session);
 		}
 	}
+
+	g_slist_free(sessions);
 }
 
 static struct connman_notifier session_notifier = {
@@ -2435,7 +2649,8 @@ static int session_nfacct_flush_cb(unsigned int error, void *user_data)
 
 int __connman_session_init(void)
 {
-	int err;
+	unsigned int interval;
+	int err, i;
 
 	DBG("");
 
@@ -2457,15 +2672,26 @@ int __connman_session_init(void)
 	session_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
 						NULL, cleanup_session);
 
+	for (i = 0; i < MAX_SERVICE_TYPES; i++)
+		type_sessions[i] = g_hash_table_new(g_direct_hash,
+							g_direct_equal);
+
 	sessionmode = FALSE;
 
 	__connman_nfacct_flush(session_nfacct_flush_cb, NULL);
 
+	interval = connman_setting_get_uint("SessionStatisticsInterval");
+	if (interval > 0)
+		stats_timeout = g_timeout_add_seconds(interval,
+						session_stats_timeout, NULL);
+
 	return 0;
 }
 
 void __connman_session_cleanup(void)
 {
+	int i;
+
 	DBG("");
 
 	if (connection == NULL)
@@ -2475,9 +2701,19 @@ void __connman_session_cleanup(void)
 
 	connman_notifier_unregister(&session_notifier);
 
+	if (stats_timeout > 0) {
+		g_source_remove(stats_timeout);
+		stats_timeout = 0;
+	}
+
 	g_hash_table_foreach(session_hash, release_session, NULL);
 	g_hash_table_destroy(session_hash);
 	session_hash = NULL;
 
+	for (i = 0; i < MAX_SERVICE_TYPES; i++) {
+		g_hash_table_destroy(type_sessions[i]);
+		type_sessions[i] = NULL;
+	}
+
 	dbus_connection_unref(connection);
 }
@@ -34,6 +34,7 @@
 
 #define SETTINGS	"settings"
 #define DEFAULT		"default.profile"
+#define INDEX		"services.index"
 
 #define MODE		(S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | \
 			S_IXGRP | S_IROTH | S_IXOTH)
@@ -86,6 +87,326 @@ static void storage_delete(const char *pathname)
 		connman_error("Failed to remove %s", pathname);
 }
 
+/*
+ * The services index caches the handful of per-service values that are
+ * needed at startup (favorite, autoconnect, last modification time and
+ * security) so that the settings keyfile of every remembered service does
+ * not need to be parsed before a matching network actually shows up.
+ * Each record also remembers the modification time of the settings file
+ * it was taken from, so that records gone stale are noticed at startup.
+ *
+ * On disk the index is a header followed by an array of fixed size records
+ * and a pool of NUL terminated strings referenced by offset, so it can be
+ * mapped and walked without any parsing.
+ */
+#define INDEX_MAGIC	0x434d5349	/* "CMSI" */
+#define INDEX_VERSION	2
+
+#define INDEX_FLAG_FAVORITE	0x01
+#define INDEX_FLAG_AUTOCONNECT	0x02
+#define INDEX_FLAG_HIDDEN	0x04
+#define INDEX_FLAG_PROVISIONED	0x08
+
+struct index_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t strings_length;
+};
+
+struct index_record {
+	uint32_t identifier;
+	uint32_t security;
+	int64_t modified;
+	int64_t mtime;
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+struct index_entry {
+	char *identifier;
+	char *security;
+	time_t modified;
+	int64_t mtime;
+	uint32_t flags;
+};
+
+static GHashTable *service_index = NULL;
+static guint index_timeout = 0;
+
+static void free_index_entry(gpointer data)
+{
+	struct index_entry *entry = data;
+
+	g_free(entry->identifier);
+	g_free(entry->security);
+	g_free(entry);
+}
+
+static const char *index_string(const char *strings, uint32_t length,
+							uint32_t offset)
+{
+	if (offset >= length)
+		return NULL;
+
+	if (memchr(strings + offset, '\0', length - offset) == NULL)
+		return NULL;
+
+	return strings + offset;
+}
+
+static int index_read(void)
+{
+	GMappedFile *mapped;
+	GError *error = NULL;
+	const struct index_header *header;
+	const struct index_record *records;
+	const char *strings, *data;
+	gchar *pathname;
+	gsize length;
+	uint32_t i;
+	int err = 0;
+
+	pathname = g_strdup_printf("%s/%s", STORAGEDIR, INDEX);
+	if (pathname == NULL)
+		return -ENOMEM;
+
+	mapped = g_mapped_file_new(pathname, FALSE, &error);
+	g_free(pathname);
+
+	if (mapped == NULL) {
+		DBG("Unable to map services index: %s", error->message);
+		g_clear_error(&error);
+		return -ENOENT;
+	}
+
+	data = g_mapped_file_get_contents(mapped);
+	length = g_mapped_file_get_length(mapped);
+
+	if (length < sizeof(*header)) {
+		err = -EINVAL;
+		goto done;
+	}
+
+	header = (const struct index_header *) data;
+	if (header->magic != INDEX_MAGIC ||
+			header->version != INDEX_VERSION) {
+		err = -EINVAL;
+		goto done;
+	}
+
+	if (length != sizeof(*header) +
+			(gsize) header->count * sizeof(*records) +
+			header->strings_length) {
+		err = -EINVAL;
+		goto done;
+	}
+
+	records = (const struct index_record *) (header + 1);
+	strings = (const char *) (records + header->count);
+
+	for (i = 0; i < header->count; i++) {
+		struct index_entry *entry;
+		const char *identifier, *security;
+
+		identifier = index_string(strings, header->strings_length,
+						records[i].identifier);
+		security = index_string(strings, header->strings_length,
+						records[i].security);
+		if (identifier == NULL || security == NULL) {
+			g_hash_table_remove_all(service_index);
+			err = -EINVAL;
+			goto done;
+		}
+
+		entry = g_try_new0(struct index_entry, 1);
+		if (entry == NULL) {
+			err = -ENOMEM;
+			goto done;
+		}
+
+		entry->identifier = g_strdup(identifier);
+		entry->security = g_strdup(security);
+		entry->modified = records[i].modified;
+		entry->mtime = records[i].mtime;
+		entry->flags = records[i].flags;
+
+		g_hash_table_replace(service_index, entry->identifier, entry);
+	}
+
+done:
+	g_mapped_file_unref(mapped);
+
+	return err;
+}
+
+static int index_write(void)
+{
+	struct index_header header;
+	struct index_record *records;
+	GHashTableIter iter;
+	gpointer value;
+	GString *strings;
+	GString *data;
+	gchar *pathname;
+	GError *error = NULL;
+	uint32_t i = 0;
+	int err = 0;
+
+	header.magic = INDEX_MAGIC;
+	header.version = INDEX_VERSION;
+	header.count = g_hash_table_size(service_index);
+
+	records = g_try_new0(struct index_record, header.count);
+	if (records == NULL && header.count > 0)
+		return -ENOMEM;
+
+	strings = g_string_new(NULL);
+
+	g_hash_table_iter_init(&iter, service_index);
+	while (g_hash_table_iter_next(&iter, NULL, &value) == TRUE) {
+		struct index_entry *entry = value;
+
+		records[i].identifier = strings->len;
+		g_string_append_len(strings, entry->identifier,
+					strlen(entry->identifier) + 1);
+
+		records[i].security = strings->len;
+		g_string_append_len(strings, entry->security,
+					strlen(entry->security) + 1);
+
+		records[i].modified = entry->modified;
+		records[i].mtime = entry->mtime;
+		records[i].flags = entry->flags;
+		i++;
+	}
+
+	header.strings_length = strings->len;
+
+	data = g_string_sized_new(sizeof(header) +
+			header.count * sizeof(*records) + strings->len);
+	g_string_append_len(data, (const gchar *) &header, sizeof(header));
+	g_string_append_len(data, (const gchar *) records,
+				header.count * sizeof(*records));
+	g_string_append_len(data, strings->str, strings->len);
+
+	g_free(records);
+	g_string_free(strings, TRUE);
+
+	pathname = g_strdup_printf("%s/%s", STORAGEDIR, INDEX);
+
+	if (!g_file_set_contents(pathname, data->str, data->len, &error)) {
+		DBG("Failed to store services index: %s", error->message);
+		g_error_free(error);
+		err = -EIO;
+	}
+
+	g_free(pathname);
+	g_string_free(data, TRUE);
+
+	DBG("Stored %u services in index", header.count);
+
+	return err;
+}
+
+static gboolean index_write_timeout(gpointer user_data)
+{
+	index_timeout = 0;
+
+	index_write();
+
+	return FALSE;
+}
+
+static void index_schedule_write(void)
+{
+	if (index_timeout > 0)
+		return;
+
+	index_timeout = g_timeout_add_seconds(1, index_write_timeout, NULL);
+}
+
+/* Modification time of the settings file in nanoseconds, 0 if missing */
+static int64_t settings_mtime(const char *service_id)
+{
+	struct stat st;
+	gchar *pathname;
+	int err;
+
+	pathname = g_strdup_printf("%s/%s/%s", STORAGEDIR, service_id,
+								SETTINGS);
+	err = stat(pathname, &st);
+	g_free(pathname);
+
+	if (err < 0)
+		return 0;
+
+	return (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static void index_update(const char *service_id, GKeyFile *keyfile)
+{
+	struct index_entry *entry;
+	const char *security;
+	GTimeVal modified;
+	gchar *str;
+
+	if (service_index == NULL)
+		return;
+
+	entry = g_hash_table_lookup(service_index, service_id);
+	if (entry == NULL) {
+		entry = g_try_new0(struct index_entry, 1);
+		if (entry == NULL)
+			return;
+
+		entry->identifier = g_strdup(service_id);
+		g_hash_table_replace(service_index, entry->identifier, entry);
+	}
+
+	/* The security is always the last component of the identifier */
+	security = strrchr(service_id, '_');
+	g_free(entry->security);
+	entry->security = g_strdup(security != NULL ? security + 1 : "");
+
+	entry->flags = 0;
+
+	if (g_key_file_get_boolean(keyfile, service_id,
+					"Favorite", NULL) == TRUE)
+		entry->flags |= INDEX_FLAG_FAVORITE;
+
+	if (g_key_file_get_boolean(keyfile, service_id,
+					"AutoConnect", NULL) == TRUE)
+		entry->flags |= INDEX_FLAG_AUTOCONNECT;
+
+	if (g_key_file_get_boolean(keyfile, service_id,
+					"Hidden", NULL) == TRUE)
+		entry->flags |= INDEX_FLAG_HIDDEN;
+
+	if (g_key_file_has_key(keyfile, service_id,
+					"Config.file", NULL) == TRUE)
+		entry->flags |= INDEX_FLAG_PROVISIONED;
+
+	entry->mtime = settings_mtime(service_id);
+	entry->modified = 0;
+
+	str = g_key_file_get_string(keyfile, service_id, "Modified", NULL);
+	if (str != NULL) {
+		if (g_time_val_from_iso8601(str, &modified) == TRUE)
+			entry->modified = modified.tv_sec;
+		g_free(str);
+	}
+}
+
+static void index_remove(const char *service_id)
+{
+	if (service_index == NULL)
+		return;
+
+	if (g_hash_table_remove(service_index, service_id) == TRUE)
+		index_schedule_write();
+}
+
 GKeyFile *__connman_storage_load_global(void)
 {
 	gchar *pathname;
@@ -185,7 +506,16 @@ GKeyFile *__connman_storage_open_service(const char *service_id)
 	return keyfile;
 }
 
-gchar **connman_storage_get_services(void)
+static gboolean is_service_dir(const struct dirent *d)
+{
+	if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0 ||
+			strncmp(d->d_name, "provider_", 9) == 0)
+		return FALSE;
+
+	return d->d_type == DT_DIR || d->d_type == DT_UNKNOWN;
+}
+
+static gchar **scan_services(void)
 {
 	struct dirent *d;
 	gchar *str;
@@ -202,28 +532,20 @@ gchar **connman_storage_get_services(void)
 	result = g_string_new(NULL);
 
 	while ((d = readdir(dir))) {
-		if (strcmp(d->d_name, ".") == 0 ||
-				strcmp(d->d_name, "..") == 0 ||
-				strncmp(d->d_name, "provider_", 9) == 0)
+		if (is_service_dir(d) == FALSE)
 			continue;
 
-		switch (d->d_type) {
-		case DT_DIR:
-		case DT_UNKNOWN:
-			/*
-			 * If the settings file is not found, then
-			 * assume this directory is not a services dir.
-			 */
-			str = g_strdup_printf("%s/%s/settings", STORAGEDIR,
-								d->d_name);
-			ret = stat(str, &buf);
-			g_free(str);
-			if (ret < 0)
-				continue;
+		/*
+		 * If the settings file is not found, then
+		 * assume this directory is not a services dir.
+		 */
+		str = g_strdup_printf("%s/%s/settings", STORAGEDIR, d->d_name);
+		ret = stat(str, &buf);
+		g_free(str);
+		if (ret < 0)
+			continue;
 
-			g_string_append_printf(result, "%s/", d->d_name);
-			break;
-		}
+		g_string_append_printf(result, "%s/", d->d_name);
 	}
 
 	closedir(dir);
@@ -242,6 +564,158 @@ gchar **connman_storage_get_services(void)
 	return services;
 }
 
+static void index_rebuild(void)
+{
+	gchar **services;
+	GKeyFile *keyfile;
+	gchar *pathname;
+	int i;
+
+	services = scan_services();
+
+	for (i = 0; services != NULL && services[i] != NULL; i++) {
+		pathname = g_strdup_printf("%s/%s/%s", STORAGEDIR,
+						services[i], SETTINGS);
+		keyfile = storage_load(pathname);
+		g_free(pathname);
+
+		if (keyfile == NULL)
+			continue;
+
+		index_update(services[i], keyfile);
+
+		g_key_file_free(keyfile);
+	}
+
+	g_strfreev(services);
+
+	index_write();
+}
+
+/*
+ * Index writes are deferred, and service directories may also be added
+ * or removed while connman is not running, so the index read at startup
+ * is checked against the directory entries. Only services missing from
+ * the index or whose settings file changed since its record was taken
+ * get their settings parsed.
+ */
+static void index_verify(void)
+{
+	GHashTable *seen;
+	GHashTableIter iter;
+	gpointer key;
+	struct dirent *d;
+	struct index_entry *entry;
+	GKeyFile *keyfile;
+	gchar *pathname;
+	gboolean changed = FALSE;
+	DIR *dir;
+
+	dir = opendir(STORAGEDIR);
+	if (dir == NULL)
+		return;
+
+	seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	while ((d = readdir(dir))) {
+		if (is_service_dir(d) == FALSE)
+			continue;
+
+		entry = g_hash_table_lookup(service_index, d->d_name);
+		if (entry != NULL && entry->mtime != 0 &&
+				entry->mtime == settings_mtime(d->d_name)) {
+			g_hash_table_replace(seen, g_strdup(d->d_name),
+							GINT_TO_POINTER(TRUE));
+			continue;
+		}
+
+		pathname = g_strdup_printf("%s/%s/%s", STORAGEDIR,
+						d->d_name, SETTINGS);
+		keyfile = storage_load(pathname);
+		g_free(pathname);
+
+		if (keyfile == NULL)
+			continue;
+
+		DBG("%s %s in services index", entry == NULL ?
+					"Adding" : "Refreshing", d->d_name);
+
+		index_update(d->d_name, keyfile);
+		g_hash_table_replace(seen, g_strdup(d->d_name),
+							GINT_TO_POINTER(TRUE));
+		changed = TRUE;
+
+		g_key_file_free(keyfile);
+	}
+
+	closedir(dir);
+
+	g_hash_table_iter_init(&iter, service_index);
+	while (g_hash_table_iter_next(&iter, &key, NULL) == TRUE) {
+		if (g_hash_table_lookup(seen, key) != NULL)
+			continue;
+
+		DBG("Removing %s from services index", (char *) key);
+
+		g_hash_table_iter_remove(&iter);
+		changed = TRUE;
+	}
+
+	g_hash_table_destroy(seen);
+
+	if (changed == TRUE)
+		index_write();
+}
+
+gchar **connman_storage_get_services(void)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gchar **services;
+	int i = 0;
+
+	if (service_index == NULL)
+		return scan_services();
+
+	if (g_hash_table_size(service_index) == 0)
+		return NULL;
+
+	services = g_try_new0(gchar *,
+				g_hash_table_size(service_index) + 1);
+	if (services == NULL)
+		return NULL;
+
+	g_hash_table_iter_init(&iter, service_index);
+	while (g_hash_table_iter_next(&iter, &key, NULL) == TRUE)
+		services[i++] = g_strdup(key);
+
+	return services;
+}
+
+int connman_storage_get_service_info(const char *service_id,
+				struct connman_storage_service_info *info)
+{
+	struct index_entry *entry;
+
+	if (service_index == NULL)
+		return -ENOENT;
+
+	entry = g_hash_table_lookup(service_index, service_id);
+	if (entry == NULL)
+		return -ENOENT;
+
+	info->favorite = entry->flags & INDEX_FLAG_FAVORITE ? TRUE : FALSE;
+	info->autoconnect = entry->flags & INDEX_FLAG_AUTOCONNECT ?
+								TRUE : FALSE;
+	info->hidden = entry->flags & INDEX_FLAG_HIDDEN ? TRUE : FALSE;
+	info->provisioned = entry->flags & INDEX_FLAG_PROVISIONED ?
+								TRUE : FALSE;
+	info->modified = entry->modified;
+	info->security = entry->security;
+
+	return 0;
+}
+
 GKeyFile *connman_storage_load_service(const char *service_id)
 {
 	gchar *pathname;
@@ -254,6 +728,9 @@ GKeyFile *connman_storage_load_service(const char *service_id)
 	keyfile =  storage_load(pathname);
 	g_free(pathname);
 
+	if (keyfile == NULL)
+		index_remove(service_id);
+
 	return keyfile;
 }
 
@@ -284,6 +761,11 @@ int __connman_storage_save_service(GKeyFile *keyfile, const char *service_id)
 
 	g_free(pathname);
 
+	if (ret == 0) {
+		index_update(service_id, keyfile);
+		index_schedule_write();
+	}
+
 	return ret;
 }
 
@@ -345,6 +827,8 @@ gboolean __connman_storage_remove_service(const char *service_id)
 	if (removed == FALSE)
 		return FALSE;
 
+	index_remove(service_id);
+
 	DBG("Removed service dir %s/%s", STORAGEDIR, service_id);
 
 	return TRUE;
@@ -476,3 +960,44 @@ gchar **__connman_storage_get_providers(void)
 
 	return providers;
 }
+
+int __connman_storage_init(void)
+{
+	GTimer *timer;
+
+	DBG("");
+
+	service_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, free_index_entry);
+
+	timer = g_timer_new();
+
+	if (index_read() < 0) {
+		g_hash_table_remove_all(service_index);
+		index_rebuild();
+	} else
+		index_verify();
+
+	DBG("Indexed %u services in %.3f ms",
+			g_hash_table_size(service_index),
+			g_timer_elapsed(timer, NULL) * 1000);
+
+	g_timer_destroy(timer);
+
+	return 0;
+}
+
+void __connman_storage_cleanup(void)
+{
+	DBG("");
+
+	if (index_timeout > 0) {
+		g_source_remove(index_timeout);
+		index_timeout = 0;
+
+		index_write();
+	}
+
+	g_hash_table_destroy(service_index);
+	service_index = NULL;
+}
@@ -160,6 +160,8 @@ static GDHCPServer *dhcp_server_start(const char *bridge,
 	g_dhcp_server_set_option(dhcp_server, G_DHCP_ROUTER, router);
 	g_dhcp_server_set_option(dhcp_server, G_DHCP_DNS_SERVER, dns);
 	g_dhcp_server_set_ip_range(dhcp_server, start_ip, end_ip);
+	g_dhcp_server_set_lease_file(dhcp_server,
+					STORAGEDIR "/tethering.leases");
 
 	g_dhcp_server_start(dhcp_server);
 
@@ -24,10 +24,18 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <net/if.h>
+#include <sys/resource.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
 
 #include <gdhcp/gdhcp.h>
+#include <gdhcp/common.h>
 
 static GMainLoop *main_loop;
 
@@ -71,14 +79,211 @@ static void dhcp_debug(const char *str, void *data)
 	printf("%s: %s\n", (const char *) data, str);
 }
 
+static gint option_bench = 0;
+static gchar *option_lease_file = NULL;
+
+/*
+ * Benchmark mode: a server on the loopback interface is fed DISCOVER
+ * and REQUEST messages from a set of simulated clients, one packet per
+ * main loop iteration, and the time for each phase is reported.
+ */
+
+struct bench {
+	unsigned int current;
+	uint32_t *offered;
+	unsigned int offers;
+	unsigned int acks;
+};
+
+static void bench_debug(const char *str, void *data)
+{
+	struct bench *bench = data;
+	struct in_addr addr;
+
+	if (g_str_has_prefix(str, "Sending OFFER of ") == TRUE) {
+		if (inet_aton(str + 17, &addr) != 0)
+			bench->offered[bench->current] = ntohl(addr.s_addr);
+		bench->offers++;
+	} else if (g_str_has_prefix(str, "Sending ACK to ") == TRUE)
+		bench->acks++;
+}
+
+static int bench_send(int sk, unsigned int client, char type,
+						uint32_t requested)
+{
+	struct sockaddr_in dst;
+	struct dhcp_packet packet;
+
+	dhcp_init_header(&packet, type);
+
+	packet.xid = htonl(client);
+	packet.chaddr[0] = 0x02;
+	packet.chaddr[2] = client >> 24;
+	packet.chaddr[3] = client >> 16;
+	packet.chaddr[4] = client >> 8;
+	packet.chaddr[5] = client;
+
+	if (requested != 0)
+		dhcp_add_option_uint32(&packet, DHCP_REQUESTED_IP, requested);
+
+	memset(&dst, 0, sizeof(dst));
+	dst.sin_family = AF_INET;
+	dst.sin_port = htons(SERVER_PORT);
+	dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (sendto(sk, &packet, sizeof(packet), 0,
+				(struct sockaddr *) &dst, sizeof(dst)) < 0)
+		return -errno;
+
+	/* The listener reads exactly one packet per dispatch */
+	g_main_context_iteration(NULL, TRUE);
+
+	return 0;
+}
+
+static double user_time(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+}
+
+/*
+ * Wall time is dominated by the kernel sending each reply, so the user
+ * CPU time is reported as well; that is where the lease bookkeeping
+ * shows up.
+ */
+static int bench_phase(int sk, struct bench *bench, unsigned int clients,
+					const char *name, char type)
+{
+	GTimer *timer;
+	double cpu;
+	unsigned int i;
+	int err = 0;
+
+	timer = g_timer_new();
+	cpu = user_time();
+
+	for (i = 0; i < clients; i++) {
+		uint32_t requested = 0;
+
+		if (type == DHCPREQUEST)
+			requested = bench->offered[i];
+
+		bench->current = i;
+
+		err = bench_send(sk, i + 1, type, requested);
+		if (err < 0) {
+			printf("%s: send failed: %s\n", name, strerror(-err));
+			break;
+		}
+	}
+
+	g_timer_stop(timer);
+	cpu = user_time() - cpu;
+
+	printf("%-10s %6u clients %10.1f ms wall %8.2f us/client user\n",
+			name, i, g_timer_elapsed(timer, NULL) * 1000,
+			cpu * 1000000 / (i ? i : 1));
+
+	g_timer_destroy(timer);
+
+	return err;
+}
+
+static int run_bench(unsigned int clients)
+{
+	GDHCPServerError error;
+	GDHCPServer *dhcp_server;
+	struct bench bench;
+	int sk, index;
+
+	index = if_nametoindex("lo");
+
+	dhcp_server = g_dhcp_server_new(G_DHCP_IPV4, index, &error);
+	if (dhcp_server == NULL) {
+		handle_error(error);
+		return -ENODEV;
+	}
+
+	memset(&bench, 0, sizeof(bench));
+	bench.offered = g_new0(uint32_t, clients);
+
+	g_dhcp_server_set_debug(dhcp_server, bench_debug, &bench);
+	g_dhcp_server_set_lease_time(dhcp_server, 3600);
+	g_dhcp_server_set_ip_range(dhcp_server, "10.128.0.1",
+							"10.191.255.254");
+	if (option_lease_file != NULL)
+		g_dhcp_server_set_lease_file(dhcp_server, option_lease_file);
+
+	if (g_dhcp_server_start(dhcp_server) < 0) {
+		printf("Cannot start DHCP server\n");
+		g_dhcp_server_unref(dhcp_server);
+		g_free(bench.offered);
+		return -EIO;
+	}
+
+	sk = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		goto done;
+
+	if (bench_phase(sk, &bench, clients, "discover", DHCPDISCOVER) < 0)
+		goto done;
+
+	if (bench_phase(sk, &bench, clients, "request", DHCPREQUEST) < 0)
+		goto done;
+
+	if (bench_phase(sk, &bench, clients, "rediscover", DHCPDISCOVER) < 0)
+		goto done;
+
+	printf("%u offers, %u acks\n", bench.offers, bench.acks);
+
+done:
+	if (sk >= 0)
+		close(sk);
+
+	g_dhcp_server_unref(dhcp_server);
+	g_free(bench.offered);
+
+	return 0;
+}
+
+static GOptionEntry options[] = {
+	{ "bench", 'b', 0, G_OPTION_ARG_INT, &option_bench,
+			"Simulate N clients against a server on loopback" },
+	{ "lease-file", 'l', 0, G_OPTION_ARG_FILENAME, &option_lease_file,
+			"Keep the lease journal in FILE", "FILE" },
+	{ NULL },
+};
 
 int main(int argc, char *argv[])
 {
+	GOptionContext *context;
+	GError *gerror = NULL;
 	struct sigaction sa;
 	GDHCPServerError error;
 	GDHCPServer *dhcp_server;
 	int index;
 
+	context = g_option_context_new("<interface index>");
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (g_option_context_parse(context, &argc, &argv, &gerror) == FALSE) {
+		if (gerror != NULL) {
+			g_printerr("%s\n", gerror->message);
+			g_error_free(gerror);
+		} else
+			g_printerr("An unknown error occurred\n");
+		exit(1);
+	}
+
+	g_option_context_free(context);
+
+	if (option_bench > 0)
+		return run_bench(option_bench) < 0 ? 1 : 0;
+
 	if (argc < 2) {
 		printf("Usage: dhcp-server-test <interface index>\n");
 		exit(0);
@@ -102,6 +307,8 @@ int main(int argc, char *argv[])
 	g_dhcp_server_set_option(dhcp_server, G_DHCP_DNS_SERVER, "192.168.0.3");
 	g_dhcp_server_set_ip_range(dhcp_server, "192.168.0.101",
 							"192.168.0.102");
+	if (option_lease_file != NULL)
+		g_dhcp_server_set_lease_file(dhcp_server, option_lease_file);
 	main_loop = g_main_loop_new(NULL, FALSE);
 
 	printf("Start DHCP Server operation\n");
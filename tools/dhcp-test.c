@@ -36,6 +36,7 @@
 #include <linux/if_arp.h>
 
 #include <gdhcp/gdhcp.h>
+#include <gdhcp/common.h>
 
 static GTimer *timer;
 
@@ -91,6 +92,17 @@ static void no_lease_cb(GDHCPClient *dhcp_client, gpointer user_data)
 	g_main_loop_quit(main_loop);
 }
 
+static void last_address_cb(GDHCPClient *dhcp_client, gpointer user_data)
+{
+	char *address;
+
+	print_elapsed();
+
+	address = g_dhcp_client_get_address(dhcp_client);
+	printf("Last address %s not in use\n", address);
+	g_free(address);
+}
+
 static void lease_available_cb(GDHCPClient *dhcp_client, gpointer user_data)
 {
 	GList *list, *option_value = NULL;
@@ -100,6 +112,16 @@ static void lease_available_cb(GDHCPClient *dhcp_client, gpointer user_data)
 
 	printf("Lease available\n");
 
+	printf("phases: discover %d offer %d request %d ack %d ms\n",
+		g_dhcp_client_get_phase_time(dhcp_client,
+					G_DHCP_CLIENT_PHASE_DISCOVER),
+		g_dhcp_client_get_phase_time(dhcp_client,
+					G_DHCP_CLIENT_PHASE_OFFER),
+		g_dhcp_client_get_phase_time(dhcp_client,
+					G_DHCP_CLIENT_PHASE_REQUEST),
+		g_dhcp_client_get_phase_time(dhcp_client,
+					G_DHCP_CLIENT_PHASE_ACK));
+
 	address = g_dhcp_client_get_address(dhcp_client);
 	printf("address %s\n", address);
 	if (address == NULL)
@@ -126,15 +148,203 @@ static void lease_available_cb(GDHCPClient *dhcp_client, gpointer user_data)
 		printf("hostname %s\n", (char *) list->data);
 }
 
+static gint option_bench = 0;
+
+/*
+ * Benchmark mode: the options of an ACK are looked up the way the client
+ * handles a reply, once by walking the packet for every code and once
+ * through the option index. Then the parameter request list and the
+ * options to send are encoded for every packet and copied from a cached
+ * block.
+ */
+
+static const uint8_t bench_requests[] = {
+	G_DHCP_HOST_NAME, G_DHCP_SUBNET, G_DHCP_DNS_SERVER,
+	G_DHCP_DOMAIN_NAME, G_DHCP_NTP_SERVER, G_DHCP_ROUTER,
+	DHCP_MESSAGE_TYPE, DHCP_SERVER_ID, DHCP_LEASE_TIME,
+	DHCP_RAPID_COMMIT,
+};
+
+static void bench_add_option(struct dhcp_packet *packet, uint8_t code,
+					const void *data, uint8_t len)
+{
+	uint8_t option[OPT_DATA + 255];
+
+	option[OPT_CODE] = code;
+	option[OPT_LEN] = len;
+	memcpy(option + OPT_DATA, data, len);
+
+	dhcp_add_binary_option(packet, option);
+}
+
+static void bench_ack(struct dhcp_packet *packet)
+{
+	uint8_t servers[12] = { 192, 168, 0, 1, 192, 168, 0, 2,
+							192, 168, 0, 3 };
+	uint8_t subnet[4] = { 255, 255, 255, 0 };
+
+	dhcp_init_header(packet, DHCPACK);
+
+	dhcp_add_option_uint32(packet, DHCP_SERVER_ID, 0xc0a80001);
+	dhcp_add_option_uint32(packet, DHCP_LEASE_TIME, 3600);
+	bench_add_option(packet, G_DHCP_SUBNET, subnet, 4);
+	bench_add_option(packet, G_DHCP_ROUTER, servers, 4);
+	bench_add_option(packet, G_DHCP_DNS_SERVER, servers, 12);
+	bench_add_option(packet, G_DHCP_NTP_SERVER, servers + 4, 8);
+	bench_add_option(packet, G_DHCP_DOMAIN_NAME, "example.com", 11);
+	bench_add_option(packet, G_DHCP_HOST_NAME, "bench", 5);
+}
+
+static double bench_ns(GTimer *timer, unsigned int rounds)
+{
+	return g_timer_elapsed(timer, NULL) * 1000000000 / rounds;
+}
+
+static int bench_lookup(unsigned int rounds)
+{
+	struct dhcp_option_index index;
+	struct dhcp_packet packet;
+	volatile uintptr_t sink = 0;
+	GTimer *timer;
+	unsigned int i, j;
+
+	bench_ack(&packet);
+
+	dhcp_index_options(&packet, &index);
+	for (j = 0; j < sizeof(bench_requests); j++) {
+		if (dhcp_get_option(&packet, bench_requests[j]) !=
+				dhcp_index_get_option(&index,
+							bench_requests[j])) {
+			printf("option %d differs\n", bench_requests[j]);
+			return -EINVAL;
+		}
+	}
+
+	timer = g_timer_new();
+
+	for (i = 0; i < rounds; i++)
+		for (j = 0; j < sizeof(bench_requests); j++)
+			sink += (uintptr_t) dhcp_get_option(&packet,
+							bench_requests[j]);
+
+	printf("lookup   walk  %8.1f ns/reply\n", bench_ns(timer, rounds));
+
+	g_timer_start(timer);
+
+	for (i = 0; i < rounds; i++) {
+		dhcp_index_options(&packet, &index);
+		for (j = 0; j < sizeof(bench_requests); j++)
+			sink += (uintptr_t) dhcp_index_get_option(&index,
+							bench_requests[j]);
+	}
+
+	printf("lookup   index %8.1f ns/reply\n", bench_ns(timer, rounds));
+
+	g_timer_destroy(timer);
+
+	return 0;
+}
+
+static int bench_encode(unsigned int rounds)
+{
+	struct dhcp_packet packet;
+	uint8_t block[DHCP_OPTIONS_BUFSIZE], cached[DHCP_OPTIONS_BUFSIZE];
+	unsigned int i, len, cached_len;
+	GHashTable *send_values;
+	GList *request_list = NULL;
+	uint8_t *option;
+	GTimer *timer;
+
+	for (i = 0; i < 6; i++)
+		request_list = g_list_prepend(request_list,
+					GINT_TO_POINTER(bench_requests[i]));
+
+	send_values = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+							NULL, g_free);
+
+	option = g_malloc(OPT_DATA + 5);
+	option[OPT_CODE] = G_DHCP_HOST_NAME;
+	option[OPT_LEN] = 5;
+	memcpy(option + OPT_DATA, "bench", 5);
+	g_hash_table_insert(send_values, GINT_TO_POINTER(G_DHCP_HOST_NAME),
+								option);
+
+	option = g_malloc(OPT_DATA + 7);
+	option[OPT_CODE] = DHCP_CLIENT_ID;
+	option[OPT_LEN] = 7;
+	memcpy(option + OPT_DATA, "\x01\x02\x00\x00\x00\x00\x01", 7);
+	g_hash_table_insert(send_values, GINT_TO_POINTER(DHCP_CLIENT_ID),
+								option);
+
+	cached_len = dhcp_encode_options(cached, sizeof(cached),
+						request_list, send_values);
+
+	timer = g_timer_new();
+
+	for (i = 0; i < rounds; i++) {
+		dhcp_init_header(&packet, DHCPREQUEST);
+		len = dhcp_encode_options(block, sizeof(block),
+						request_list, send_values);
+		dhcp_add_option_block(&packet, block, len);
+	}
+
+	printf("encode   every %8.1f ns/packet\n", bench_ns(timer, rounds));
+
+	g_timer_start(timer);
+
+	for (i = 0; i < rounds; i++) {
+		dhcp_init_header(&packet, DHCPREQUEST);
+		dhcp_add_option_block(&packet, cached, cached_len);
+	}
+
+	printf("encode   cache %8.1f ns/packet\n", bench_ns(timer, rounds));
+
+	g_timer_destroy(timer);
+
+	g_hash_table_destroy(send_values);
+	g_list_free(request_list);
+
+	return 0;
+}
+
+static GOptionEntry options[] = {
+	{ "bench", 'b', 0, G_OPTION_ARG_INT, &option_bench,
+			"Time N rounds of option lookup and encoding" },
+	{ NULL },
+};
+
 int main(int argc, char *argv[])
 {
+	GOptionContext *context;
+	GError *gerror = NULL;
 	struct sigaction sa;
 	GDHCPClientError error;
 	GDHCPClient *dhcp_client;
 	int index;
 
+	context = g_option_context_new("<interface index> [last address]");
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (g_option_context_parse(context, &argc, &argv, &gerror) == FALSE) {
+		if (gerror != NULL) {
+			g_printerr("%s\n", gerror->message);
+			g_error_free(gerror);
+		} else
+			g_printerr("An unknown error occurred\n");
+		exit(1);
+	}
+
+	g_option_context_free(context);
+
+	if (option_bench > 0) {
+		if (bench_lookup(option_bench) < 0)
+			return 1;
+
+		return bench_encode(option_bench) < 0 ? 1 : 0;
+	}
+
 	if (argc < 2) {
-		printf("Usage: dhcp-test <interface index>\n");
+		printf("Usage: dhcp-test <interface index> [last address]\n");
 		exit(0);
 	}
 
@@ -164,13 +374,17 @@ int main(int argc, char *argv[])
 	g_dhcp_client_register_event(dhcp_client,
 			G_DHCP_CLIENT_EVENT_NO_LEASE, no_lease_cb, NULL);
 
+	g_dhcp_client_register_event(dhcp_client,
+			G_DHCP_CLIENT_EVENT_LAST_ADDRESS_AVAILABLE,
+						last_address_cb, NULL);
+
 	main_loop = g_main_loop_new(NULL, FALSE);
 
 	printf("Start DHCP operation\n");
 
 	timer = g_timer_new();
 
-	g_dhcp_client_start(dhcp_client, NULL);
+	g_dhcp_client_start(dhcp_client, argc > 2 ? argv[2] : NULL);
 
 	memset(&sa, 0, sizeof(sa));
 	sa.sa_handler = sig_term;
@@ -0,0 +1,541 @@
+/*
+ *
+ *  Connection Manager
+ *
+ *  Copyright (C) 2013  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "../src/connman.h"
+
+/*
+ * The tests run against the firewall backend connmand is built with.
+ * Every assertion names the rule as iptables-save and as nft print it,
+ * NULL if the backend has no rule for it.
+ */
+#ifdef HAVE_NFTABLES
+#define LIST_TOOL	NFT
+#else
+#define LIST_TOOL	IPTABLES_SAVE
+#endif
+
+static connman_bool_t assert_rule(const char *table_name, const char *rule)
+{
+	char *cmd, *output, **lines;
+	GError **error = NULL;
+	connman_bool_t found = FALSE;
+	int i;
+
+#ifdef HAVE_NFTABLES
+	cmd = g_strdup(NFT " list table ip connman");
+#else
+	cmd = g_strdup_printf(IPTABLES_SAVE " -t %s", table_name);
+#endif
+	g_spawn_command_line_sync(cmd, &output, NULL, NULL, error);
+	g_free(cmd);
+
+	lines = g_strsplit(output, "\n", 0);
+	g_free(output);
+
+	for (i = 0; lines[i] != NULL; i++) {
+		DBG("lines[%02d]: %s\n", i, lines[i]);
+		if (g_strcmp0(g_strstrip(lines[i]), rule) == 0) {
+			found = TRUE;
+			break;
+		}
+	}
+	g_strfreev(lines);
+
+	return found;
+}
+
+#ifdef HAVE_NFTABLES
+/*
+ * Session marks are elements of the uid-marks and gid-marks maps
+ * instead of rules. The element is given as "owner : mark", both
+ * printed numerically.
+ */
+static connman_bool_t assert_map_element(const char *map,
+						const char *element)
+{
+	char *cmd, *output, *start, *end, **elements;
+	GError **error = NULL;
+	connman_bool_t found = FALSE;
+	int i;
+
+	cmd = g_strdup_printf(NFT " -nnn list map ip connman %s", map);
+	g_spawn_command_line_sync(cmd, &output, NULL, NULL, error);
+	g_free(cmd);
+
+	start = output != NULL ? strstr(output, "elements = {") : NULL;
+	end = start != NULL ? strchr(start, '}') : NULL;
+	if (end == NULL) {
+		g_free(output);
+		return FALSE;
+	}
+
+	*end = '\0';
+	elements = g_strsplit(start + strlen("elements = {"), ",", 0);
+	g_free(output);
+
+	for (i = 0; elements[i] != NULL; i++) {
+		DBG("elements[%02d]: %s\n", i, elements[i]);
+		if (g_strcmp0(g_strstrip(elements[i]), element) == 0) {
+			found = TRUE;
+			break;
+		}
+	}
+	g_strfreev(elements);
+
+	return found;
+}
+#endif
+
+static const char *backend_rule(const char *ipt_rule, const char *nft_rule)
+{
+#ifdef HAVE_NFTABLES
+	return nft_rule;
+#else
+	return ipt_rule;
+#endif
+}
+
+static void assert_rule_exists(const char *table_name, const char *ipt_rule,
+							const char *nft_rule)
+{
+	const char *rule = backend_rule(ipt_rule, nft_rule);
+
+	if (g_strcmp0(LIST_TOOL, "") == 0) {
+		DBG("listing tool is missing, no assertion possible");
+		return;
+	}
+
+	if (rule == NULL)
+		return;
+
+	g_assert(assert_rule(table_name, rule));
+}
+
+static void assert_rule_not_exists(const char *table_name,
+				const char *ipt_rule, const char *nft_rule)
+{
+	const char *rule = backend_rule(ipt_rule, nft_rule);
+
+	if (g_strcmp0(LIST_TOOL, "") == 0) {
+		DBG("listing tool is missing, no assertion possible");
+		return;
+	}
+
+	if (rule == NULL)
+		return;
+
+	g_assert(!assert_rule(table_name, rule));
+}
+
+/*
+ * Session marking is a MARK rule with iptables and an element of the
+ * map given in nft_map with nftables.
+ */
+static void assert_mark_exists(const char *ipt_rule, const char *nft_map,
+						const char *nft_element)
+{
+#ifdef HAVE_NFTABLES
+	if (g_strcmp0(LIST_TOOL, "") == 0) {
+		DBG("listing tool is missing, no assertion possible");
+		return;
+	}
+
+	g_assert(assert_map_element(nft_map, nft_element));
+#else
+	assert_rule_exists("mangle", ipt_rule, NULL);
+#endif
+}
+
+static void assert_mark_not_exists(const char *ipt_rule, const char *nft_map,
+						const char *nft_element)
+{
+#ifdef HAVE_NFTABLES
+	if (g_strcmp0(LIST_TOOL, "") == 0) {
+		DBG("listing tool is missing, no assertion possible");
+		return;
+	}
+
+	g_assert(!assert_map_element(nft_map, nft_element));
+#else
+	assert_rule_not_exists("mangle", ipt_rule, NULL);
+#endif
+}
+
+struct connman_notifier *nat_notifier;
+
+struct connman_service {
+	char *dummy;
+};
+
+char *connman_service_get_interface(struct connman_service *service)
+{
+	return "eth0";
+}
+
+int connman_notifier_register(struct connman_notifier *notifier)
+{
+	nat_notifier = notifier;
+
+	return 0;
+}
+
+void connman_notifier_unregister(struct connman_notifier *notifier)
+{
+	nat_notifier = NULL;
+}
+
+static void test_nat_basic0(void)
+{
+	int err;
+
+	/* Without default service nothing is masqueraded */
+	err = __connman_nat_enable("bridge", "192.168.2.1", 24);
+	g_assert(err == 0);
+
+	assert_rule_not_exists("nat",
+		"-A connman-POSTROUTING -s 192.168.2.0/24 -o eth0 -j MASQUERADE",
+		"ip saddr 192.168.2.0/24 oifname \"eth0\" masquerade");
+
+	__connman_nat_disable("bridge");
+}
+
+static void test_nat_basic1(void)
+{
+	struct connman_service *service;
+	int err;
+
+	service = g_try_new0(struct connman_service, 1);
+	g_assert(service);
+
+	nat_notifier->default_changed(service);
+
+	err = __connman_nat_enable("bridge", "192.168.2.1", 24);
+	g_assert(err == 0);
+
+	assert_rule_exists("nat",
+		"-A connman-POSTROUTING -s 192.168.2.0/24 -o eth0 -j MASQUERADE",
+		"ip saddr 192.168.2.0/24 oifname \"eth0\" masquerade");
+
+	__connman_nat_disable("bridge");
+
+	assert_rule_not_exists("nat",
+		"-A connman-POSTROUTING -s 192.168.2.0/24 -o eth0 -j MASQUERADE",
+		"ip saddr 192.168.2.0/24 oifname \"eth0\" masquerade");
+
+	g_free(service);
+}
+
+static void test_firewall_basic0(void)
+{
+	struct firewall_context *ctx;
+	int err;
+
+	ctx = __connman_firewall_create();
+	g_assert(ctx != NULL);
+
+	err = __connman_firewall_enable_nat(ctx, "10.0.0.1", 8, "wlan0");
+	g_assert(err == 0);
+
+	assert_rule_exists("nat", ":connman-POSTROUTING - [0:0]", NULL);
+	assert_rule_exists("nat", "-A POSTROUTING -j connman-POSTROUTING",
+									NULL);
+	assert_rule_exists("nat",
+		"-A connman-POSTROUTING -s 10.0.0.0/8 -o wlan0 -j MASQUERADE",
+		"ip saddr 10.0.0.0/8 oifname \"wlan0\" masquerade");
+
+	err = __connman_firewall_disable_nat(ctx);
+	g_assert(err == 0);
+
+	assert_rule_not_exists("nat", ":connman-POSTROUTING - [0:0]", NULL);
+	assert_rule_not_exists("nat", "-A POSTROUTING -j connman-POSTROUTING",
+									NULL);
+	assert_rule_not_exists("nat",
+		"-A connman-POSTROUTING -s 10.0.0.0/8 -o wlan0 -j MASQUERADE",
+		"ip saddr 10.0.0.0/8 oifname \"wlan0\" masquerade");
+
+	__connman_firewall_destroy(ctx);
+}
+
+static void test_firewall_basic1(void)
+{
+	struct firewall_context *ctx;
+	int err;
+
+	ctx = __connman_firewall_create();
+	g_assert(ctx != NULL);
+
+	err = __connman_firewall_enable_marking(ctx,
+				CONNMAN_SESSION_ID_TYPE_UID, "0", 999);
+	g_assert(err == 0);
+
+	assert_mark_exists("-A connman-OUTPUT -m owner "
+			"--uid-owner 0 -j MARK --set-xmark 0x3e7/0xffffffff",
+			"uid-marks", "0 : 0x000003e7");
+
+	err = __connman_firewall_disable_marking(ctx);
+	g_assert(err == 0);
+
+	assert_mark_not_exists("-A connman-OUTPUT -m owner "
+			"--uid-owner 0 -j MARK --set-xmark 0x3e7/0xffffffff",
+			"uid-marks", "0 : 0x000003e7");
+
+	err = __connman_firewall_enable_marking(ctx,
+				CONNMAN_SESSION_ID_TYPE_GID, "0", 998);
+	g_assert(err == 0);
+
+	assert_mark_exists("-A connman-OUTPUT -m owner "
+			"--gid-owner 0 -j MARK --set-xmark 0x3e6/0xffffffff",
+			"gid-marks", "0 : 0x000003e6");
+	assert_mark_not_exists("-A connman-OUTPUT -m owner "
+			"--uid-owner 0 -j MARK --set-xmark 0x3e6/0xffffffff",
+			"uid-marks", "0 : 0x000003e6");
+
+	err = __connman_firewall_disable_marking(ctx);
+	g_assert(err == 0);
+
+	assert_mark_not_exists("-A connman-OUTPUT -m owner "
+			"--gid-owner 0 -j MARK --set-xmark 0x3e6/0xffffffff",
+			"gid-marks", "0 : 0x000003e6");
+
+	err = __connman_firewall_enable_marking(ctx,
+				CONNMAN_SESSION_ID_TYPE_LSM, "foo", 999);
+	g_assert(err == -EINVAL);
+
+	__connman_firewall_destroy(ctx);
+}
+
+static void test_firewall_basic2(void)
+{
+	struct firewall_context *ctx;
+	int err;
+
+	ctx = __connman_firewall_create();
+	g_assert(ctx != NULL);
+
+	err = __connman_firewall_enable_connmark(ctx);
+	g_assert(err == 0);
+
+	assert_rule_exists("mangle", "-A connman-INPUT -j CONNMARK "
+			"--restore-mark --nfmask 0xffffffff --ctmask 0xffffffff",
+			"meta mark set ct mark");
+	assert_rule_exists("mangle", "-A connman-POSTROUTING -j CONNMARK "
+			"--save-mark --nfmask 0xffffffff --ctmask 0xffffffff",
+			"ct mark set meta mark");
+
+	err = __connman_firewall_disable_connmark(ctx);
+	g_assert(err == 0);
+
+	assert_rule_not_exists("mangle", "-A connman-INPUT -j CONNMARK "
+			"--restore-mark --nfmask 0xffffffff --ctmask 0xffffffff",
+			"meta mark set ct mark");
+	assert_rule_not_exists("mangle", "-A connman-POSTROUTING -j CONNMARK "
+			"--save-mark --nfmask 0xffffffff --ctmask 0xffffffff",
+			"ct mark set meta mark");
+
+	__connman_firewall_destroy(ctx);
+}
+
+static void test_firewall_basic3(void)
+{
+	struct firewall_context *ctx1, *ctx2;
+	int err;
+
+	/* Two sessions of the same user, released in creation order */
+	ctx1 = __connman_firewall_create();
+	ctx2 = __connman_firewall_create();
+
+	err = __connman_firewall_enable_marking(ctx1,
+				CONNMAN_SESSION_ID_TYPE_UID, "0", 1);
+	g_assert(err == 0);
+
+	err = __connman_firewall_enable_marking(ctx2,
+				CONNMAN_SESSION_ID_TYPE_UID, "0", 2);
+	g_assert(err == 0);
+
+	assert_mark_exists("-A connman-OUTPUT -m owner "
+			"--uid-owner 0 -j MARK --set-xmark 0x2/0xffffffff",
+			"uid-marks", "0 : 0x00000002");
+
+	err = __connman_firewall_disable_marking(ctx1);
+	g_assert(err == 0);
+
+	assert_mark_exists("-A connman-OUTPUT -m owner "
+			"--uid-owner 0 -j MARK --set-xmark 0x2/0xffffffff",
+			"uid-marks", "0 : 0x00000002");
+
+	err = __connman_firewall_disable_marking(ctx2);
+	g_assert(err == 0);
+
+	assert_mark_not_exists("-A connman-OUTPUT -m owner "
+			"--uid-owner 0 -j MARK --set-xmark 0x2/0xffffffff",
+			"uid-marks", "0 : 0x00000002");
+
+	__connman_firewall_destroy(ctx1);
+	__connman_firewall_destroy(ctx2);
+}
+
+#define BENCH_SESSIONS 32
+
+static struct firewall_context *bench_session_create(uint32_t mark)
+{
+	struct firewall_context *ctx;
+	char *uid;
+	int err;
+
+	ctx = __connman_firewall_create();
+	g_assert(ctx != NULL);
+
+	/* One owner per session, as in init_firewall_session() */
+	uid = g_strdup_printf("%u", 10000 + mark);
+	err = __connman_firewall_enable_marking(ctx,
+				CONNMAN_SESSION_ID_TYPE_UID, uid, mark);
+	g_free(uid);
+	g_assert(err == 0);
+
+	return ctx;
+}
+
+static void bench_session_destroy(gpointer data)
+{
+	struct firewall_context *ctx = data;
+	int err;
+
+	err = __connman_firewall_disable_marking(ctx);
+	g_assert(err == 0);
+
+	__connman_firewall_destroy(ctx);
+}
+
+static void test_firewall_bench0(void)
+{
+	static const int table_sizes[] = { 0, 64, 256 };
+	GList *sessions = NULL;
+	GTimer *timer;
+	gdouble elapsed;
+	unsigned int i;
+	int n, count = 0, mark = 1;
+
+	timer = g_timer_new();
+
+	for (i = 0; i < G_N_ELEMENTS(table_sizes); i++) {
+		while (count < table_sizes[i]) {
+			sessions = g_list_prepend(sessions,
+						bench_session_create(mark++));
+			count++;
+		}
+
+		g_timer_start(timer);
+
+		for (n = 0; n < BENCH_SESSIONS; n++)
+			sessions = g_list_prepend(sessions,
+						bench_session_create(mark++));
+
+		g_timer_stop(timer);
+
+		elapsed = g_timer_elapsed(timer, NULL);
+
+		g_print("%4d sessions installed: %d new sessions in "
+			"%.3f seconds (%.1f sessions/s)\n", count,
+			BENCH_SESSIONS, elapsed, BENCH_SESSIONS / elapsed);
+
+		count += BENCH_SESSIONS;
+	}
+
+	g_timer_destroy(timer);
+
+	g_list_free_full(sessions, bench_session_destroy);
+}
+
+static gchar *option_debug = NULL;
+
+static gboolean parse_debug(const char *key, const char *value,
+					gpointer user_data, GError **error)
+{
+	if (value)
+		option_debug = g_strdup(value);
+	else
+		option_debug = g_strdup("*");
+
+	return TRUE;
+}
+
+static GOptionEntry options[] = {
+	{ "debug", 'd', G_OPTION_FLAG_OPTIONAL_ARG,
+				G_OPTION_ARG_CALLBACK, parse_debug,
+				"Specify debug options to enable", "DEBUG" },
+	{ NULL },
+};
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	int err;
+
+	g_test_init(&argc, &argv, NULL);
+
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (g_option_context_parse(context, &argc, &argv, &error) == FALSE) {
+		if (error != NULL) {
+			g_printerr("%s\n", error->message);
+			g_error_free(error);
+		} else
+			g_printerr("An unknown error occurred\n");
+		return 1;
+	}
+
+	g_option_context_free(context);
+
+	__connman_log_init(argv[0], option_debug, FALSE, FALSE,
+			"Unit Tests Connection Manager", VERSION);
+
+	__connman_firewall_init();
+	__connman_nat_init();
+
+	g_test_add_func("/nat/basic0", test_nat_basic0);
+	g_test_add_func("/nat/basic1", test_nat_basic1);
+	g_test_add_func("/firewall/basic0", test_firewall_basic0);
+	g_test_add_func("/firewall/basic1", test_firewall_basic1);
+	g_test_add_func("/firewall/basic2", test_firewall_basic2);
+	g_test_add_func("/firewall/basic3", test_firewall_basic3);
+
+	if (g_test_perf() == TRUE)
+		g_test_add_func("/firewall/bench0", test_firewall_bench0);
+
+	err = g_test_run();
+
+	__connman_nat_cleanup();
+	__connman_firewall_cleanup();
+
+	g_free(option_debug);
+
+	return err;
+}
@@ -0,0 +1,310 @@
+/*
+ *
+ *  Connection Manager
+ *
+ *  Copyright (C) 2013  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Times the routing setup of a service bring-up and tear-down with the
+ * helpers of src/inet.c: the source rule of the address, a host route
+ * per nameserver or VPN split route (in the main and in the per
+ * interface table) and the session fwmark rule with its default route.
+ * The helpers are called one at a time with a new netlink socket for
+ * every call like older versions of src/inet.c did, one at a time over
+ * the shared handle, and with the routes handed over in one batch.
+ * Needs to run as root.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "../src/connman.h"
+
+#define ADDRESS		"10.90.0.1"
+#define NETMASK		"255.255.0.0"
+#define GATEWAY		"10.90.0.254"
+#define TABLE_ID	0x7fff
+#define FWMARK		0x7fff
+
+struct test_mode {
+	const char *name;
+	int (*up)(int index, struct connman_inet_route *routes, int count);
+	int (*down)(int index, struct connman_inet_route *routes, int count);
+};
+
+static gboolean socket_per_call;
+
+/* Drop the shared handle, the next helper has to open a new socket */
+static void call_done(void)
+{
+	if (socket_per_call == TRUE)
+		__connman_inet_cleanup();
+}
+
+static int single_up(int index, struct connman_inet_route *routes,
+								int count)
+{
+	int i, err;
+
+	err = connman_inet_add_rule(ADDRESS, index);
+	call_done();
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < count; i++) {
+		err = connman_inet_add_host_route(index, routes[i].host,
+							routes[i].gateway);
+		call_done();
+		if (err < 0)
+			return err;
+	}
+
+	err = __connman_inet_add_fwmark_rule(TABLE_ID, AF_INET, FWMARK);
+	call_done();
+	if (err < 0)
+		return err;
+
+	err = __connman_inet_add_default_to_table(TABLE_ID, index, GATEWAY);
+	call_done();
+
+	return err;
+}
+
+static int single_down(int index, struct connman_inet_route *routes,
+								int count)
+{
+	int i, err;
+
+	err = __connman_inet_del_default_from_table(TABLE_ID, index,
+								GATEWAY);
+	call_done();
+	if (err < 0)
+		return err;
+
+	err = __connman_inet_del_fwmark_rule(TABLE_ID, AF_INET, FWMARK);
+	call_done();
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < count; i++) {
+		err = connman_inet_del_host_route(index, routes[i].host);
+		call_done();
+		if (err < 0)
+			return err;
+	}
+
+	err = connman_inet_del_rule(ADDRESS, index);
+	call_done();
+
+	return err;
+}
+
+static int batched_up(int index, struct connman_inet_route *routes,
+								int count)
+{
+	int err;
+
+	err = connman_inet_add_rule(ADDRESS, index);
+	if (err < 0)
+		return err;
+
+	err = __connman_inet_add_host_routes(index, routes, count);
+	if (err < 0)
+		return err;
+
+	err = __connman_inet_add_fwmark_rule(TABLE_ID, AF_INET, FWMARK);
+	if (err < 0)
+		return err;
+
+	return __connman_inet_add_default_to_table(TABLE_ID, index, GATEWAY);
+}
+
+static int batched_down(int index, struct connman_inet_route *routes,
+								int count)
+{
+	int err;
+
+	err = __connman_inet_del_default_from_table(TABLE_ID, index,
+								GATEWAY);
+	if (err < 0)
+		return err;
+
+	err = __connman_inet_del_fwmark_rule(TABLE_ID, AF_INET, FWMARK);
+	if (err < 0)
+		return err;
+
+	err = __connman_inet_del_host_routes(index, routes, count);
+	if (err < 0)
+		return err;
+
+	return connman_inet_del_rule(ADDRESS, index);
+}
+
+static struct test_mode modes[] = {
+	{ "socket per call", single_up, single_down },
+	{ "shared handle", single_up, single_down },
+	{ "batched", batched_up, batched_down },
+};
+
+static int run_mode(struct test_mode *mode, int index,
+			struct connman_inet_route *routes, int count)
+{
+	GTimer *timer;
+	double up_time, down_time = 0;
+	int err;
+
+	socket_per_call = mode == &modes[0];
+
+	timer = g_timer_new();
+
+	err = mode->up(index, routes, count);
+	up_time = g_timer_elapsed(timer, NULL);
+
+	if (err == 0) {
+		g_timer_start(timer);
+		err = mode->down(index, routes, count);
+		down_time = g_timer_elapsed(timer, NULL);
+	}
+
+	if (err < 0)
+		printf("%-16s failed: %s\n", mode->name, strerror(-err));
+	else
+		printf("%-16s up %7.3f ms down %7.3f ms\n", mode->name,
+				up_time * 1000, down_time * 1000);
+
+	g_timer_destroy(timer);
+
+	/* Start every mode from a fresh handle */
+	__connman_inet_cleanup();
+	__connman_inet_init();
+
+	return err;
+}
+
+static gint option_routes = 50;
+static gint option_rounds = 5;
+
+static GOptionEntry options[] = {
+	{ "routes", 'n', 0, G_OPTION_ARG_INT, &option_routes,
+			"Number of host routes to add (default 50)" },
+	{ "rounds", 'r', 0, G_OPTION_ARG_INT, &option_rounds,
+			"Number of bring-ups per mode (default 5)" },
+	{ NULL },
+};
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	struct connman_ipaddress *ipaddress;
+	struct connman_inet_route *routes;
+	char **hosts;
+	char *iface = NULL;
+	unsigned int i;
+	int fd, index, n, err;
+
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (g_option_context_parse(context, &argc, &argv, &error) == FALSE) {
+		if (error != NULL) {
+			g_printerr("%s\n", error->message);
+			g_error_free(error);
+		} else
+			g_printerr("An unknown error occurred\n");
+		exit(1);
+	}
+
+	g_option_context_free(context);
+
+	if (option_routes < 0)
+		option_routes = 0;
+
+	err = __connman_inet_init();
+	if (err < 0) {
+		printf("cannot open sockets: %s\n", strerror(-err));
+		return 1;
+	}
+
+	fd = connman_inet_create_tunnel(&iface);
+	if (fd < 0) {
+		printf("cannot create tunnel: %s\n", strerror(-fd));
+		goto out;
+	}
+
+	index = connman_inet_ifindex(iface);
+	connman_inet_ifup(index);
+
+	ipaddress = connman_ipaddress_alloc(AF_INET);
+	connman_ipaddress_set_ipv4(ipaddress, ADDRESS, NETMASK, GATEWAY);
+
+	err = connman_inet_set_address(index, ipaddress);
+	if (err < 0) {
+		printf("cannot set address: %s\n", strerror(-err));
+		goto done;
+	}
+
+	hosts = g_new0(char *, option_routes + 1);
+	routes = g_new0(struct connman_inet_route, option_routes);
+
+	for (n = 0; n < option_routes; n++) {
+		hosts[n] = g_strdup_printf("10.91.%d.%d", n / 250,
+							n % 250 + 1);
+
+		routes[n].family = AF_INET;
+		routes[n].host = hosts[n];
+		routes[n].gateway = GATEWAY;
+	}
+
+	printf("%s, %d host routes\n", iface, option_routes);
+
+	for (n = 0; n < option_rounds; n++) {
+		for (i = 0; i < G_N_ELEMENTS(modes); i++) {
+			if (run_mode(&modes[i], index, routes,
+						option_routes) < 0)
+				goto clear;
+		}
+	}
+
+clear:
+	g_free(routes);
+	g_strfreev(hosts);
+
+	connman_inet_clear_address(index, ipaddress);
+
+done:
+	connman_ipaddress_free(ipaddress);
+	connman_inet_ifdown(index);
+	close(fd);
+	g_free(iface);
+
+out:
+	__connman_inet_cleanup();
+
+	return 0;
+}
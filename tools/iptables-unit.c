@@ -314,171 +314,73 @@ static void test_iptables_target0(void)
 	assert_rule_not_exists("filter", "-A INPUT -m mark --mark 0x2");
 }
 
-struct connman_notifier *nat_notifier;
-
-struct connman_service {
-	char *dummy;
-};
-
-char *connman_service_get_interface(struct connman_service *service)
-{
-	return "eth0";
-}
-
-int connman_notifier_register(struct connman_notifier *notifier)
-{
-	nat_notifier = notifier;
-
-	return 0;
-}
-
-void connman_notifier_unregister(struct connman_notifier *notifier)
-{
-	nat_notifier = NULL;
-}
-
-static void test_nat_basic0(void)
-{
-	int err;
-
-	err = __connman_nat_enable("bridge", "192.168.2.1", 24);
-	g_assert(err == 0);
-
-	/* test that table is empty */
-	err = __connman_iptables_append("nat", "POSTROUTING",
-					"-s 192.168.2.1/24 -o eth0 -j MASQUERADE");
-	g_assert(err == 0);
-
-	err = __connman_iptables_commit("nat");
-	g_assert(err == 0);
-
-	assert_rule_exists("nat",
-		"-A POSTROUTING -s 192.168.2.0/24 -o eth0 -j MASQUERADE");
-
-	err = __connman_iptables_delete("nat", "POSTROUTING",
-					"-s 192.168.2.1/24 -o eth0 -j MASQUERADE");
-	g_assert(err == 0);
-
-	err = __connman_iptables_commit("nat");
-	g_assert(err == 0);
-
-	assert_rule_not_exists("nat",
-		"-A POSTROUTING -s 192.168.2.0/24 -o eth0 -j MASQUERADE");
-
-	__connman_nat_disable("bridge");
-}
-
-static void test_nat_basic1(void)
+static void test_iptables_template0(void)
 {
-	struct connman_service *service;
+	char *params[] = { "1", "2", NULL };
 	int err;
 
-	service = g_try_new0(struct connman_service, 1);
-	g_assert(service);
-
-	nat_notifier->default_changed(service);
-
-	err = __connman_nat_enable("bridge", "192.168.2.1", 24);
-	g_assert(err == 0);
-
-	/* test that table is not empty */
-	err = __connman_iptables_append("nat", "POSTROUTING",
-					"-s 192.168.2.1/24 -o eth0 -j MASQUERADE");
-	g_assert(err == 0);
-
-	err = __connman_iptables_commit("nat");
-	g_assert(err == 0);
-
-	__connman_nat_disable("bridge");
-
-	/* test that table is empty again */
-	err = __connman_iptables_delete("nat", "POSTROUTING",
-					"-s 192.168.2.1/24 -o eth0 -j MASQUERADE");
-	g_assert(err == 0);
-
-	err = __connman_iptables_commit("nat");
+	err = __connman_iptables_append_template("mangle", "OUTPUT",
+				"-m mark --mark %s -j MARK --set-mark %s",
+				params);
 	g_assert(err == 0);
 
-	g_free(service);
-}
-
-static void test_firewall_basic0(void)
-{
-	struct firewall_context *ctx;
-	int err;
-
-	ctx = __connman_firewall_create();
-	g_assert(ctx != NULL);
+	params[0] = "3";
+	params[1] = "4";
 
-	err = __connman_firewall_add_rule(ctx, "filter", "INPUT",
-					"-m mark --mark 999 -j LOG");
+	err = __connman_iptables_append_template("mangle", "OUTPUT",
+				"-m mark --mark %s -j MARK --set-mark %s",
+				params);
 	g_assert(err == 0);
 
-	err = __connman_firewall_enable(ctx);
+	err = __connman_iptables_commit("mangle");
 	g_assert(err == 0);
 
-	assert_rule_exists("filter", ":connman-INPUT - [0:0]");
-	assert_rule_exists("filter", "-A INPUT -j connman-INPUT");
-	assert_rule_exists("filter", "-A connman-INPUT -m mark --mark 0x3e7 -j LOG");
+	assert_rule_exists("mangle",
+		"-A OUTPUT -m mark --mark 0x1 -j MARK --set-xmark 0x2/0xffffffff");
+	assert_rule_exists("mangle",
+		"-A OUTPUT -m mark --mark 0x3 -j MARK --set-xmark 0x4/0xffffffff");
 
-	err = __connman_firewall_disable(ctx);
+	err = __connman_iptables_delete("mangle", "OUTPUT",
+				"-m mark --mark 3 -j MARK --set-mark 4");
 	g_assert(err == 0);
 
-	assert_rule_not_exists("filter", ":connman-INPUT - [0:0]");
-	assert_rule_not_exists("filter", "-A INPUT -j connman-INPUT");
-	assert_rule_not_exists("filter", "-A connman-INPUT -m mark --mark 0x3e7 -j LOG");
+	params[0] = "1";
+	params[1] = "2";
 
-	__connman_firewall_destroy(ctx);
-}
-
-static void test_firewall_basic1(void)
-{
-	struct firewall_context *ctx;
-	int err;
-
-	ctx = __connman_firewall_create();
-	g_assert(ctx != NULL);
-
-	err = __connman_firewall_add_rule(ctx, "filter", "INPUT",
-					"-m mark --mark 999 -j LOG");
-	g_assert(err == 0);
-
-	err = __connman_firewall_add_rule(ctx, "filter", "OUTPUT",
-					"-m mark --mark 999 -j LOG");
+	err = __connman_iptables_delete_template("mangle", "OUTPUT",
+				"-m mark --mark %s -j MARK --set-mark %s",
+				params);
 	g_assert(err == 0);
 
-	err = __connman_firewall_enable(ctx);
+	err = __connman_iptables_commit("mangle");
 	g_assert(err == 0);
 
-	err = __connman_firewall_disable(ctx);
-	g_assert(err == 0);
-
-	__connman_firewall_destroy(ctx);
+	assert_rule_not_exists("mangle",
+		"-A OUTPUT -m mark --mark 0x1 -j MARK --set-xmark 0x2/0xffffffff");
+	assert_rule_not_exists("mangle",
+		"-A OUTPUT -m mark --mark 0x3 -j MARK --set-xmark 0x4/0xffffffff");
 }
 
-static void test_firewall_basic2(void)
+static void test_iptables_template1(void)
 {
-	struct firewall_context *ctx;
 	int err;
 
-	ctx = __connman_firewall_create();
-	g_assert(ctx != NULL);
-
-	err = __connman_firewall_add_rule(ctx, "mangle", "INPUT",
-					"-j CONNMARK --restore-mark");
+	/* The session marking and accounting rules of the firewall */
+	err = __connman_iptables_check_template("mangle",
+			"-m owner --uid-owner %s -j MARK --set-mark %s");
 	g_assert(err == 0);
 
-	err = __connman_firewall_add_rule(ctx, "mangle", "POSTROUTING",
-					"-j CONNMARK --save-mark");
+	err = __connman_iptables_check_template("mangle",
+			"-m owner --gid-owner %s -j MARK --set-mark %s");
 	g_assert(err == 0);
 
-	err = __connman_firewall_enable(ctx);
+	err = __connman_iptables_check_template("filter",
+			"-m mark --mark %s -m nfacct --nfacct-name session-input-%s");
 	g_assert(err == 0);
 
-	err = __connman_firewall_disable(ctx);
+	err = __connman_iptables_check_template("filter",
+			"-m mark --mark %s -m nfacct --nfacct-name session-output-%s");
 	g_assert(err == 0);
-
-	__connman_firewall_destroy(ctx);
 }
 
 static gchar *option_debug = NULL;
@@ -527,8 +429,6 @@ int main(int argc, char *argv[])
 			"Unit Tests Connection Manager", VERSION);
 
 	__connman_iptables_init();
-	__connman_firewall_init();
-	__connman_nat_init();
 
 	g_test_add_func("/iptables/chain0", test_iptables_chain0);
 	g_test_add_func("/iptables/chain1", test_iptables_chain1);
@@ -538,16 +438,11 @@ int main(int argc, char *argv[])
 	g_test_add_func("/iptables/rule1",  test_iptables_rule1);
 	g_test_add_func("/iptables/rule2",  test_iptables_rule2);
 	g_test_add_func("/iptables/target0", test_iptables_target0);
-	g_test_add_func("/nat/basic0", test_nat_basic0);
-	g_test_add_func("/nat/basic1", test_nat_basic1);
-	g_test_add_func("/firewall/basic0", test_firewall_basic0);
-	g_test_add_func("/firewall/basic1", test_firewall_basic1);
-	g_test_add_func("/firewall/basic2", test_firewall_basic2);
+	g_test_add_func("/iptables/template0", test_iptables_template0);
+	g_test_add_func("/iptables/template1", test_iptables_template1);
 
 	err = g_test_run();
 
-	__connman_nat_cleanup();
-	__connman_firewall_cleanup();
 	__connman_iptables_cleanup();
 
 	g_free(option_debug);
@@ -0,0 +1,412 @@
+/*
+ *
+ *  Connection Manager
+ *
+ *  Copyright (C) 2013  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Times the link, address and route dumps connmand does on startup.
+ * A number of interfaces with one address each are created first, then
+ * the dumps are read once the way older connmand did it (one 4k read
+ * per main loop wakeup) and once the way src/rtnl.c does it now (drain
+ * the socket with a 32k buffer, send the next dump as soon as the
+ * previous one is done). Needs to run as root.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <glib.h>
+
+#define IFNAME_PREFIX	"rtnltest"
+
+struct dump_mode {
+	const char *name;
+	size_t buffer_size;
+	int max_reads;
+};
+
+static struct dump_mode modes[] = {
+	{ "single 4k read", 4096, 1 },
+	{ "drain 32k", 32 * 1024, 64 },
+};
+
+static GMainLoop *main_loop;
+static struct dump_mode *mode;
+static unsigned char *buffer;
+static GSList *pending;
+static unsigned int wakeups;
+static unsigned int messages;
+static guint32 seq;
+
+static int rtnl_socket(void)
+{
+	struct sockaddr_nl addr;
+	int sk;
+
+	sk = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (sk < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(sk);
+		return -errno;
+	}
+
+	return sk;
+}
+
+static void add_attr(struct nlmsghdr *hdr, int type,
+				const void *data, int len)
+{
+	struct rtattr *rta;
+
+	rta = (struct rtattr *) ((char *) hdr + NLMSG_ALIGN(hdr->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+
+	hdr->nlmsg_len = NLMSG_ALIGN(hdr->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+static int send_sync(int sk, struct nlmsghdr *hdr)
+{
+	unsigned char buf[4096];
+	struct nlmsgerr *err;
+	struct nlmsghdr *reply;
+	ssize_t len;
+
+	hdr->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+	hdr->nlmsg_seq = ++seq;
+
+	if (send(sk, hdr, hdr->nlmsg_len, 0) < 0)
+		return -errno;
+
+	len = recv(sk, buf, sizeof(buf), 0);
+	if (len < 0)
+		return -errno;
+
+	reply = (struct nlmsghdr *) buf;
+	if (NLMSG_OK(reply, (size_t) len) == 0 ||
+				reply->nlmsg_type != NLMSG_ERROR)
+		return -EIO;
+
+	err = NLMSG_DATA(reply);
+
+	return err->error;
+}
+
+static int create_link(int sk, const char *kind, int i)
+{
+	struct {
+		struct nlmsghdr hdr;
+		struct ifinfomsg msg;
+		char buf[256];
+	} req;
+	struct rtattr *linkinfo;
+	char ifname[32];
+
+	snprintf(ifname, sizeof(ifname), "%s%d", IFNAME_PREFIX, i);
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(req.msg));
+	req.hdr.nlmsg_type = RTM_NEWLINK;
+	req.hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+	req.msg.ifi_family = AF_UNSPEC;
+	req.msg.ifi_flags = IFF_UP;
+	req.msg.ifi_change = IFF_UP;
+
+	add_attr(&req.hdr, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+
+	linkinfo = (struct rtattr *) ((char *) &req +
+					NLMSG_ALIGN(req.hdr.nlmsg_len));
+	add_attr(&req.hdr, IFLA_LINKINFO, NULL, 0);
+	add_attr(&req.hdr, IFLA_INFO_KIND, kind, strlen(kind));
+	linkinfo->rta_len = (char *) &req + req.hdr.nlmsg_len -
+							(char *) linkinfo;
+
+	return send_sync(sk, &req.hdr);
+}
+
+static int add_address(int sk, int i)
+{
+	struct {
+		struct nlmsghdr hdr;
+		struct ifaddrmsg msg;
+		char buf[64];
+	} req;
+	char ifname[32];
+	struct in_addr addr;
+
+	snprintf(ifname, sizeof(ifname), "%s%d", IFNAME_PREFIX, i);
+
+	/* 10.<hi>.<lo>.1/24, one subnet and so one route per link */
+	addr.s_addr = htonl(0x0a000001 | (i & 0xffff) << 8);
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(req.msg));
+	req.hdr.nlmsg_type = RTM_NEWADDR;
+	req.hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+	req.msg.ifa_family = AF_INET;
+	req.msg.ifa_prefixlen = 24;
+	req.msg.ifa_index = if_nametoindex(ifname);
+
+	if (req.msg.ifa_index == 0)
+		return -ENODEV;
+
+	add_attr(&req.hdr, IFA_LOCAL, &addr, sizeof(addr));
+	add_attr(&req.hdr, IFA_ADDRESS, &addr, sizeof(addr));
+
+	return send_sync(sk, &req.hdr);
+}
+
+static int delete_link(int sk, int i)
+{
+	struct {
+		struct nlmsghdr hdr;
+		struct ifinfomsg msg;
+	} req;
+	char ifname[32];
+
+	snprintf(ifname, sizeof(ifname), "%s%d", IFNAME_PREFIX, i);
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(req.msg));
+	req.hdr.nlmsg_type = RTM_DELLINK;
+	req.msg.ifi_family = AF_UNSPEC;
+	req.msg.ifi_index = if_nametoindex(ifname);
+
+	if (req.msg.ifi_index == 0)
+		return -ENODEV;
+
+	return send_sync(sk, &req.hdr);
+}
+
+static int send_dump(int sk, int type)
+{
+	struct {
+		struct nlmsghdr hdr;
+		struct rtgenmsg msg;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = sizeof(req);
+	req.hdr.nlmsg_type = type;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.hdr.nlmsg_seq = ++seq;
+	req.msg.rtgen_family = AF_INET;
+
+	if (send(sk, &req, req.hdr.nlmsg_len, 0) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static void dump_done(int sk)
+{
+	pending = g_slist_delete_link(pending, pending);
+
+	if (pending == NULL) {
+		g_main_loop_quit(main_loop);
+		return;
+	}
+
+	send_dump(sk, GPOINTER_TO_INT(pending->data));
+}
+
+static gboolean dump_event(GIOChannel *chan, GIOCondition cond,
+							gpointer user_data)
+{
+	struct nlmsghdr *hdr;
+	ssize_t len;
+	int sk, i;
+
+	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
+		return FALSE;
+
+	sk = g_io_channel_unix_get_fd(chan);
+
+	wakeups++;
+
+	for (i = 0; i < mode->max_reads; i++) {
+		len = recv(sk, buffer, mode->buffer_size, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN)
+				break;
+
+			printf("recv failed: %s\n", strerror(errno));
+			g_main_loop_quit(main_loop);
+			return FALSE;
+		}
+
+		for (hdr = (struct nlmsghdr *) buffer;
+				NLMSG_OK(hdr, (size_t) len);
+				hdr = NLMSG_NEXT(hdr, len)) {
+			messages++;
+
+			if (hdr->nlmsg_type == NLMSG_DONE ||
+					hdr->nlmsg_type == NLMSG_ERROR)
+				dump_done(sk);
+		}
+	}
+
+	return TRUE;
+}
+
+static void run_dumps(struct dump_mode *m)
+{
+	GIOChannel *channel;
+	GTimer *timer;
+	guint watch;
+	int sk;
+
+	sk = rtnl_socket();
+	if (sk < 0) {
+		printf("cannot open rtnl socket: %s\n", strerror(-sk));
+		return;
+	}
+
+	mode = m;
+	buffer = g_malloc(mode->buffer_size);
+	wakeups = 0;
+	messages = 0;
+
+	pending = g_slist_append(NULL, GINT_TO_POINTER(RTM_GETLINK));
+	pending = g_slist_append(pending, GINT_TO_POINTER(RTM_GETADDR));
+	pending = g_slist_append(pending, GINT_TO_POINTER(RTM_GETROUTE));
+
+	channel = g_io_channel_unix_new(sk);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	watch = g_io_add_watch(channel,
+				G_IO_IN | G_IO_NVAL | G_IO_HUP | G_IO_ERR,
+				dump_event, NULL);
+
+	timer = g_timer_new();
+
+	send_dump(sk, RTM_GETLINK);
+	g_main_loop_run(main_loop);
+
+	g_timer_stop(timer);
+
+	printf("%-16s %6u messages %5u wakeups %8.3f ms\n", mode->name,
+			messages, wakeups,
+			g_timer_elapsed(timer, NULL) * 1000);
+
+	g_timer_destroy(timer);
+	g_source_remove(watch);
+	g_io_channel_shutdown(channel, TRUE, NULL);
+	g_io_channel_unref(channel);
+	g_free(buffer);
+}
+
+static gint option_count = 200;
+static gchar *option_kind = NULL;
+static gint option_rounds = 5;
+
+static GOptionEntry options[] = {
+	{ "count", 'n', 0, G_OPTION_ARG_INT, &option_count,
+			"Number of interfaces to create (default 200)" },
+	{ "kind", 'k', 0, G_OPTION_ARG_STRING, &option_kind,
+			"Link type of the interfaces (default dummy)" },
+	{ "rounds", 'r', 0, G_OPTION_ARG_INT, &option_rounds,
+			"Number of times the dumps are read (default 5)" },
+	{ NULL },
+};
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	unsigned int i;
+	int sk, n, err;
+
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (g_option_context_parse(context, &argc, &argv, &error) == FALSE) {
+		if (error != NULL) {
+			g_printerr("%s\n", error->message);
+			g_error_free(error);
+		} else
+			g_printerr("An unknown error occurred\n");
+		exit(1);
+	}
+
+	g_option_context_free(context);
+
+	if (option_kind == NULL)
+		option_kind = g_strdup("dummy");
+
+	sk = rtnl_socket();
+	if (sk < 0) {
+		printf("cannot open rtnl socket: %s\n", strerror(-sk));
+		return 1;
+	}
+
+	for (n = 0; n < option_count; n++) {
+		err = create_link(sk, option_kind, n);
+		if (err == 0)
+			err = add_address(sk, n);
+		if (err < 0) {
+			printf("cannot set up %s%d: %s\n", IFNAME_PREFIX, n,
+							strerror(-err));
+			n++;
+			goto out;
+		}
+	}
+
+	printf("%d %s interfaces\n", n, option_kind);
+
+	main_loop = g_main_loop_new(NULL, FALSE);
+
+	for (n = 0; n < option_rounds; n++) {
+		for (i = 0; i < G_N_ELEMENTS(modes); i++)
+			run_dumps(&modes[i]);
+	}
+
+	g_main_loop_unref(main_loop);
+
+	n = option_count;
+
+out:
+	while (n-- > 0)
+		delete_link(sk, n);
+
+	close(sk);
+	g_free(option_kind);
+
+	return 0;
+}
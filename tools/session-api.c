@@ -119,6 +119,7 @@ static DBusMessage *notify_update(DBusConnection *conn,
 	while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_DICT_ENTRY) {
 		DBusMessageIter entry, value;
 		const char *key;
+		uint64_t *counter, val;
 
 		dbus_message_iter_recurse(&array, &entry);
 		dbus_message_iter_get_basic(&entry, &key);
@@ -192,6 +193,42 @@ static DBusMessage *notify_update(DBusConnection *conn,
 				return __connman_error_invalid_arguments(msg);
 			}
 			break;
+		case DBUS_TYPE_UINT32:
+			if (g_str_equal(key, "NotificationsSent") == TRUE) {
+				dbus_message_iter_get_basic(&value,
+							&info->notify_sent);
+			} else if (g_str_equal(key,
+					"NotificationsCoalesced") == TRUE) {
+				dbus_message_iter_get_basic(&value,
+						&info->notify_coalesced);
+			} else {
+				g_assert(FALSE);
+				return __connman_error_invalid_arguments(msg);
+			}
+			break;
+		case DBUS_TYPE_UINT64:
+			if (g_str_equal(key, "RxPackets") == TRUE) {
+				counter = &info->rx_packets;
+			} else if (g_str_equal(key, "RxBytes") == TRUE) {
+				counter = &info->rx_bytes;
+			} else if (g_str_equal(key, "TxPackets") == TRUE) {
+				counter = &info->tx_packets;
+			} else if (g_str_equal(key, "TxBytes") == TRUE) {
+				counter = &info->tx_bytes;
+			} else {
+				g_assert(FALSE);
+				return __connman_error_invalid_arguments(msg);
+			}
+
+			dbus_message_iter_get_basic(&value, &val);
+
+			LOG("session %p %s %" G_GUINT64_FORMAT, session,
+								key, val);
+
+			/* The counters only ever grow during a session */
+			g_assert(val >= *counter);
+			*counter = val;
+			break;
 		default:
 			g_assert(FALSE);
 			return __connman_error_invalid_arguments(msg);
@@ -85,6 +85,12 @@ struct test_session_info {
 	enum connman_session_type type;
 	/* ipv4, ipv6 dicts */
 	GSList *allowed_bearers;
+	uint32_t notify_sent;
+	uint32_t notify_coalesced;
+	uint64_t rx_packets;
+	uint64_t rx_bytes;
+	uint64_t tx_packets;
+	uint64_t tx_bytes;
 };
 
 struct test_session {
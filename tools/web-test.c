@@ -24,8 +24,14 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <gweb/gweb.h>
 
@@ -33,6 +39,10 @@ static GTimer *timer;
 
 static GMainLoop *main_loop;
 
+static GWeb *web;
+static char *url;
+static int repeat_count;
+
 static void web_debug(const char *str, void *data)
 {
 	g_print("%s: %s\n", (const char *) data, str);
@@ -65,16 +75,222 @@ static gboolean web_result(GWebResult *result, gpointer user_data)
 
 	g_print("elapse: %f seconds\n", elapsed);
 
+	if (--repeat_count > 0) {
+		g_timer_start(timer);
+
+		if (g_web_request_get(web, url, web_result, NULL, NULL) != 0)
+			return FALSE;
+	}
+
+	g_main_loop_quit(main_loop);
+
+	return FALSE;
+}
+
+static gint option_bench = 0;
+
+/*
+ * Benchmark mode: a forked server answers every request on one
+ * keep-alive connection with the same large chunked response. The
+ * body is fed through a GWebParser the way WISPr consumes it.
+ */
+
+#define BENCH_BODY_SIZE		(1 << 20)
+#define BENCH_CHUNK_SIZE	4000
+
+static GString *bench_response;
+static GWebParser *bench_parser;
+static gsize bench_bytes;
+static unsigned int bench_tokens;
+static unsigned int bench_left;
+
+static void bench_build_response(void)
+{
+	const char *token = "<WISPAccessGatewayParam><ResponseCode>50"
+				"</ResponseCode></WISPAccessGatewayParam>";
+	GString *body;
+	gsize offset;
+
+	body = g_string_sized_new(BENCH_BODY_SIZE);
+
+	while (body->len < BENCH_BODY_SIZE) {
+		if (body->len % 65536 == 0)
+			g_string_append(body, token);
+		else
+			g_string_append(body,
+				"<p>captive portal filler text line</p>\r\n");
+	}
+
+	bench_response = g_string_new("HTTP/1.1 200 OK\r\n"
+				"Server: web-test\r\n"
+				"Content-Type: text/html\r\n"
+				"Cache-Control: no-cache\r\n"
+				"Transfer-Encoding: chunked\r\n\r\n");
+
+	for (offset = 0; offset < body->len; offset += BENCH_CHUNK_SIZE) {
+		gsize count = MIN(BENCH_CHUNK_SIZE, body->len - offset);
+
+		g_string_append_printf(bench_response, "%zx\r\n", count);
+		g_string_append_len(bench_response, body->str + offset, count);
+		g_string_append(bench_response, "\r\n");
+	}
+
+	g_string_append(bench_response, "0\r\n\r\n");
+
+	g_string_free(body, TRUE);
+}
+
+static void bench_serve(int sk)
+{
+	char buf[4096];
+	gsize len = 0;
+	int fd;
+
+	fd = accept(sk, NULL, NULL);
+	if (fd < 0)
+		exit(1);
+
+	while (1) {
+		ssize_t count;
+		gsize sent;
+
+		count = read(fd, buf + len, sizeof(buf) - len - 1);
+		if (count <= 0)
+			break;
+
+		len += count;
+		buf[len] = '\0';
+
+		if (strstr(buf, "\r\n\r\n") == NULL)
+			continue;
+
+		len = 0;
+
+		for (sent = 0; sent < bench_response->len; sent += count) {
+			count = write(fd, bench_response->str + sent,
+						bench_response->len - sent);
+			if (count <= 0)
+				exit(1);
+		}
+	}
+
+	close(fd);
+	exit(0);
+}
+
+static void bench_token(const char *str, gpointer user_data)
+{
+	bench_tokens++;
+}
+
+static gboolean bench_result(GWebResult *result, gpointer user_data)
+{
+	const guint8 *chunk;
+	gsize length;
+
+	g_web_result_get_chunk(result, &chunk, &length);
+
+	if (length > 0) {
+		g_web_parser_feed_data(bench_parser, chunk, length);
+		bench_bytes += length;
+		return TRUE;
+	}
+
+	g_web_parser_end_data(bench_parser);
+
+	if (g_web_result_get_status(result) != 200) {
+		g_printerr("status %u\n", g_web_result_get_status(result));
+		g_main_loop_quit(main_loop);
+		return FALSE;
+	}
+
+	if (--bench_left > 0 && g_web_request_get(web, url, bench_result,
+							NULL, NULL) != 0)
+		return FALSE;
+
 	g_main_loop_quit(main_loop);
 
 	return FALSE;
 }
 
+static int bench_run(unsigned int count)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	gdouble elapsed;
+	pid_t pid;
+	int sk;
+
+	bench_build_response();
+
+	sk = socket(AF_INET, SOCK_STREAM, 0);
+	if (sk < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+			listen(sk, 1) < 0 ||
+			getsockname(sk, (struct sockaddr *) &addr, &len) < 0) {
+		close(sk);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		close(sk);
+		return -1;
+	}
+
+	if (pid == 0)
+		bench_serve(sk);
+
+	close(sk);
+
+	url = g_strdup_printf("http://127.0.0.1:%u/bench",
+						ntohs(addr.sin_port));
+
+	bench_parser = g_web_parser_new("<WISPAccessGatewayParam",
+					"WISPAccessGatewayParam>",
+					bench_token, NULL);
+
+	bench_left = count;
+
+	g_timer_start(timer);
+
+	if (g_web_request_get(web, url, bench_result, NULL, NULL) == 0) {
+		kill(pid, SIGTERM);
+		return -1;
+	}
+
+	g_main_loop_run(main_loop);
+
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	g_print("responses %u body %zu bytes tokens %u\n",
+				count - bench_left, bench_bytes, bench_tokens);
+	g_print("elapse: %f seconds, %.1f MB/s, %.1f usec/response\n",
+			elapsed, bench_bytes / elapsed / 1e6,
+			elapsed * 1e6 / count);
+
+	g_web_parser_unref(bench_parser);
+	g_string_free(bench_response, TRUE);
+	g_free(url);
+
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+
+	return bench_left == 0 ? 0 : -1;
+}
+
 static gboolean option_debug = FALSE;
 static gchar *option_proxy = NULL;
 static gchar *option_nameserver = NULL;
 static gchar *option_user_agent = NULL;
 static gchar *option_http_version = NULL;
+static gint option_repeat = 1;
 
 static GOptionEntry options[] = {
 	{ "debug", 'd', 0, G_OPTION_ARG_NONE, &option_debug,
@@ -87,6 +303,10 @@ static GOptionEntry options[] = {
 					"Specific user agent", "STRING" },
 	{ "http-version", 'H', 0, G_OPTION_ARG_STRING, &option_http_version,
 					"Specific HTTP version", "STRING" },
+	{ "repeat", 'r', 0, G_OPTION_ARG_INT, &option_repeat,
+				"Fetch the URL multiple times", "COUNT" },
+	{ "bench", 'b', 0, G_OPTION_ARG_INT, &option_bench,
+			"Time COUNT large chunked responses", "COUNT" },
 	{ NULL },
 };
 
@@ -95,7 +315,6 @@ int main(int argc, char *argv[])
 	GOptionContext *context;
 	GError *error = NULL;
 	struct sigaction sa;
-	GWeb *web;
 	int index = 0;
 
 	context = g_option_context_new(NULL);
@@ -112,7 +331,7 @@ int main(int argc, char *argv[])
 
 	g_option_context_free(context);
 
-	if (argc < 2) {
+	if (argc < 2 && option_bench <= 0) {
 		fprintf(stderr, "Missing argument\n");
 		return 1;
 	}
@@ -150,7 +369,20 @@ int main(int argc, char *argv[])
 
 	timer = g_timer_new();
 
-	if (g_web_request_get(web, argv[1], web_result, NULL,  NULL) == 0) {
+	if (option_bench > 0) {
+		int err = bench_run(option_bench);
+
+		g_timer_destroy(timer);
+		g_web_unref(web);
+		g_main_loop_unref(main_loop);
+
+		return err < 0 ? 1 : 0;
+	}
+
+	url = argv[1];
+	repeat_count = option_repeat;
+
+	if (g_web_request_get(web, url, web_result, NULL,  NULL) == 0) {
 		fprintf(stderr, "Failed to start request\n");
 		return 1;
 	}
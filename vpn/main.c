@@ -319,6 +319,7 @@ int main(int argc, char *argv[])
 		config_init(option_config);
 
 	__connman_inotify_init();
+	__connman_inet_init();
 	__connman_agent_init();
 	__vpn_provider_init(option_routes);
 	__vpn_manager_init();
@@ -345,6 +346,7 @@ int main(int argc, char *argv[])
 	__vpn_manager_cleanup();
 	__vpn_provider_cleanup();
 	__connman_agent_cleanup();
+	__connman_inet_cleanup();
 	__connman_inotify_cleanup();
 	__connman_dbus_cleanup();
 	__connman_log_cleanup(FALSE);
@@ -319,23 +319,33 @@ static void set_user_networks(struct vpn_provider *provider, GSList *networks)
 
 static void del_routes(struct vpn_provider *provider)
 {
+	struct connman_inet_route *routes;
 	GHashTableIter hash;
 	gpointer value, key;
+	unsigned int count = 0;
+
+	routes = g_try_new0(struct connman_inet_route,
+				g_hash_table_size(provider->user_routes));
 
 	g_hash_table_iter_init(&hash, provider->user_routes);
-	while (handle_routes == TRUE && g_hash_table_iter_next(&hash,
-						&key, &value) == TRUE) {
+	while (handle_routes == TRUE && routes != NULL &&
+			g_hash_table_iter_next(&hash, &key, &value) == TRUE) {
 		struct vpn_route *route = value;
-		if (route->family == AF_INET6) {
-			unsigned char prefixlen = atoi(route->netmask);
-			connman_inet_del_ipv6_network_route(provider->index,
-							route->network,
-							prefixlen);
-		} else
-			connman_inet_del_host_route(provider->index,
-						route->network);
+
+		routes[count].family = route->family;
+		routes[count].host = route->network;
+
+		if (route->family == AF_INET6)
+			routes[count].prefix_len = atoi(route->netmask);
+		else
+			routes[count].netmask = route->netmask;
+
+		count++;
 	}
 
+	connman_inet_del_routes(provider->index, routes, count);
+	g_free(routes);
+
 	g_hash_table_remove_all(provider->user_routes);
 	g_slist_free_full(provider->user_networks, free_route);
 	provider->user_networks = NULL;
@@ -1441,15 +1451,10 @@ static connman_bool_t check_host(char **hosts, char *host)
 	return FALSE;
 }
 
-static void provider_append_routes(gpointer key, gpointer value,
-					gpointer user_data)
+static void collect_route(struct vpn_provider *provider, GArray *routes,
+						struct vpn_route *route)
 {
-	struct vpn_route *route = value;
-	struct vpn_provider *provider = user_data;
-	int index = provider->index;
-
-	if (handle_routes == FALSE)
-		return;
+	struct connman_inet_route entry;
 
 	/*
 	 * If the VPN administrator/user has given a route to
@@ -1458,21 +1463,63 @@ static void provider_append_routes(gpointer key, gpointer value,
 	 */
 	if (check_host(provider->host_ip, route->network) == TRUE) {
 		DBG("Discarding VPN route to %s via %s at index %d",
-			route->network, route->gateway, index);
+			route->network, route->gateway, provider->index);
 		return;
 	}
 
-	if (route->family == AF_INET6) {
-		unsigned char prefix_len = atoi(route->netmask);
+	memset(&entry, 0, sizeof(entry));
+	entry.family = route->family;
+	entry.host = route->network;
+	entry.gateway = route->gateway;
 
-		connman_inet_add_ipv6_network_route(index, route->network,
-							route->gateway,
-							prefix_len);
-	} else {
-		connman_inet_add_network_route(index, route->network,
-						route->gateway,
-						route->netmask);
+	if (route->family == AF_INET6)
+		entry.prefix_len = atoi(route->netmask);
+	else
+		entry.netmask = route->netmask;
+
+	g_array_append_val(routes, entry);
+}
+
+/*
+ * Servers can push hundreds of split routes, so they are collected
+ * first and handed to the kernel in one batch.
+ */
+static void add_routes(struct vpn_provider *provider)
+{
+	struct connman_inet_route *entry;
+	GHashTableIter hash;
+	gpointer value, key;
+	GArray *routes;
+	unsigned int i;
+
+	if (handle_routes == FALSE)
+		return;
+
+	routes = g_array_new(FALSE, FALSE, sizeof(struct connman_inet_route));
+
+	g_hash_table_iter_init(&hash, provider->routes);
+	while (g_hash_table_iter_next(&hash, &key, &value) == TRUE)
+		collect_route(provider, routes, value);
+
+	g_hash_table_iter_init(&hash, provider->user_routes);
+	while (g_hash_table_iter_next(&hash, &key, &value) == TRUE)
+		collect_route(provider, routes, value);
+
+	if (connman_inet_add_routes(provider->index,
+				(struct connman_inet_route *) routes->data,
+				routes->len) < 0)
+		goto out;
+
+	for (i = 0; i < routes->len; i++) {
+		entry = &g_array_index(routes, struct connman_inet_route, i);
+		if (entry->error < 0)
+			connman_warn("VPN route to %s via %s failed: %s",
+					entry->host, entry->gateway,
+					strerror(-entry->error));
 	}
+
+out:
+	g_array_free(routes, TRUE);
 }
 
 static int set_connected(struct vpn_provider *provider,
@@ -1497,11 +1544,7 @@ static int set_connected(struct vpn_provider *provider,
 		provider_indicate_state(provider,
 					VPN_PROVIDER_STATE_READY);
 
-		g_hash_table_foreach(provider->routes, provider_append_routes,
-					provider);
-
-		g_hash_table_foreach(provider->user_routes,
-					provider_append_routes, provider);
+		add_routes(provider);
 
 	} else {
 		provider_indicate_state(provider,